@@ -141,6 +141,14 @@ public:
         float   contextErase = 0.5f;    // percent of context to erase if we exceed the context window
     };
 
+    struct BatchPrompt {
+        std::string_view  prompt;
+        PromptCallback    promptCallback;
+        ResponseCallback  responseCallback;
+        PromptContext     promptCtx;
+        std::string       error; // set if this prompt failed
+    };
+
     explicit LLModel() {}
     virtual ~LLModel() {}
 
@@ -155,6 +163,11 @@ public:
     virtual size_t saveState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const = 0;
     virtual size_t restoreState(std::span<const uint8_t> state, std::span<const Token> inputTokens) = 0;
 
+    // Create an additional inference context on the loaded model. It shares the weights, which stay alive until every
+    // context is deleted, but has its own KV cache, sampler, and token cache, so it may be used concurrently with this
+    // one. Returns nullptr if unsupported or if the context could not be created.
+    virtual LLModel *createContext() const { return nullptr; }
+
     // This method requires the model to return true from supportsCompletion otherwise it will throw
     // an error
     virtual void prompt(std::string_view        prompt,
@@ -162,6 +175,12 @@ public:
                         const ResponseCallback &responseCallback,
                         const PromptContext    &ctx);
 
+    // Process independent prompts on up to nParallel inference contexts that share this model's weights, each on its
+    // own thread. The callbacks of different prompts may be called concurrently. Errors are reported per prompt.
+    // The contexts are created with createContext() for the batch, so the KV cache and token cache of this one are
+    // left untouched; if none can be created, the prompts run here one at a time and the state is restored after.
+    virtual void promptBatch(std::span<BatchPrompt> prompts, int32_t nParallel);
+
     virtual int32_t countPromptTokens(std::string_view prompt) const;
 
     virtual size_t embeddingSize() const {
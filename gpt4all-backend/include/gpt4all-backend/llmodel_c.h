@@ -23,6 +23,11 @@ extern "C" {
  */
 typedef void *llmodel_model;
 
+/**
+ * Opaque pointer to a response that is being generated by llmodel_prompt_begin.
+ */
+typedef void *llmodel_prompt_stream;
+
 /**
  * A token.
  */
@@ -88,6 +93,21 @@ typedef bool (*llmodel_emb_cancel_callback)(unsigned *batch_sizes, unsigned n_ba
 
 typedef void (*llmodel_special_token_callback)(const char *name, const char *token);
 
+/**
+ * llmodel_batch_prompt structure for one of the prompts passed to llmodel_prompt_batch.
+ */
+struct llmodel_batch_prompt {
+    const char                *prompt;            // the input prompt
+    llmodel_prompt_callback    prompt_callback;   // handles the processing of this prompt
+    llmodel_response_callback  response_callback; // handles the response to this prompt
+    llmodel_prompt_context    *ctx;               // sampling parameters for this prompt
+    const char                *error;             // set by llmodel_prompt_batch if this prompt failed, else NULL
+};
+
+#ifndef __cplusplus
+typedef struct llmodel_batch_prompt llmodel_batch_prompt;
+#endif
+
 /**
  * Create a llmodel instance.
  * Recognises correct model type from file at model_path
@@ -106,6 +126,16 @@ DEPRECATED llmodel_model llmodel_model_create(const char *model_path);
  */
 llmodel_model llmodel_model_create2(const char *model_path, const char *backend, const char **error);
 
+/**
+ * Create an additional inference context on a loaded model. The new instance shares the weights of the model but has
+ * its own context window, KV cache, sampler, and token cache, so the two can be used concurrently from different
+ * threads. Either may be destroyed first.
+ * @param model A pointer to the llmodel_model instance, which must have a model loaded.
+ * @param error A pointer to a string; will only be set on error.
+ * @return A pointer to a new llmodel_model instance that must be freed with llmodel_model_destroy; NULL on error.
+ */
+llmodel_model llmodel_context_create(llmodel_model model, const char **error);
+
 /**
  * Destroy a llmodel instance.
  * Recognises correct model type using type info
@@ -198,6 +228,106 @@ bool llmodel_prompt(llmodel_model               model,
                     llmodel_prompt_context     *ctx,
                     const char                **error);
 
+/**
+ * Generate responses to many independent prompts using the model. The prompts are distributed across up to n_parallel
+ * inference contexts that share the weights of the model, each of which runs on its own thread. The conversation state
+ * of the model itself is not changed.
+ * NOTE: The callbacks of different prompts may be called concurrently from different threads.
+ * @param model A pointer to the llmodel_model instance.
+ * @param prompts An array of llmodel_batch_prompt structures. The error of each is set if that prompt fails, and
+ * remains valid until the next call to llmodel_prompt_batch on the same thread.
+ * @param n_prompts The number of prompts in the array.
+ * @param n_parallel The maximum number of prompts to process at once, or 0 to choose based on the thread count.
+ * @param error A pointer to a string; will only be set on error.
+ * @return true if every prompt was processed successfully, false otherwise.
+ */
+bool llmodel_prompt_batch(llmodel_model           model,
+                          llmodel_batch_prompt   *prompts,
+                          size_t                  n_prompts,
+                          int32_t                 n_parallel,
+                          const char            **error);
+
+/**
+ * Start generating a response using the model, without callbacks. Generation runs on a background thread and the
+ * generated tokens are retrieved in batches using llmodel_prompt_next.
+ * NOTE: The model must not be used in any other way until the stream is released with llmodel_prompt_end.
+ * @param model A pointer to the llmodel_model instance.
+ * @param prompt A string representing the input prompt.
+ * @param ctx A pointer to the llmodel_prompt_context structure. It is copied and need not outlive this call.
+ * @param error A pointer to a string; will only be set on error.
+ * @return A pointer to the llmodel_prompt_stream instance; NULL on error.
+ */
+llmodel_prompt_stream llmodel_prompt_begin(llmodel_model                 model,
+                                           const char                   *prompt,
+                                           const llmodel_prompt_context *ctx,
+                                           const char                  **error);
+
+/**
+ * Retrieve every generated token that is ready, up to max_tokens. Blocks until at least one token is ready or
+ * generation has finished.
+ * @param stream A pointer to the llmodel_prompt_stream instance.
+ * @param token_ids Where to store the ids of the tokens. Must have room for max_tokens elements.
+ * @param piece_sizes Where to store the length in bytes of the piece of each token. Must have room for max_tokens
+ * elements.
+ * @param pieces Where to store the pieces of the tokens, concatenated in order. This is not NUL-terminated.
+ * @param pieces_size The size of the pieces buffer, in bytes.
+ * @param max_tokens The maximum number of tokens to retrieve.
+ * @param error A pointer to a string; will only be set on error.
+ * @return The number of tokens retrieved, zero once the response is complete, or -1 on error.
+ */
+int32_t llmodel_prompt_next(llmodel_prompt_stream   stream,
+                            token_t                *token_ids,
+                            size_t                 *piece_sizes,
+                            char                   *pieces,
+                            size_t                  pieces_size,
+                            size_t                  max_tokens,
+                            const char            **error);
+
+/**
+ * Callback type for llmodel_prompt_set_notify.
+ * @param user_data The pointer that was passed to llmodel_prompt_set_notify.
+ */
+typedef void (*llmodel_prompt_notify_callback)(void *user_data);
+
+/**
+ * Register a callback that is invoked when tokens become ready after the stream has been drained, and when
+ * generation finishes. It is called from the generation thread, or immediately from the calling thread if
+ * tokens are already ready, and must not call back into the stream. Use with llmodel_prompt_poll to wait for tokens
+ * from an event loop instead of a blocked thread.
+ * @param stream A pointer to the llmodel_prompt_stream instance.
+ * @param callback The callback, or NULL to unregister.
+ * @param user_data A pointer passed to each invocation of the callback.
+ */
+void llmodel_prompt_set_notify(llmodel_prompt_stream stream, llmodel_prompt_notify_callback callback, void *user_data);
+
+/**
+ * Like llmodel_prompt_next, but never blocks.
+ * @param stream A pointer to the llmodel_prompt_stream instance.
+ * @param token_ids Where to store the ids of the tokens. Must have room for max_tokens elements.
+ * @param piece_sizes Where to store the length in bytes of the piece of each token. Must have room for max_tokens
+ * elements.
+ * @param pieces Where to store the pieces of the tokens, concatenated in order. This is not NUL-terminated.
+ * @param pieces_size The size of the pieces buffer, in bytes.
+ * @param max_tokens The maximum number of tokens to retrieve.
+ * @param finished Set to true once the response is complete and every token has been retrieved.
+ * @param error A pointer to a string; will only be set on error.
+ * @return The number of tokens retrieved, which may be zero, or -1 on error.
+ */
+int32_t llmodel_prompt_poll(llmodel_prompt_stream   stream,
+                            token_t                *token_ids,
+                            size_t                 *piece_sizes,
+                            char                   *pieces,
+                            size_t                  pieces_size,
+                            size_t                  max_tokens,
+                            bool                   *finished,
+                            const char            **error);
+
+/**
+ * Stop generating if the response is not yet complete, and free the stream.
+ * @param stream A pointer to the llmodel_prompt_stream instance.
+ */
+void llmodel_prompt_end(llmodel_prompt_stream stream);
+
 /**
  * Generate an embedding using the model.
  * NOTE: If given NULL pointers for the model or text, or an empty text, a NULL pointer will be
@@ -221,6 +221,7 @@ struct LLamaPrivate {
     std::vector<LLModel::Token>  inputTokens;
 
     llama_model          *model        = nullptr;
+    std::shared_ptr<llama_model> modelRef; // keeps the weights alive while any context uses them
     llama_context        *ctx          = nullptr;
     llama_model_params    model_params;
     llama_context_params  ctx_params;
@@ -336,14 +337,12 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
     d_ptr->modelLoaded = false;
 
     // clean up after previous loadModel()
-    if (d_ptr->model) {
-        llama_free_model(d_ptr->model);
-        d_ptr->model = nullptr;
-    }
     if (d_ptr->ctx) {
         llama_free(d_ptr->ctx);
         d_ptr->ctx = nullptr;
     }
+    d_ptr->modelRef.reset();
+    d_ptr->model = nullptr;
 
     if (n_ctx < 8) {
         std::cerr << "warning: minimum context size is 8, using minimum size.\n";
@@ -404,6 +403,7 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
         std::cerr << "LLAMA ERROR: failed to load model from " << modelPath << std::endl;
         return false;
     }
+    d_ptr->modelRef.reset(d_ptr->model, llama_free_model);
 
     // -- initialize the context --
 
@@ -440,7 +440,7 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
     if (!d_ptr->ctx) {
         fflush(stdout);
         std::cerr << "LLAMA ERROR: failed to init context for model " <<  modelPath << std::endl;
-        llama_free_model(d_ptr->model);
+        d_ptr->modelRef.reset();
         d_ptr->model = nullptr;
 #ifndef GGML_USE_CUDA
         d_ptr->device = -1;
@@ -488,7 +488,6 @@ LLamaModel::~LLamaModel()
     if (d_ptr->ctx) {
         llama_free(d_ptr->ctx);
     }
-    llama_free_model(d_ptr->model);
     llama_sampler_free(d_ptr->sampler_chain);
 }
 
@@ -713,6 +712,40 @@ bool LLamaModel::shouldAddBOS() const
     return llama_add_bos_token(d_ptr->model);
 }
 
+LLModel *LLamaModel::createContext() const
+{
+    if (!d_ptr->modelLoaded)
+        return nullptr;
+
+    auto *ctx = llama_new_context_with_model(d_ptr->model, d_ptr->ctx_params);
+    if (!ctx) {
+        std::cerr << "LLAMA ERROR: failed to init additional context for model " << llama_model_name(d_ptr->model)
+                  << std::endl;
+        return nullptr;
+    }
+    llama_set_n_threads(ctx, d_ptr->n_threads, d_ptr->n_threads);
+
+    // the new context shares the weights, but has its own KV cache, sampler chain, and token cache
+    auto *fres = new LLamaModel;
+    auto &d = *fres->d_ptr;
+    d.device       = d_ptr->device;
+    d.deviceName   = d_ptr->deviceName;
+    d.n_threads    = d_ptr->n_threads;
+    d.end_tokens   = d_ptr->end_tokens;
+    d.backend_name = d_ptr->backend_name;
+    d.model        = d_ptr->model;
+    d.modelRef     = d_ptr->modelRef;
+    d.ctx          = ctx;
+    d.model_params = d_ptr->model_params;
+    d.ctx_params   = d_ptr->ctx_params;
+    d.modelLoaded  = true;
+
+    fres->m_implementation     = m_implementation;
+    fres->m_supportsEmbedding  = m_supportsEmbedding;
+    fres->m_supportsCompletion = m_supportsCompletion;
+    return fres;
+}
+
 int32_t LLamaModel::maxContextLength(std::string const &modelPath) const
 {
     return get_arch_key_u32(modelPath, "context_length");
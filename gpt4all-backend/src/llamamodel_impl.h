@@ -31,6 +31,7 @@ public:
     size_t stateSize() const override;
     size_t saveState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const override;
     size_t restoreState(std::span<const uint8_t> state, std::span<const Token> inputTokens) override;
+    LLModel *createContext() const override;
     void setThreadCount(int32_t n_threads) override;
     int32_t threadCount() const override;
     std::vector<GPUDevice> availableGPUDevices(size_t memoryRequired = 0) const override;
@@ -3,15 +3,20 @@
 #include "llmodel.h"
 
 #include <algorithm>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <exception>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <span>
 
@@ -58,6 +63,26 @@ llmodel_model llmodel_model_create2(const char *model_path, const char *backend,
     return wrapper;
 }
 
+llmodel_model llmodel_context_create(llmodel_model model, const char **error)
+{
+    auto *wrapper = static_cast<LLModelWrapper *>(model);
+
+    if (!wrapper->llModel->isModelLoaded()) {
+        llmodel_set_error(error, "model is not loaded");
+        return nullptr;
+    }
+
+    LLModel *llModel = wrapper->llModel->createContext();
+    if (!llModel) {
+        llmodel_set_error(error, "failed to create an inference context");
+        return nullptr;
+    }
+
+    auto newWrapper = new LLModelWrapper;
+    newWrapper->llModel = llModel;
+    return newWrapper;
+}
+
 void llmodel_model_destroy(llmodel_model model)
 {
     delete static_cast<LLModelWrapper *>(model);
@@ -124,17 +149,9 @@ uint64_t llmodel_state_set_data(llmodel_model model, const uint8_t *state, uint6
     return wrapper->llModel->restoreState({state, size_t(state_size)}, {input_tokens, size_t(n_input_tokens)});
 }
 
-bool llmodel_prompt(llmodel_model               model,
-                    const char                 *prompt,
-                    llmodel_prompt_callback     prompt_callback,
-                    llmodel_response_callback   response_callback,
-                    llmodel_prompt_context     *ctx,
-                    const char                **error)
+static LLModel::PromptContext llmodel_copy_prompt_context(const llmodel_prompt_context *ctx)
 {
-    auto *wrapper = static_cast<LLModelWrapper *>(model);
-
-    // Copy the C prompt context
-    LLModel::PromptContext promptContext {
+    return {
         .n_predict      = ctx->n_predict,
         .top_k          = ctx->top_k,
         .top_p          = ctx->top_p,
@@ -145,6 +162,19 @@ bool llmodel_prompt(llmodel_model               model,
         .repeat_last_n  = ctx->repeat_last_n,
         .contextErase   = ctx->context_erase,
     };
+}
+
+bool llmodel_prompt(llmodel_model               model,
+                    const char                 *prompt,
+                    llmodel_prompt_callback     prompt_callback,
+                    llmodel_response_callback   response_callback,
+                    llmodel_prompt_context     *ctx,
+                    const char                **error)
+{
+    auto *wrapper = static_cast<LLModelWrapper *>(model);
+
+    // Copy the C prompt context
+    auto promptContext = llmodel_copy_prompt_context(ctx);
 
     auto prompt_func = [prompt_callback](std::span<const LLModel::Token> token_ids, bool cached) {
         return prompt_callback(token_ids.data(), token_ids.size(), cached);
@@ -164,6 +194,222 @@ bool llmodel_prompt(llmodel_model               model,
     return true;
 }
 
+bool llmodel_prompt_batch(llmodel_model           model,
+                          llmodel_batch_prompt   *prompts,
+                          size_t                  n_prompts,
+                          int32_t                 n_parallel,
+                          const char            **error)
+{
+    thread_local static std::vector<std::string> last_batch_errors;
+
+    auto *wrapper = static_cast<LLModelWrapper *>(model);
+
+    std::vector<LLModel::BatchPrompt> batch;
+    batch.reserve(n_prompts);
+    for (auto &p : std::span(prompts, n_prompts)) {
+        batch.push_back({
+            .prompt = p.prompt,
+            .promptCallback = [cb = p.prompt_callback](std::span<const LLModel::Token> token_ids, bool cached) {
+                return cb(token_ids.data(), token_ids.size(), cached);
+            },
+            .responseCallback = [cb = p.response_callback](LLModel::Token token_id, std::string_view piece) {
+                return cb(token_id, piece.data());
+            },
+            .promptCtx = llmodel_copy_prompt_context(p.ctx),
+            .error = {},
+        });
+        p.error = nullptr;
+    }
+
+    try {
+        wrapper->llModel->promptBatch(batch, n_parallel);
+    } catch (std::exception const &e) {
+        llmodel_set_error(error, e.what());
+        return false;
+    }
+
+    last_batch_errors.clear();
+    last_batch_errors.reserve(n_prompts); // must not reallocate below
+    bool ok = true;
+    for (size_t i = 0; i < n_prompts; i++) {
+        if (batch[i].error.empty())
+            continue;
+        prompts[i].error = last_batch_errors.emplace_back(std::move(batch[i].error)).c_str();
+        ok = false;
+    }
+    if (!ok)
+        llmodel_set_error(error, "one or more prompts failed");
+    return ok;
+}
+
+// Tokens produced by a prompt running on a background thread, consumed by llmodel_prompt_next
+struct LLModelPromptStream {
+    std::thread                                          thread;
+    std::mutex                                           mutex;
+    std::condition_variable                              cond;
+    std::deque<std::pair<LLModel::Token, std::string>>   pending;
+    std::optional<std::string>                           error;
+    bool                                                 finished      = false;
+    bool                                                 stopRequested = false;
+    llmodel_prompt_notify_callback                       notify        = nullptr;
+    void                                                *notifyData    = nullptr;
+
+    // called without the lock held, so that the callback may block on locks of its own
+    void notifyReady(std::unique_lock<std::mutex> &lock)
+    {
+        auto callback = notify;
+        auto *data    = notifyData;
+        lock.unlock();
+        cond.notify_one();
+        if (callback)
+            callback(data);
+    }
+
+    int32_t takePending(token_t *token_ids, size_t *piece_sizes, char *pieces, size_t pieces_size,
+                        size_t max_tokens, const char **error);
+};
+
+int32_t LLModelPromptStream::takePending(token_t *token_ids, size_t *piece_sizes, char *pieces, size_t pieces_size,
+                                         size_t max_tokens, const char **error)
+{
+    // copy out as many tokens as fit
+    size_t nTokens = 0, offset = 0;
+    for (auto &[token, piece] : pending) {
+        if (nTokens >= max_tokens || offset + piece.size() > pieces_size)
+            break;
+        token_ids  [nTokens] = token;
+        piece_sizes[nTokens] = piece.size();
+        std::memcpy(pieces + offset, piece.data(), piece.size());
+        offset += piece.size();
+        nTokens++;
+    }
+    if (!nTokens) {
+        llmodel_set_error(error, "buffer is too small for the next token");
+        return -1;
+    }
+    pending.erase(pending.begin(), pending.begin() + nTokens);
+    return int32_t(nTokens);
+}
+
+llmodel_prompt_stream llmodel_prompt_begin(llmodel_model                 model,
+                                           const char                   *prompt,
+                                           const llmodel_prompt_context *ctx,
+                                           const char                  **error)
+{
+    auto *wrapper = static_cast<LLModelWrapper *>(model);
+    auto promptContext = llmodel_copy_prompt_context(ctx);
+
+    auto *stream = new LLModelPromptStream;
+    auto run = [wrapper, stream, promptText = std::string(prompt), promptContext] {
+        auto prompt_func = [stream](std::span<const LLModel::Token>, bool) {
+            std::unique_lock lock(stream->mutex);
+            return !stream->stopRequested;
+        };
+        auto response_func = [stream](LLModel::Token token_id, std::string_view piece) {
+            std::unique_lock lock(stream->mutex);
+            if (stream->stopRequested)
+                return false;
+            bool wasEmpty = stream->pending.empty();
+            stream->pending.emplace_back(token_id, piece);
+            if (wasEmpty)
+                stream->notifyReady(lock);
+            return true;
+        };
+
+        std::optional<std::string> error;
+        try {
+            wrapper->llModel->prompt(promptText, prompt_func, response_func, promptContext);
+        } catch (std::exception const &e) {
+            error = e.what();
+        }
+
+        std::unique_lock lock(stream->mutex);
+        stream->error    = std::move(error);
+        stream->finished = true;
+        stream->notifyReady(lock);
+    };
+
+    try {
+        stream->thread = std::thread(std::move(run));
+    } catch (std::exception const &e) {
+        delete stream;
+        llmodel_set_error(error, e.what());
+        return nullptr;
+    }
+    return stream;
+}
+
+int32_t llmodel_prompt_next(llmodel_prompt_stream   stream,
+                            token_t                *token_ids,
+                            size_t                 *piece_sizes,
+                            char                   *pieces,
+                            size_t                  pieces_size,
+                            size_t                  max_tokens,
+                            const char            **error)
+{
+    auto *s = static_cast<LLModelPromptStream *>(stream);
+
+    std::unique_lock lock(s->mutex);
+    s->cond.wait(lock, [s] { return !s->pending.empty() || s->finished; });
+
+    if (s->pending.empty()) {
+        if (s->error) {
+            llmodel_set_error(error, s->error->c_str());
+            return -1;
+        }
+        return 0; // response is complete
+    }
+    return s->takePending(token_ids, piece_sizes, pieces, pieces_size, max_tokens, error);
+}
+
+void llmodel_prompt_set_notify(llmodel_prompt_stream stream, llmodel_prompt_notify_callback callback, void *user_data)
+{
+    auto *s = static_cast<LLModelPromptStream *>(stream);
+
+    std::unique_lock lock(s->mutex);
+    s->notify     = callback;
+    s->notifyData = user_data;
+    if (!s->pending.empty() || s->finished)
+        s->notifyReady(lock);
+}
+
+int32_t llmodel_prompt_poll(llmodel_prompt_stream   stream,
+                            token_t                *token_ids,
+                            size_t                 *piece_sizes,
+                            char                   *pieces,
+                            size_t                  pieces_size,
+                            size_t                  max_tokens,
+                            bool                   *finished,
+                            const char            **error)
+{
+    auto *s = static_cast<LLModelPromptStream *>(stream);
+
+    std::unique_lock lock(s->mutex);
+    *finished = false;
+    if (s->pending.empty()) {
+        if (!s->finished)
+            return 0; // nothing ready yet
+        if (s->error) {
+            llmodel_set_error(error, s->error->c_str());
+            return -1;
+        }
+        *finished = true;
+        return 0;
+    }
+    return s->takePending(token_ids, piece_sizes, pieces, pieces_size, max_tokens, error);
+}
+
+void llmodel_prompt_end(llmodel_prompt_stream stream)
+{
+    auto *s = static_cast<LLModelPromptStream *>(stream);
+    {
+        std::unique_lock lock(s->mutex);
+        s->stopRequested = true;
+    }
+    s->thread.join();
+    delete s;
+}
+
 float *llmodel_embed(
     llmodel_model model, const char **texts, size_t *embedding_size, const char *prefix, int dimensionality,
     size_t *token_count, bool do_mean, bool atlas, llmodel_emb_cancel_callback cancel_cb, const char **error
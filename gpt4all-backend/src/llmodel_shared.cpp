@@ -1,16 +1,20 @@
 #include "llmodel.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <exception>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <optional>
 #include <ranges>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 namespace ranges = std::ranges;
@@ -39,6 +43,59 @@ void LLModel::prompt(
         generateResponse(responseCallback, promptCtx, /*n_past*/ *res);
 }
 
+void LLModel::promptBatch(std::span<BatchPrompt> prompts, int32_t nParallel)
+{
+    if (!isModelLoaded())
+        throw std::invalid_argument("Attempted to prompt an unloaded model.");
+    if (prompts.empty())
+        return;
+
+    if (nParallel <= 0)
+        nParallel = std::max(1u, std::thread::hardware_concurrency() / std::max(1, threadCount()));
+    nParallel = std::min(nParallel, int32_t(prompts.size()));
+
+    // the batch runs on contexts of its own, so the conversation in this one is left as it was
+    std::vector<std::unique_ptr<LLModel>> contexts;
+    for (int32_t i = 0; i < nParallel; i++) {
+        auto *context = createContext();
+        if (!context)
+            break; // not supported or out of memory, use what we have
+        contexts.emplace_back(context);
+    }
+
+    std::atomic<size_t> nextPrompt = 0;
+    auto worker = [&prompts, &nextPrompt](LLModel *model) {
+        for (size_t i; (i = nextPrompt++) < prompts.size();) {
+            auto &p = prompts[i];
+            try {
+                model->prompt(p.prompt, p.promptCallback, p.responseCallback, p.promptCtx);
+            } catch (const std::exception &e) {
+                p.error = e.what();
+            }
+        }
+    };
+
+    if (contexts.empty()) {
+        // no extra context at all: run the prompts here, one at a time, and put back the state they replaced
+        std::vector<uint8_t> state(stateSize());
+        std::vector<Token> inputTokens;
+        state.resize(saveState(state, inputTokens));
+        if (state.empty())
+            throw std::runtime_error("Failed to save the model state for the batch.");
+        worker(this);
+        if (!restoreState(state, inputTokens))
+            throw std::runtime_error("Failed to restore the model state after the batch.");
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (auto &context : contexts | views::drop(1))
+        threads.emplace_back(worker, context.get());
+    worker(contexts.front().get());
+    for (auto &thread : threads)
+        thread.join();
+}
+
 int32_t LLModel::countPromptTokens(std::string_view prompt) const
 {
     if (!isModelLoaded())
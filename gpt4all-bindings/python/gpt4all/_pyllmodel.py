@@ -1,15 +1,15 @@
 from __future__ import annotations
 
+import asyncio
+import codecs
 import ctypes
 import os
 import platform
 import subprocess
 import sys
 import textwrap
-import threading
-from enum import Enum
-from queue import Queue
-from typing import TYPE_CHECKING, Any, Callable, Generic, Iterable, Iterator, Literal, NoReturn, TypeVar, overload
+from typing import (TYPE_CHECKING, Any, AsyncIterator, Callable, Generic, Iterable, Iterator, Literal, NoReturn, TypeVar,
+                    overload)
 
 if sys.version_info >= (3, 9):
     import importlib.resources as importlib_resources
@@ -148,6 +148,9 @@ llmodel.llmodel_model_create.restype = ctypes.c_void_p
 llmodel.llmodel_model_create2.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p)]
 llmodel.llmodel_model_create2.restype = ctypes.c_void_p
 
+llmodel.llmodel_context_create.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p)]
+llmodel.llmodel_context_create.restype = ctypes.c_void_p
+
 llmodel.llmodel_model_destroy.argtypes = [ctypes.c_void_p]
 llmodel.llmodel_model_destroy.restype = None
 
@@ -162,6 +165,7 @@ PromptCallback       = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.POINTER(ctypes.c_i
 ResponseCallback     = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.c_int32, ctypes.c_char_p)
 EmbCancelCallback    = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.POINTER(ctypes.c_uint), ctypes.c_uint, ctypes.c_char_p)
 SpecialTokenCallback = ctypes.CFUNCTYPE(None, ctypes.c_char_p, ctypes.c_char_p)
+PromptNotifyCallback = ctypes.CFUNCTYPE(None, ctypes.c_void_p)
 
 llmodel.llmodel_prompt.argtypes = [
     ctypes.c_void_p,
@@ -174,6 +178,66 @@ llmodel.llmodel_prompt.argtypes = [
 
 llmodel.llmodel_prompt.restype = ctypes.c_bool
 
+class LLModelBatchPrompt(ctypes.Structure):
+    _fields_ = [
+        ("prompt",            ctypes.c_char_p),
+        ("prompt_callback",   PromptCallback),
+        ("response_callback", ResponseCallback),
+        ("ctx",               ctypes.POINTER(LLModelPromptContext)),
+        ("error",             ctypes.c_char_p),
+    ]
+
+
+llmodel.llmodel_prompt_batch.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(LLModelBatchPrompt),
+    ctypes.c_size_t,
+    ctypes.c_int32,
+    ctypes.POINTER(ctypes.c_char_p),
+]
+
+llmodel.llmodel_prompt_batch.restype = ctypes.c_bool
+
+llmodel.llmodel_prompt_begin.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_char_p,
+    ctypes.POINTER(LLModelPromptContext),
+    ctypes.POINTER(ctypes.c_char_p),
+]
+
+llmodel.llmodel_prompt_begin.restype = ctypes.c_void_p
+
+llmodel.llmodel_prompt_next.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(ctypes.c_int32),
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.c_char_p,
+    ctypes.c_size_t,
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_char_p),
+]
+
+llmodel.llmodel_prompt_next.restype = ctypes.c_int32
+
+llmodel.llmodel_prompt_set_notify.argtypes = [ctypes.c_void_p, PromptNotifyCallback, ctypes.c_void_p]
+llmodel.llmodel_prompt_set_notify.restype = None
+
+llmodel.llmodel_prompt_poll.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(ctypes.c_int32),
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.c_char_p,
+    ctypes.c_size_t,
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_bool),
+    ctypes.POINTER(ctypes.c_char_p),
+]
+
+llmodel.llmodel_prompt_poll.restype = ctypes.c_int32
+
+llmodel.llmodel_prompt_end.argtypes = [ctypes.c_void_p]
+llmodel.llmodel_prompt_end.restype = None
+
 llmodel.llmodel_embed.argtypes = [
     ctypes.c_void_p,
     ctypes.POINTER(ctypes.c_char_p),
@@ -232,13 +296,51 @@ RawResponseCallbackType = Callable[[int, bytes], bool]
 EmbCancelCallbackType: TypeAlias = 'Callable[[list[int], str], bool]'
 
 
-def empty_response_callback(token_id: int, response: str) -> bool:
-    return True
+# Maximum number of tokens, and bytes of text, retrieved per call to llmodel_prompt_next
+STREAM_MAX_TOKENS = 256
+STREAM_BUFFER_SIZE = 64 * 1024
+
+
+class _StreamReader:
+    """Buffers for retrieving batches of tokens from an llmodel_prompt_stream, and their decoding."""
+
+    def __init__(
+        self, callback_decoder: Callable[[ResponseCallbackType], RawResponseCallbackType],
+        callback: ResponseCallbackType,
+    ):
+        self.token_ids   = (ctypes.c_int32 * STREAM_MAX_TOKENS)()
+        self.piece_sizes = (ctypes.c_size_t * STREAM_MAX_TOKENS)()
+        self.pieces      = ctypes.create_string_buffer(STREAM_BUFFER_SIZE)
 
+        # Collect the decoded pieces of each batch so they can be yielded
+        self._responses: list[str] = []
 
-# Symbol to terminate from generator
-class Sentinel(Enum):
-    TERMINATING_SYMBOL = 0
+        def _generator_callback(token_id: int, response: str) -> bool:
+            if callback(token_id, response):
+                self._responses.append(response)
+                return True
+            return False
+
+        self._raw_callback = callback_decoder(_generator_callback)
+
+    def decode(self, n_tokens: int) -> bool:
+        """Decode a batch of n_tokens tokens. Returns False if the callback asked to stop."""
+        data = ctypes.string_at(self.pieces, sum(self.piece_sizes[:n_tokens]))
+        offset = 0
+        for i in range(n_tokens):
+            piece = data[offset:offset + self.piece_sizes[i]]
+            offset += self.piece_sizes[i]
+            if not self._raw_callback(self.token_ids[i], piece):
+                return False
+        return True
+
+    def take_responses(self) -> list[str]:
+        responses, self._responses = self._responses, []
+        return responses
+
+
+def empty_response_callback(token_id: int, response: str) -> bool:
+    return True
 
 
 class EmbedResult(Generic[EmbeddingsType], TypedDict):
@@ -304,6 +406,34 @@ class LLModel:
             llmodel.llmodel_model_destroy(self.model)
             self.model = None
 
+    def create_context(self) -> LLModel:
+        """
+        Create an additional inference context on the loaded model. The new LLModel shares the weights of this one, but
+        has its own context window and token cache, so both can generate at the same time from different threads.
+
+        Returns
+        -------
+        A new LLModel that must be closed independently of this one
+        """
+        if self.model is None:
+            self._raise_closed()
+
+        err = ctypes.c_char_p()
+        model = llmodel.llmodel_context_create(self.model, ctypes.byref(err))
+        if model is None:
+            s = err.value
+            raise RuntimeError(f"Unable to create context: {'null' if s is None else s.decode()}")
+
+        context = LLModel.__new__(LLModel)
+        context.model_path = self.model_path
+        context.n_ctx = self.n_ctx
+        context.ngl = self.ngl
+        context.buffer = bytearray()
+        context.buff_expecting_cont_bytes = 0
+        context.model = model
+        context.special_tokens_map = dict(self.special_tokens_map)
+        return context
+
     def _raise_closed(self) -> NoReturn:
         raise ValueError("Attempted operation on a closed LLModel")
 
@@ -499,7 +629,7 @@ class LLModel:
         self.buffer.clear()
         self.buff_expecting_cont_bytes = 0
 
-        context = LLModelPromptContext(
+        context = self._prompt_context(
             n_predict      = n_predict,
             top_k          = top_k,
             top_p          = top_p,
@@ -528,46 +658,182 @@ class LLModel:
             s = err.value
             raise RuntimeError(f"prompt error: {'null' if s is None else s.decode()}")
 
-    def prompt_model_streaming(
-        self, prompt: str, callback: ResponseCallbackType = empty_response_callback, **kwargs: Any,
-    ) -> Iterator[str]:
+    def prompt_model_batch(
+        self, prompts: list[str], callbacks: list[ResponseCallbackType], n_parallel: int = 0, **kwargs: Any,
+    ) -> list[str | None]:
+        """
+        Generate responses to independent prompts on several inference contexts that share this model's weights.
+
+        Parameters
+        ----------
+        prompts: list[str]
+            The prompts to respond to
+        callbacks: list[Callable[[int, str], bool]]
+            One callback per prompt, which receives the tokens of its response. Callbacks may be called from
+            different threads.
+        n_parallel: int
+            The maximum number of prompts to process at once, or 0 to choose based on the thread count
+
+        Returns
+        -------
+        The error message of each prompt, or None for prompts that succeeded
+        """
         if self.model is None:
             self._raise_closed()
+        if len(prompts) != len(callbacks):
+            raise ValueError("there must be exactly one callback per prompt")
 
-        output_queue: Queue[str | Sentinel] = Queue()
+        def _decoding_callback(callback: ResponseCallbackType) -> RawResponseCallbackType:
+            decoder = codecs.getincrementaldecoder("utf-8")(errors="replace")
 
-        # Put response tokens into an output queue
-        def _generator_callback_wrapper(callback: ResponseCallbackType) -> ResponseCallbackType:
-            def _generator_callback(token_id: int, response: str):
-                nonlocal callback
+            def _raw_callback(token_id: int, response: bytes) -> bool:
+                decoded = decoder.decode(response)
+                if not decoded and response:
+                    return True  # wait for more continuation bytes
+                return callback(token_id, decoded)
 
-                if callback(token_id, response):
-                    output_queue.put(response)
-                    return True
+            return _raw_callback
 
-                return False
+        # the C callbacks and contexts must stay alive until llmodel_prompt_batch returns
+        contexts = [self._prompt_context(**kwargs) for _ in prompts]
+        prompt_cbs = [PromptCallback(self._prompt_callback) for _ in prompts]
+        response_cbs = [ResponseCallback(_decoding_callback(cb)) for cb in callbacks]
+
+        c_prompts = (LLModelBatchPrompt * len(prompts))()
+        for i, prompt in enumerate(prompts):
+            c_prompts[i].prompt            = prompt.encode()
+            c_prompts[i].prompt_callback   = prompt_cbs[i]
+            c_prompts[i].response_callback = response_cbs[i]
+            c_prompts[i].ctx               = ctypes.pointer(contexts[i])
+
+        err = ctypes.c_char_p()
+        if not llmodel.llmodel_prompt_batch(self.model, c_prompts, len(prompts), n_parallel, ctypes.byref(err)):
+            if not any(p.error for p in c_prompts):
+                s = err.value
+                raise RuntimeError(f"prompt error: {'null' if s is None else s.decode()}")
+
+        return [None if p.error is None else p.error.decode() for p in c_prompts]
+
+    def prompt_model_streaming(
+        self, prompt: str, callback: ResponseCallbackType = empty_response_callback, **kwargs: Any,
+    ) -> Iterator[str]:
+        stream, reader = self._begin_stream(prompt, callback, **kwargs)
+        err = ctypes.c_char_p()
+        try:
+            while True:
+                # ctypes releases the GIL while this waits for the model
+                n_tokens = llmodel.llmodel_prompt_next(
+                    stream, reader.token_ids, reader.piece_sizes, reader.pieces, STREAM_BUFFER_SIZE,
+                    STREAM_MAX_TOKENS, ctypes.byref(err),
+                )
+                if n_tokens < 0:
+                    s = err.value
+                    raise RuntimeError(f"prompt error: {'null' if s is None else s.decode()}")
+                if n_tokens == 0:
+                    break
+
+                keep_going = reader.decode(n_tokens)
+                yield from reader.take_responses()
+                if not keep_going:
+                    break
+        finally:
+            llmodel.llmodel_prompt_end(stream)
+
+    async def aprompt_model_streaming(
+        self, prompt: str, callback: ResponseCallbackType = empty_response_callback, **kwargs: Any,
+    ) -> AsyncIterator[str]:
+        """
+        Like prompt_model_streaming, but waits for tokens on the running event loop instead of a blocked thread. The
+        model runs on a native thread without the GIL and wakes up the event loop once per batch of tokens.
+        """
+        loop = asyncio.get_running_loop()
+        ready = asyncio.Event()
+
+        def _notify(user_data: Any) -> None:
+            try:
+                loop.call_soon_threadsafe(ready.set)
+            except RuntimeError:
+                pass  # the event loop was closed
+
+        stream, reader = self._begin_stream(prompt, callback, **kwargs)
+        # must stay alive until llmodel_prompt_end returns
+        notify_callback = PromptNotifyCallback(_notify)
+        err = ctypes.c_char_p()
+        finished = ctypes.c_bool()
+        try:
+            llmodel.llmodel_prompt_set_notify(stream, notify_callback, None)
+            while True:
+                ready.clear()
+                n_tokens = llmodel.llmodel_prompt_poll(
+                    stream, reader.token_ids, reader.piece_sizes, reader.pieces, STREAM_BUFFER_SIZE,
+                    STREAM_MAX_TOKENS, ctypes.byref(finished), ctypes.byref(err),
+                )
+                if n_tokens < 0:
+                    s = err.value
+                    raise RuntimeError(f"prompt error: {'null' if s is None else s.decode()}")
+                if finished.value:
+                    break
+                if n_tokens == 0:
+                    await ready.wait()
+                    continue
+
+                keep_going = reader.decode(n_tokens)
+                for response in reader.take_responses():
+                    yield response
+                if not keep_going:
+                    break
+        finally:
+            # ending the stream waits for the model to stop, so it must not run on the event loop; the executor call
+            # holds notify_callback until it returns, even if this task is cancelled while it waits
+            def _end(keep_alive: Any) -> None:
+                llmodel.llmodel_prompt_end(stream)
+
+            try:
+                await asyncio.shield(loop.run_in_executor(None, _end, notify_callback))
+            except RuntimeError:
+                _end(notify_callback)  # the executor was shut down with the event loop
+
+    def _begin_stream(
+        self, prompt: str, callback: ResponseCallbackType, **kwargs: Any,
+    ) -> tuple[int, _StreamReader]:
+        if self.model is None:
+            self._raise_closed()
+
+        self.buffer.clear()
+        self.buff_expecting_cont_bytes = 0
 
-            return _generator_callback
+        context = self._prompt_context(**kwargs)
 
-        def run_llmodel_prompt(prompt: str, callback: ResponseCallbackType, **kwargs):
-            self.prompt_model(prompt, callback, **kwargs)
-            output_queue.put(Sentinel.TERMINATING_SYMBOL)
+        err = ctypes.c_char_p()
+        stream = llmodel.llmodel_prompt_begin(self.model, prompt.encode(), context, ctypes.byref(err))
+        if stream is None:
+            s = err.value
+            raise RuntimeError(f"prompt error: {'null' if s is None else s.decode()}")
+        return stream, _StreamReader(self._callback_decoder, callback)
 
-        # Kick off llmodel_prompt in separate thread so we can return generator
-        # immediately
-        thread = threading.Thread(
-            target=run_llmodel_prompt,
-            args=(prompt, _generator_callback_wrapper(callback)),
-            kwargs=kwargs,
+    @staticmethod
+    def _prompt_context(
+        n_predict      : int   = 4096,
+        top_k          : int   = 40,
+        top_p          : float = 0.9,
+        min_p          : float = 0.0,
+        temp           : float = 0.1,
+        n_batch        : int   = 8,
+        repeat_penalty : float = 1.2,
+        repeat_last_n  : int   = 10,
+        context_erase  : float = 0.75,
+    ) -> LLModelPromptContext:
+        return LLModelPromptContext(
+            n_predict      = n_predict,
+            top_k          = top_k,
+            top_p          = top_p,
+            min_p          = min_p,
+            temp           = temp,
+            n_batch        = n_batch,
+            repeat_penalty = repeat_penalty,
+            repeat_last_n  = repeat_last_n,
+            context_erase  = context_erase,
         )
-        thread.start()
-
-        # Generator
-        while True:
-            response = output_queue.get()
-            if isinstance(response, Sentinel):
-                break
-            yield response
 
     def _callback_decoder(self, callback: ResponseCallbackType) -> RawResponseCallbackType:
         def _raw_callback(token_id: int, response: bytes) -> bool:
@@ -3,6 +3,9 @@ Python only API for running all GPT4All models.
 """
 from __future__ import annotations
 
+import asyncio
+import copy
+import functools
 import hashlib
 import json
 import os
@@ -14,7 +17,8 @@ from contextlib import contextmanager
 from datetime import datetime
 from pathlib import Path
 from types import TracebackType
-from typing import TYPE_CHECKING, Any, Iterable, Iterator, Literal, NamedTuple, NoReturn, Protocol, TypedDict, overload
+from typing import (TYPE_CHECKING, Any, AsyncIterator, Callable, Iterable, Iterator, Literal, NamedTuple, NoReturn, Protocol,
+                    TypedDict, overload)
 
 import jinja2
 import requests
@@ -187,6 +191,22 @@ class Embed4All:
         result = self.gpt4all.model.generate_embeddings(text, prefix, dimensionality, do_mean, atlas, cancel_cb)
         return result if return_dict else result["embeddings"]
 
+    async def aembed(self, text: str | list[str], **kwargs: Any) -> Any:
+        """
+        Generate one or more embeddings like `embed`, without blocking the event loop. The model runs on a worker
+        thread that does not hold the GIL. Calls on the same instance are processed one at a time.
+
+        Args:
+            text: A text or list of texts to generate embeddings for.
+            **kwargs: The keyword arguments of `embed`.
+
+        Returns:
+            The same result as `embed`.
+        """
+        async with self.gpt4all._get_async_lock():
+            loop = asyncio.get_running_loop()
+            return await loop.run_in_executor(None, functools.partial(self.embed, text, **kwargs))
+
 
 class GPT4All:
     """
@@ -234,6 +254,8 @@ class GPT4All:
 
         self.model_type = model_type
         self._chat_session: ChatSession | None = None
+        # serializes the async methods, created on first use so that it belongs to the running event loop
+        self._async_lock: asyncio.Lock | None = None
 
         device_init = None
         if sys.platform == "darwin":
@@ -280,6 +302,20 @@ class GPT4All:
         """Delete the model instance and free associated system resources."""
         self.model.close()
 
+    def create_context(self) -> GPT4All:
+        """
+        Create another GPT4All instance that shares the weights of this one. It has its own context window and chat
+        session, so the two can generate concurrently from different threads without loading the model twice.
+
+        Returns:
+            A new GPT4All instance, which must be closed separately.
+        """
+        context = copy.copy(self)
+        context._chat_session = None
+        context._async_lock = None
+        context.model = self.model.create_context()
+        return context
+
     @property
     def backend(self) -> Literal["cpu", "kompute", "cuda", "metal"]:
         """The name of the llama.cpp backend currently in use. One of "cpu", "kompute", "cuda", or "metal"."""
@@ -566,6 +602,97 @@ class GPT4All:
             full_response += response
             return callback(token_id, response)
 
+        prompt = self._prepare_prompt(prompt)
+
+        # Send the request to the model
+        if streaming:
+            def stream() -> Iterator[str]:
+                yield from self.model.prompt_model_streaming(prompt, _callback_wrapper, **generate_kwargs)
+                if self._chat_session is not None:
+                    self._chat_session.history.append(MessageType(role="assistant", content=full_response))
+            return stream()
+
+        self.model.prompt_model(prompt, _callback_wrapper, **generate_kwargs)
+        if self._chat_session is not None:
+            self._chat_session.history.append(MessageType(role="assistant", content=full_response))
+        return full_response
+
+    async def agenerate(
+        self,
+        prompt         : str,
+        *,
+        max_tokens     : int                  = 200,
+        temp           : float                = 0.7,
+        top_k          : int                  = 40,
+        top_p          : float                = 0.4,
+        min_p          : float                = 0.0,
+        repeat_penalty : float                = 1.18,
+        repeat_last_n  : int                  = 64,
+        n_batch        : int                  = 8,
+        n_predict      : int | None           = None,
+        streaming      : bool                 = False,
+        callback       : ResponseCallbackType = empty_response_callback,
+    ) -> Any:
+        """
+        Generate outputs like `generate`, without blocking the event loop. The model runs on a native thread that does
+        not hold the GIL, and the tokens are handed to the event loop in batches, so many streams can be served
+        without a thread each.
+
+        Calls on the same instance are processed one at a time. Use `create_context` to serve clients concurrently.
+
+        Args:
+            prompt: The prompt for the model to complete.
+            max_tokens: The maximum number of tokens to generate.
+            temp: The model temperature. Larger values increase creativity but decrease factuality.
+            top_k: Randomly sample from the top_k most likely tokens at each generation step. Set this to 1 for greedy decoding.
+            top_p: Randomly sample at each generation step from the top most likely tokens whose probabilities add up to top_p.
+            min_p: Randomly sample at each generation step from the top most likely tokens whose probabilities are at least min_p.
+            repeat_penalty: Penalize the model for repetition. Higher values result in less repetition.
+            repeat_last_n: How far in the models generation history to apply the repeat penalty.
+            n_batch: Number of prompt tokens processed in parallel. Larger values decrease latency but increase resource requirements.
+            n_predict: Equivalent to max_tokens, exists for backwards compatibility.
+            streaming: If True, this method will instead return an async generator that yields tokens as the model generates them.
+            callback: A function with arguments token_id:int and response:str, which receives the tokens from the model as they are generated and stops the generation by returning False. It is called on the event loop.
+
+        Returns:
+            Either the entire completion or an async generator that yields the completion token by token.
+        """
+
+        generate_kwargs: dict[str, Any] = dict(
+            temp           = temp,
+            top_k          = top_k,
+            top_p          = top_p,
+            min_p          = min_p,
+            repeat_penalty = repeat_penalty,
+            repeat_last_n  = repeat_last_n,
+            n_batch        = n_batch,
+            n_predict      = n_predict if n_predict is not None else max_tokens,
+        )
+
+        lock = self._get_async_lock()
+
+        async def stream() -> AsyncIterator[str]:
+            async with lock:
+                full_response = ""
+                async for token in self.model.aprompt_model_streaming(
+                    self._prepare_prompt(prompt), callback, **generate_kwargs,
+                ):
+                    full_response += token
+                    yield token
+                if self._chat_session is not None:
+                    self._chat_session.history.append(MessageType(role="assistant", content=full_response))
+
+        if streaming:
+            return stream()
+        return "".join([token async for token in stream()])
+
+    def _get_async_lock(self) -> asyncio.Lock:
+        if self._async_lock is None:
+            self._async_lock = asyncio.Lock()
+        return self._async_lock
+
+    def _prepare_prompt(self, prompt: str) -> str:
+        """Render the prompt with the current chat session, if any, and check its length."""
         last_msg_rendered = prompt
         if self._chat_session is not None:
             session = self._chat_session
@@ -584,19 +711,76 @@ class GPT4All:
         last_msg_len = self.model.count_prompt_tokens(last_msg_rendered)
         if last_msg_len > (limit := self.model.n_ctx - 4):
             raise ValueError(f"Your message was too long and could not be processed ({last_msg_len} > {limit}).")
+        return prompt
 
-        # Send the request to the model
-        if streaming:
-            def stream() -> Iterator[str]:
-                yield from self.model.prompt_model_streaming(prompt, _callback_wrapper, **generate_kwargs)
-                if self._chat_session is not None:
-                    self._chat_session.history.append(MessageType(role="assistant", content=full_response))
-            return stream()
+    def generate_batch(
+        self,
+        prompts        : list[str],
+        *,
+        max_tokens     : int   = 200,
+        temp           : float = 0.7,
+        top_k          : int   = 40,
+        top_p          : float = 0.4,
+        min_p          : float = 0.0,
+        repeat_penalty : float = 1.18,
+        repeat_last_n  : int   = 64,
+        n_batch        : int   = 8,
+        n_parallel     : int   = 0,
+        callback       : Callable[[int, int, str], bool] | None = None,
+    ) -> list[str]:
+        """
+        Generate outputs for many independent prompts, processing several at once on inference contexts that share
+        the loaded weights. The prompts are sent as-is; the current chat session is neither used nor updated.
 
-        self.model.prompt_model(prompt, _callback_wrapper, **generate_kwargs)
-        if self._chat_session is not None:
-            self._chat_session.history.append(MessageType(role="assistant", content=full_response))
-        return full_response
+        Args:
+            prompts: The prompts for the model to complete.
+            max_tokens: The maximum number of tokens to generate for each prompt.
+            temp: The model temperature. Larger values increase creativity but decrease factuality.
+            top_k: Randomly sample from the top_k most likely tokens at each generation step. Set this to 1 for greedy decoding.
+            top_p: Randomly sample at each generation step from the top most likely tokens whose probabilities add up to top_p.
+            min_p: Randomly sample at each generation step from the top most likely tokens whose probabilities are at least min_p.
+            repeat_penalty: Penalize the model for repetition. Higher values result in less repetition.
+            repeat_last_n: How far in the models generation history to apply the repeat penalty.
+            n_batch: Number of prompt tokens processed in parallel. Larger values decrease latency but increase resource requirements.
+            n_parallel: The maximum number of prompts to process at once, or 0 to choose based on the thread count. Each one needs its own context window in memory.
+            callback: A function with arguments index:int, token_id:int and response:str, which receives the tokens of the response to prompts[index] as they are generated and stops that response by returning False. It may be called from several threads at once.
+
+        Returns:
+            The completion of each prompt, in order.
+        """
+
+        generate_kwargs: dict[str, Any] = dict(
+            temp           = temp,
+            top_k          = top_k,
+            top_p          = top_p,
+            min_p          = min_p,
+            repeat_penalty = repeat_penalty,
+            repeat_last_n  = repeat_last_n,
+            n_batch        = n_batch,
+            n_predict      = max_tokens,
+        )
+
+        # Check request lengths
+        limit = self.model.n_ctx - 4
+        for prompt in prompts:
+            if (prompt_len := self.model.count_prompt_tokens(prompt)) > limit:
+                raise ValueError(f"Your message was too long and could not be processed ({prompt_len} > {limit}).")
+
+        responses = [""] * len(prompts)
+
+        def make_callback(index: int) -> ResponseCallbackType:
+            def _callback_wrapper(token_id: int, response: str) -> bool:
+                responses[index] += response
+                return True if callback is None else callback(index, token_id, response)
+            return _callback_wrapper
+
+        errors = self.model.prompt_model_batch(
+            prompts, [make_callback(i) for i in range(len(prompts))], n_parallel, **generate_kwargs,
+        )
+        if failed := [(i, e) for i, e in enumerate(errors) if e is not None]:
+            raise RuntimeError(f"{len(failed)} of {len(prompts)} prompts failed, first error at index {failed[0][0]}: "
+                               f"{failed[0][1]}")
+        return responses
 
     @contextmanager
     def chat_session(
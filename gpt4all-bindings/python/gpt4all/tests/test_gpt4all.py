@@ -1,3 +1,4 @@
+import asyncio
 import sys
 from io import StringIO
 from pathlib import Path
@@ -33,6 +34,63 @@ def test_inference():
         print(model.current_chat_session)
 
 
+def test_inference_streaming():
+    model = GPT4All(model_name='orca-mini-3b-gguf2-q4_0.gguf')
+    output = model.generate('hello', top_k=1)
+
+    tokens = list(model.generate('hello', top_k=1, streaming=True))
+    assert ''.join(tokens) == output
+
+    # stopping early must not leave generation running in the background
+    for token in model.generate('write me a poem about dogs', top_k=1, streaming=True):
+        break
+    assert model.generate('hello', top_k=1) == output
+
+
+def test_inference_async():
+    model = GPT4All(model_name='orca-mini-3b-gguf2-q4_0.gguf')
+    output = model.generate('hello', top_k=1)
+
+    async def run():
+        assert await model.agenerate('hello', top_k=1) == output
+        tokens = [token async for token in await model.agenerate('hello', top_k=1, streaming=True)]
+        assert ''.join(tokens) == output
+        # concurrent calls on one instance take turns
+        outputs = await asyncio.gather(*(model.agenerate('hello', top_k=1) for _ in range(3)))
+        assert outputs == [output] * 3
+
+    asyncio.run(run())
+
+
+def test_embedding_async():
+    embedder = Embed4All()
+    output = asyncio.run(embedder.aembed('The quick brown fox jumps over the lazy dog'))
+    assert output == embedder.embed('The quick brown fox jumps over the lazy dog')
+
+
+def test_inference_batch():
+    model = GPT4All(model_name='orca-mini-3b-gguf2-q4_0.gguf')
+    prompts = ['hello', 'write me a short poem', 'The capital of france is ']
+    expected = [model.generate(p, top_k=1) for p in prompts]
+
+    outputs = model.generate_batch(prompts, top_k=1, n_parallel=2)
+    assert outputs == expected
+
+
+def test_inference_context():
+    model = GPT4All(model_name='orca-mini-3b-gguf2-q4_0.gguf')
+    output = model.generate('hello', top_k=1)
+
+    with model.create_context() as context:
+        with context.chat_session():
+            context.generate('write me a short poem', top_k=1)
+        assert context.generate('hello', top_k=1) == output
+        assert model.current_chat_session is None
+
+    # the weights must outlive the closed context
+    assert model.generate('hello', top_k=1) == output
+
+
 def do_long_input(model):
     long_input = " ".join(["hello how are you"] * 40)
 
@@ -4,7 +4,8 @@
       "target_name": "gpt4all", # gpt4all-ts will cause compile error
       "include_dirs": [
         "<!@(node -p \"require('node-addon-api').include\")",
-        "../../gpt4all-backend",
+        "../../gpt4all-backend/include/gpt4all-backend",
+        "../../gpt4all-backend/src",
       ],
       "sources": [
         # PREVIOUS VERSION: had to required the sources, but with newest changes do not need to
@@ -12,8 +13,10 @@
         #"../../gpt4all-backend/llama.cpp/ggml.c",
         #"../../gpt4all-backend/llama.cpp/llama.cpp",
         # "../../gpt4all-backend/utils.cpp",
-        "../../gpt4all-backend/llmodel_c.cpp",
-        "../../gpt4all-backend/llmodel.cpp",
+        "../../gpt4all-backend/src/llmodel_c.cpp",
+        "../../gpt4all-backend/src/llmodel.cpp",
+        "../../gpt4all-backend/src/llmodel_shared.cpp",
+        "embed.cc",
         "prompt.cc",
         "index.cc",
        ],
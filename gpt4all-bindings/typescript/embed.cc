@@ -0,0 +1,68 @@
+#include "embed.h"
+#include <algorithm>
+
+EmbedWorker::EmbedWorker(Napi::Env env, EmbedWorkerConfig config)
+    : AsyncWorker(env), promise(Napi::Promise::Deferred::New(env)), _config(std::move(config))
+{
+}
+
+void EmbedWorker::Execute()
+{
+    std::vector<const char *> str_ptrs;
+    str_ptrs.reserve(_config.texts.size() + 1);
+    for (auto &text : _config.texts)
+        str_ptrs.push_back(text.c_str());
+    str_ptrs.push_back(nullptr);
+
+    size_t embedding_size;
+    const char *error = nullptr;
+    float *embeds = llmodel_embed(_config.model, str_ptrs.data(), &embedding_size,
+                                  _config.prefix ? _config.prefix->c_str() : nullptr, _config.dimensionality,
+                                  &tokenCount, _config.doMean, _config.atlas, nullptr, &error);
+    if (!embeds)
+    {
+        SetError(error ? error : "unknown error");
+        return;
+    }
+    embeddings.assign(embeds, embeds + embedding_size);
+    llmodel_free_embedding(embeds);
+}
+
+void EmbedWorker::OnOK()
+{
+    _config.session->Finished();
+    auto env = Env();
+    size_t n_texts = _config.texts.size();
+    size_t n_embd = n_texts ? embeddings.size() / n_texts : 0;
+
+    auto embedmat = Napi::Array::New(env, n_texts);
+    for (size_t i = 0; i < n_texts; i++)
+    {
+        auto fltarr = Napi::Float32Array::New(env, n_embd);
+        std::copy_n(embeddings.data() + i * n_embd, n_embd, fltarr.Data());
+        embedmat.Set(static_cast<uint32_t>(i), fltarr);
+    }
+
+    auto res = Napi::Object::New(env);
+    res.Set("n_prompt_tokens", tokenCount);
+    if (_config.isSingleText)
+    {
+        res.Set("embeddings", embedmat.Get(static_cast<uint32_t>(0)));
+    }
+    else
+    {
+        res.Set("embeddings", embedmat);
+    }
+    promise.Resolve(res);
+}
+
+void EmbedWorker::OnError(const Napi::Error &e)
+{
+    _config.session->Finished();
+    promise.Reject(e.Value());
+}
+
+Napi::Promise EmbedWorker::GetPromise()
+{
+    return promise.Promise();
+}
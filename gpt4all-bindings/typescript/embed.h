@@ -0,0 +1,45 @@
+#ifndef EMBED_WORKER_H
+#define EMBED_WORKER_H
+
+#include "llmodel_c.h"
+#include "napi.h"
+#include "prompt.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct EmbedWorkerConfig
+{
+    llmodel_model model;
+    // embedding uses the same context as prompting, so it is scheduled by the session
+    std::shared_ptr<PromptSession> session;
+    std::vector<std::string> texts;
+    bool isSingleText = false;
+    std::optional<std::string> prefix;
+    int32_t dimensionality = -1;
+    bool doMean = true;
+    bool atlas = false;
+};
+
+/**
+ * Computes embeddings off the main thread and resolves with {n_prompt_tokens, embeddings}.
+ */
+class EmbedWorker : public Napi::AsyncWorker
+{
+  public:
+    EmbedWorker(Napi::Env env, EmbedWorkerConfig config);
+    void Execute() override;
+    void OnOK() override;
+    void OnError(const Napi::Error &e) override;
+    Napi::Promise GetPromise();
+
+  private:
+    Napi::Promise::Deferred promise;
+    std::vector<float> embeddings;
+    size_t tokenCount = 0;
+    EmbedWorkerConfig _config;
+};
+
+#endif // EMBED_WORKER_H
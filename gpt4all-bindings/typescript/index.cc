@@ -9,6 +9,7 @@ Napi::Function NodeModelWrapper::GetClass(Napi::Env env)
                                        InstanceMethod("name", &NodeModelWrapper::GetName),
                                        InstanceMethod("stateSize", &NodeModelWrapper::StateSize),
                                        InstanceMethod("infer", &NodeModelWrapper::Infer),
+                                       InstanceMethod("createContext", &NodeModelWrapper::CreateContext),
                                        InstanceMethod("setThreadCount", &NodeModelWrapper::SetThreadCount),
                                        InstanceMethod("embed", &NodeModelWrapper::GenerateEmbedding),
                                        InstanceMethod("threadCount", &NodeModelWrapper::ThreadCount),
@@ -102,12 +103,26 @@ Napi::Value NodeModelWrapper::InitGpuByString(const Napi::CallbackInfo &info)
 }
 Napi::Value NodeModelWrapper::HasGpuDevice(const Napi::CallbackInfo &info)
 {
-    return Napi::Boolean::New(info.Env(), llmodel_has_gpu_device(GetInference()));
+    return Napi::Boolean::New(info.Env(), llmodel_model_gpu_device_name(GetInference()) != nullptr);
 }
 
 NodeModelWrapper::NodeModelWrapper(const Napi::CallbackInfo &info) : Napi::ObjectWrap<NodeModelWrapper>(info)
 {
     auto env = info.Env();
+
+    // created by createContext() from an already loaded model
+    if (info[0].IsExternal())
+    {
+        inference_ = info[0].As<Napi::External<void>>().Data();
+        auto parent = NodeModelWrapper::Unwrap(info[1].As<Napi::Object>());
+        type = parent->type;
+        name = parent->name;
+        nCtx = parent->nCtx;
+        nGpuLayers = parent->nGpuLayers;
+        full_model_path = parent->full_model_path;
+        return;
+    }
+
     auto config_object = info[0].As<Napi::Object>();
 
     // sets the directory where models (gguf files) are to be searched
@@ -188,96 +203,46 @@ Napi::Value NodeModelWrapper::IsModelLoaded(const Napi::CallbackInfo &info)
 Napi::Value NodeModelWrapper::StateSize(const Napi::CallbackInfo &info)
 {
     // Implement the binding for the stateSize method
-    return Napi::Number::New(info.Env(), static_cast<int64_t>(llmodel_get_state_size(GetInference())));
-}
-
-Napi::Array ChunkedFloatPtr(float *embedding_ptr, int embedding_size, int text_len, Napi::Env const &env)
-{
-    auto n_embd = embedding_size / text_len;
-    // std::cout << "Embedding size: " << embedding_size << std::endl;
-    // std::cout << "Text length: " << text_len << std::endl;
-    // std::cout << "Chunk size (n_embd): " << n_embd << std::endl;
-    Napi::Array result = Napi::Array::New(env, text_len);
-    auto count = 0;
-    for (int i = 0; i < embedding_size; i += n_embd)
-    {
-        int end = std::min(i + n_embd, embedding_size);
-        // possible bounds error?
-        // Constructs a container with as many elements as the range [first,last), with each element emplace-constructed
-        // from its corresponding element in that range, in the same order.
-        std::vector<float> chunk(embedding_ptr + i, embedding_ptr + end);
-        Napi::Float32Array fltarr = Napi::Float32Array::New(env, chunk.size());
-        // I know there's a way to emplace the raw float ptr into a Napi::Float32Array but idk how and
-        //  im too scared to cause memory issues
-        //  this is goodenough
-        for (int j = 0; j < chunk.size(); j++)
-        {
-
-            fltarr.Set(j, chunk[j]);
-        }
-        result.Set(count++, fltarr);
-    }
-    return result;
+    return Napi::Number::New(info.Env(), static_cast<int64_t>(llmodel_state_get_size(GetInference())));
 }
 
 Napi::Value NodeModelWrapper::GenerateEmbedding(const Napi::CallbackInfo &info)
 {
     auto env = info.Env();
 
-    auto prefix = info[1];
-    auto dimensionality = info[2].As<Napi::Number>().Int32Value();
-    auto do_mean = info[3].As<Napi::Boolean>().Value();
-    auto atlas = info[4].As<Napi::Boolean>().Value();
-    size_t embedding_size;
-    size_t token_count = 0;
+    EmbedWorkerConfig embedWorkerConfig;
+    embedWorkerConfig.model = GetInference();
+    embedWorkerConfig.session = session_;
 
-    // This procedure can maybe be optimized but its whatever, i have too many intermediary structures
-    std::vector<std::string> text_arr;
-    bool is_single_text = false;
     if (info[0].IsString())
     {
-        is_single_text = true;
-        text_arr.push_back(info[0].As<Napi::String>().Utf8Value());
+        embedWorkerConfig.isSingleText = true;
+        embedWorkerConfig.texts.push_back(info[0].As<Napi::String>().Utf8Value());
     }
     else
     {
         auto jsarr = info[0].As<Napi::Array>();
         size_t len = jsarr.Length();
-        text_arr.reserve(len);
+        embedWorkerConfig.texts.reserve(len);
         for (size_t i = 0; i < len; ++i)
         {
-            std::string str = jsarr.Get(i).As<Napi::String>().Utf8Value();
-            text_arr.push_back(str);
+            embedWorkerConfig.texts.push_back(jsarr.Get(i).As<Napi::String>().Utf8Value());
         }
     }
-    std::vector<const char *> str_ptrs;
-    str_ptrs.reserve(text_arr.size() + 1);
-    for (size_t i = 0; i < text_arr.size(); ++i)
-        str_ptrs.push_back(text_arr[i].c_str());
-    str_ptrs.push_back(nullptr);
-    const char *_err = nullptr;
-    float *embeds = llmodel_embed(GetInference(), str_ptrs.data(),  &embedding_size,
-                                  prefix.IsUndefined() ? nullptr : prefix.As<Napi::String>().Utf8Value().c_str(),
-                                  dimensionality, &token_count, do_mean, atlas, nullptr, &_err);
-    if (!embeds)
-    {
-        // i dont wanna deal with c strings lol
-        std::string err(_err);
-        Napi::Error::New(env, err == "(unknown error)" ? "Unknown error: sorry bud" : err).ThrowAsJavaScriptException();
-        return env.Undefined();
+    if (!info[1].IsUndefined())
+    {
+        embedWorkerConfig.prefix = info[1].As<Napi::String>().Utf8Value();
     }
-    auto embedmat = ChunkedFloatPtr(embeds, embedding_size, text_arr.size(), env);
+    embedWorkerConfig.dimensionality = info[2].As<Napi::Number>().Int32Value();
+    embedWorkerConfig.doMean = info[3].As<Napi::Boolean>().Value();
+    embedWorkerConfig.atlas = info[4].As<Napi::Boolean>().Value();
 
-    llmodel_free_embedding(embeds);
-    auto res = Napi::Object::New(env);
-    res.Set("n_prompt_tokens", token_count);
-    if(is_single_text) {
-        res.Set("embeddings", embedmat.Get(static_cast<uint32_t>(0)));
-    } else {
-        res.Set("embeddings", embedmat);
-    }
+    auto session = embedWorkerConfig.session;
+    auto worker = new EmbedWorker(env, std::move(embedWorkerConfig));
+
+    session->Schedule(worker);
 
-    return res;
+    return worker->GetPromise();
 }
 
 /**
@@ -305,11 +270,7 @@ Napi::Value NodeModelWrapper::Infer(const Napi::CallbackInfo &info)
         return info.Env().Undefined();
     }
     // defaults copied from python bindings
-    llmodel_prompt_context promptContext = {.logits = nullptr,
-                                            .tokens = nullptr,
-                                            .n_past = 0,
-                                            .n_ctx = nCtx,
-                                            .n_predict = 4096,
+    llmodel_prompt_context promptContext = {.n_predict = 4096,
                                             .top_k = 40,
                                             .top_p = 0.9f,
                                             .min_p = 0.0f,
@@ -333,7 +294,7 @@ Napi::Value NodeModelWrapper::Infer(const Napi::CallbackInfo &info)
     // Assign the remaining properties
     if (inputObject.Has("nPast") && inputObject.Get("nPast").IsNumber())
     {
-        promptContext.n_past = inputObject.Get("nPast").As<Napi::Number>().Int32Value();
+        promptWorkerConfig.nPast = inputObject.Get("nPast").As<Napi::Number>().Int32Value();
     }
     if (inputObject.Has("nPredict") && inputObject.Get("nPredict").IsNumber())
     {
@@ -371,12 +332,25 @@ Napi::Value NodeModelWrapper::Infer(const Napi::CallbackInfo &info)
     {
         promptContext.context_erase = inputObject.Get("contextErase").As<Napi::Number>().FloatValue();
     }
-    if (inputObject.Has("onPromptToken") && inputObject.Get("onPromptToken").IsFunction())
+    // the batched callbacks take one call per batch of tokens, so they are preferred if both are given
+    if (inputObject.Has("onPromptTokens") && inputObject.Get("onPromptTokens").IsFunction())
+    {
+        promptWorkerConfig.promptCallback = inputObject.Get("onPromptTokens").As<Napi::Function>();
+        promptWorkerConfig.hasPromptCallback = true;
+        promptWorkerConfig.batchedPromptCallback = true;
+    }
+    else if (inputObject.Has("onPromptToken") && inputObject.Get("onPromptToken").IsFunction())
     {
         promptWorkerConfig.promptCallback = inputObject.Get("onPromptToken").As<Napi::Function>();
         promptWorkerConfig.hasPromptCallback = true;
     }
-    if (inputObject.Has("onResponseToken") && inputObject.Get("onResponseToken").IsFunction())
+    if (inputObject.Has("onResponseTokens") && inputObject.Get("onResponseTokens").IsFunction())
+    {
+        promptWorkerConfig.responseCallback = inputObject.Get("onResponseTokens").As<Napi::Function>();
+        promptWorkerConfig.hasResponseCallback = true;
+        promptWorkerConfig.batchedResponseCallback = true;
+    }
+    else if (inputObject.Has("onResponseToken") && inputObject.Get("onResponseToken").IsFunction())
     {
         promptWorkerConfig.responseCallback = inputObject.Get("onResponseToken").As<Napi::Function>();
         promptWorkerConfig.hasResponseCallback = true;
@@ -386,29 +360,42 @@ Napi::Value NodeModelWrapper::Infer(const Napi::CallbackInfo &info)
     //  llmodel_prompt_context copiedPrompt = promptContext;
     promptWorkerConfig.context = promptContext;
     promptWorkerConfig.model = GetInference();
-    promptWorkerConfig.mutex = &inference_mutex;
+    promptWorkerConfig.nCtx = nCtx;
+    promptWorkerConfig.session = session_;
     promptWorkerConfig.prompt = prompt;
-    promptWorkerConfig.result = "";
 
     promptWorkerConfig.promptTemplate = inputObject.Get("promptTemplate").As<Napi::String>();
-    if (inputObject.Has("special"))
-    {
-        promptWorkerConfig.special = inputObject.Get("special").As<Napi::Boolean>();
-    }
-    if (inputObject.Has("fakeReply"))
+    // "special" is accepted for compatibility, special tokens in the template are always parsed
+    if (inputObject.Has("fakeReply") && inputObject.Get("fakeReply").IsString())
     {
-        // this will be deleted in the worker
-        promptWorkerConfig.fakeReply = new std::string(inputObject.Get("fakeReply").As<Napi::String>().Utf8Value());
+        promptWorkerConfig.hasFakeReply = true;
+        promptWorkerConfig.fakeReply = inputObject.Get("fakeReply").As<Napi::String>().Utf8Value();
     }
-    auto worker = new PromptWorker(env, promptWorkerConfig);
+    auto worker = new PromptWorker(env, std::move(promptWorkerConfig));
 
-    worker->Queue();
+    session_->Schedule(worker);
 
     return worker->GetPromise();
 }
+Napi::Value NodeModelWrapper::CreateContext(const Napi::CallbackInfo &info)
+{
+    auto env = info.Env();
+    const char *error = nullptr;
+    llmodel_model context = llmodel_context_create(GetInference(), &error);
+    if (!context)
+    {
+        Napi::Error::New(env, error ? error : "unknown error").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    auto constructor = env.GetInstanceData<Napi::FunctionReference>();
+    return constructor->New({Napi::External<void>::New(env, context), Value()});
+}
+
 void NodeModelWrapper::Dispose(const Napi::CallbackInfo &info)
 {
+    // the weights are freed along with the last context that uses them
     llmodel_model_destroy(inference_);
+    inference_ = nullptr;
 }
 void NodeModelWrapper::SetThreadCount(const Napi::CallbackInfo &info)
 {
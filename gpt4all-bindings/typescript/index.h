@@ -1,4 +1,4 @@
-#include "llmodel.h"
+#include "embed.h"
 #include "llmodel_c.h"
 #include "prompt.h"
 #include <atomic>
@@ -22,10 +22,15 @@ class NodeModelWrapper : public Napi::ObjectWrap<NodeModelWrapper>
     Napi::Value StateSize(const Napi::CallbackInfo &info);
     // void Finalize(Napi::Env env) override;
     /**
-     * Prompting the model. This entails spawning a new thread and adding the response tokens
-     * into a thread local string variable.
+     * Prompting the model. This runs on a worker thread, and the tokens are handed to the JS callbacks
+     * in batches.
      */
     Napi::Value Infer(const Napi::CallbackInfo &info);
+    /**
+     * Creates another LLModel that shares the loaded weights but has its own context, so that it can
+     * run prompts concurrently with this one.
+     */
+    Napi::Value CreateContext(const Napi::CallbackInfo &info);
     void SetThreadCount(const Napi::CallbackInfo &info);
     void Dispose(const Napi::CallbackInfo &info);
     Napi::Value GetName(const Napi::CallbackInfo &info);
@@ -50,9 +55,10 @@ class NodeModelWrapper : public Napi::ObjectWrap<NodeModelWrapper>
     /**
      * The underlying inference that interfaces with the C interface
      */
-    llmodel_model inference_;
+    llmodel_model inference_ = nullptr;
 
-    std::mutex inference_mutex;
+    // serializes work on this context and remembers what was fed to it
+    std::shared_ptr<PromptSession> session_ = std::make_shared<PromptSession>();
 
     std::string type;
     // corresponds to LLModel::name() in typescript
@@ -1,196 +1,316 @@
 #include "prompt.h"
-#include <future>
+#include <algorithm>
+#include <iostream>
 
-PromptWorker::PromptWorker(Napi::Env env, PromptWorkerConfig config)
-    : promise(Napi::Promise::Deferred::New(env)), _config(config), AsyncWorker(env)
+// llmodel_prompt callbacks carry no user data, but they run on the thread that called llmodel_prompt
+static thread_local PromptWorker *t_currentWorker = nullptr;
+
+static bool promptCallbackTrampoline(const token_t *token_ids, size_t n_token_ids, bool cached)
 {
-    if (_config.hasResponseCallback)
+    (void)cached;
+    return t_currentWorker->PromptCallback(token_ids, n_token_ids);
+}
+
+static bool responseCallbackTrampoline(token_t token_id, const char *response)
+{
+    return t_currentWorker->ResponseCallback(token_id, response);
+}
+
+TokenBatcher::TokenBatcher(Napi::Env env, Napi::Function callback, const char *name, bool withText, bool batched)
+    : _state(std::make_shared<State>()), _tsfn(Napi::ThreadSafeFunction::New(env, callback, name, 0, 1)),
+      _callback(Napi::Persistent(callback))
+{
+    _state->withText = withText;
+    _state->batched = batched;
+}
+
+TokenBatcher::~TokenBatcher()
+{
+    _tsfn.Release();
+}
+
+bool TokenBatcher::Push(int32_t tokenId, std::string_view token)
+{
+    if (_state->stopped)
     {
-        _responseCallbackFn = Napi::ThreadSafeFunction::New(config.responseCallback.Env(), config.responseCallback,
-                                                            "PromptWorker", 0, 1, this);
+        return false;
     }
 
-    if (_config.hasPromptCallback)
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        _state->pending.push_back({tokenId, std::string(token)});
+        // the tokens that come before the delivery runs on the main thread go along with this one
+        schedule = !std::exchange(_state->deliveryScheduled, true);
+    }
+
+    if (schedule)
     {
-        _promptCallbackFn = Napi::ThreadSafeFunction::New(config.promptCallback.Env(), config.promptCallback,
-                                                          "PromptWorker", 0, 1, this);
+        // the state is shared with the call so it stays valid even if the worker is gone by the time it runs
+        auto status = _tsfn.NonBlockingCall(
+            [state = _state](Napi::Env env, Napi::Function jsCallback) { Deliver(env, jsCallback, *state); });
+        if (status != napi_ok)
+        {
+            Napi::Error::Fatal("TokenBatcher", "Napi::ThreadSafeFunction.NonBlockingCall() failed");
+        }
     }
+    return true;
 }
 
-PromptWorker::~PromptWorker()
+void TokenBatcher::Flush(Napi::Env env)
 {
-    if (_config.hasResponseCallback)
+    Deliver(env, _callback.Value(), *_state);
+}
+
+bool TokenBatcher::AsksToStop(const Napi::Value &jsResult)
+{
+    // a callback that returns nothing continues, as documented for the JS API
+    return !jsResult.IsUndefined() && !jsResult.ToBoolean();
+}
+
+void TokenBatcher::Deliver(Napi::Env env, Napi::Function jsCallback, State &state)
+{
+    std::vector<ResponseCallbackData> batch;
     {
-        _responseCallbackFn.Release();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        batch.swap(state.pending);
+        state.deliveryScheduled = false;
     }
-    if (_config.hasPromptCallback)
+
+    if (batch.empty() || state.stopped)
     {
-        _promptCallbackFn.Release();
+        return;
+    }
+
+    try
+    {
+        if (state.batched)
+        {
+            auto tokenIds = Napi::Array::New(env, batch.size());
+            auto tokens = Napi::Array::New(env, state.withText ? batch.size() : 0);
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                tokenIds.Set(uint32_t(i), Napi::Number::New(env, batch[i].tokenId));
+                if (state.withText)
+                {
+                    tokens.Set(uint32_t(i), Napi::String::New(env, batch[i].token));
+                }
+            }
+            auto jsResult = state.withText ? jsCallback.Call({tokenIds, tokens}) : jsCallback.Call({tokenIds});
+            if (AsksToStop(jsResult))
+            {
+                state.stopped = true;
+            }
+            return;
+        }
+
+        for (auto &value : batch)
+        {
+            auto token_id = Napi::Number::New(env, value.tokenId);
+            auto jsResult = state.withText ? jsCallback.Call({token_id, Napi::String::New(env, value.token)})
+                                           : jsCallback.Call({token_id});
+            if (AsksToStop(jsResult))
+            {
+                state.stopped = true;
+                break;
+            }
+        }
+    }
+    catch (const Napi::Error &e)
+    {
+        std::cerr << "Error in token callback: " << e.what() << std::endl;
+        state.stopped = true;
     }
 }
 
-void PromptWorker::Execute()
+void PromptSession::Schedule(Napi::AsyncWorker *worker)
 {
-    _config.mutex->lock();
-
-    LLModelWrapper *wrapper = reinterpret_cast<LLModelWrapper *>(_config.model);
-
-    auto ctx = &_config.context;
-
-    if (size_t(ctx->n_past) < wrapper->promptContext.tokens.size())
-        wrapper->promptContext.tokens.resize(ctx->n_past);
-
-    // Copy the C prompt context
-    wrapper->promptContext.n_past = ctx->n_past;
-    wrapper->promptContext.n_ctx = ctx->n_ctx;
-    wrapper->promptContext.n_predict = ctx->n_predict;
-    wrapper->promptContext.top_k = ctx->top_k;
-    wrapper->promptContext.top_p = ctx->top_p;
-    wrapper->promptContext.temp = ctx->temp;
-    wrapper->promptContext.n_batch = ctx->n_batch;
-    wrapper->promptContext.repeat_penalty = ctx->repeat_penalty;
-    wrapper->promptContext.repeat_last_n = ctx->repeat_last_n;
-    wrapper->promptContext.contextErase = ctx->context_erase;
-
-    // Call the C++ prompt method
-
-    wrapper->llModel->prompt(
-        _config.prompt, _config.promptTemplate, [this](int32_t token_id) { return PromptCallback(token_id); },
-        [this](int32_t token_id, const std::string token) { return ResponseCallback(token_id, token); },
-        [](bool isRecalculating) { return isRecalculating; }, wrapper->promptContext, _config.special,
-        _config.fakeReply);
-
-    // Update the C context by giving access to the wrappers raw pointers to std::vector data
-    // which involves no copies
-    ctx->logits = wrapper->promptContext.logits.data();
-    ctx->logits_size = wrapper->promptContext.logits.size();
-    ctx->tokens = wrapper->promptContext.tokens.data();
-    ctx->tokens_size = wrapper->promptContext.tokens.size();
-
-    // Update the rest of the C prompt context
-    ctx->n_past = wrapper->promptContext.n_past;
-    ctx->n_ctx = wrapper->promptContext.n_ctx;
-    ctx->n_predict = wrapper->promptContext.n_predict;
-    ctx->top_k = wrapper->promptContext.top_k;
-    ctx->top_p = wrapper->promptContext.top_p;
-    ctx->temp = wrapper->promptContext.temp;
-    ctx->n_batch = wrapper->promptContext.n_batch;
-    ctx->repeat_penalty = wrapper->promptContext.repeat_penalty;
-    ctx->repeat_last_n = wrapper->promptContext.repeat_last_n;
-    ctx->context_erase = wrapper->promptContext.contextErase;
-
-    _config.mutex->unlock();
+    if (std::exchange(_busy, true))
+    {
+        _pending.push_back(worker);
+        return;
+    }
+    worker->Queue();
 }
 
-void PromptWorker::OnOK()
+void PromptSession::Finished()
 {
-    Napi::Object returnValue = Napi::Object::New(Env());
-    returnValue.Set("text", result);
-    returnValue.Set("nPast", _config.context.n_past);
-    promise.Resolve(returnValue);
-    delete _config.fakeReply;
+    if (_pending.empty())
+    {
+        _busy = false;
+        return;
+    }
+    Napi::AsyncWorker *next = _pending.front();
+    _pending.pop_front();
+    next->Queue();
 }
 
-void PromptWorker::OnError(const Napi::Error &e)
+int32_t PromptSession::Trim(int32_t nPast, int32_t maxTokens)
 {
-    delete _config.fakeReply;
-    promise.Reject(e.Value());
+    if (checkpoints.size() < 2)
+    {
+        return nPast;
+    }
+
+    // the first checkpoint after which the rest fits, keeping at least the last turn
+    size_t keep = 0;
+    while (keep + 2 < checkpoints.size() && nPast - checkpoints[keep].first > maxTokens)
+    {
+        keep++;
+    }
+    // the transcript now starts at that checkpoint, the counts of the ones after it are rebased to the new start
+    auto [cutTokens, cut] = checkpoints[keep];
+    transcript.erase(0, cut);
+    checkpoints.erase(checkpoints.begin(), checkpoints.begin() + keep + 1);
+    for (auto &checkpoint : checkpoints)
+    {
+        checkpoint.first -= cutTokens;
+        checkpoint.second -= cut;
+    }
+    return nPast - cutTokens;
 }
 
-Napi::Promise PromptWorker::GetPromise()
+PromptWorker::PromptWorker(Napi::Env env, PromptWorkerConfig config)
+    : AsyncWorker(env), promise(Napi::Promise::Deferred::New(env)), _config(std::move(config))
 {
-    return promise.Promise();
+    if (_config.hasResponseCallback)
+    {
+        _responseBatcher = std::make_unique<TokenBatcher>(env, _config.responseCallback, "PromptWorker", true,
+                                                          _config.batchedResponseCallback);
+    }
+    if (_config.hasPromptCallback)
+    {
+        _promptBatcher = std::make_unique<TokenBatcher>(env, _config.promptCallback, "PromptWorker", false,
+                                                        _config.batchedPromptCallback);
+    }
 }
 
-bool PromptWorker::ResponseCallback(int32_t token_id, const std::string token)
+void PromptWorker::Execute()
 {
-    if (token_id == -1)
+    // the session runs one worker at a time
+    auto &session = *_config.session;
+
+    // rewind the session to the requested position
+    if (_config.nPast == 0)
     {
-        return false;
+        session.transcript.clear();
+        session.checkpoints.clear();
     }
-
-    if (!_config.hasResponseCallback)
+    else if (_config.nPast > 0)
     {
-        return true;
+        // the latest match, in case two responses ended at the same count
+        auto it = std::find_if(session.checkpoints.rbegin(), session.checkpoints.rend(),
+                               [this](auto &checkpoint) { return checkpoint.first == _config.nPast; });
+        if (it == session.checkpoints.rend())
+        {
+            SetError("nPast does not match the end of a previous response");
+            return;
+        }
+        session.transcript.resize(it->second);
+        session.checkpoints.erase(it.base(), session.checkpoints.end());
     }
 
-    result += token;
+    // %1 is replaced by the prompt and %2 by the response, which is appended if %2 is absent
+    std::string templateBefore = _config.promptTemplate, templateAfter;
+    if (auto pos = templateBefore.find("%2"); pos != std::string::npos)
+    {
+        templateAfter = templateBefore.substr(pos + 2);
+        templateBefore.resize(pos);
+    }
+    auto pos = templateBefore.find("%1");
+    if (pos == std::string::npos)
+    {
+        SetError("promptTemplate must contain %1");
+        return;
+    }
+    templateBefore.replace(pos, 2, _config.prompt);
 
-    std::promise<bool> promise;
+    std::string input = session.transcript + templateBefore;
+    if (_config.hasFakeReply)
+    {
+        // nothing to generate, the reply is decoded along with the next prompt
+        result = _config.fakeReply;
+    }
+    else
+    {
+        const char *error = nullptr;
+        t_currentWorker = this;
+        bool ok = llmodel_prompt(_config.model, input.c_str(), promptCallbackTrampoline, responseCallbackTrampoline,
+                                 &_config.context, &error);
+        t_currentWorker = nullptr;
+        if (!ok)
+        {
+            SetError(error ? error : "unknown error");
+            return;
+        }
+    }
 
-    auto info = new ResponseCallbackData();
-    info->tokenId = token_id;
-    info->token = token;
+    session.transcript = input + result + templateAfter;
 
-    auto future = promise.get_future();
+    const char *error = nullptr;
+    nPast = llmodel_count_prompt_tokens(_config.model, session.transcript.c_str(), &error);
+    if (nPast < 0)
+    {
+        SetError(error ? error : "unknown error");
+        return;
+    }
+    session.checkpoints.emplace_back(nPast, session.transcript.size());
+    if (_config.nCtx > 0 && nPast > _config.nCtx)
+    {
+        // erase like the backend does when the context is full, so the common prefix is kept for a while after
+        nPast = session.Trim(nPast, int32_t(_config.nCtx * (1.f - _config.context.context_erase)));
+    }
+}
 
-    auto status = _responseCallbackFn.BlockingCall(
-        info, [&promise](Napi::Env env, Napi::Function jsCallback, ResponseCallbackData *value) {
-            try
-            {
-                // Transform native data into JS data, passing it to the provided
-                // `jsCallback` -- the TSFN's JavaScript function.
-                auto token_id = Napi::Number::New(env, value->tokenId);
-                auto token = Napi::String::New(env, value->token);
-                auto jsResult = jsCallback.Call({token_id, token}).ToBoolean();
-                promise.set_value(jsResult);
-            }
-            catch (const Napi::Error &e)
-            {
-                std::cerr << "Error in onResponseToken callback: " << e.what() << std::endl;
-                promise.set_value(false);
-            }
+void PromptWorker::OnOK()
+{
+    _config.session->Finished();
 
-            delete value;
-        });
-    if (status != napi_ok)
+    // deliver the tokens that arrived after the last batch
+    if (_promptBatcher)
     {
-        Napi::Error::Fatal("PromptWorkerResponseCallback", "Napi::ThreadSafeNapi::Function.NonBlockingCall() failed");
+        _promptBatcher->Flush(Env());
+    }
+    if (_responseBatcher)
+    {
+        _responseBatcher->Flush(Env());
     }
 
-    return future.get();
+    Napi::Object returnValue = Napi::Object::New(Env());
+    returnValue.Set("text", result);
+    returnValue.Set("nPast", nPast);
+    promise.Resolve(returnValue);
 }
 
-bool PromptWorker::RecalculateCallback(bool isRecalculating)
+void PromptWorker::OnError(const Napi::Error &e)
 {
-    return isRecalculating;
+    _config.session->Finished();
+    promise.Reject(e.Value());
 }
 
-bool PromptWorker::PromptCallback(int32_t token_id)
+Napi::Promise PromptWorker::GetPromise()
 {
-    if (!_config.hasPromptCallback)
+    return promise.Promise();
+}
+
+bool PromptWorker::ResponseCallback(int32_t token_id, std::string_view token)
+{
+    result += token;
+    return !_responseBatcher || _responseBatcher->Push(token_id, token);
+}
+
+bool PromptWorker::PromptCallback(const int32_t *token_ids, size_t n_token_ids)
+{
+    if (!_promptBatcher)
     {
         return true;
     }
-
-    std::promise<bool> promise;
-
-    auto info = new PromptCallbackData();
-    info->tokenId = token_id;
-
-    auto future = promise.get_future();
-
-    auto status = _promptCallbackFn.BlockingCall(
-        info, [&promise](Napi::Env env, Napi::Function jsCallback, PromptCallbackData *value) {
-            try
-            {
-                // Transform native data into JS data, passing it to the provided
-                // `jsCallback` -- the TSFN's JavaScript function.
-                auto token_id = Napi::Number::New(env, value->tokenId);
-                auto jsResult = jsCallback.Call({token_id}).ToBoolean();
-                promise.set_value(jsResult);
-            }
-            catch (const Napi::Error &e)
-            {
-                std::cerr << "Error in onPromptToken callback: " << e.what() << std::endl;
-                promise.set_value(false);
-            }
-            delete value;
-        });
-    if (status != napi_ok)
+    for (size_t i = 0; i < n_token_ids; i++)
     {
-        Napi::Error::Fatal("PromptWorkerPromptCallback", "Napi::ThreadSafeNapi::Function.NonBlockingCall() failed");
+        if (!_promptBatcher->Push(token_ids[i], {}))
+        {
+            return false;
+        }
     }
-
-    return future.get();
+    return true;
 }
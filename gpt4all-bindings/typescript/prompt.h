@@ -1,14 +1,17 @@
 #ifndef PREDICT_WORKER_H
 #define PREDICT_WORKER_H
 
-#include "llmodel.h"
 #include "llmodel_c.h"
 #include "napi.h"
 #include <atomic>
-#include <iostream>
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <mutex>
-#include <thread>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 struct ResponseCallbackData
 {
@@ -16,57 +19,111 @@ struct ResponseCallbackData
     std::string token;
 };
 
-struct PromptCallbackData
+/**
+ * Delivers tokens from the worker thread to a JS callback in batches. The worker never waits for JS: the first token
+ * schedules a delivery on the main thread, and every token that arrives before it runs is sent along with it, so the
+ * batches grow only while JS is busy. A batched callback receives the whole batch in one call, a per-token callback is
+ * called for each token of it. A JS callback that returns false stops the generation at the next token after its
+ * batch, one that returns nothing continues.
+ */
+class TokenBatcher
 {
-    int32_t tokenId;
+  public:
+    TokenBatcher(Napi::Env env, Napi::Function callback, const char *name, bool withText, bool batched);
+    ~TokenBatcher();
+
+    // called on the worker thread, returns false once JS has asked to stop
+    bool Push(int32_t tokenId, std::string_view token);
+    // called on the main thread to deliver whatever is still pending
+    void Flush(Napi::Env env);
+
+  private:
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<ResponseCallbackData> pending;
+        bool deliveryScheduled = false;
+        std::atomic<bool> stopped = false;
+        bool withText;
+        bool batched;
+    };
+
+    static bool AsksToStop(const Napi::Value &jsResult);
+    static void Deliver(Napi::Env env, Napi::Function jsCallback, State &state);
+
+    std::shared_ptr<State> _state;
+    Napi::ThreadSafeFunction _tsfn;
+    Napi::FunctionReference _callback;
 };
 
-struct LLModelWrapper
+/**
+ * The text that has been fed to a model context so far. The current llmodel API reuses the longest common prefix of
+ * the previous input, so the legacy nPast/promptTemplate/fakeReply options are emulated by rebuilding the transcript.
+ * It is trimmed at a checkpoint once it no longer fits in the context window, as the backend would drop those tokens.
+ *
+ * The session also runs the work on its context one worker at a time. Workers wait in its queue, not on a libuv
+ * thread; use LLModel.createContext() to run prompts concurrently.
+ */
+class PromptSession
 {
-    LLModel *llModel = nullptr;
-    LLModel::PromptContext promptContext;
-    ~LLModelWrapper()
-    {
-        delete llModel;
-    }
+  public:
+    // main thread only: queues the worker now if the context is idle, else once the workers before it are done
+    void Schedule(Napi::AsyncWorker *worker);
+    // main thread only, called by every scheduled worker from OnOK or OnError
+    void Finished();
+
+    // the following are used by the running worker only
+    std::string transcript;
+    // transcript length at each nPast returned to JS, counted from the start of the trimmed transcript
+    std::vector<std::pair<int32_t, size_t>> checkpoints;
+
+    // drops the oldest turns until the transcript holds at most maxTokens of its nPast tokens, or only its last turn,
+    // and returns nPast counted from the new start
+    int32_t Trim(int32_t nPast, int32_t maxTokens);
+
+  private:
+    std::deque<Napi::AsyncWorker *> _pending;
+    bool _busy = false;
 };
 
 struct PromptWorkerConfig
 {
     Napi::Function responseCallback;
     bool hasResponseCallback = false;
+    bool batchedResponseCallback = false; // called with arrays of token ids and texts
     Napi::Function promptCallback;
     bool hasPromptCallback = false;
+    bool batchedPromptCallback = false; // called with an array of token ids
     llmodel_model model;
-    std::mutex *mutex;
+    int32_t nCtx = 0;
+    std::shared_ptr<PromptSession> session;
     std::string prompt;
     std::string promptTemplate;
     llmodel_prompt_context context;
-    std::string result;
-    bool special = false;
-    std::string *fakeReply = nullptr;
+    int32_t nPast = -1; // -1 to continue from the end of the session
+    bool hasFakeReply = false;
+    std::string fakeReply;
 };
 
 class PromptWorker : public Napi::AsyncWorker
 {
   public:
     PromptWorker(Napi::Env env, PromptWorkerConfig config);
-    ~PromptWorker();
     void Execute() override;
     void OnOK() override;
     void OnError(const Napi::Error &e) override;
     Napi::Promise GetPromise();
 
-    bool ResponseCallback(int32_t token_id, const std::string token);
-    bool RecalculateCallback(bool isrecalculating);
-    bool PromptCallback(int32_t token_id);
+    bool ResponseCallback(int32_t token_id, std::string_view token);
+    bool PromptCallback(const int32_t *token_ids, size_t n_token_ids);
 
   private:
     Napi::Promise::Deferred promise;
     std::string result;
+    int32_t nPast = 0;
     PromptWorkerConfig _config;
-    Napi::ThreadSafeFunction _responseCallbackFn;
-    Napi::ThreadSafeFunction _promptCallbackFn;
+    std::unique_ptr<TokenBatcher> _responseBatcher;
+    std::unique_ptr<TokenBatcher> _promptBatcher;
 };
 
 #endif // PREDICT_WORKER_H
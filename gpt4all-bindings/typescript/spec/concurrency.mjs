@@ -1,6 +1,7 @@
 import {
     loadModel,
     createCompletion,
+    InferenceModel,
 } from "../src/gpt4all.js";
 
 const modelOptions = {
@@ -13,6 +14,8 @@ const model1 = await loadModel("orca-mini-3b-gguf2-q4_0.gguf", {
 });
 const model2 = await loadModel("orca-mini-3b-gguf2-q4_0.gguf", modelOptions);
 const model3 = await loadModel("orca-mini-3b-gguf2-q4_0.gguf", modelOptions);
+// a second context shares the weights of model1 instead of loading them again
+const model4 = new InferenceModel(model1.llm.createContext(), model1.config);
 
 const promptContext = {
     verbose: true,
@@ -25,5 +28,6 @@ const responses = await Promise.all([
     // generating with different model instances will run in parallel
     createCompletion(model2, "What is 1 + 2?", promptContext),
     createCompletion(model3, "What is 1 + 3?", promptContext),
+    createCompletion(model4, "What is 1 + 4?", promptContext),
 ]);
 console.log(responses.map((res) => res.choices[0].message));
@@ -16,10 +16,10 @@ const lineReader = readline.createInterface({
     crlfDelay: Infinity
 })
 
-lineReader.on('line', line => {
+lineReader.on('line', async line => {
     //pairs of questions and answers
     const question_answer = JSON.parse(line)
-    console.log(createEmbedding(embedder, question_answer))
+    console.log(await createEmbedding(embedder, question_answer))
 })
 
 lineReader.on('close', () => embedder.dispose())
@@ -169,28 +169,28 @@ interface EmbedddingOptions {
  * @param {EmbeddingModel} model The embedding model instance.
  * @param {string} text Text to embed.
  * @param {EmbeddingOptions} options Optional parameters for the embedding.
- * @returns {EmbeddingResult} The embedding result.
+ * @returns {Promise<EmbeddingResult>} The embedding result.
  * @throws {Error} If dimensionality is set to a value smaller than 1.
  */
 declare function createEmbedding(
     model: EmbeddingModel,
     text: string,
     options?: EmbedddingOptions
-): EmbeddingResult<Float32Array>;
+): Promise<EmbeddingResult<Float32Array>>;
 
 /**
  * Overload that takes multiple strings to embed.
  * @param {EmbeddingModel} model The embedding model instance.
  * @param {string[]} texts Texts to embed.
  * @param {EmbeddingOptions} options Optional parameters for the embedding.
- * @returns {EmbeddingResult<Float32Array[]>} The embedding result.
+ * @returns {Promise<EmbeddingResult<Float32Array[]>>} The embedding result.
  * @throws {Error} If dimensionality is set to a value smaller than 1.
  */
 declare function createEmbedding(
     model: EmbeddingModel,
     text: string[],
     options?: EmbedddingOptions
-): EmbeddingResult<Float32Array[]>;
+): Promise<EmbeddingResult<Float32Array[]>>;
 
 /**
  * The resulting embedding.
@@ -220,7 +220,7 @@ declare class EmbeddingModel {
      * @param {number} dimensionality
      * @param {boolean} doMean
      * @param {boolean} atlas
-     * @returns {EmbeddingResult<Float32Array>} The embedding result.
+     * @returns {Promise<EmbeddingResult<Float32Array>>} The embedding result.
      */
     embed(
         text: string,
@@ -228,7 +228,7 @@ declare class EmbeddingModel {
         dimensionality: number,
         doMean: boolean,
         atlas: boolean
-    ): EmbeddingResult<Float32Array>;
+    ): Promise<EmbeddingResult<Float32Array>>;
     /**
      * Create an embedding from a given input text array. See EmbeddingOptions.
      * @param {string[]} text
@@ -236,7 +236,7 @@ declare class EmbeddingModel {
      * @param {number} dimensionality
      * @param {boolean} doMean
      * @param {boolean} atlas
-     * @returns {EmbeddingResult<Float32Array[]>} The embedding result.
+     * @returns {Promise<EmbeddingResult<Float32Array[]>>} The embedding result.
      */
     embed(
         text: string[],
@@ -244,7 +244,7 @@ declare class EmbeddingModel {
         dimensionality: number,
         doMean: boolean,
         atlas: boolean
-    ): EmbeddingResult<Float32Array[]>;
+    ): Promise<EmbeddingResult<Float32Array[]>>;
 
     /**
      * delete and cleanup the native model
@@ -272,6 +272,17 @@ interface LLModelInferenceOptions extends Partial<LLModelPromptContext> {
      * @returns {boolean | undefined} Whether to continue ingesting the prompt.
      * */
     onPromptToken?: (tokenId: number) => boolean | void;
+    /** Callback for response tokens, called with each batch of generated tokens. Takes precedence over onResponseToken.
+     * @param {number[]} tokenIds The token ids.
+     * @param {string[]} tokens The tokens.
+     * @returns {boolean | undefined} Whether to continue generating tokens.
+     * */
+    onResponseTokens?: (tokenIds: number[], tokens: string[]) => boolean | void;
+    /** Callback for prompt tokens, called with each batch of input tokens. Takes precedence over onPromptToken.
+     * @param {number[]} tokenIds The token ids.
+     * @returns {boolean | undefined} Whether to continue ingesting the prompt.
+     * */
+    onPromptTokens?: (tokenIds: number[]) => boolean | void;
 }
 
 /**
@@ -324,6 +335,13 @@ declare class LLModel {
         options: LLModelInferenceOptions
     ): Promise<LLModelInferenceResult>;
 
+    /**
+     * Create another LLModel that shares the loaded weights but has its own context.
+     * Prompts on one LLModel run one at a time; use separate contexts to run them concurrently.
+     * @returns {LLModel} The new context, which must be disposed separately.
+     */
+    createContext(): LLModel;
+
     /**
      * Embed text with the model. See EmbeddingOptions for more information.
      * Use the higher level createEmbedding methods for a more user-friendly interface.
@@ -332,7 +350,7 @@ declare class LLModel {
      * @param {number} dimensionality
      * @param {boolean} doMean
      * @param {boolean} atlas
-     * @returns {Float32Array} The embedding of the text.
+     * @returns {Promise<EmbeddingResult<Float32Array>>} The embedding of the text.
      */
     embed(
         text: string,
@@ -340,7 +358,7 @@ declare class LLModel {
         dimensionality: number,
         doMean: boolean,
         atlas: boolean
-    ): Float32Array;
+    ): Promise<EmbeddingResult<Float32Array>>;
 
     /**
      * Embed multiple texts with the model. See EmbeddingOptions for more information.
@@ -350,15 +368,15 @@ declare class LLModel {
      * @param {number} dimensionality
      * @param {boolean} doMean
      * @param {boolean} atlas
-     * @returns {Float32Array[]} The embeddings of the texts.
+     * @returns {Promise<EmbeddingResult<Float32Array[]>>} The embeddings of the texts.
      */
     embed(
-        texts: string,
+        texts: string[],
         prefix: string,
         dimensionality: number,
         doMean: boolean,
         atlas: boolean
-    ): Float32Array[];
+    ): Promise<EmbeddingResult<Float32Array[]>>;
 
     /**
      * Whether the model is loaded or not.
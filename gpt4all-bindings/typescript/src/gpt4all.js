@@ -84,7 +84,7 @@ async function loadModel(modelName, options = {}) {
     }
 }
 
-function createEmbedding(model, text, options={}) {
+async function createEmbedding(model, text, options={}) {
     let {
         dimensionality = undefined,
         longTextMode = "mean",
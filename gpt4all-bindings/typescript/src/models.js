@@ -93,36 +93,41 @@ class InferenceModel {
         const result = await this.llm.infer(prompt, {
             ...promptContext,
             nPast,
-            onPromptToken: (tokenId) => {
-                let continueIngestion = true;
-                tokensIngested++;
-                if (options.onPromptToken) {
-                    // catch errors because if they go through cpp they will loose stacktraces
-                    try {
-                        // don't cancel ingestion unless user explicitly returns false
-                        continueIngestion =
-                            options.onPromptToken(tokenId) !== false;
-                    } catch (e) {
-                        console.error("Error in onPromptToken callback", e);
-                        continueIngestion = false;
+            // tokens arrive in batches, one call from native code per batch
+            onPromptTokens: (tokenIds) => {
+                for (const tokenId of tokenIds) {
+                    tokensIngested++;
+                    if (options.onPromptToken) {
+                        // catch errors because if they go through cpp they will loose stacktraces
+                        try {
+                            // don't cancel ingestion unless user explicitly returns false
+                            if (options.onPromptToken(tokenId) === false) {
+                                return false;
+                            }
+                        } catch (e) {
+                            console.error("Error in onPromptToken callback", e);
+                            return false;
+                        }
                     }
                 }
-                return continueIngestion;
+                return true;
             },
-            onResponseToken: (tokenId, token) => {
-                let continueGeneration = true;
-                tokensGenerated++;
-                if (options.onResponseToken) {
-                    try {
-                        // don't cancel the generation unless user explicitly returns false
-                        continueGeneration =
-                            options.onResponseToken(tokenId, token) !== false;
-                    } catch (err) {
-                        console.error("Error in onResponseToken callback", err);
-                        continueGeneration = false;
+            onResponseTokens: (tokenIds, tokens) => {
+                for (let i = 0; i < tokenIds.length; i++) {
+                    tokensGenerated++;
+                    if (options.onResponseToken) {
+                        try {
+                            // don't cancel the generation unless user explicitly returns false
+                            if (options.onResponseToken(tokenIds[i], tokens[i]) === false) {
+                                return false;
+                            }
+                        } catch (err) {
+                            console.error("Error in onResponseToken callback", err);
+                            return false;
+                        }
                     }
                 }
-                return continueGeneration;
+                return true;
             },
         });
 
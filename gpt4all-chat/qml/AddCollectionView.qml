@@ -89,10 +89,17 @@ Rectangle {
             property alias collection: collection.text
             property alias folder_path: folderEdit.text
 
+            property alias snapshot_path: snapshotEdit.text
+
             MyFolderDialog {
                 id: folderDialog
             }
 
+            MyFileDialog {
+                id: snapshotDialog
+                nameFilters: [qsTr("LocalDocs snapshots (*.localdocs)"), qsTr("All files (*)")]
+            }
+
             Label {
                 Layout.row: 2
                 Layout.column: 0
@@ -170,8 +177,48 @@ Rectangle {
                 }
             }
 
-            MyButton {
+            Label {
                 Layout.row: 4
+                Layout.column: 0
+                text: qsTr("Snapshot")
+                font.bold: true
+                font.pixelSize: theme.fontSizeLarger
+                color: theme.settingsTitleTextColor
+            }
+
+            RowLayout {
+                Layout.row: 4
+                Layout.column: 1
+                Layout.minimumWidth: 400
+                Layout.maximumWidth: 400
+                Layout.alignment: Qt.AlignRight
+                spacing: 10
+                MyTextField {
+                    id: snapshotEdit
+                    Layout.fillWidth: true
+                    color: theme.textColor
+                    font.pixelSize: theme.fontSizeLarge
+                    placeholderText: qsTr("Snapshot path...")
+                    placeholderTextColor: theme.mutedTextColor
+                    ToolTip.text: qsTr("Exported index of the same documents to import instead of indexing the folder from scratch (Optional)")
+                    ToolTip.visible: hovered
+                    Accessible.role: Accessible.EditableText
+                    Accessible.name: snapshotEdit.text
+                    Accessible.description: ToolTip.text
+                }
+
+                MySettingsButton {
+                    text: qsTr("Browse")
+                    onClicked: {
+                        snapshotDialog.openFileDialog(StandardPaths.writableLocation(StandardPaths.HomeLocation), function(selectedFile) {
+                            root.snapshot_path = selectedFile
+                        })
+                    }
+                }
+            }
+
+            MyButton {
+                Layout.row: 5
                 Layout.column: 1
                 Layout.alignment: Qt.AlignRight
                 text: qsTr("Create Collection")
@@ -187,9 +234,13 @@ Rectangle {
                     }
                     if (isError)
                         return;
-                    LocalDocs.addFolder(root.collection, root.folder_path)
+                    if (root.snapshot_path !== "")
+                        LocalDocs.importCollection(root.snapshot_path, root.collection, root.folder_path)
+                    else
+                        LocalDocs.addFolder(root.collection, root.folder_path)
                     root.collection = ""
                     root.folder_path = ""
+                    root.snapshot_path = ""
                     collection.clear()
                     localDocsViewRequested()
                 }
@@ -67,10 +67,11 @@ MySettingsTab {
                     // normalize and deduplicate
                     exts = exts.map(e => e.toLowerCase());
                     exts = Array.from(new Set(exts));
-                    /* Blacklist common unsupported file extensions. We only support plain text and PDFs, and although we
-                     * reject binary data, we don't want to waste time trying to index files that we don't support. */
+                    /* Blacklist common unsupported file extensions. We only support plain text, PDFs, and Word and Excel
+                     * documents, and although we reject binary data, we don't want to waste time trying to index files
+                     * that we don't support. */
                     exts = exts.filter(e => ![
-                        /* Microsoft documents  */ "rtf", "ppt", "pptx", "xls", "xlsx",
+                        /* Microsoft documents  */ "rtf", "ppt", "pptx", "xls",
                         /* OpenOffice           */ "odt", "ods", "odp", "odg",
                         /* photos               */ "jpg", "jpeg", "png", "gif", "bmp", "tif", "tiff", "webp",
                         /* audio                */ "mp3", "wma", "m4a", "wav", "flac",
@@ -202,6 +203,79 @@ MySettingsTab {
             }
         }
 
+        RowLayout {
+            MySettingsLabel {
+                id: embedWorkersLabel
+                text: qsTr("Embedding Workers")
+                helpText: qsTr("Number of document snippet batches embedded in parallel by the local model. The workers share one copy of the model, each has its own context and a share of the CPU threads. Requires restart.")
+            }
+            MyTextField {
+                id: embedWorkersField
+                enabled: !useNomicAPIBox.checked
+                text: MySettings.localDocsEmbedWorkers
+                color: theme.textColor
+                font.pixelSize: theme.fontSizeLarge
+                Layout.alignment: Qt.AlignRight
+                Layout.minimumWidth: 200
+                validator: IntValidator {
+                    bottom: 1
+                    top: 16
+                }
+                onEditingFinished: {
+                    var val = parseInt(text)
+                    if (!isNaN(val)) {
+                        MySettings.localDocsEmbedWorkers = val
+                        focus = false
+                    } else {
+                        text = MySettings.localDocsEmbedWorkers
+                    }
+                }
+                Accessible.role: Accessible.EditableText
+                Accessible.name: embedWorkersLabel.text
+                Accessible.description: embedWorkersLabel.helpText
+            }
+        }
+
+        RowLayout {
+            MySettingsLabel {
+                id: quantizationLabel
+                text: qsTr("Search Compression")
+                helpText: qsTr("Search a compressed copy of the embeddings first and rescore the best matches exactly. Reduces memory use per search on large collections at a small cost in accuracy.")
+            }
+            MyComboBox {
+                id: quantizationBox
+                Layout.minimumWidth: 400
+                Layout.maximumWidth: 400
+                Layout.fillWidth: false
+                Layout.alignment: Qt.AlignRight
+                // These values should not be translated
+                readonly property var values: ["None", "Int8", "Binary"]
+                model: [qsTr("None"), qsTr("8-bit"), qsTr("1-bit")]
+                currentIndex: Math.max(0, values.indexOf(MySettings.localDocsVectorQuantization))
+                Accessible.name: quantizationLabel.text
+                Accessible.description: quantizationLabel.helpText
+                onActivated: {
+                    MySettings.localDocsVectorQuantization = values[quantizationBox.currentIndex];
+                }
+            }
+        }
+
+        RowLayout {
+            visible: LocalDocs.chunkCompressionAvailable
+            MySettingsLabel {
+                id: compressChunksLabel
+                text: qsTr("Compress Snippets")
+                helpText: qsTr("Store the text of document snippets compressed, to keep the database of large collections small. Snippets that are already compressed stay compressed when this is turned off.")
+            }
+            MyCheckBox {
+                id: compressChunksBox
+                checked: MySettings.localDocsCompressChunks
+                onClicked: {
+                    MySettings.localDocsCompressChunks = !MySettings.localDocsCompressChunks
+                }
+            }
+        }
+
         ColumnLayout {
             spacing: 10
             Label {
@@ -286,6 +360,36 @@ MySettingsTab {
             }
         }
 
+        RowLayout {
+            Layout.topMargin: 15
+            MySettingsLabel {
+                id: chunkTokensLabel
+                Layout.fillWidth: true
+                text: qsTr("Document snippet size (tokens)")
+                helpText: qsTr("Number of embedding model tokens per document snippet, filled with whole words. Fewer, fuller snippets are faster to embed. Requires a local embedding model; 0 uses the size in characters.")
+            }
+
+            MyTextField {
+                id: chunkTokensTextField
+                text: MySettings.localDocsChunkTokens
+                validator: IntValidator {
+                    bottom: 0
+                }
+                onEditingFinished: {
+                    var val = parseInt(text)
+                    if (!isNaN(val)) {
+                        MySettings.localDocsChunkTokens = val
+                        focus = false
+                    } else {
+                        text = MySettings.localDocsChunkTokens
+                    }
+                }
+                Accessible.role: Accessible.EditableText
+                Accessible.name: chunkTokensLabel.text
+                Accessible.description: chunkTokensLabel.helpText
+            }
+        }
+
         RowLayout {
             Layout.topMargin: 15
             MySettingsLabel {
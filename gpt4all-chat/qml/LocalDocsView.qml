@@ -3,6 +3,7 @@ import QtQuick
 import QtQuick.Controls
 import QtQuick.Controls.Basic
 import QtQuick.Layouts
+import QtQuick.Dialogs
 import Qt5Compat.GraphicalEffects
 import llm
 import chatlistmodel
@@ -26,6 +27,29 @@ Rectangle {
     signal settingsViewRequested(int page)
     signal addCollectionViewRequested()
 
+    ToastManager {
+        id: messageToast
+    }
+
+    MyFileDialog {
+        id: exportDialog
+        fileMode: FileDialog.SaveFile
+        defaultSuffix: "localdocs"
+        nameFilters: [qsTr("LocalDocs snapshots (*.localdocs)")]
+    }
+
+    Connections {
+        target: LocalDocs
+        function onCollectionExported(collection, error) {
+            messageToast.show(error === "" ? qsTr("Exported %1").arg(collection)
+                                           : qsTr("ERROR: Cannot export %1: %2").arg(collection).arg(error));
+        }
+        function onCollectionImported(collection, error) {
+            if (error !== "")
+                messageToast.show(qsTr("ERROR: Cannot import %1: %2").arg(collection).arg(error));
+        }
+    }
+
     ColumnLayout {
         id: mainArea
         anchors.left: parent.left
@@ -414,6 +438,21 @@ Rectangle {
                             Item {
                                 Layout.fillWidth: true
                             }
+                            MySettingsButton {
+                                id: exportButton
+                                visible: !model.forceIndexing && !model.indexing && model.currentEmbeddingsToIndex === 0
+                                text: qsTr("Export")
+                                textColor: theme.green500
+                                onClicked: {
+                                    exportDialog.openFileDialog(StandardPaths.writableLocation(StandardPaths.DocumentsLocation), function(selectedFile) {
+                                        // compressed search implies that 8-bit embeddings are accurate enough
+                                        LocalDocs.exportCollection(collection, selectedFile, MySettings.localDocsVectorQuantization !== "None")
+                                    })
+                                }
+                                toolTip: qsTr("Save the index of this collection to a snapshot that can be imported on another computer.")
+                                backgroundColor: "transparent"
+                                backgroundColorHovered: theme.lighterButtonBackgroundHovered
+                            }
                             MySettingsButton {
                                 id: rebuildButton
                                 visible: !model.forceIndexing && !model.indexing && model.currentEmbeddingsToIndex === 0
@@ -181,9 +181,10 @@ ChatLLM::ChatLLM(Chat *parent, bool isServer)
     connect(MySettings::globalInstance(), &MySettings::forceMetalChanged, this, &ChatLLM::handleForceMetalChanged);
     connect(MySettings::globalInstance(), &MySettings::deviceChanged, this, &ChatLLM::handleDeviceChanged);
 
-    // The following are blocking operations and will block the llm thread
+    // The following are blocking operations and will block the llm thread. Retrieval runs on the database's reader
+    // connections, so it does not wait for the database thread.
     connect(this, &ChatLLM::requestRetrieveFromDB, LocalDocs::globalInstance()->database(), &Database::retrieveFromDB,
-        Qt::BlockingQueuedConnection);
+        Qt::DirectConnection);
 
     m_llmThread.setObjectName(parent->id());
     m_llmThread.start();
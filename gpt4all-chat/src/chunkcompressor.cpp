@@ -0,0 +1,192 @@
+#include "chunkcompressor.h"
+
+#if defined(GPT4ALL_USE_ZSTD)
+#   include <zdict.h>
+#   include <zstd.h>
+#endif
+
+#include <QDebug>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QtLogging>
+
+#include <vector>
+
+
+#if defined(GPT4ALL_USE_ZSTD)
+
+static constexpr size_t s_dictionaryCapacity = 64 * 1024; // bytes, dictionaries are kept in memory by every reader
+static constexpr int    s_compressionLevel   = 12;        // chunks are compressed once and read many times
+static constexpr size_t s_maxTextSize        = 16 * 1024 * 1024; // bytes, a larger frame is not one of ours
+
+struct ChunkCompressor::Dictionary {
+    ZSTD_CDict *cdict = nullptr;
+    ZSTD_DDict *ddict = nullptr;
+
+    ~Dictionary()
+    {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+    }
+};
+
+// contexts are reused by each thread, they are too large to allocate per chunk
+namespace {
+    struct ZstdContexts {
+        ZSTD_CCtx *cctx = ZSTD_createCCtx();
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+
+        ~ZstdContexts()
+        {
+            ZSTD_freeCCtx(cctx);
+            ZSTD_freeDCtx(dctx);
+        }
+    };
+} // namespace
+
+static ZstdContexts &zstdContexts()
+{
+    thread_local ZstdContexts contexts;
+    return contexts;
+}
+
+#else
+
+struct ChunkCompressor::Dictionary {};
+
+#endif // GPT4ALL_USE_ZSTD
+
+ChunkCompressor::ChunkCompressor() = default;
+ChunkCompressor::~ChunkCompressor() = default;
+
+bool ChunkCompressor::isAvailable()
+{
+#if defined(GPT4ALL_USE_ZSTD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+QByteArray ChunkCompressor::trainDictionary(const QList<QByteArray> &samples)
+{
+#if defined(GPT4ALL_USE_ZSTD)
+    // zdict takes the samples concatenated, with their sizes alongside
+    QByteArray buffer;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    for (const QByteArray &sample: samples) {
+        buffer.append(sample);
+        sizes.push_back(size_t(sample.size()));
+    }
+
+    QByteArray dictionary(s_dictionaryCapacity, Qt::Uninitialized);
+    size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), buffer.constData(), sizes.data(),
+                                        unsigned(sizes.size()));
+    if (ZDICT_isError(size)) {
+        qWarning() << "ChunkCompressor ERROR: failed to train dictionary:" << ZDICT_getErrorName(size);
+        return {};
+    }
+    dictionary.truncate(qsizetype(size));
+    return dictionary;
+#else
+    Q_UNUSED(samples);
+    return {};
+#endif
+}
+
+quint32 ChunkCompressor::dictionaryId(const QByteArray &dictionary)
+{
+#if defined(GPT4ALL_USE_ZSTD)
+    return ZDICT_getDictID(dictionary.constData(), dictionary.size());
+#else
+    Q_UNUSED(dictionary);
+    return 0;
+#endif
+}
+
+bool ChunkCompressor::hasDictionary(quint32 id) const
+{
+    QReadLocker locker(&m_lock);
+    return m_dictionaries.contains(id);
+}
+
+bool ChunkCompressor::addDictionary(const QByteArray &dictionary)
+{
+#if defined(GPT4ALL_USE_ZSTD)
+    const quint32 id = dictionaryId(dictionary);
+    if (!id)
+        return false;
+
+    auto dict = std::make_shared<Dictionary>();
+    dict->cdict = ZSTD_createCDict(dictionary.constData(), dictionary.size(), s_compressionLevel);
+    dict->ddict = ZSTD_createDDict(dictionary.constData(), dictionary.size());
+    if (!dict->cdict || !dict->ddict) {
+        qWarning() << "ChunkCompressor ERROR: failed to load dictionary" << id;
+        return false;
+    }
+
+    QWriteLocker locker(&m_lock);
+    m_dictionaries.insert(id, std::move(dict));
+    return true;
+#else
+    Q_UNUSED(dictionary);
+    return false;
+#endif
+}
+
+QByteArray ChunkCompressor::compress(quint32 id, QStringView text) const
+{
+#if defined(GPT4ALL_USE_ZSTD)
+    std::shared_ptr<Dictionary> dict;
+    {
+        QReadLocker locker(&m_lock);
+        dict = m_dictionaries.value(id);
+    }
+    if (!dict)
+        return {};
+
+    // the frame records the size of the text and the id of the dictionary
+    const QByteArray utf8 = text.toUtf8();
+    QByteArray frame(qsizetype(ZSTD_compressBound(utf8.size())), Qt::Uninitialized);
+    size_t size = ZSTD_compress_usingCDict(zstdContexts().cctx, frame.data(), frame.size(), utf8.constData(),
+                                           utf8.size(), dict->cdict);
+    if (ZSTD_isError(size)) {
+        qWarning() << "ChunkCompressor ERROR: failed to compress chunk:" << ZSTD_getErrorName(size);
+        return {};
+    }
+    frame.truncate(qsizetype(size));
+    return frame;
+#else
+    Q_UNUSED(id);
+    Q_UNUSED(text);
+    return {};
+#endif
+}
+
+std::optional<QString> ChunkCompressor::decompress(QByteArrayView frame) const
+{
+#if defined(GPT4ALL_USE_ZSTD)
+    std::shared_ptr<Dictionary> dict;
+    {
+        QReadLocker locker(&m_lock);
+        dict = m_dictionaries.value(ZSTD_getDictID_fromFrame(frame.data(), frame.size()));
+    }
+    if (!dict)
+        return std::nullopt;
+
+    const unsigned long long size = ZSTD_getFrameContentSize(frame.data(), frame.size());
+    if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || size > s_maxTextSize)
+        return std::nullopt;
+
+    QByteArray utf8(qsizetype(size), Qt::Uninitialized);
+    size_t n = ZSTD_decompress_usingDDict(zstdContexts().dctx, utf8.data(), utf8.size(), frame.data(), frame.size(),
+                                          dict->ddict);
+    if (ZSTD_isError(n) || n != size)
+        return std::nullopt;
+    return QString::fromUtf8(utf8);
+#else
+    Q_UNUSED(frame);
+    return std::nullopt;
+#endif
+}
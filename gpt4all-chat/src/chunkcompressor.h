@@ -0,0 +1,51 @@
+#ifndef CHUNKCOMPRESSOR_H
+#define CHUNKCOMPRESSOR_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QHash>
+#include <QList>
+#include <QReadWriteLock>
+#include <QString>
+#include <QStringView>
+#include <QtGlobal>
+
+#include <memory>
+#include <optional>
+
+
+/* Compresses chunk text with zstd, using dictionaries trained on the chunks of a collection. A chunk is a few hundred
+ * characters, too short for zstd to find much to reuse within it; a dictionary of the phrases that are common in the
+ * collection recovers most of the ratio of compressing the collection as a whole. Every frame records the id of its
+ * dictionary, so a chunk can be decompressed without knowing which collection it was compressed for.
+ *
+ * Dictionaries are added by the database thread and used by the readers too, all methods are thread-safe. Without
+ * zstd, isAvailable() is false and nothing can be compressed. */
+class ChunkCompressor {
+public:
+    ChunkCompressor();
+    ~ChunkCompressor();
+
+    static bool isAvailable();
+
+    // returns an empty array if there are too few samples or training fails
+    static QByteArray trainDictionary(const QList<QByteArray> &samples);
+    // the id zstd assigned to a trained dictionary, 0 if it is not one
+    static quint32 dictionaryId(const QByteArray &dictionary);
+
+    bool hasDictionary(quint32 id) const;
+    bool addDictionary(const QByteArray &dictionary);
+
+    // returns an empty array on failure
+    QByteArray compress(quint32 id, QStringView text) const;
+    // returns std::nullopt if the frame is corrupt or its dictionary was not added
+    std::optional<QString> decompress(QByteArrayView frame) const;
+
+private:
+    struct Dictionary;
+
+    mutable QReadWriteLock                      m_lock;
+    QHash<quint32, std::shared_ptr<Dictionary>> m_dictionaries;
+};
+
+#endif // CHUNKCOMPRESSOR_H
@@ -0,0 +1,923 @@
+#include "chunkstreamer.h"
+
+#include "textscan.h"
+#include "xlsxtomd.h"
+
+#include <duckx/duckx.hpp> // IWYU pragma: keep (zip API)
+#include <fmt/format.h>
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFile>
+#include <QIODevice>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker> // IWYU pragma: keep
+#include <QPdfDocument>
+#include <QPdfSelection>
+#include <QStringConverter>
+#include <QStringDecoder>
+#include <QTextStream>
+#include <QWaitCondition>
+#include <QXmlStreamReader>
+#include <Qt>
+#include <QtLogging>
+
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+
+/* QFile that checks input for binary data. If seen, it fails the read and returns true
+ * for binarySeen(). */
+class BinaryDetectingFile: public QFile {
+public:
+    using QFile::QFile;
+
+    bool binarySeen() const { return m_binarySeen; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override {
+        qint64 res = QFile::readData(data, maxSize);
+        return checkData(data, res);
+    }
+
+    qint64 readLineData(char *data, qint64 maxSize) override {
+        qint64 res = QFile::readLineData(data, maxSize);
+        return checkData(data, res);
+    }
+
+private:
+    qint64 checkData(const char *data, qint64 size) {
+        Q_ASSERT(!isTextModeEnabled()); // We need raw bytes from the underlying QFile
+        if (size != -1 && !m_binarySeen)
+            m_binarySeen = TextScan::containsBinary(data, size);
+        return m_binarySeen ? -1 : size;
+    }
+
+    bool m_binarySeen = false;
+};
+
+} // namespace
+
+static constexpr size_t    s_pdfPagesAhead       = 8;  // PDF pages extracted ahead of the chunker
+static constexpr size_t    s_textPiecesAhead     = 16; // pieces of Word or Excel text parsed ahead of the chunker
+static constexpr qsizetype s_textPieceSize       = 4096; // characters
+static constexpr qsizetype s_maxCachedWordTokens = 65536; // token counts of distinct words kept per document
+
+// identifies unchanged documents and chunks when a document is indexed again
+static QByteArray textHash(const QString &text)
+{
+    auto data = QByteArrayView(reinterpret_cast<const char *>(text.utf16()), text.size() * sizeof(char16_t));
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+}
+
+class DocumentReader {
+public:
+    using Metadata = DocumentMetadata;
+
+    static std::unique_ptr<DocumentReader> fromDocument(const DocumentInfo &info);
+
+    const DocumentInfo           &doc     () const { return *m_info; }
+    const Metadata               &metadata() const { return m_metadata; }
+    // the current word, valid until nextWord()
+    const std::optional<QStringView> &word    () const { return m_word; }
+    const std::optional<QStringView> &nextWord()       { m_word = advance(); return m_word; }
+    virtual std::optional<ChunkStreamer::Status> getError() const { return std::nullopt; }
+    virtual int page() const { return -1; }
+
+    virtual ~DocumentReader() = default;
+
+protected:
+    explicit DocumentReader(const DocumentInfo &info)
+        : m_info(&info) {}
+
+    void postInit(Metadata &&metadata = {})
+    {
+        m_metadata = std::move(metadata);
+        m_word = advance();
+    }
+
+    // returns the next word, which must stay valid until the next call
+    virtual std::optional<QStringView> advance() = 0;
+
+    const DocumentInfo         *m_info;
+    Metadata                    m_metadata;
+    std::optional<QStringView>  m_word;
+};
+
+namespace {
+
+/* Runs a producer on a thread of its own that hands text to a reader in order, at most a few pieces ahead. Reading
+ * the document then overlaps with chunking, and memory stays bounded whatever the size of the document. */
+class TextPrefetcher {
+public:
+    // the producer returns false if the document could not be read
+    using Producer = std::function<bool(TextPrefetcher &)>;
+
+    explicit TextPrefetcher(size_t maxAhead)
+        : m_maxAhead(maxAhead) {}
+
+    ~TextPrefetcher() { stop(); }
+
+    void start(Producer producer)
+    {
+        m_thread = std::thread([this, producer = std::move(producer)] {
+            bool ok = producer(*this);
+            QMutexLocker locker(&m_mutex);
+            m_failed = !ok && !m_stopping;
+            m_finished = true;
+            m_textAvailable.wakeAll();
+        });
+    }
+
+    void stop()
+    {
+        if (!m_thread.joinable())
+            return;
+        {
+            QMutexLocker locker(&m_mutex);
+            m_stopping = true;
+            m_spaceAvailable.wakeAll();
+        }
+        m_thread.join();
+    }
+
+    // called by the producer, returns false once the reader is gone
+    bool push(QString text)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!m_stopping && m_texts.size() >= m_maxAhead)
+            m_spaceAvailable.wait(locker.mutex());
+        if (m_stopping)
+            return false;
+        m_texts.push_back(std::move(text));
+        m_textAvailable.wakeOne();
+        return true;
+    }
+
+    // the next piece of text, or nullopt once the producer is done
+    std::optional<QString> take()
+    {
+        QMutexLocker locker(&m_mutex);
+        while (m_texts.empty() && !m_finished)
+            m_textAvailable.wait(locker.mutex());
+        if (m_texts.empty())
+            return std::nullopt;
+        QString text = std::move(m_texts.front());
+        m_texts.pop_front();
+        m_spaceAvailable.wakeOne();
+        return text;
+    }
+
+    bool failed() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_failed;
+    }
+
+private:
+    const size_t        m_maxAhead;
+    std::thread         m_thread;
+    mutable QMutex      m_mutex; // guards the members below
+    QWaitCondition      m_textAvailable;
+    QWaitCondition      m_spaceAvailable;
+    std::deque<QString> m_texts;
+    bool                m_stopping = false;
+    bool                m_finished = false;
+    bool                m_failed = false;
+};
+
+/* The text of each page is extracted by a TextPrefetcher, a few pages ahead of the chunker. More extraction threads
+ * would not help: QtPdf serializes all calls into PDFium. */
+class PdfDocumentReader final : public DocumentReader {
+public:
+    explicit PdfDocumentReader(const DocumentInfo &info)
+        : DocumentReader(info)
+    {
+        QString path = info.file.canonicalFilePath();
+        if (m_doc.load(path) != QPdfDocument::Error::None)
+            throw std::runtime_error(fmt::format("Failed to load PDF: {}", path));
+        Metadata metadata {
+            .title    = m_doc.metaData(QPdfDocument::MetaDataField::Title   ).toString(),
+            .author   = m_doc.metaData(QPdfDocument::MetaDataField::Author  ).toString(),
+            .subject  = m_doc.metaData(QPdfDocument::MetaDataField::Subject ).toString(),
+            .keywords = m_doc.metaData(QPdfDocument::MetaDataField::Keywords).toString(),
+        };
+        m_pages.start([this](TextPrefetcher &pages) {
+            for (int page = 0, count = m_doc.pageCount(); page < count; page++) {
+                if (!pages.push(m_doc.getAllText(page).text()))
+                    break;
+            }
+            return true;
+        });
+        postInit(std::move(metadata));
+    }
+
+    int page() const override { return m_currentPage; }
+
+private:
+    std::optional<QStringView> advance() override
+    {
+        do {
+            while (!m_stream || m_stream->atEnd()) {
+                auto text = m_pages.take();
+                if (!text)
+                    return std::nullopt;
+                m_pageText = std::move(*text);
+                m_currentPage++;
+                m_stream.emplace(&m_pageText);
+            }
+            *m_stream >> m_currentWord;
+        } while (m_currentWord.isEmpty());
+        return m_currentWord;
+    }
+
+    QPdfDocument               m_doc;
+    int                        m_currentPage = 0; // pages taken by the chunker
+    QString                    m_pageText;
+    QString                    m_currentWord;
+    std::optional<QTextStream> m_stream;
+    TextPrefetcher             m_pages { s_pdfPagesAhead }; // stopped before the document is destroyed
+};
+
+/* Parses one XML part of a zip archive as it is inflated, without holding the part in memory. The handler is called
+ * for each token and returns false to stop early. Returns false if the part is missing or is not valid XML. */
+template <typename Handler>
+static bool parseZipXml(zip_t *zip, const char *part, Handler &&handler)
+{
+    if (zip_entry_open(zip, part) < 0)
+        return false;
+
+    struct State {
+        QXmlStreamReader xml;
+        Handler         &handler;
+        bool             stopped = false;
+    } state { {}, handler };
+
+    // a generic lambda converts to the callback type, whichever integer type this version of the API uses for offsets
+    auto onExtract = [](void *arg, auto /*offset*/, const void *data, size_t size) -> size_t {
+        auto &state = *static_cast<State *>(arg);
+        state.xml.addData(QByteArray(static_cast<const char *>(data), qsizetype(size)));
+        for (;;) {
+            auto token = state.xml.readNext();
+            if (token == QXmlStreamReader::Invalid)
+                return state.xml.error() == QXmlStreamReader::PrematureEndOfDocumentError ? size : 0;
+            if (!state.handler(state.xml)) {
+                state.stopped = true;
+                return 0; // aborts the extraction
+            }
+            if (token == QXmlStreamReader::EndDocument)
+                return size;
+        }
+    };
+    zip_entry_extract(zip, onExtract, &state);
+    zip_entry_close(zip);
+
+    if (state.stopped)
+        return true;
+    if (state.xml.hasError())
+        qWarning() << "LocalDocs ERROR: cannot parse" << part << state.xml.errorString();
+    return state.xml.tokenType() == QXmlStreamReader::EndDocument;
+}
+
+/* Reads the text of an Office Open XML document (a zip archive of XML parts) straight out of the archive: the parts
+ * are parsed by a TextPrefetcher as they are inflated, and the reader splits the text it hands over into words. */
+class OfficeDocumentReader : public DocumentReader {
+protected:
+    explicit OfficeDocumentReader(const DocumentInfo &info)
+        : DocumentReader(info)
+    {
+        QString path = info.file.canonicalFilePath();
+        m_zip.reset(zip_open(QFile::encodeName(path).constData(), 0, 'r'));
+        if (!m_zip)
+            throw std::runtime_error(fmt::format("Failed to open {}", path));
+    }
+
+    // the archive is read on the prefetcher thread from now on
+    void startReading(TextPrefetcher::Producer producer)
+    {
+        m_text.start(std::move(producer));
+        postInit();
+    }
+
+    /* The producer reads the members of the derived reader, so each derived reader stops it in its destructor:
+     * m_text itself is only destroyed after them, and a document can be dropped before it has been read. */
+    void stopReading() { m_text.stop(); }
+
+    zip_t *zip() const { return m_zip.get(); }
+
+    std::optional<ChunkStreamer::Status> getError() const override
+    {
+        if (m_text.failed())
+            return ChunkStreamer::Status::ERROR;
+        return std::nullopt;
+    }
+
+    std::optional<QStringView> advance() override
+    {
+        // find non-space char
+        qsizetype wordStart = 0;
+        while (m_buffer.isEmpty() || m_buffer[wordStart].isSpace()) {
+            if (m_buffer.isEmpty() && !fillBuffer())
+                return std::nullopt;
+            if (m_buffer[wordStart].isSpace() && ++wordStart >= m_buffer.size()) {
+                m_buffer.clear();
+                wordStart = 0;
+            }
+        }
+
+        // find space char
+        qsizetype wordEnd = wordStart + 1;
+        while (wordEnd >= m_buffer.size() || !m_buffer[wordEnd].isSpace()) {
+            if (wordEnd >= m_buffer.size() && !fillBuffer())
+                break;
+            if (!m_buffer[wordEnd].isSpace())
+                ++wordEnd;
+        }
+
+        if (wordStart == wordEnd)
+            return std::nullopt;
+
+        auto size = wordEnd - wordStart;
+        m_currentWord = std::move(m_buffer);
+        m_buffer = m_currentWord.sliced(wordStart + size);
+        if (wordStart == 0)
+            m_currentWord.resize(size);
+        else
+            m_currentWord = m_currentWord.sliced(wordStart, size);
+        return m_currentWord;
+    }
+
+    bool fillBuffer()
+    {
+        for (;;) {
+            auto text = m_text.take();
+            if (!text)
+                return false;
+            if (!text->isEmpty()) {
+                m_buffer += *text;
+                return true;
+            }
+        }
+    }
+
+private:
+    struct ZipCloser { void operator()(zip_t *zip) const { zip_close(zip); } };
+
+    std::unique_ptr<zip_t, ZipCloser> m_zip;
+    QString                           m_buffer;
+    QString                           m_currentWord;
+    TextPrefetcher                    m_text { s_textPiecesAhead }; // stopped before the archive is closed
+};
+
+class WordDocumentReader final : public OfficeDocumentReader {
+public:
+    explicit WordDocumentReader(const DocumentInfo &info)
+        : OfficeDocumentReader(info)
+    {
+        // TODO(jared): metadata for Word documents?
+        startReading([this](TextPrefetcher &out) { return readBody(out); });
+    }
+
+    ~WordDocumentReader() override { stopReading(); }
+
+private:
+    bool readBody(TextPrefetcher &out)
+    {
+        QString text;
+        bool inText = false;
+        bool ok = parseZipXml(zip(), "word/document.xml", [&](QXmlStreamReader &xml) {
+            switch (xml.tokenType()) {
+            case QXmlStreamReader::StartElement:
+                if (xml.name() == "t"_L1) {
+                    inText = true;
+                } else if (xml.name() == "br"_L1 || xml.name() == "cr"_L1) {
+                    text += u'\n';
+                } else if (xml.name() == "tab"_L1) {
+                    text += u'\t';
+                }
+                break;
+            case QXmlStreamReader::EndElement:
+                if (xml.name() == "t"_L1) {
+                    inText = false;
+                } else if (xml.name() == "p"_L1) {
+                    text += u'\n';
+                }
+                break;
+            case QXmlStreamReader::Characters:
+                if (inText)
+                    text += xml.text();
+                break;
+            default:
+                ;
+            }
+            return text.size() < s_textPieceSize || out.push(std::exchange(text, {}));
+        });
+        if (!text.isEmpty())
+            out.push(std::move(text));
+        return ok;
+    }
+};
+
+/* Excel workbooks are read as one markdown table per sheet, like XLSXToMD does for attachments but a row at a time.
+ * Only the shared strings are kept in memory, as cells refer to them by index. */
+class ExcelDocumentReader final : public OfficeDocumentReader {
+public:
+    explicit ExcelDocumentReader(const DocumentInfo &info)
+        : OfficeDocumentReader(info)
+    {
+        if (!readSheetList())
+            throw std::runtime_error(fmt::format("Failed to read workbook: {}", info.file.canonicalFilePath()));
+        readSharedStrings();
+        startReading([this](TextPrefetcher &out) { return readSheets(out); });
+    }
+
+    ~ExcelDocumentReader() override { stopReading(); }
+
+private:
+    struct Sheet { QString name; QByteArray part; };
+
+    // the names of the sheets in workbook order, and the parts they are stored in
+    bool readSheetList()
+    {
+        QHash<QString, QString> targets; // by relationship id
+        bool ok = parseZipXml(zip(), "xl/_rels/workbook.xml.rels", [&](QXmlStreamReader &xml) {
+            if (xml.isStartElement() && xml.name() == "Relationship"_L1) {
+                auto attrs = xml.attributes();
+                targets.insert(attrs.value("Id"_L1).toString(), attrs.value("Target"_L1).toString());
+            }
+            return true;
+        });
+        ok = ok && parseZipXml(zip(), "xl/workbook.xml", [&](QXmlStreamReader &xml) {
+            if (xml.isStartElement() && xml.name() == "sheet"_L1) {
+                QString name, target;
+                for (const auto &attr: xml.attributes()) {
+                    if (attr.name() == "name"_L1)
+                        name = attr.value().toString();
+                    else if (attr.name() == "id"_L1) // r:id
+                        target = targets.value(attr.value().toString());
+                }
+                if (!target.isEmpty()) {
+                    // relative to the workbook, unless absolute
+                    QString part = target.startsWith(u'/') ? target.sliced(1) : u"xl/"_s + target;
+                    m_sheets.append({ name, part.toUtf8() });
+                }
+            }
+            return true;
+        });
+        return ok;
+    }
+
+    void readSharedStrings()
+    {
+        QString current;
+        int textDepth = 0, phoneticDepth = 0;
+        // optional, a workbook without text cells has none
+        parseZipXml(zip(), "xl/sharedStrings.xml", [&](QXmlStreamReader &xml) {
+            if (xml.isStartElement()) {
+                if (xml.name() == "si"_L1)
+                    current.clear();
+                else if (xml.name() == "t"_L1)
+                    textDepth++;
+                else if (xml.name() == "rPh"_L1)
+                    phoneticDepth++; // pronunciation hints, not part of the text
+            } else if (xml.isEndElement()) {
+                if (xml.name() == "si"_L1)
+                    m_sharedStrings << std::exchange(current, {});
+                else if (xml.name() == "t"_L1)
+                    textDepth--;
+                else if (xml.name() == "rPh"_L1)
+                    phoneticDepth--;
+            } else if (xml.isCharacters() && textDepth && !phoneticDepth) {
+                current += xml.text();
+            }
+            return true;
+        });
+    }
+
+    bool readSheets(TextPrefetcher &out)
+    {
+        for (const auto &sheet: std::as_const(m_sheets)) {
+            if (!readSheet(out, sheet))
+                return false;
+        }
+        return true;
+    }
+
+    // 1-based column of a cell reference such as "AB12"
+    static int columnOf(QStringView ref)
+    {
+        int col = 0;
+        for (QChar c: ref) {
+            if (c < u'A' || c > u'Z')
+                break;
+            col = col * 26 + (c.unicode() - u'A' + 1);
+        }
+        return col;
+    }
+
+    bool readSheet(TextPrefetcher &out, const Sheet &sheet)
+    {
+        QString text = u"### %1\n\n"_s.arg(sheet.name);
+        // columns from the dimension of the sheet; without one, from column A to the last column seen so far
+        int firstCol = 0, lastCol = 0;
+        bool bounded = false;
+        bool hasRows = false;
+        QMap<int, QString> row; // cell text by column
+        int col = 0;
+        QString type, value;
+        bool inValue = false;
+
+        auto appendRow = [&] {
+            if (row.isEmpty())
+                return;
+            if (!bounded) {
+                firstCol = 1;
+                lastCol = std::max(lastCol, row.lastKey());
+            }
+            if (!hasRows) {
+                // empty header
+                text += u'|' + u" |"_s.repeated(lastCol - firstCol + 1) + u'\n';
+                text += u'|' + u"-|"_s.repeated(lastCol - firstCol + 1) + u'\n';
+                hasRows = true;
+            }
+            text += u'|';
+            for (int c = firstCol; c <= lastCol; c++) {
+                QString cellText = row.value(c);
+                text += cellText.isEmpty() ? u" "_s : cellText;
+                text += u'|';
+            }
+            text += u'\n';
+            row.clear();
+        };
+
+        bool ok = parseZipXml(zip(), sheet.part.constData(), [&](QXmlStreamReader &xml) {
+            if (xml.isStartElement()) {
+                if (xml.name() == "dimension"_L1) {
+                    auto ref = xml.attributes().value("ref"_L1);
+                    // a single cell, such as "A1", is what is written for an empty sheet and bounds nothing
+                    auto colon = ref.indexOf(u':');
+                    if (colon >= 0) {
+                        int first = columnOf(ref.first(colon));
+                        int last = columnOf(ref.sliced(colon + 1));
+                        if (first && last >= first) {
+                            firstCol = first;
+                            lastCol = last;
+                            bounded = true;
+                        }
+                    }
+                } else if (xml.name() == "c"_L1) {
+                    auto attrs = xml.attributes();
+                    int refCol = columnOf(attrs.value("r"_L1));
+                    col = refCol ? refCol : col + 1;
+                    type = attrs.value("t"_L1).toString();
+                    value.clear();
+                } else if (xml.name() == "v"_L1 || xml.name() == "t"_L1) {
+                    inValue = true;
+                }
+            } else if (xml.isEndElement()) {
+                if (xml.name() == "v"_L1 || xml.name() == "t"_L1) {
+                    inValue = false;
+                } else if (xml.name() == "c"_L1) {
+                    if (type == "s"_L1)
+                        value = m_sharedStrings.value(value.toInt());
+                    else if (type == "b"_L1)
+                        value = value == "1"_L1 ? u"TRUE"_s : u"FALSE"_s;
+                    if (!value.isEmpty() && (!bounded || (col >= firstCol && col <= lastCol)))
+                        row.insert(col, XLSXToMD::escapeCellText(value));
+                } else if (xml.name() == "row"_L1) {
+                    appendRow();
+                    col = 0;
+                }
+            } else if (xml.isCharacters() && inValue) {
+                value += xml.text();
+            }
+            return text.size() < s_textPieceSize || out.push(std::exchange(text, {}));
+        });
+
+        if (!hasRows)
+            text += u"*No data available.*\n"_s;
+        text += u'\n';
+        out.push(std::move(text));
+        return ok;
+    }
+
+    QList<Sheet> m_sheets;
+    QStringList  m_sharedStrings;
+};
+
+/* Plain text is decoded a block at a time, and words are views into the decoded block, so that no string is built
+ * per word. */
+class TxtDocumentReader final : public DocumentReader {
+public:
+    explicit TxtDocumentReader(const DocumentInfo &info)
+        : DocumentReader(info)
+        , m_file(info.file.canonicalFilePath())
+    {
+        if (!m_file.open(QIODevice::ReadOnly))
+            throw std::runtime_error(fmt::format("Failed to open text file: {}", m_file.fileName()));
+
+        postInit();
+    }
+
+protected:
+    std::optional<QStringView> advance() override
+    {
+        for (;;) {
+            if (getError())
+                return std::nullopt;
+
+            const qsizetype size = m_text.size();
+            while (m_pos < size && TextScan::isSpace(m_text[m_pos]))
+                m_pos++;
+            qsizetype end = TextScan::findSpace(m_text, m_pos);
+            // a word at the end of the block may continue in the next one, unless it is overlong
+            if (m_pos < end && (end < size || m_atEnd || end - m_pos >= s_textBlockSize)) {
+                QStringView word = QStringView(m_text).sliced(m_pos, end - m_pos);
+                m_pos = end;
+                return word;
+            }
+            if (m_atEnd)
+                return std::nullopt;
+            readBlock();
+        }
+    }
+
+    std::optional<ChunkStreamer::Status> getError() const override
+    {
+        if (m_file.binarySeen())
+            return ChunkStreamer::Status::BINARY_SEEN;
+        if (m_file.error())
+            return ChunkStreamer::Status::ERROR;
+        return std::nullopt;
+    }
+
+private:
+    static constexpr qsizetype s_textBlockSize = 64 * 1024; // bytes read at a time
+
+    void readBlock()
+    {
+        // keep the start of a word that is cut off by the end of the block
+        m_text.remove(0, m_pos);
+        m_pos = 0;
+
+        m_block.resize(s_textBlockSize);
+        qint64 n = m_file.read(m_block.data(), m_block.size());
+        if (n <= 0) {
+            m_atEnd = true;
+            return;
+        }
+        auto block = QByteArrayView(m_block).first(n);
+
+        if (!m_decoder.isValid()) {
+            // UTF-8 unless there is a byte order mark, like QTextStream
+            auto encoding = QStringConverter::encodingForData(block).value_or(QStringConverter::Utf8);
+            m_decoder = QStringDecoder(encoding);
+        }
+        m_text += m_decoder(block);
+    }
+
+    BinaryDetectingFile m_file;
+    QByteArray          m_block;
+    QStringDecoder      m_decoder;
+    QString             m_text; // decoded text that has not been split yet, from m_pos
+    qsizetype           m_pos = 0;
+    bool                m_atEnd = false;
+};
+
+} // namespace
+
+std::unique_ptr<DocumentReader> DocumentReader::fromDocument(const DocumentInfo &doc)
+{
+    if (doc.isPdf())
+        return std::make_unique<PdfDocumentReader>(doc);
+    if (doc.isDocx())
+        return std::make_unique<WordDocumentReader>(doc);
+    if (doc.isXlsx())
+        return std::make_unique<ExcelDocumentReader>(doc);
+    return std::make_unique<TxtDocumentReader>(doc);
+}
+
+ChunkStreamer::ChunkStreamer(int chunkSize, int chunkTokens, TokenCounter countTokens)
+    : m_chunkSize(chunkSize)
+    , m_chunkTokens(countTokens ? chunkTokens : 0)
+    , m_countTokens(std::move(countTokens))
+{}
+
+ChunkStreamer::~ChunkStreamer() = default;
+
+void ChunkStreamer::setDocument(const DocumentInfo &doc)
+{
+    m_reader = DocumentReader::fromDocument(doc);
+    m_chunk.clear();
+    m_chunk.reserve(m_chunkTokens ? 0 : m_chunkSize + 1);
+    m_nChunkWords = 0;
+    m_nChunkTokens = 0;
+    m_page = 0;
+    m_wordTokens.clear();
+    m_countFailed = false;
+}
+
+const DocumentMetadata &ChunkStreamer::metadata() const
+{
+    return m_reader->metadata();
+}
+
+ChunkStreamer::Status ChunkStreamer::step(QList<ParsedChunk> &chunks, qsizetype maxChunks)
+{
+    if (m_chunkTokens > 0 && !m_countFailed)
+        return stepTokens(chunks, maxChunks);
+
+    const int maxChunkSize = m_chunkSize;
+
+    for (;;) {
+        if (auto error = m_reader->getError())
+            return *error;
+
+        // get a word, if needed
+        std::optional<QStringView> word = QStringView(u""); // empty string to disable EOF logic
+        if (m_chunk.length() < maxChunkSize + 1) {
+            word = m_reader->word();
+            if (m_chunk.isEmpty())
+                m_page = m_reader->page(); // page number of first word
+
+            if (word) {
+                m_chunk += *word;
+                m_chunk += u' ';
+                m_reader->nextWord();
+                m_nChunkWords++;
+            }
+        }
+
+        if (!word || m_chunk.length() >= maxChunkSize + 1) { // +1 for trailing space
+            if (!m_chunk.isEmpty()) {
+                int nThisChunkWords = 0;
+                auto chunk = m_chunk; // copy
+
+                // handle overlength chunks
+                if (m_chunk.length() > maxChunkSize + 1) {
+                    // find the final space
+                    qsizetype chunkEnd = chunk.lastIndexOf(u' ', -2);
+
+                    qsizetype spaceSize;
+                    if (chunkEnd >= 0) {
+                        // slice off the last word
+                        spaceSize = 1;
+                        Q_ASSERT(m_nChunkWords >= 1);
+                        // one word left
+                        nThisChunkWords = m_nChunkWords - 1;
+                        m_nChunkWords = 1;
+                    } else {
+                        // slice the overlong word
+                        spaceSize = 0;
+                        chunkEnd = maxChunkSize;
+                        // partial word left, don't count it
+                        nThisChunkWords = m_nChunkWords;
+                        m_nChunkWords = 0;
+                    }
+                    // save the second part, excluding space if any
+                    m_chunk = chunk.sliced(chunkEnd + spaceSize);
+                    // consume the first part
+                    chunk.truncate(chunkEnd);
+                } else {
+                    nThisChunkWords = m_nChunkWords;
+                    m_nChunkWords = 0;
+                    // there is no second part
+                    m_chunk.clear();
+                    // consume the whole chunk, excluding space
+                    chunk.chop(1);
+                }
+                Q_ASSERT(chunk.length() <= maxChunkSize);
+
+                QByteArray hash = textHash(chunk);
+                chunks.append({ std::move(chunk), m_page, nThisChunkWords, std::move(hash) });
+            }
+
+            if (!word)
+                return Status::DOC_COMPLETE;
+        }
+
+        if (chunks.size() >= maxChunks)
+            return Status::INTERRUPTED;
+    }
+}
+
+/* Packs whole words into chunks of at most m_chunkTokens tokens. Words are counted one at a time, which adds up to the
+ * tokens of the chunk for WordPiece tokenizers like the one of Nomic Embed, as they split text on whitespace first. The
+ * tokens recorded for a chunk are counted on its text. */
+ChunkStreamer::Status ChunkStreamer::stepTokens(QList<ParsedChunk> &chunks, qsizetype maxChunks)
+{
+    for (;;) {
+        if (auto error = m_reader->getError())
+            return *error;
+
+        std::optional<QStringView> word = m_reader->word();
+        if (!word) {
+            if (!m_chunk.isEmpty())
+                finishTokenChunk(chunks);
+            return Status::DOC_COMPLETE;
+        }
+
+        int tokens = wordTokens(*word);
+        if (tokens < 0) {
+            stopCountingTokens(chunks); // the word starts the first chunk cut by characters
+            return step(chunks, maxChunks);
+        }
+        if (!m_chunk.isEmpty() && m_nChunkTokens + tokens > m_chunkTokens) {
+            finishTokenChunk(chunks); // the word starts the next chunk
+        } else {
+            if (m_chunk.isEmpty())
+                m_page = m_reader->page(); // page number of first word
+
+            // cut a word that does not fit in a chunk of its own, such as encoded data, into pieces that do
+            QStringView rest = *word;
+            while (tokens > m_chunkTokens) {
+                qsizetype length = rest.size();
+                int pieceTokens = tokens;
+                while (pieceTokens > m_chunkTokens && length > 1) {
+                    length = std::max<qsizetype>(1, length * m_chunkTokens / pieceTokens);
+                    pieceTokens = m_countTokens(rest.first(length));
+                }
+                if (pieceTokens < 0) {
+                    tokens = pieceTokens;
+                    break;
+                }
+                // the word is counted with its last piece
+                appendChunk(chunks, rest.first(length).toString(), 0, pieceTokens);
+                rest = rest.sliced(length);
+                tokens = rest.isEmpty() ? 0 : m_countTokens(rest);
+            }
+
+            if (tokens < 0) {
+                // the rest of the word is cut by characters, the chunk is empty as the word did not fit in it
+                stopCountingTokens(chunks);
+                m_chunk = rest.toString() + u' ';
+                m_nChunkWords = 1;
+                m_reader->nextWord();
+                return step(chunks, maxChunks);
+            }
+
+            if (!rest.isEmpty()) {
+                m_chunk += rest;
+                m_chunk += u' ';
+                m_nChunkTokens += tokens;
+            }
+            m_nChunkWords++;
+            m_reader->nextWord();
+        }
+
+        if (chunks.size() >= maxChunks)
+            return Status::INTERRUPTED;
+    }
+}
+
+int ChunkStreamer::wordTokens(QStringView word)
+{
+    QString key = word.toString();
+    if (auto it = m_wordTokens.constFind(key); it != m_wordTokens.constEnd())
+        return *it;
+
+    int tokens = m_countTokens(word);
+    if (tokens < 0)
+        return tokens;
+    if (m_wordTokens.size() >= s_maxCachedWordTokens)
+        m_wordTokens.clear();
+    m_wordTokens.insert(std::move(key), tokens);
+    return tokens;
+}
+
+/* Without token counts a chunk would only end with the document, so once the tokenizer fails, e.g. because the
+ * embedding model could not be loaded, the rest of the document is cut into chunks of m_chunkSize characters. */
+void ChunkStreamer::stopCountingTokens(QList<ParsedChunk> &chunks)
+{
+    qWarning() << "LocalDocs ERROR: cannot count tokens, chunking" << m_reader->doc().file.fileName()
+               << "by characters";
+    if (!m_chunk.isEmpty())
+        finishTokenChunk(chunks);
+    m_countFailed = true;
+}
+
+void ChunkStreamer::finishTokenChunk(QList<ParsedChunk> &chunks)
+{
+    m_chunk.chop(1); // trailing space
+    int tokens = m_countTokens(m_chunk);
+    if (tokens < 0)
+        tokens = m_nChunkTokens;
+    appendChunk(chunks, std::exchange(m_chunk, QString()), m_nChunkWords, tokens);
+    m_nChunkWords = 0;
+    m_nChunkTokens = 0;
+}
+
+void ChunkStreamer::appendChunk(QList<ParsedChunk> &chunks, QString text, int words, int tokens)
+{
+    QByteArray hash = textHash(text);
+    chunks.append({ std::move(text), m_page, words, std::move(hash), tokens });
+}
@@ -0,0 +1,91 @@
+#ifndef CHUNKSTREAMER_H
+#define CHUNKSTREAMER_H
+
+#include <QByteArray>
+#include <QFileInfo>
+#include <QHash>
+#include <QLatin1String>
+#include <QList>
+#include <QString>
+#include <QStringView>
+#include <QtGlobal>
+
+#include <functional>
+#include <memory>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+class DocumentReader;
+
+struct DocumentInfo
+{
+    using key_type = std::pair<int, QString>;
+
+    int       folder;
+    QFileInfo file;
+
+    key_type key() const { return {folder, file.canonicalFilePath()}; } // for comparison
+
+    bool isPdf () const { return !file.suffix().compare("pdf"_L1,  Qt::CaseInsensitive); }
+    bool isDocx() const { return !file.suffix().compare("docx"_L1, Qt::CaseInsensitive); }
+    bool isXlsx() const { return !file.suffix().compare("xlsx"_L1, Qt::CaseInsensitive); }
+};
+
+struct DocumentMetadata {
+    QString title, author, subject, keywords;
+
+    bool operator==(const DocumentMetadata &other) const = default;
+};
+
+// A piece of document text cut by ChunkStreamer, before it is written to the database.
+struct ParsedChunk {
+    QString    text;
+    int        page;
+    int        words;
+    QByteArray hash;       // of the text
+    int        tokens = 0; // of the embedding model, if they were counted
+};
+
+// counts the tokens of a text for the embedding model, returns -1 if they cannot be counted
+using TokenCounter = std::function<int(QStringView text)>;
+
+/* Splits the words of a document into chunks of at most chunkSize characters or, given a token budget, into chunks of
+ * as many whole words as fit in chunkTokens tokens of the embedding model. If the tokens cannot be counted, the rest
+ * of the document is chunked by characters. */
+class ChunkStreamer {
+public:
+    enum class Status { DOC_COMPLETE, INTERRUPTED, ERROR, BINARY_SEEN };
+
+    explicit ChunkStreamer(int chunkSize, int chunkTokens = 0, TokenCounter countTokens = {});
+    ~ChunkStreamer();
+
+    // throws std::runtime_error if the document cannot be opened
+    void setDocument(const DocumentInfo &doc);
+    const DocumentMetadata &metadata() const;
+
+    // appends chunks until the document ends or maxChunks have been appended, which returns INTERRUPTED
+    Status step(QList<ParsedChunk> &chunks, qsizetype maxChunks);
+
+private:
+    Status stepTokens(QList<ParsedChunk> &chunks, qsizetype maxChunks);
+    int wordTokens(QStringView word); // -1 if the word cannot be counted
+    void stopCountingTokens(QList<ParsedChunk> &chunks);
+    void finishTokenChunk(QList<ParsedChunk> &chunks);
+    void appendChunk(QList<ParsedChunk> &chunks, QString text, int words, int tokens);
+
+    int                             m_chunkSize;
+    int                             m_chunkTokens; // 0 to chunk by characters
+    TokenCounter                    m_countTokens;
+    std::unique_ptr<DocumentReader> m_reader;
+
+    // working state
+    QString                         m_chunk; // has a trailing space for convenience
+    int                             m_nChunkWords = 0;
+    int                             m_nChunkTokens = 0;
+    int                             m_page = 0;
+    QHash<QString, int>             m_wordTokens; // tokens of the words seen in this document
+    bool                            m_countFailed = false; // the rest of the document is chunked by characters
+};
+
+#endif // CHUNKSTREAMER_H
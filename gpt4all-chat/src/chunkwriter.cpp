@@ -0,0 +1,123 @@
+#include "chunkwriter.h"
+
+#include <QStringList>
+#include <QVariant>
+
+#include <algorithm>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+namespace ranges = std::ranges;
+
+
+static constexpr qsizetype s_chunkInsertRows = 64; // rows per insert statement, 13 parameters each
+
+// rows are appended as %1
+static const QString INSERT_CHUNKS_SQL = uR"(
+    insert into chunks(document_id, chunk_text,
+        file, title, author, subject, keywords, page, line_from, line_to, words, tokens, chunk_hash)
+        values %1
+        returning id;
+)"_s;
+
+static const QString INSERT_CHUNKS_ROW_SQL = u"(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"_s;
+
+// the rowid of a full-text entry is the id of its chunk
+static const QString INSERT_CHUNKS_FTS_SQL = uR"(
+        insert into chunks_fts(rowid, document_id, chunk_text,
+            file, title, author, subject, keywords)
+            select id, document_id, chunk_text, file, title, author, subject, keywords
+            from chunks
+            where id between ? and ?;
+)"_s;
+
+QSqlQuery *ChunkWriter::insertQuery(qsizetype nRows)
+{
+    auto it = m_inserts.find(nRows);
+    if (it != m_inserts.end())
+        return &it->second;
+
+    QStringList rows(nRows, INSERT_CHUNKS_ROW_SQL);
+    QSqlQuery q(m_db);
+    if (!q.prepare(INSERT_CHUNKS_SQL.arg(rows.join(u", "_s)))) {
+        m_error = q.lastError();
+        return nullptr;
+    }
+    return &m_inserts.emplace(nRows, std::move(q)).first->second;
+}
+
+bool ChunkWriter::add(int document_id, const QString &file, const DocumentMetadata &metadata,
+                      const QList<ParsedChunk> &chunks, QList<int> &chunk_ids)
+{
+    // TODO: implement line_from/line_to
+    constexpr int line_from = -1;
+    constexpr int line_to = -1;
+
+    for (qsizetype start = 0; start < chunks.size(); start += s_chunkInsertRows) {
+        auto rows = chunks.sliced(start, std::min(s_chunkInsertRows, chunks.size() - start));
+        QSqlQuery *q = insertQuery(rows.size());
+        if (!q)
+            return false;
+
+        int i = 0;
+        for (const ParsedChunk &chunk: rows) {
+            q->bindValue(i++, document_id);
+            q->bindValue(i++, chunk.text);
+            q->bindValue(i++, file);
+            q->bindValue(i++, metadata.title);
+            q->bindValue(i++, metadata.author);
+            q->bindValue(i++, metadata.subject);
+            q->bindValue(i++, metadata.keywords);
+            q->bindValue(i++, chunk.page);
+            q->bindValue(i++, line_from);
+            q->bindValue(i++, line_to);
+            q->bindValue(i++, chunk.words);
+            q->bindValue(i++, chunk.tokens);
+            q->bindValue(i++, chunk.hash);
+        }
+        if (!q->exec()) {
+            m_error = q->lastError();
+            return false;
+        }
+
+        /* RETURNING does not guarantee an order, but the rows of one statement get increasing ids as they are
+         * inserted in order, so sorting the ids restores the order of the rows. */
+        QList<int> ids;
+        ids.reserve(rows.size());
+        while (q->next())
+            ids << q->value(0).toInt();
+        q->finish();
+        Q_ASSERT(ids.size() == rows.size());
+        ranges::sort(ids);
+
+        if (!ids.isEmpty()) {
+            if (m_firstUnindexed == -1)
+                m_firstUnindexed = ids.front();
+            m_lastUnindexed = ids.back();
+        }
+        chunk_ids << ids;
+    }
+    return true;
+}
+
+int ChunkWriter::flush()
+{
+    if (m_firstUnindexed == -1)
+        return 0;
+
+    // chunks of this range that were removed in the meantime are simply not found
+    QSqlQuery q(m_db);
+    if (!q.prepare(INSERT_CHUNKS_FTS_SQL)) {
+        m_error = q.lastError();
+        return -1;
+    }
+    q.addBindValue(m_firstUnindexed);
+    q.addBindValue(m_lastUnindexed);
+    if (!q.exec()) {
+        m_error = q.lastError();
+        return -1;
+    }
+    int nIndexed = q.numRowsAffected();
+    m_firstUnindexed = m_lastUnindexed = -1;
+    return nIndexed;
+}
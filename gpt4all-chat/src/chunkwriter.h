@@ -0,0 +1,44 @@
+#ifndef CHUNKWRITER_H
+#define CHUNKWRITER_H
+
+#include "chunkstreamer.h"
+
+#include <QList>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QString>
+#include <QtGlobal>
+
+#include <map>
+
+
+/* Inserts chunks with multi-row statements that are prepared once per transaction. The full-text index is not
+ * touched until flush(), which adds every chunk written since the last flush in a single statement.
+ *
+ * Chunks must not be removed while they wait for flush(): FTS5 finds the entries to remove through the chunks table,
+ * and would remove entries that were never added, which corrupts the full-text index. */
+class ChunkWriter {
+public:
+    explicit ChunkWriter(const QSqlDatabase &db)
+        : m_db(db) {}
+
+    // the ids of the new chunks are appended to chunk_ids in the order of chunks
+    bool add(int document_id, const QString &file, const DocumentMetadata &metadata,
+             const QList<ParsedChunk> &chunks, QList<int> &chunk_ids);
+    // returns the number of chunks added to the full-text index, or -1 on error
+    int flush();
+
+    const QSqlError &lastError() const { return m_error; }
+
+private:
+    QSqlQuery *insertQuery(qsizetype nRows);
+
+    QSqlDatabase                   m_db;
+    std::map<qsizetype, QSqlQuery> m_inserts; // by number of rows
+    QSqlError                      m_error;
+    int                            m_firstUnindexed = -1;
+    int                            m_lastUnindexed  = -1;
+};
+
+#endif // CHUNKWRITER_H
@@ -0,0 +1,449 @@
+#include "collectionsnapshot.h"
+
+#include "chunkcompressor.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+#include <QtLogging>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+// collection snapshots are SQLite files of their own, identified by application_id and versioned by user_version
+static constexpr int    s_snapshotApplicationId = 0x47344c44; // "G4LD"
+static constexpr int    s_snapshotVersion       = 1;
+static constexpr qint64 s_snapshotMmapSize      = qint64(1) << 32; // bytes of a snapshot read through mmap on import
+static constexpr int    s_decompressBatchSize   = 1024; // compressed chunks restored per query
+
+static const QString ATTACH_SNAPSHOT_SQL = uR"(
+    attach database ? as snapshot;
+)"_s;
+
+static const QString DETACH_SNAPSHOT_SQL = uR"(
+    detach database snapshot;
+)"_s;
+
+/* A snapshot keeps the ids of the exporting database, with documents stored relative to their folder and chunks in
+ * document order. The full-text index is not included: its entries are keyed by chunk id, and the chunks get new ids
+ * on import, so it is rebuilt from the chunk text there. */
+static const QString INIT_SNAPSHOT_SQL[] = {
+    // must come before the first table, larger pages suit the sequential reads of an import
+    u"pragma snapshot.page_size = 65536;"_s,
+    u"pragma snapshot.application_id = %1;"_s.arg(s_snapshotApplicationId),
+    u"pragma snapshot.user_version = %1;"_s.arg(s_snapshotVersion),
+    uR"(
+        create table snapshot.info(
+            collection      text not null,
+            embedding_model text not null,
+            dimensions      integer not null,
+            quantization    text not null,
+            created_time    integer not null
+        );
+    )"_s, uR"(
+        create table snapshot.folders(
+            id   integer primary key,
+            path text not null
+        );
+    )"_s, uR"(
+        create table snapshot.documents(
+            id            integer primary key,
+            folder_id     integer not null,
+            document_time integer not null,
+            document_path text not null,
+            content_hash  blob
+        );
+    )"_s, uR"(
+        create table snapshot.chunks(
+            id            integer primary key,
+            document_id   integer not null,
+            chunk_text    text not null,
+            file          text not null,
+            title         text,
+            author        text,
+            subject       text,
+            keywords      text,
+            page          integer,
+            line_from     integer,
+            line_to       integer,
+            words         integer not null,
+            tokens        integer not null,
+            chunk_hash    blob
+        );
+    )"_s, uR"(
+        create table snapshot.embeddings(
+            chunk_id      integer primary key,
+            embedding     blob not null
+        );
+    )"_s,
+};
+
+static const QString INSERT_SNAPSHOT_FOLDER_SQL = uR"(
+    insert into snapshot.folders(id, path) values(?, ?);
+)"_s;
+
+// documents outside of their folder, e.g. behind a symbolic link, have no path to remap and are left out
+static const QString INSERT_SNAPSHOT_DOCUMENTS_SQL = uR"(
+    insert into snapshot.documents(id, folder_id, document_time, document_path, content_hash)
+        select id, folder_id, document_time, substr(document_path, length(:root) + 2), content_hash
+        from main.documents
+        where folder_id = :folder_id and substr(document_path, 1, length(:root) + 1) = :root || '/'
+        order by id;
+)"_s;
+
+static const QString INSERT_SNAPSHOT_CHUNKS_SQL = uR"(
+    insert into snapshot.chunks(id, document_id, chunk_text, file, title, author, subject, keywords, page,
+                                line_from, line_to, words, tokens, chunk_hash)
+        select c.id, c.document_id, c.chunk_text, c.file, c.title, c.author, c.subject, c.keywords, c.page,
+               c.line_from, c.line_to, c.words, c.tokens, c.chunk_hash
+        from snapshot.documents d
+        join main.chunks c on c.document_id = d.id
+        order by c.document_id, c.id;
+)"_s;
+
+// snapshots hold plain text, the dictionaries stay with the database they were trained for
+static const QString SELECT_COMPRESSED_SNAPSHOT_CHUNKS_SQL = uR"(
+    select id, chunk_text from snapshot.chunks where typeof(chunk_text) = 'blob' limit ?;
+)"_s;
+
+static const QString UPDATE_SNAPSHOT_CHUNK_TEXT_SQL = uR"(
+    update snapshot.chunks set chunk_text = ? where id = ?;
+)"_s;
+
+static const QString SELECT_SNAPSHOT_EMBEDDINGS_SQL = uR"(
+    select e.chunk_id, e.embedding
+    from snapshot.chunks c
+    join main.embeddings e on e.chunk_id = c.id
+    where e.model = ?
+    order by c.id;
+)"_s;
+
+static const QString INSERT_SNAPSHOT_EMBEDDING_SQL = uR"(
+    insert into snapshot.embeddings(chunk_id, embedding) values(?, ?);
+)"_s;
+
+static const QString INSERT_SNAPSHOT_INFO_SQL = uR"(
+    insert into snapshot.info(collection, embedding_model, dimensions, quantization, created_time)
+        values(?, ?, ?, ?, ?);
+)"_s;
+
+static const QString SELECT_SNAPSHOT_INFO_SQL = uR"(
+    select embedding_model, dimensions, quantization from snapshot.info;
+)"_s;
+
+static const QString SELECT_SNAPSHOT_FOLDERS_SQL = uR"(
+    select id, path from snapshot.folders order by id;
+)"_s;
+
+// imported rows get ids after every id in use; chunk ids after every one ever used, as the indexes may still hold them
+static const QString SELECT_IMPORT_OFFSETS_SQL = uR"(
+    select (select coalesce(max(id), 0) from main.documents),
+           max((select coalesce(max(id), 0) from main.chunks),
+               coalesce((select seq from main.sqlite_sequence where name = 'chunks'), 0)),
+           (select coalesce(max(id), 0) from snapshot.chunks);
+)"_s;
+
+static const QString IMPORT_SNAPSHOT_DOCUMENTS_SQL = uR"(
+    insert into main.documents(id, folder_id, document_time, document_path, content_hash)
+        select id + :document_offset, :folder_id, document_time, :root || '/' || document_path, content_hash
+        from snapshot.documents
+        where folder_id = :snapshot_folder_id;
+)"_s;
+
+static const QString IMPORT_SNAPSHOT_CHUNKS_SQL = uR"(
+    insert into main.chunks(id, document_id, chunk_text, file, title, author, subject, keywords, page,
+                            line_from, line_to, words, tokens, chunk_hash)
+        select id + :chunk_offset, document_id + :document_offset, chunk_text, file, title, author, subject,
+               keywords, page, line_from, line_to, words, tokens, chunk_hash
+        from snapshot.chunks
+        order by id;
+)"_s;
+
+// the rowid of a full-text entry is the id of its chunk
+static const QString IMPORT_SNAPSHOT_FTS_SQL = uR"(
+    insert into main.chunks_fts(rowid, document_id, chunk_text, file, title, author, subject, keywords)
+        select id + :chunk_offset, document_id + :document_offset, chunk_text, file, title, author, subject,
+               keywords
+        from snapshot.chunks
+        order by id;
+)"_s;
+
+static const QString IMPORT_SNAPSHOT_EMBEDDINGS_SQL = uR"(
+    insert into main.embeddings(model, folder_id, chunk_id, embedding)
+        select :model, d.folder_id, e.chunk_id + :chunk_offset, e.embedding
+        from snapshot.embeddings e
+        join main.chunks c on c.id = e.chunk_id + :chunk_offset
+        join main.documents d on d.id = c.document_id
+        order by e.chunk_id;
+)"_s;
+
+static const QString SELECT_QUANTIZED_SNAPSHOT_EMBEDDINGS_SQL = uR"(
+    select d.folder_id, e.chunk_id + :chunk_offset, e.embedding
+    from snapshot.embeddings e
+    join main.chunks c on c.id = e.chunk_id + :chunk_offset
+    join main.documents d on d.id = c.document_id
+    order by e.chunk_id;
+)"_s;
+
+static const QString INSERT_IMPORTED_EMBEDDING_SQL = uR"(
+    insert into main.embeddings(model, folder_id, chunk_id, embedding) values(?, ?, ?, ?);
+)"_s;
+
+static QString sqlErrorText(const QString &what, const QSqlQuery &q)
+{
+    return u"%1: %2"_s.arg(what, q.lastError().text());
+}
+
+// an 8-bit embedding is a float scale followed by one signed byte per dimension
+static QByteArray quantizeEmbedding(const QByteArray &embedding)
+{
+    const auto *values = reinterpret_cast<const float *>(embedding.constData());
+    const qsizetype n = embedding.size() / qsizetype(sizeof(float));
+
+    float maxAbs = 0;
+    for (qsizetype i = 0; i < n; i++)
+        maxAbs = std::max(maxAbs, std::abs(values[i]));
+    const float scale = maxAbs > 0 ? maxAbs / 127 : 1;
+
+    QByteArray result(sizeof(float) + n, Qt::Uninitialized);
+    std::memcpy(result.data(), &scale, sizeof(float));
+    auto *dst = reinterpret_cast<qint8 *>(result.data() + sizeof(float));
+    for (qsizetype i = 0; i < n; i++)
+        dst[i] = qint8(std::lround(values[i] / scale));
+    return result;
+}
+
+// returns an empty array if the data does not have the given dimensions
+static QByteArray dequantizeEmbedding(const QByteArray &data, int dimensions)
+{
+    if (data.size() != qsizetype(sizeof(float)) + dimensions)
+        return {};
+
+    float scale;
+    std::memcpy(&scale, data.constData(), sizeof(float));
+    const auto *src = reinterpret_cast<const qint8 *>(data.constData() + sizeof(float));
+
+    QByteArray result(dimensions * sizeof(float), Qt::Uninitialized);
+    auto *values = reinterpret_cast<float *>(result.data());
+    float norm = 0;
+    for (int i = 0; i < dimensions; i++) {
+        values[i] = src[i] * scale;
+        norm += values[i] * values[i];
+    }
+    // the search expects unit vectors, like the embedding model returns them
+    if (norm > 0) {
+        norm = std::sqrt(norm);
+        for (int i = 0; i < dimensions; i++)
+            values[i] /= norm;
+    }
+    return result;
+}
+
+QString CollectionSnapshot::attach(const QString &path)
+{
+    QSqlQuery q(m_db);
+    if (!q.prepare(ATTACH_SNAPSHOT_SQL))
+        return sqlErrorText(u"Cannot open snapshot"_s, q);
+    q.addBindValue(path);
+    if (!q.exec())
+        return sqlErrorText(u"Cannot open snapshot"_s, q);
+    return {};
+}
+
+void CollectionSnapshot::detach()
+{
+    QSqlQuery q(m_db);
+    if (!q.exec(DETACH_SNAPSHOT_SQL))
+        qWarning() << "Database ERROR: Cannot detach snapshot:" << q.lastError();
+}
+
+QString CollectionSnapshot::create()
+{
+    QSqlQuery q(m_db);
+    for (const auto &cmd: INIT_SNAPSHOT_SQL) {
+        if (!q.exec(cmd))
+            return sqlErrorText(u"Cannot create snapshot"_s, q);
+    }
+    return {};
+}
+
+QString CollectionSnapshot::write(const QString &collection, const QString &embeddingModel,
+                                  const QList<Folder> &folders, const ChunkCompressor *compressor, bool quantize)
+{
+    QSqlQuery q(m_db);
+    for (const Folder &folder: folders) {
+        if (!q.prepare(INSERT_SNAPSHOT_FOLDER_SQL))
+            return sqlErrorText(u"Cannot add folder"_s, q);
+        q.addBindValue(folder.id);
+        q.addBindValue(folder.root);
+        if (!q.exec())
+            return sqlErrorText(u"Cannot add folder"_s, q);
+
+        // document paths are stored relative to the folder, so they can be remapped on import
+        if (!q.prepare(INSERT_SNAPSHOT_DOCUMENTS_SQL))
+            return sqlErrorText(u"Cannot add documents"_s, q);
+        q.bindValue(u":root"_s, folder.root);
+        q.bindValue(u":folder_id"_s, folder.id);
+        if (!q.exec())
+            return sqlErrorText(u"Cannot add documents"_s, q);
+    }
+
+    if (!q.exec(INSERT_SNAPSHOT_CHUNKS_SQL))
+        return sqlErrorText(u"Cannot add chunks"_s, q);
+
+    // restored chunks no longer match, so the same query is repeated until it returns nothing
+    qsizetype nRestored = compressor ? 1 : 0;
+    while (nRestored > 0) {
+        if (!q.prepare(SELECT_COMPRESSED_SNAPSHOT_CHUNKS_SQL))
+            return sqlErrorText(u"Cannot select chunks"_s, q);
+        q.addBindValue(s_decompressBatchSize);
+        if (!q.exec())
+            return sqlErrorText(u"Cannot select chunks"_s, q);
+        QList<std::pair<int, QString>> chunks;
+        while (q.next()) {
+            std::optional<QString> text = compressor->decompress(q.value(1).toByteArray());
+            if (!text)
+                return u"Cannot decompress the text of chunk %1"_s.arg(q.value(0).toInt());
+            chunks.append({ q.value(0).toInt(), std::move(*text) });
+        }
+        if (!q.prepare(UPDATE_SNAPSHOT_CHUNK_TEXT_SQL))
+            return sqlErrorText(u"Cannot add chunks"_s, q);
+        for (const auto &[chunk_id, text]: std::as_const(chunks)) {
+            q.addBindValue(text);
+            q.addBindValue(chunk_id);
+            if (!q.exec())
+                return sqlErrorText(u"Cannot add chunks"_s, q);
+        }
+        nRestored = chunks.size();
+    }
+
+    QSqlQuery insert(m_db);
+    if (!q.prepare(SELECT_SNAPSHOT_EMBEDDINGS_SQL) || !insert.prepare(INSERT_SNAPSHOT_EMBEDDING_SQL))
+        return sqlErrorText(u"Cannot add embeddings"_s, q);
+    q.addBindValue(embeddingModel);
+    if (!q.exec())
+        return sqlErrorText(u"Cannot select embeddings"_s, q);
+    int dimensions = 0;
+    while (q.next()) {
+        const QByteArray embedding = q.value(1).toByteArray();
+        dimensions = int(embedding.size() / sizeof(float));
+        insert.addBindValue(q.value(0).toInt());
+        insert.addBindValue(quantize ? quantizeEmbedding(embedding) : embedding);
+        if (!insert.exec())
+            return sqlErrorText(u"Cannot add embeddings"_s, insert);
+    }
+
+    if (!q.prepare(INSERT_SNAPSHOT_INFO_SQL))
+        return sqlErrorText(u"Cannot add snapshot info"_s, q);
+    q.addBindValue(collection);
+    q.addBindValue(embeddingModel);
+    q.addBindValue(dimensions);
+    q.addBindValue(quantize ? u"Int8"_s : u"None"_s);
+    q.addBindValue(QDateTime::currentMSecsSinceEpoch());
+    if (!q.exec())
+        return sqlErrorText(u"Cannot add snapshot info"_s, q);
+    return {};
+}
+
+QString CollectionSnapshot::readInfo(Info &info)
+{
+    QSqlQuery q(m_db);
+
+    // the snapshot is only read, so SQLite can map it instead of copying its pages
+    if (!q.exec(u"pragma snapshot.mmap_size = %1;"_s.arg(s_snapshotMmapSize)))
+        qWarning() << "Database WARNING: Cannot map snapshot:" << q.lastError();
+
+    if (!q.exec(u"pragma snapshot.application_id;"_s) || !q.next()
+        || q.value(0).toInt() != s_snapshotApplicationId) {
+        return u"Not a LocalDocs snapshot"_s;
+    }
+    if (!q.exec(u"pragma snapshot.user_version;"_s) || !q.next())
+        return sqlErrorText(u"Cannot read snapshot version"_s, q);
+    if (int version = q.value(0).toInt(); version != s_snapshotVersion)
+        return u"Unsupported snapshot version %1"_s.arg(version);
+
+    if (!q.exec(SELECT_SNAPSHOT_INFO_SQL) || !q.next())
+        return sqlErrorText(u"Cannot read snapshot"_s, q);
+    info.embeddingModel = q.value(0).toString();
+    info.dimensions = q.value(1).toInt();
+    info.quantized = q.value(2).toString() == u"Int8"_s;
+    return {};
+}
+
+QString CollectionSnapshot::readFolders(QList<Folder> &folders)
+{
+    QSqlQuery q(m_db);
+    if (!q.exec(SELECT_SNAPSHOT_FOLDERS_SQL))
+        return sqlErrorText(u"Cannot read snapshot folders"_s, q);
+    while (q.next())
+        folders.append({ q.value(0).toInt(), q.value(1).toString() });
+    return {};
+}
+
+QString CollectionSnapshot::import(const Info &info, const QHash<int, Folder> &localFolders, int &nChunks)
+{
+    QSqlQuery q(m_db);
+    if (!q.exec(SELECT_IMPORT_OFFSETS_SQL) || !q.next())
+        return sqlErrorText(u"Cannot select ids"_s, q);
+    const int documentOffset = q.value(0).toInt();
+    const int chunkOffset = q.value(1).toInt();
+    nChunks = q.value(2).toInt();
+
+    for (auto it = localFolders.constBegin(); it != localFolders.constEnd(); ++it) {
+        if (!q.prepare(IMPORT_SNAPSHOT_DOCUMENTS_SQL))
+            return sqlErrorText(u"Cannot import documents"_s, q);
+        q.bindValue(u":document_offset"_s, documentOffset);
+        q.bindValue(u":folder_id"_s, it->id);
+        q.bindValue(u":root"_s, it->root);
+        q.bindValue(u":snapshot_folder_id"_s, it.key());
+        if (!q.exec())
+            return sqlErrorText(u"Cannot import documents"_s, q);
+    }
+
+    for (const QString &sql: { IMPORT_SNAPSHOT_CHUNKS_SQL, IMPORT_SNAPSHOT_FTS_SQL }) {
+        if (!q.prepare(sql))
+            return sqlErrorText(u"Cannot import chunks"_s, q);
+        q.bindValue(u":chunk_offset"_s, chunkOffset);
+        q.bindValue(u":document_offset"_s, documentOffset);
+        if (!q.exec())
+            return sqlErrorText(u"Cannot import chunks"_s, q);
+    }
+
+    if (!info.quantized) {
+        if (!q.prepare(IMPORT_SNAPSHOT_EMBEDDINGS_SQL))
+            return sqlErrorText(u"Cannot import embeddings"_s, q);
+        q.bindValue(u":model"_s, info.embeddingModel);
+        q.bindValue(u":chunk_offset"_s, chunkOffset);
+        if (!q.exec())
+            return sqlErrorText(u"Cannot import embeddings"_s, q);
+        return {};
+    }
+
+    QSqlQuery insert(m_db);
+    if (!q.prepare(SELECT_QUANTIZED_SNAPSHOT_EMBEDDINGS_SQL) || !insert.prepare(INSERT_IMPORTED_EMBEDDING_SQL))
+        return sqlErrorText(u"Cannot import embeddings"_s, q);
+    q.bindValue(u":chunk_offset"_s, chunkOffset);
+    if (!q.exec())
+        return sqlErrorText(u"Cannot import embeddings"_s, q);
+    while (q.next()) {
+        const QByteArray embedding = dequantizeEmbedding(q.value(2).toByteArray(), info.dimensions);
+        if (embedding.isEmpty())
+            return u"The snapshot has an embedding of the wrong size"_s;
+        insert.addBindValue(info.embeddingModel);
+        insert.addBindValue(q.value(0).toInt());
+        insert.addBindValue(q.value(1).toInt());
+        insert.addBindValue(embedding);
+        if (!insert.exec())
+            return sqlErrorText(u"Cannot import embeddings"_s, insert);
+    }
+    return {};
+}
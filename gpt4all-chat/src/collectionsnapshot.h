@@ -0,0 +1,56 @@
+#ifndef COLLECTIONSNAPSHOT_H
+#define COLLECTIONSNAPSHOT_H
+
+#include <QHash>
+#include <QList>
+#include <QSqlDatabase>
+#include <QString>
+
+class ChunkCompressor;
+
+
+/* A collection written to a SQLite file of its own, from which another installation can add it without indexing it
+ * again. The file is attached to a connection of the LocalDocs database as "snapshot" while it is written or read,
+ * and rows are copied between the two in SQL, so documents, chunks and embeddings never pass through memory one by
+ * one unless they have to be converted.
+ *
+ * The methods return an error message, or an empty string on success. The caller holds a transaction around write()
+ * and import(), and keeps the collections and folders of the database in order. */
+class CollectionSnapshot {
+public:
+    struct Folder {
+        int     id;   // in the database the rows come from or go to
+        QString root; // canonical path, without a trailing slash
+    };
+
+    struct Info {
+        QString embeddingModel;
+        int     dimensions = 0;
+        bool    quantized = false; // 8-bit embeddings
+    };
+
+    explicit CollectionSnapshot(const QSqlDatabase &db)
+        : m_db(db) {}
+
+    // the file is created if it does not exist
+    QString attach(const QString &path);
+    void detach();
+
+    // creates the tables of an empty snapshot, outside of a transaction
+    QString create();
+    // copies the documents of folders with their chunks and embeddings, chunk text is decompressed by compressor
+    QString write(const QString &collection, const QString &embeddingModel, const QList<Folder> &folders,
+                  const ChunkCompressor *compressor, bool quantize);
+
+    QString readInfo(Info &info);
+    QString readFolders(QList<Folder> &folders);
+    /* Adds the documents of each snapshot folder to the local folder it is mapped to, with new ids after those in
+     * use, and all chunks with their full-text entries and embeddings. nChunks is set to the number of chunk ids
+     * used. */
+    QString import(const Info &info, const QHash<int, Folder> &localFolders, int &nChunks);
+
+private:
+    QSqlDatabase m_db;
+};
+
+#endif // COLLECTIONSNAPSHOT_H
@@ -1,35 +1,44 @@
 #include "database.h"
 
+#include "chunkwriter.h"
+#include "collectionsnapshot.h"
 #include "mysettings.h"
+#include "scanjournal.h"
 #include "utils.h"
 
-#include <duckx/duckx.hpp>
-#include <fmt/format.h>
 #include <usearch/index_plugins.hpp>
 
+#include <QCryptographicHash>
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
 #include <QFile>
-#include <QFileSystemWatcher>
 #include <QIODevice>
-#include <QPdfDocument>
-#include <QPdfSelection>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutexLocker> // IWYU pragma: keep
+#include <QReadLocker>
 #include <QRegularExpression>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QTextStream>
+#include <QSqlRecord>
+#include <QStringView>
 #include <QTimer>
 #include <QMap>
 #include <QUtf8StringView>
 #include <QVariant>
+#include <QWriteLocker>
 #include <Qt>
 #include <QtLogging>
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <optional>
 #include <stdexcept>
+#include <thread>
+#include <utility>
 
 using namespace Qt::Literals::StringLiterals;
 namespace ranges = std::ranges;
@@ -38,52 +47,129 @@ namespace us = unum::usearch;
 //#define DEBUG
 //#define DEBUG_EXAMPLE
 
-namespace {
+static int s_batchSize = 100;
 
-/* QFile that checks input for binary data. If seen, it fails the read and returns true
- * for binarySeen(). */
-class BinaryDetectingFile: public QFile {
-public:
-    using QFile::QFile;
-
-    bool binarySeen() const { return m_binarySeen; }
-
-protected:
-    qint64 readData(char *data, qint64 maxSize) override {
-        qint64 res = QFile::readData(data, maxSize);
-        return checkData(data, res);
-    }
-
-    qint64 readLineData(char *data, qint64 maxSize) override {
-        qint64 res = QFile::readLineData(data, maxSize);
-        return checkData(data, res);
-    }
-
-private:
-    qint64 checkData(const char *data, qint64 size) {
-        Q_ASSERT(!isTextModeEnabled()); // We need raw bytes from the underlying QFile
-        if (size != -1 && !m_binarySeen) {
-            for (qint64 i = 0; i < size; i++) {
-                /* Control characters we should never see in plain text:
-                 * 0x00 NUL - 0x06 ACK
-                 * 0x0E SO  - 0x1A SUB
-                 * 0x1C FS  - 0x1F US */
-                auto c = static_cast<unsigned char>(data[i]);
-                if (c < 0x07 || (c >= 0x0E && c < 0x1B) || (c >= 0x1C && c < 0x20)) {
-                    m_binarySeen = true;
-                    break;
-                }
-            }
-        }
-        return m_binarySeen ? -1 : size;
-    }
+// ingestion pipeline tuning
+static constexpr int       s_ftsOptimizeRows     = 10000; // merge the full-text index after this many new chunks
+static constexpr qsizetype s_ingestBatchChunks   = 64; // chunks per batch handed to the database thread
+static constexpr size_t    s_ingestQueueBatches  = 16; // batches waiting to be written before workers block
+static constexpr int       s_ingestJobsPerThread = 2;  // documents submitted ahead of the workers
+static constexpr int       s_ingestWaitTime      = 10; // ms to wait for a batch when there is nothing else to do
+
+static constexpr int s_readerThreads = 2; // concurrent retrievals
+
+// vector index tuning
+static constexpr int    s_indexBuildBatchSize    = 4096;
+static constexpr int    s_indexSaveDelay         = 30000; // ms
+static constexpr int    s_indexRecallInterval    = 50;    // check every nth indexed search against exact search
+static constexpr double s_indexMinRecall         = 0.9;
+static constexpr size_t s_indexMaxExpansion      = 1024;
+
+static constexpr int s_embeddingCacheMaxRows = 50000; // least recently used entries beyond this are dropped at startup
+
+// folders with directories beyond the watch limit are rescanned instead, which the journal keeps cheap
+static constexpr int    s_unwatchedScanInterval = 5 * 60 * 1000; // ms
+
+static constexpr int s_queryEmbeddingCacheSize = 64;  // recent queries
+static constexpr int s_searchResultCacheSize   = 256; // recent (collections, k, query) results
+
+// chunk text compression
+static constexpr int s_compressBatchSize    = 1024; // chunks compressed per event loop iteration
+static constexpr int s_dictionarySamples    = 8192; // chunks a dictionary is trained on
+static constexpr int s_dictionaryMinSamples = 1000; // collections with fewer chunks are not compressed
+
+/* Chunk text is stored as text, or as a zstd frame once it has been compressed. Returns nullopt if the frame cannot
+ * be decompressed, because its dictionary is missing or this build has no zstd: the stored frame is then the only
+ * copy of the text, and must not be replaced. */
+static std::optional<QString> chunkText(const ChunkCompressor &compressor, const QVariant &value)
+{
+    if (value.typeId() != QMetaType::QByteArray)
+        return value.toString();
+    std::optional<QString> text = compressor.decompress(value.toByteArray());
+    if (!text)
+        qWarning() << "Database ERROR: Cannot decompress chunk text";
+    return text;
+}
 
-    bool m_binarySeen = false;
+static QByteArray fileHash(const QString &path)
+{
+    QFile file(path);
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file))
+        return {};
+    return hash.result();
+}
+
+static EmbeddingSegment::Quantization quantizationFromSetting(const QString &value)
+{
+    using enum EmbeddingSegment::Quantization;
+    if (value == "Int8"_L1)   return Int8;
+    if (value == "Binary"_L1) return Binary;
+    return None;
+}
+
+// columns added without a version bump, as (table, column definition)
+static const std::pair<QString, QString> ADDED_COLUMNS[] = {
+    { u"documents"_s, u"content_hash blob"_s },
+    { u"chunks"_s,    u"chunk_hash blob"_s   },
+    { u"chunks"_s,    u"dictionary_id integer"_s },
 };
 
-} // namespace
+// tables added without a version bump
+static const QString ADDED_TABLES_SQL[] = {
+    // embeddings by content, shared by all collections and kept when chunks are removed
+    uR"(
+        create table if not exists embedding_cache(
+            text_hash     blob not null,
+            model         text not null,
+            embedding     blob not null,
+            last_used     integer not null,
+            primary key(text_hash, model)
+        );
+    )"_s,
+    // the directories seen by the last scan, to skip listing the ones that did not change
+    uR"(
+        create table if not exists scan_journal(
+            dir_path      text primary key,
+            folder_id     integer not null,
+            dir_time      integer not null,
+            entry_count   integer not null
+        );
+    )"_s,
+    // zstd dictionaries of compressed chunk text, by the id zstd records in each frame
+    uR"(
+        create table if not exists chunk_dictionaries(
+            id            integer primary key,
+            collection_id integer not null,
+            dictionary    blob not null
+        );
+    )"_s,
+    // bumped on every change to the embeddings of a folder, so saved vector indexes can tell if they missed one
+    uR"(
+        create table if not exists embedding_generations(
+            model         text not null,
+            folder_id     integer not null,
+            generation    integer not null,
+            primary key(model, folder_id)
+        );
+    )"_s, uR"(
+        create trigger if not exists embeddings_insert_generation after insert on embeddings begin
+            insert into embedding_generations(model, folder_id, generation) values(new.model, new.folder_id, 1)
+            on conflict(model, folder_id) do update set generation = generation + 1;
+        end;
+    )"_s, uR"(
+        create trigger if not exists embeddings_delete_generation after delete on embeddings begin
+            insert into embedding_generations(model, folder_id, generation) values(old.model, old.folder_id, 1)
+            on conflict(model, folder_id) do update set generation = generation + 1;
+        end;
+    )"_s,
+};
 
-static int s_batchSize = 100;
+static const QString OPEN_DB_SQL[] = {
+    u"pragma journal_mode = wal;"_s,
+    // with WAL, a crash can lose the last transactions but cannot corrupt the database
+    u"pragma synchronous = normal;"_s,
+};
 
 static const QString INIT_DB_SQL[] = {
     // automatically free unused disk space
@@ -104,6 +190,8 @@ static const QString INIT_DB_SQL[] = {
             line_to       integer,
             words         integer default 0 not null,
             tokens        integer default 0 not null,
+            chunk_hash    blob,
+            dictionary_id integer,
             foreign key(document_id) references documents(id)
         );
     )"_s, uR"(
@@ -147,6 +235,7 @@ static const QString INIT_DB_SQL[] = {
             folder_id     integer not null,
             document_time integer not null,
             document_path text unique not null,
+            content_hash  blob,
             foreign key(folder_id) references folders(id)
         );
     )"_s, uR"(
@@ -163,17 +252,12 @@ static const QString INIT_DB_SQL[] = {
     )"_s,
 };
 
-static const QString INSERT_CHUNK_SQL = uR"(
-    insert into chunks(document_id, chunk_text,
-        file, title, author, subject, keywords, page, line_from, line_to, words)
-        values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
-        returning id;
+static const QString UPDATE_CHUNK_POSITION_SQL = uR"(
+    update chunks set page = ?, words = ?, tokens = ? where id = ?;
 )"_s;
 
-static const QString INSERT_CHUNK_FTS_SQL = uR"(
-        insert into chunks_fts(document_id, chunk_text,
-            file, title, author, subject, keywords)
-            values(?, ?, ?, ?, ?, ?, ?);
+static const QString SELECT_PREVIOUS_CHUNKS_SQL = uR"(
+    select id, chunk_hash, file, title, author, subject, keywords from chunks where document_id = ?;
 )"_s;
 
 static const QString SELECT_CHUNKED_DOCUMENTS_SQL[] = {
@@ -190,17 +274,102 @@ static const QString DELETE_CHUNKS_SQL[] = {
         where chunk_id in (
             select id from chunks where document_id = ?
         );
+    )"_s,
+    // FTS5 reads the text of the chunks to remove their full-text entries, so this comes first
+    uR"(
+        delete from chunks_fts where document_id = ?;
     )"_s, uR"(
         delete from chunks where document_id = ?;
+    )"_s,
+};
+
+static const QString DELETE_CHUNKS_BY_ID_SQL[] = {
+    uR"(
+        delete from embeddings where chunk_id in (%1);
+    )"_s,
+    // FTS5 reads the text of the chunk to remove its full-text entry, so this comes first
+    uR"(
+        delete from chunks_fts where rowid in (%1);
     )"_s, uR"(
-        delete from chunks_fts where document_id = ?;
+        delete from chunks where id in (%1);
     )"_s,
 };
 
+// compressed chunks are restored to plain text before their full-text entries are removed; restored chunks no
+// longer match, so this one is repeated until it returns nothing
+static const QString SELECT_COMPRESSED_CHUNKS_SQL = uR"(
+    select id, chunk_text from chunks where dictionary_id is not null limit ?;
+)"_s;
+
+static const QString SELECT_COMPRESSED_CHUNKS_BY_DOCUMENT_SQL = uR"(
+    select id, chunk_text from chunks where document_id = ? and dictionary_id is not null;
+)"_s;
+
+static const QString SELECT_COMPRESSED_CHUNKS_BY_ID_SQL = uR"(
+    select id, chunk_text from chunks where id in (%1) and dictionary_id is not null;
+)"_s;
+
+static const QString HAS_COMPRESSED_CHUNKS_SQL = uR"(
+    select exists(select 1 from chunks where dictionary_id is not null);
+)"_s;
+
+static const QString UPDATE_CHUNK_TEXT_SQL = uR"(
+    update chunks set chunk_text = ?, dictionary_id = ? where id = ?;
+)"_s;
+
+static const QString SELECT_CHUNK_DICTIONARIES_SQL = uR"(
+    select id, dictionary from chunk_dictionaries;
+)"_s;
+
+static const QString SELECT_COLLECTION_DICTIONARY_SQL = uR"(
+    select id from chunk_dictionaries where collection_id = ?;
+)"_s;
+
+static const QString INSERT_CHUNK_DICTIONARY_SQL = uR"(
+    insert into chunk_dictionaries(id, collection_id, dictionary) values(?, ?, ?);
+)"_s;
+
+// dictionaries of removed collections are kept while chunks of folders in other collections still use them
+static const QString DELETE_UNUSED_DICTIONARIES_SQL = uR"(
+    delete from chunk_dictionaries
+    where collection_id not in (select id from collections)
+    and id not in (select dictionary_id from chunks where dictionary_id is not null);
+)"_s;
+
+static const QString SELECT_COLLECTION_IDS_SQL = uR"(
+    select id from collections order by id;
+)"_s;
+
+// training samples from all over the collection
+static const QString SELECT_DICTIONARY_SAMPLES_SQL = uR"(
+    select c.chunk_text
+    from chunks c
+    join documents d on d.id = c.document_id
+    join collection_items ci on ci.folder_id = d.folder_id
+    where ci.collection_id = ? and c.dictionary_id is null
+    order by random() limit ?;
+)"_s;
+
+static const QString SELECT_UNCOMPRESSED_CHUNKS_SQL = uR"(
+    select c.id, c.chunk_text
+    from chunks c
+    join documents d on d.id = c.document_id
+    join collection_items ci on ci.folder_id = d.folder_id
+    where ci.collection_id = ? and c.dictionary_id is null and c.id > ?
+    order by c.id limit ?;
+)"_s;
+
 static const QString SELECT_CHUNKS_BY_DOCUMENT_SQL = uR"(
     select id from chunks WHERE document_id = ?;
 )"_s;
 
+static const QString SELECT_CHUNK_FOLDERS_BY_DOCUMENT_SQL = uR"(
+    select c.id, d.folder_id
+    from chunks c
+    join documents d on d.id = c.document_id
+    where c.document_id = ?;
+)"_s;
+
 static const QString SELECT_CHUNKS_SQL = uR"(
     select c.id, d.document_time, d.document_path, c.chunk_text, c.file, c.title, c.author, c.page, c.line_from, c.line_to, co.name
     from chunks c
@@ -232,15 +401,16 @@ static const QString SELECT_COUNT_CHUNKS_SQL = uR"(
     where d.folder_id = ?;
 )"_s;
 
+// :match is the phrase or any of the terms, phrase matches come first; :folders is a JSON array of folder ids
 static const QString SELECT_CHUNKS_FTS_SQL = uR"(
-    select fts.id, bm25(chunks_fts) as score
+    select fts.rowid, bm25(chunks_fts) as score,
+        fts.rowid in (select rowid from chunks_fts where chunks_fts match :phrase) as exact
     from chunks_fts fts
-    join documents d on fts.document_id = d.id
-    join collection_items ci on d.folder_id = ci.folder_id
-    join collections co on ci.collection_id = co.id
-    where chunks_fts match ?
-    and co.name in ('%1')
-    order by score limit %2;
+    where chunks_fts match :match
+    and fts.document_id in (
+        select id from documents where folder_id in (select value from json_each(:folders))
+    )
+    order by exact desc, score limit :k;
 )"_s;
 
 
@@ -256,11 +426,15 @@ namespace {
     struct IncompleteChunk: EmbeddingKey { int folder_id; QString text; };
 } // namespace
 
-static bool selectAllUncompletedChunks(QSqlQuery &q, QHash<IncompleteChunk, QStringList> &chunks)
+static bool selectAllUncompletedChunks(QSqlQuery &q, const ChunkCompressor &compressor,
+                                       QHash<IncompleteChunk, QStringList> &chunks)
 {
     if (!q.exec(SELECT_UNCOMPLETED_CHUNKS_SQL))
         return false;
     while (q.next()) {
+        std::optional<QString> text = chunkText(compressor, q.value(4));
+        if (!text)
+            continue; // cannot be embedded, it stays uncompleted
         QString collection = q.value(0).toString();
         IncompleteChunk ic {
             /*EmbeddingKey*/ {
@@ -268,7 +442,7 @@ static bool selectAllUncompletedChunks(QSqlQuery &q, QHash<IncompleteChunk, QStr
                 .chunk_id        = q.value(2).toInt(),
             },
             /*folder_id =*/ q.value(3).toInt(),
-            /*text      =*/ q.value(4).toString(),
+            /*text      =*/ std::move(*text),
         };
         chunks[ic] << collection;
     }
@@ -354,10 +528,36 @@ static const QString FTS_INTEGRITY_SQL = uR"(
     insert into chunks_fts(chunks_fts, rank) values('integrity-check', 1);
 )"_s;
 
+// without comparing the index to the content, which is not plain text once chunks are compressed
+static const QString FTS_INDEX_INTEGRITY_SQL = uR"(
+    insert into chunks_fts(chunks_fts) values('integrity-check');
+)"_s;
+
 static const QString FTS_REBUILD_SQL = uR"(
     insert into chunks_fts(chunks_fts) values('rebuild');
 )"_s;
 
+static const QString FTS_OPTIMIZE_SQL = uR"(
+    insert into chunks_fts(chunks_fts) values('optimize');
+)"_s;
+
+static bool sqlAddMissingSchema(QSqlQuery &q)
+{
+    for (const auto &cmd: ADDED_TABLES_SQL) {
+        if (!q.exec(cmd))
+            return false;
+    }
+    for (const auto &[table, column]: ADDED_COLUMNS) {
+        if (!q.exec(u"select * from %1 limit 0;"_s.arg(table)))
+            return false;
+        if (q.record().contains(column.section(u' ', 0, 0)))
+            continue;
+        if (!q.exec(u"alter table %1 add column %2;"_s.arg(table, column)))
+            return false;
+    }
+    return true;
+}
+
 static bool addCollection(QSqlQuery &q, const QString &collection_name, const QDateTime &start_update,
                           const QDateTime &last_update, const QString &embedding_model, CollectionItem &item)
 {
@@ -536,6 +736,33 @@ static const QString FOLDER_REMOVE_ALL_DOCS_SQL[] = {
     )"_s,
 };
 
+// the directory, and the entries below it
+static const QString SELECT_SCAN_JOURNAL_SQL = uR"(
+    select dir_path, dir_time, entry_count from scan_journal
+    where folder_id = :folder and (dir_path = :dir or substr(dir_path, 1, length(:prefix)) = :prefix);
+    )"_s;
+
+static const QString SELECT_DOCUMENT_TIMES_SQL = uR"(
+    select id, document_path, document_time from documents
+    where folder_id = :folder and substr(document_path, 1, length(:prefix)) = :prefix;
+    )"_s;
+
+static const QString UPDATE_SCAN_JOURNAL_SQL = uR"(
+    insert or replace into scan_journal(dir_path, folder_id, dir_time, entry_count) values(?, ?, ?, ?);
+    )"_s;
+
+static const QString DELETE_SCAN_JOURNAL_DIR_SQL = uR"(
+    delete from scan_journal where dir_path = ?;
+    )"_s;
+
+static const QString DELETE_FOLDER_SCAN_JOURNAL_SQL = uR"(
+    delete from scan_journal where folder_id = ?;
+    )"_s;
+
+static const QString CLEAR_SCAN_JOURNAL_SQL = uR"(
+    delete from scan_journal;
+    )"_s;
+
 static bool addFolderToDB(QSqlQuery &q, const QString &folder_path, int *folder_id)
 {
     if (!q.prepare(INSERT_FOLDERS_SQL))
@@ -549,10 +776,14 @@ static bool addFolderToDB(QSqlQuery &q, const QString &folder_path, int *folder_
 
 static bool removeFolderFromDB(QSqlQuery &q, int folder_id)
 {
-    if (!q.prepare(DELETE_FOLDERS_SQL))
-        return false;
-    q.addBindValue(folder_id);
-    return q.exec();
+    for (const auto &sql: { DELETE_FOLDER_SCAN_JOURNAL_SQL, DELETE_FOLDERS_SQL }) {
+        if (!q.prepare(sql))
+            return false;
+        q.addBindValue(folder_id);
+        if (!q.exec())
+            return false;
+    }
+    return true;
 }
 
 static bool selectFolder(QSqlQuery &q, const QString &folder_path, int *id)
@@ -635,12 +866,16 @@ static const QString UPDATE_DOCUMENT_TIME_SQL = uR"(
     update documents set document_time = ? where id = ?;
     )"_s;
 
+static const QString UPDATE_DOCUMENT_HASH_SQL = uR"(
+    update documents set content_hash = ? where id = ?;
+    )"_s;
+
 static const QString DELETE_DOCUMENTS_SQL = uR"(
     delete from documents where id = ?;
     )"_s;
 
 static const QString SELECT_DOCUMENT_SQL = uR"(
-    select id, document_time from documents where document_path = ?;
+    select id, document_time, content_hash from documents where document_path = ?;
     )"_s;
 
 static const QString SELECT_DOCUMENTS_SQL = uR"(
@@ -688,7 +923,17 @@ static bool updateDocument(QSqlQuery &q, int id, qint64 document_time)
     return q.exec();
 }
 
-static bool selectDocument(QSqlQuery &q, const QString &document_path, int *id, qint64 *document_time)
+static bool updateDocumentHash(QSqlQuery &q, int id, const QByteArray &content_hash)
+{
+    if (!q.prepare(UPDATE_DOCUMENT_HASH_SQL))
+        return false;
+    q.addBindValue(content_hash);
+    q.addBindValue(id);
+    return q.exec();
+}
+
+static bool selectDocument(QSqlQuery &q, const QString &document_path, int *id, qint64 *document_time,
+                           QByteArray *content_hash)
 {
     if (!q.prepare(SELECT_DOCUMENT_SQL))
         return false;
@@ -699,6 +944,7 @@ static bool selectDocument(QSqlQuery &q, const QString &document_path, int *id,
     if (q.next()) {
         *id = q.value(0).toInt();
         *document_time = q.value(1).toLongLong();
+        *content_hash = q.value(2).toByteArray();
     }
     return true;
 }
@@ -743,38 +989,90 @@ static const QString INSERT_EMBEDDING_SQL = uR"(
     limit 1;
 )"_s;
 
-static const QString GET_COLLECTION_EMBEDDINGS_SQL = uR"(
-    select e.chunk_id, e.embedding
-    from embeddings e
-    join collections co on co.embedding_model = e.model
-    join collection_items ci on ci.folder_id = e.folder_id and ci.collection_id = co.id
-    where co.name in ('%1');
+static const QString SELECT_COLLECTION_FOLDERS_SQL = uR"(
+    select ci.folder_id, co.embedding_model, co.name
+    from collections co
+    join collection_items ci on ci.collection_id = co.id
+    where co.embedding_model is not null;
+)"_s;
+
+static const QString GET_FOLDER_EMBEDDINGS_SQL = uR"(
+    select chunk_id, embedding
+    from embeddings
+    where model = ? and folder_id in (%1);
+)"_s;
+
+// keyset pagination for building an index without holding a long-running read
+static const QString GET_FOLDER_EMBEDDINGS_BATCH_SQL = uR"(
+    select chunk_id, embedding
+    from embeddings
+    where model = ? and folder_id = ? and chunk_id > ?
+    order by chunk_id
+    limit ?;
+)"_s;
+
+static const QString GET_MODEL_EMBEDDINGS_BATCH_SQL = uR"(
+    select chunk_id, folder_id, embedding
+    from embeddings
+    where model = ? and chunk_id > ?
+    order by chunk_id
+    limit ?;
+)"_s;
+
+static const QString COUNT_MODEL_EMBEDDINGS_SQL = uR"(
+    select count(*) from embeddings where model = ?;
 )"_s;
 
-static const QString GET_CHUNK_EMBEDDINGS_SQL = uR"(
-    select e.chunk_id, e.embedding
-    from embeddings e
-    where e.chunk_id in (%1);
+static const QString COUNT_FOLDER_EMBEDDINGS_SQL = uR"(
+    select count(*) from embeddings where model = ? and folder_id = ?;
+)"_s;
+
+// rows are never deleted, so the sum over the folders of a model also grows with every change
+static const QString GET_MODEL_EMBEDDING_GENERATION_SQL = uR"(
+    select coalesce(sum(generation), 0) from embedding_generations where model = ?;
+)"_s;
+
+static const QString GET_FOLDER_EMBEDDING_GENERATION_SQL = uR"(
+    select coalesce(max(generation), 0) from embedding_generations where model = ? and folder_id = ?;
 )"_s;
 
 static const QString GET_CHUNK_FILE_SQL = uR"(
     select file from chunks where id = ?;
 )"_s;
 
+static const QString INSERT_CACHED_EMBEDDING_SQL = uR"(
+    insert into embedding_cache(text_hash, model, embedding, last_used)
+        select chunk_hash, ?, ?, ? from chunks where id = ? and chunk_hash is not null
+        on conflict(text_hash, model) do update set last_used = excluded.last_used;
+)"_s;
+
+static const QString SELECT_CACHED_EMBEDDINGS_SQL = uR"(
+    select c.id, ec.model, ec.embedding
+    from chunks c
+    join embedding_cache ec on ec.text_hash = c.chunk_hash
+    where c.id in (%1);
+)"_s;
+
+static const QString TRIM_EMBEDDING_CACHE_SQL = uR"(
+    delete from embedding_cache where rowid in (
+        select rowid from embedding_cache order by last_used desc limit -1 offset ?
+    );
+)"_s;
+
 namespace {
-    struct Embedding { QString model; int folder_id; int chunk_id; QByteArray data; };
+    struct Embedding { QString model; int folder_id; int chunk_id; QByteArray data; bool added = false; };
     struct EmbeddingStat { QString lastFile; int nAdded; int nSkipped; };
 } // namespace
 
 NAMED_PAIR(EmbeddingFolder, QString, embedding_model, int, folder_id)
 
-static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats)
+static bool sqlAddEmbeddings(QSqlQuery &q, QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats)
 {
     if (!q.prepare(INSERT_EMBEDDING_SQL))
         return false;
 
     // insert embedding if needed
-    for (const auto &e: embeddings) {
+    for (auto &e: embeddings) {
         q.bindValue(":model", e.model);
         q.bindValue(":chunk_id", e.chunk_id);
         q.bindValue(":embedding", e.data);
@@ -782,7 +1080,8 @@ static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, Q
             return false;
 
         auto &stat = embeddingStats[{ e.model, e.folder_id }];
-        if (q.numRowsAffected()) {
+        e.added = q.numRowsAffected();
+        if (e.added) {
             stat.nAdded++; // embedding added
         } else {
             stat.nSkipped++; // embedding no longer needed
@@ -803,9 +1102,76 @@ static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, Q
         }
     }
 
+    if (!q.prepare(INSERT_CACHED_EMBEDDING_SQL))
+        return false;
+
+    // remember the embeddings by content, including the ones that were served from the cache
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    for (const auto &e: embeddings) {
+        q.addBindValue(e.model);
+        q.addBindValue(e.data);
+        q.addBindValue(now);
+        q.addBindValue(e.chunk_id);
+        if (!q.exec())
+            return false;
+    }
+
+    return true;
+}
+
+static bool sqlTrimEmbeddingCache(QSqlQuery &q)
+{
+    if (!q.prepare(TRIM_EMBEDDING_CACHE_SQL))
+        return false;
+    q.addBindValue(s_embeddingCacheMaxRows);
+    return q.exec();
+}
+
+static bool sqlCountFolderEmbeddings(QSqlQuery &q, const QString &embedding_model, int folder_id, int *count)
+{
+    if (!q.prepare(COUNT_FOLDER_EMBEDDINGS_SQL))
+        return false;
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    if (!q.exec() || !q.next())
+        return false;
+    *count = q.value(0).toInt();
+    return true;
+}
+
+static bool sqlCountModelEmbeddings(QSqlQuery &q, const QString &embedding_model, int *count)
+{
+    if (!q.prepare(COUNT_MODEL_EMBEDDINGS_SQL))
+        return false;
+    q.addBindValue(embedding_model);
+    if (!q.exec() || !q.next())
+        return false;
+    *count = q.value(0).toInt();
     return true;
 }
 
+static std::optional<quint64> sqlFolderEmbeddingGeneration(QSqlQuery &q, const QString &embedding_model,
+                                                           int folder_id)
+{
+    if (!q.prepare(GET_FOLDER_EMBEDDING_GENERATION_SQL))
+        return std::nullopt;
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    if (!q.exec() || !q.next())
+        return std::nullopt;
+    return q.value(0).toULongLong();
+}
+
+static std::optional<quint64> sqlModelEmbeddingGeneration(QSqlQuery &q, const QString &embedding_model)
+{
+    if (!q.prepare(GET_MODEL_EMBEDDING_GENERATION_SQL))
+        return std::nullopt;
+    q.addBindValue(embedding_model);
+    if (!q.exec() || !q.next())
+        return std::nullopt;
+    return q.value(0).toULongLong();
+}
+
 void Database::transaction()
 {
     bool ok = m_db.transaction();
@@ -816,6 +1182,7 @@ void Database::commit()
 {
     bool ok = m_db.commit();
     Q_ASSERT(ok);
+    m_searchGeneration++; // cached search results may be outdated
 }
 
 void Database::rollback()
@@ -836,44 +1203,28 @@ bool Database::refreshDocumentIdCache(QSqlQuery &q)
     return true;
 }
 
-bool Database::addChunk(QSqlQuery &q, int document_id, const QString &chunk_text, const QString &file,
-                        const QString &title, const QString &author, const QString &subject, const QString &keywords,
-                        int page, int from, int to, int words, int *chunk_id)
+bool Database::removeChunksByDocumentId(QSqlQuery &q, int document_id)
 {
-    if (!q.prepare(INSERT_CHUNK_SQL))
-        return false;
-    q.addBindValue(document_id);
-    q.addBindValue(chunk_text);
-    q.addBindValue(file);
-    q.addBindValue(title);
-    q.addBindValue(author);
-    q.addBindValue(subject);
-    q.addBindValue(keywords);
-    q.addBindValue(page);
-    q.addBindValue(from);
-    q.addBindValue(to);
-    q.addBindValue(words);
-    if (!q.exec() || !q.next())
-        return false;
-    *chunk_id = q.value(0).toInt();
+    // remember the chunks so they can also be removed from the loaded vector indexes
+    QList<std::pair<int, int>> removed; // (folder_id, chunk_id)
+    if (!m_embeddingIndexes->indexes().empty() || !m_embeddingSegments.empty()) {
+        if (!q.prepare(SELECT_CHUNK_FOLDERS_BY_DOCUMENT_SQL))
+            return false;
+        q.addBindValue(document_id);
+        if (!q.exec())
+            return false;
+        while (q.next())
+            removed.append({ q.value(1).toInt(), q.value(0).toInt() });
+    }
 
-    if (!q.prepare(INSERT_CHUNK_FTS_SQL))
-        return false;
-    q.addBindValue(document_id);
-    q.addBindValue(chunk_text);
-    q.addBindValue(file);
-    q.addBindValue(title);
-    q.addBindValue(author);
-    q.addBindValue(subject);
-    q.addBindValue(keywords);
-    if (!q.exec())
-        return false;
-    m_documentIdCache << document_id;
-    return true;
-}
+    if (m_hasCompressedChunks) {
+        if (!q.prepare(SELECT_COMPRESSED_CHUNKS_BY_DOCUMENT_SQL))
+            return false;
+        q.addBindValue(document_id);
+        if (!q.exec() || !restoreChunkText(q))
+            return false;
+    }
 
-bool Database::removeChunksByDocumentId(QSqlQuery &q, int document_id)
-{
     for (const auto &cmd: DELETE_CHUNKS_SQL) {
         if (!q.prepare(cmd))
             return false;
@@ -882,6 +1233,72 @@ bool Database::removeChunksByDocumentId(QSqlQuery &q, int document_id)
             return false;
     }
     m_documentIdCache.remove(document_id);
+
+    QWriteLocker locker(&m_vectorLock);
+    for (const auto &[folder_id, chunk_id]: std::as_const(removed)) {
+        m_embeddingIndexes->removeChunk(folder_id, chunk_id);
+        for (auto &[model, segment]: m_embeddingSegments)
+            segment->remove(chunk_id);
+    }
+    if (!removed.isEmpty())
+        m_indexSaveTimer->start();
+    return true;
+}
+
+bool Database::removeChunks(QSqlQuery &q, const QList<std::pair<int, int>> &chunks)
+{
+    if (chunks.isEmpty())
+        return true;
+
+    QStringList chunkStrings;
+    for (const auto &[folder_id, chunk_id]: chunks)
+        chunkStrings << QString::number(chunk_id);
+    const QString chunkIds = chunkStrings.join(u", "_s);
+    if (m_hasCompressedChunks) {
+        if (!q.exec(SELECT_COMPRESSED_CHUNKS_BY_ID_SQL.arg(chunkIds)) || !restoreChunkText(q))
+            return false;
+    }
+    for (const auto &cmd: DELETE_CHUNKS_BY_ID_SQL) {
+        if (!q.exec(cmd.arg(chunkIds)))
+            return false;
+    }
+
+    QWriteLocker locker(&m_vectorLock);
+    for (const auto &[folder_id, chunk_id]: chunks) {
+        m_embeddingIndexes->removeChunk(folder_id, chunk_id);
+        for (auto &[model, segment]: m_embeddingSegments)
+            segment->remove(chunk_id);
+    }
+    m_indexSaveTimer->start();
+    return true;
+}
+
+/* FTS5 removes the full-text entry of a chunk by tokenizing its content again, which must be the text it indexed.
+ * Fails without changing anything if a chunk cannot be decompressed, as removing its entry would then corrupt the
+ * full-text index, and restoring it would lose its text. */
+bool Database::restoreChunkText(QSqlQuery &q, int *nRestored)
+{
+    QList<std::pair<int, QString>> chunks;
+    while (q.next()) {
+        std::optional<QString> text = chunkText(m_chunkCompressor, q.value(1));
+        if (!text)
+            return false;
+        chunks.append({ q.value(0).toInt(), std::move(*text) });
+    }
+    if (nRestored)
+        *nRestored = int(chunks.size());
+    if (chunks.isEmpty())
+        return true;
+
+    if (!q.prepare(UPDATE_CHUNK_TEXT_SQL))
+        return false;
+    for (const auto &[chunk_id, text]: std::as_const(chunks)) {
+        q.addBindValue(text);
+        q.addBindValue(QVariant(QMetaType::fromType<int>())); // null, not compressed
+        q.addBindValue(chunk_id);
+        if (!q.exec())
+            return false;
+    }
     return true;
 }
 
@@ -918,6 +1335,12 @@ int Database::openDatabase(const QString &modelPath, bool create, int ver)
         qWarning() << "ERROR: opening db" << dbPath << m_db.lastError();
         return -1;
     }
+    // let the retrieval connections read while this one writes
+    QSqlQuery q(m_db);
+    for (const auto &cmd: OPEN_DB_SQL) {
+        if (!q.exec(cmd))
+            qWarning() << "ERROR: configuring db" << dbPath << q.lastError();
+    }
     return hasContent();
 }
 
@@ -999,21 +1422,30 @@ bool Database::initDb(const QString &modelPath, const QList<CollectionItem> &old
     return true;
 }
 
-Database::Database(int chunkSize, QStringList extensions)
+Database::Database(int chunkSize, int chunkTokens, QStringList extensions)
     : QObject(nullptr)
     , m_chunkSize(chunkSize)
+    , m_chunkTokens(chunkTokens)
     , m_scannedFileExtensions(std::move(extensions))
     , m_scanIntervalTimer(new QTimer(this))
-    , m_watcher(new QFileSystemWatcher(this))
+    , m_watcher(new FolderWatcher(this))
+    , m_unwatchedScanTimer(new QTimer(this))
     , m_embLLM(new EmbeddingLLM)
     , m_databaseValid(true)
-    , m_chunkStreamer(this)
+    , m_ingestPool(std::make_unique<IngestPool>(std::clamp(int(std::thread::hardware_concurrency()) / 2, 1, 4),
+                                                m_embLLM))
+    , m_readerPool(std::make_unique<ReaderPool>(s_readerThreads))
+    , m_embeddingIndexes(std::make_unique<EmbeddingIndexSet>())
+    , m_indexSaveTimer(new QTimer(this))
 {
     m_db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
     if (!m_db.isValid())
         m_db = QSqlDatabase::addDatabase("QSQLITE");
     Q_ASSERT(m_db.isValid());
 
+    m_queryEmbeddingCache.setMaxCost(s_queryEmbeddingCacheSize);
+    m_searchResultCache.setMaxCost(s_searchResultCacheSize);
+
     moveToThread(&m_dbThread);
     m_dbThread.setObjectName("database");
     m_dbThread.start();
@@ -1021,8 +1453,16 @@ Database::Database(int chunkSize, QStringList extensions)
 
 Database::~Database()
 {
+    // the generations of the saved indexes are read on the thread of the connection
+    if (QThread::currentThread() == &m_dbThread) {
+        saveEmbeddingIndexes();
+    } else if (m_dbThread.isRunning()) {
+        QMetaObject::invokeMethod(this, &Database::saveEmbeddingIndexes, Qt::BlockingQueuedConnection);
+    }
     m_dbThread.quit();
     m_dbThread.wait();
+    m_ingestPool.reset(); // stops the workers
+    m_readerPool.reset();
     delete m_embLLM;
 }
 
@@ -1099,393 +1539,213 @@ static void handleDocumentError(const QString &errorMessage, int document_id, co
     qWarning() << errorMessage << document_id << document_path << error;
 }
 
-class DocumentReader {
-public:
-    struct Metadata { QString title, author, subject, keywords; };
-
-    static std::unique_ptr<DocumentReader> fromDocument(const DocumentInfo &info);
-
-    const DocumentInfo           &doc     () const { return *m_info; }
-    const Metadata               &metadata() const { return m_metadata; }
-    const std::optional<QString> &word    () const { return m_word; }
-    const std::optional<QString> &nextWord()       { m_word = advance(); return m_word; }
-    virtual std::optional<ChunkStreamer::Status> getError() const { return std::nullopt; }
-    virtual int page() const { return -1; }
-
-    virtual ~DocumentReader() = default;
-
-protected:
-    explicit DocumentReader(const DocumentInfo &info)
-        : m_info(&info) {}
-
-    void postInit(Metadata &&metadata = {})
-    {
-        m_metadata = std::move(metadata);
-        m_word = advance();
-    }
-
-    virtual std::optional<QString> advance() = 0;
-
-    const DocumentInfo     *m_info;
-    Metadata                m_metadata;
-    std::optional<QString>  m_word;
-};
-
-namespace {
-
-class PdfDocumentReader final : public DocumentReader {
-public:
-    explicit PdfDocumentReader(const DocumentInfo &info)
-        : DocumentReader(info)
-    {
-        QString path = info.file.canonicalFilePath();
-        if (m_doc.load(path) != QPdfDocument::Error::None)
-            throw std::runtime_error(fmt::format("Failed to load PDF: {}", path));
-        Metadata metadata {
-            .title    = m_doc.metaData(QPdfDocument::MetaDataField::Title   ).toString(),
-            .author   = m_doc.metaData(QPdfDocument::MetaDataField::Author  ).toString(),
-            .subject  = m_doc.metaData(QPdfDocument::MetaDataField::Subject ).toString(),
-            .keywords = m_doc.metaData(QPdfDocument::MetaDataField::Keywords).toString(),
-        };
-        postInit(std::move(metadata));
-    }
-
-    int page() const override { return m_currentPage; }
-
-private:
-    std::optional<QString> advance() override
-    {
-        QString word;
-        do {
-            while (!m_stream || m_stream->atEnd()) {
-                if (m_currentPage >= m_doc.pageCount())
-                    return std::nullopt;
-                m_pageText = m_doc.getAllText(m_currentPage++).text();
-                m_stream.emplace(&m_pageText);
-            }
-            *m_stream >> word;
-        } while (word.isEmpty());
-        return word;
-    }
-
-    QPdfDocument               m_doc;
-    int                        m_currentPage = 0;
-    QString                    m_pageText;
-    std::optional<QTextStream> m_stream;
-};
+IngestPool::IngestPool(int nThreads, EmbeddingLLM *embLLM)
+    : m_embLLM(embLLM)
+{
+    for (int i = 0; i < nThreads; i++)
+        m_threads.emplace_back(&IngestPool::run, this);
+}
 
-class WordDocumentReader final : public DocumentReader {
-public:
-    explicit WordDocumentReader(const DocumentInfo &info)
-        : DocumentReader(info)
-        , m_doc(info.file.canonicalFilePath().toStdString())
+IngestPool::~IngestPool()
+{
     {
-        m_doc.open();
-        if (!m_doc.is_open())
-            throw std::runtime_error(fmt::format("Failed to open DOCX: {}", info.file.canonicalFilePath()));
-
-        m_paragraph = &m_doc.paragraphs();
-        m_run       = &m_paragraph->runs();
-        // TODO(jared): metadata for Word documents?
-        postInit();
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_jobAvailable.wakeAll();
+        m_spaceAvailable.wakeAll();
     }
+    for (auto &thread: m_threads)
+        thread.join();
+}
 
-protected:
-    std::optional<QString> advance() override
-    {
-        // find non-space char
-        qsizetype wordStart = 0;
-        while (m_buffer.isEmpty() || m_buffer[wordStart].isSpace()) {
-            if (m_buffer.isEmpty() && !fillBuffer())
-                return std::nullopt;
-            if (m_buffer[wordStart].isSpace() && ++wordStart >= m_buffer.size()) {
-                m_buffer.clear();
-                wordStart = 0;
-            }
-        }
-
-        // find space char
-        qsizetype wordEnd = wordStart + 1;
-        while (wordEnd >= m_buffer.size() || !m_buffer[wordEnd].isSpace()) {
-            if (wordEnd >= m_buffer.size() && !fillBuffer())
-                break;
-            if (!m_buffer[wordEnd].isSpace())
-                ++wordEnd;
-        }
-
-        if (wordStart == wordEnd)
-            return std::nullopt;
-
-        auto size = wordEnd - wordStart;
-        QString word = std::move(m_buffer);
-        m_buffer = word.sliced(wordStart + size);
-        if (wordStart == 0)
-            word.resize(size);
-        else
-            word = word.sliced(wordStart, size);
-        return word;
-    }
+void IngestPool::submit(IngestJob &&job)
+{
+    QMutexLocker locker(&m_mutex);
+    m_jobs.push_back(std::move(job));
+    m_jobAvailable.wakeOne();
+}
 
-    bool fillBuffer()
-    {
-        for (;;) {
-            // get a run
-            while (!m_run->has_next()) {
-                // try next paragraph
-                if (!m_paragraph->has_next())
-                    return false;
-
-                m_paragraph->next();
-                m_buffer += u'\n';
-            }
+bool IngestPool::take(IngestBatch &batch, int timeoutMs)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_batches.empty() && timeoutMs > 0)
+        m_batchAvailable.wait(locker.mutex(), timeoutMs);
+    if (m_batches.empty())
+        return false;
+    batch = std::move(m_batches.front());
+    m_batches.pop_front();
+    m_spaceAvailable.wakeOne();
+    return true;
+}
 
-            bool foundText = false;
-            auto &run = m_run->get_node();
-            for (auto node = run.first_child(); node; node = node.next_sibling()) {
-                std::string node_name = node.name();
-                if (node_name == "w:t") {
-                    const char *text = node.text().get();
-                    if (*text) {
-                        foundText = true;
-                        m_buffer += QUtf8StringView(text);
-                    }
-                } else if (node_name == "w:br") {
-                    m_buffer += u'\n';
-                } else if (node_name == "w:tab") {
-                    m_buffer += u'\t';
-                }
-            }
+bool IngestPool::push(IngestBatch &&batch)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_stopping && m_batches.size() >= s_ingestQueueBatches)
+        m_spaceAvailable.wait(locker.mutex());
+    if (m_stopping)
+        return false;
+    m_batches.push_back(std::move(batch));
+    m_batchAvailable.wakeOne();
+    return true;
+}
 
-            m_run->next();
-            if (foundText) return true;
+void IngestPool::run()
+{
+    for (;;) {
+        IngestJob job;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (!m_stopping && m_jobs.empty())
+                m_jobAvailable.wait(locker.mutex());
+            if (m_stopping)
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
         }
+        ingest(job);
     }
+}
 
-    duckx::Document   m_doc;
-    duckx::Paragraph *m_paragraph;
-    duckx::Run       *m_run;
-    QString           m_buffer;
-};
-
-class TxtDocumentReader final : public DocumentReader {
-public:
-    explicit TxtDocumentReader(const DocumentInfo &info)
-        : DocumentReader(info)
-        , m_file(info.file.canonicalFilePath())
-    {
-        if (!m_file.open(QIODevice::ReadOnly))
-            throw std::runtime_error(fmt::format("Failed to open text file: {}", m_file.fileName()));
-
-        m_stream.setDevice(&m_file);
-        postInit();
+void IngestPool::ingest(const IngestJob &job)
+{
+    // a file that was only touched, or saved without changes, keeps its chunks as they are
+    QByteArray contentHash = fileHash(job.info.file.canonicalFilePath());
+    if (!contentHash.isEmpty() && contentHash == job.previousHash) {
+        push({ .jobId = job.id, .status = ChunkStreamer::Status::DOC_COMPLETE, .unchanged = true });
+        return;
     }
 
-protected:
-    std::optional<QString> advance() override
-    {
-        if (getError())
-            return std::nullopt;
-        while (!m_stream.atEnd()) {
-            QString word;
-            m_stream >> word;
-            if (getError())
-                return std::nullopt;
-            if (!word.isEmpty())
-                return word;
-        }
-        return std::nullopt;
+    // without a local embedding model, e.g. with the Nomic API, tokens cannot be counted and chunks are cut by size
+    int chunkTokens = 0;
+    if (job.chunkTokens > 0)
+        chunkTokens = std::min(job.chunkTokens, m_embLLM->maxInputTokens());
+    ChunkStreamer streamer(job.chunkSize, chunkTokens, [this](QStringView text) {
+        return m_embLLM->countTokens(text);
+    });
+    try {
+        streamer.setDocument(job.info);
+    } catch (const std::runtime_error &e) {
+        qWarning() << "LocalDocs ERROR:" << e.what();
+        push({ .jobId = job.id, .status = ChunkStreamer::Status::ERROR });
+        return;
     }
 
-    std::optional<ChunkStreamer::Status> getError() const override
-    {
-        if (m_file.binarySeen())
-            return ChunkStreamer::Status::BINARY_SEEN;
-        if (m_file.error())
-            return ChunkStreamer::Status::ERROR;
-        return std::nullopt;
+    for (;;) {
+        IngestBatch batch { .jobId = job.id, .metadata = streamer.metadata(), .contentHash = contentHash };
+        auto status = streamer.step(batch.chunks, s_ingestBatchChunks);
+        if (status != ChunkStreamer::Status::INTERRUPTED)
+            batch.status = status;
+        if (*job.cancelled || !push(std::move(batch)))
+            return;
+        if (status != ChunkStreamer::Status::INTERRUPTED)
+            return;
     }
+}
 
-    BinaryDetectingFile m_file;
-    QTextStream m_stream;
-};
-
-} // namespace
-
-std::unique_ptr<DocumentReader> DocumentReader::fromDocument(const DocumentInfo &doc)
+ReaderPool::ReaderPool(int nThreads)
 {
-    if (doc.isPdf())
-        return std::make_unique<PdfDocumentReader>(doc);
-    if (doc.isDocx())
-        return std::make_unique<WordDocumentReader>(doc);
-    return std::make_unique<TxtDocumentReader>(doc);
+    for (int i = 0; i < nThreads; i++)
+        m_threads.emplace_back(&ReaderPool::work, this, i);
 }
 
-ChunkStreamer::ChunkStreamer(Database *database)
-    : m_database(database) {}
-
-ChunkStreamer::~ChunkStreamer() = default;
-
-void ChunkStreamer::setDocument(const DocumentInfo &doc, int documentId, const QString &embeddingModel)
+ReaderPool::~ReaderPool()
 {
-    auto docKey = doc.key();
-    if (!m_docKey || *m_docKey != docKey) {
-        m_docKey         = docKey;
-        m_reader         = DocumentReader::fromDocument(doc);
-        m_documentId     = documentId;
-        m_embeddingModel = embeddingModel;
-        m_chunk.clear();
-        m_page = 0;
-
-        // make sure the document doesn't already have any chunks
-        if (m_database->m_documentIdCache.contains(documentId)) {
-            QSqlQuery q(m_database->m_db);
-            if (!m_database->removeChunksByDocumentId(q, documentId))
-                handleDocumentError("ERROR: Cannot remove chunks of document", documentId, doc.file.canonicalPath(), q.lastError());
-        }
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_taskAvailable.wakeAll();
     }
+    for (auto &thread: m_threads)
+        thread.join();
 }
 
-std::optional<DocumentInfo::key_type> ChunkStreamer::currentDocKey() const
+void ReaderPool::setDatabasePath(const QString &path)
 {
-    return m_docKey;
+    QMutexLocker locker(&m_mutex);
+    m_databasePath = path;
 }
 
-void ChunkStreamer::reset()
+void ReaderPool::run(const Task &task)
 {
-    m_docKey.reset();
+    PackagedTask packaged(task);
+    auto future = packaged.get_future();
+    {
+        QMutexLocker locker(&m_mutex);
+        m_tasks.push_back(std::move(packaged));
+        m_taskAvailable.wakeOne();
+    }
+    future.wait(); // also returns if the pool stops before running the task
 }
 
-ChunkStreamer::Status ChunkStreamer::step()
+void ReaderPool::post(const Task &task)
 {
-    // TODO: implement line_from/line_to
-    constexpr int line_from = -1;
-    constexpr int line_to = -1;
-    const int folderId = m_reader->doc().folder;
-    const int maxChunkSize = m_database->m_chunkSize;
-    int nChunks = 0;
-    int nAddedWords = 0;
-    Status retval;
-
-    for (;;) {
-        if (auto error = m_reader->getError()) {
-            m_docKey.reset(); // done processing
-            retval = *error;
-            break;
-        }
+    QMutexLocker locker(&m_mutex);
+    m_tasks.emplace_back(task);
+    m_taskAvailable.wakeOne();
+}
 
-        // get a word, if needed
-        std::optional<QString> word = QString(); // empty string to disable EOF logic
-        if (m_chunk.length() < maxChunkSize + 1) {
-            word = m_reader->word();
-            if (m_chunk.isEmpty())
-                m_page = m_reader->page(); // page number of first word
+// statements prepared on the connection of a reader thread, by SQL
+static thread_local std::map<QString, QSqlQuery> *t_readerStatements = nullptr;
+static thread_local const QSqlDatabase *t_readerConnection = nullptr;
 
-            if (word) {
-                m_chunk += *word;
-                m_chunk += u' ';
-                m_reader->nextWord();
-                m_nChunkWords++;
-            }
+QSqlQuery *ReaderPool::prepared(const QString &sql)
+{
+    if (!t_readerStatements)
+        return nullptr;
+    auto it = t_readerStatements->find(sql);
+    if (it == t_readerStatements->end()) {
+        QSqlQuery q(*t_readerConnection);
+        if (!q.prepare(sql)) {
+            qWarning() << "Database ERROR: cannot prepare statement:" << q.lastError();
+            return nullptr;
         }
+        it = t_readerStatements->emplace(sql, std::move(q)).first;
+    }
+    return &it->second;
+}
 
-        if (!word || m_chunk.length() >= maxChunkSize + 1) { // +1 for trailing space
-            if (!m_chunk.isEmpty()) {
-                int nThisChunkWords = 0;
-                auto chunk = m_chunk; // copy
-
-                // handle overlength chunks
-                if (m_chunk.length() > maxChunkSize + 1) {
-                    // find the final space
-                    qsizetype chunkEnd = chunk.lastIndexOf(u' ', -2);
-
-                    qsizetype spaceSize;
-                    if (chunkEnd >= 0) {
-                        // slice off the last word
-                        spaceSize = 1;
-                        Q_ASSERT(m_nChunkWords >= 1);
-                        // one word left
-                        nThisChunkWords = m_nChunkWords - 1;
-                        m_nChunkWords = 1;
-                    } else {
-                        // slice the overlong word
-                        spaceSize = 0;
-                        chunkEnd = maxChunkSize;
-                        // partial word left, don't count it
-                        nThisChunkWords = m_nChunkWords;
-                        m_nChunkWords = 0;
-                    }
-                    // save the second part, excluding space if any
-                    m_chunk = chunk.sliced(chunkEnd + spaceSize);
-                    // consume the first part
-                    chunk.truncate(chunkEnd);
-                } else {
-                    nThisChunkWords = m_nChunkWords;
-                    m_nChunkWords = 0;
-                    // there is no second part
-                    m_chunk.clear();
-                    // consume the whole chunk, excluding space
-                    chunk.chop(1);
-                }
-                Q_ASSERT(chunk.length() <= maxChunkSize);
-
-                QSqlQuery q(m_database->m_db);
-                int chunkId = 0;
-                auto &metadata = m_reader->metadata();
-                if (!m_database->addChunk(q,
-                    m_documentId,
-                    chunk,
-                    m_reader->doc().file.fileName(), // basename
-                    metadata.title,
-                    metadata.author,
-                    metadata.subject,
-                    metadata.keywords,
-                    m_page,
-                    line_from,
-                    line_to,
-                    nThisChunkWords,
-                    &chunkId
-                )) {
-                    qWarning() << "ERROR: Could not insert chunk into db" << q.lastError();
-                }
-
-                nAddedWords += nThisChunkWords;
+void ReaderPool::work(int index)
+{
+    // a connection may only be used by the thread that opened it
+    const QString connectionName = u"localdocs_reader_%1"_s.arg(index);
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setConnectOptions(u"QSQLITE_OPEN_READONLY"_s);
+        std::map<QString, QSqlQuery> statements;
+        t_readerStatements = &statements;
+        t_readerConnection = &db;
 
-                EmbeddingChunk toEmbed;
-                toEmbed.model = m_embeddingModel;
-                toEmbed.folder_id = folderId;
-                toEmbed.chunk_id = chunkId;
-                toEmbed.chunk = chunk;
-                m_database->appendChunk(toEmbed);
-                ++nChunks;
+        for (;;) {
+            PackagedTask task;
+            QString path;
+            {
+                QMutexLocker locker(&m_mutex);
+                while (!m_stopping && m_tasks.empty())
+                    m_taskAvailable.wait(locker.mutex());
+                if (m_stopping)
+                    break;
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+                path = m_databasePath;
             }
 
-            if (!word) {
-                retval = Status::DOC_COMPLETE;
-                m_docKey.reset(); // done processing
-                break;
+            if (db.databaseName() != path || !db.isOpen()) {
+                statements.clear();
+                db.close();
+                db.setDatabaseName(path);
+                if (!path.isEmpty() && !db.open())
+                    qWarning() << "Database ERROR: cannot open reader connection" << path << db.lastError();
             }
+            task(db);
         }
 
-        if (m_database->scanQueueInterrupted()) {
-            retval = Status::INTERRUPTED;
-            break;
-        }
-    }
-
-    if (nChunks) {
-        CollectionItem item = m_database->guiCollectionItem(folderId);
-
-        // Set the start update if we haven't done so already
-        if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
-            m_database->setStartUpdateTime(item);
-
-        item.currentEmbeddingsToIndex += nChunks;
-        item.totalEmbeddingsToIndex += nChunks;
-        item.totalWords += nAddedWords;
-        m_database->updateGuiForCollectionItem(item);
+        t_readerStatements = nullptr;
+        t_readerConnection = nullptr;
+        statements.clear();
+        db.close();
     }
-
-    return retval;
+    QSqlDatabase::removeDatabase(connectionName);
 }
 
 void Database::appendChunk(const EmbeddingChunk &chunk)
@@ -1498,10 +1758,59 @@ void Database::appendChunk(const EmbeddingChunk &chunk)
 
 void Database::sendChunkList()
 {
-    m_embLLM->generateDocEmbeddingsAsync(m_chunkList);
+    embedChunks(m_chunkList);
     m_chunkList.clear();
 }
 
+void Database::embedChunks(const QVector<EmbeddingChunk> &chunks)
+{
+    if (chunks.isEmpty())
+        return;
+
+    // chunks with the same text as one embedded before, in any collection, are not sent to the model again
+    QHash<EmbeddingKey, int> wanted; // -> folder_id
+    QStringList chunkIds;
+    for (const auto &c: chunks) {
+        wanted.insert({ c.model, c.chunk_id }, c.folder_id);
+        chunkIds << QString::number(c.chunk_id);
+    }
+
+    QVector<EmbeddingResult> cached;
+    QSqlQuery q(m_db);
+    if (!q.exec(SELECT_CACHED_EMBEDDINGS_SQL.arg(chunkIds.join(u", "_s)))) {
+        qWarning() << "Database ERROR: cannot look up cached embeddings:" << q.lastError();
+    } else {
+        while (q.next()) {
+            EmbeddingKey key { .embedding_model = q.value(1).toString(), .chunk_id = q.value(0).toInt() };
+            auto it = wanted.find(key);
+            if (it == wanted.end())
+                continue; // made by another model
+            QByteArray data = q.value(2).toByteArray();
+            std::vector<float> embedding(data.size() / sizeof(float));
+            std::memcpy(embedding.data(), data.constData(), embedding.size() * sizeof(float));
+            cached.append({ key.embedding_model, *it, key.chunk_id, std::move(embedding) });
+            wanted.erase(it);
+        }
+    }
+
+    if (cached.isEmpty()) {
+        m_embLLM->generateDocEmbeddingsAsync(chunks);
+    } else {
+        QVector<EmbeddingChunk> toEmbed;
+        for (const auto &c: chunks) {
+            if (wanted.contains({ c.model, c.chunk_id }))
+                toEmbed.append(c);
+        }
+        if (!toEmbed.isEmpty())
+            m_embLLM->generateDocEmbeddingsAsync(toEmbed);
+
+        // the chunks may have been inserted by a transaction that is still open
+        QMetaObject::invokeMethod(this, [this, cached = std::move(cached)] {
+            handleEmbeddingsGenerated(cached);
+        }, Qt::QueuedConnection);
+    }
+}
+
 void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddings)
 {
     Q_ASSERT(!embeddings.isEmpty());
@@ -1515,9 +1824,18 @@ void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddi
         sqlEmbeddings.append({e.model, e.folder_id, e.chunk_id, std::move(data)});
     }
 
+    // load the vector indexes of these folders before the new embeddings make them look outdated
+    QSqlQuery q(m_db);
+    QSet<EmbeddingFolder> folders;
+    for (const auto &e: std::as_const(sqlEmbeddings))
+        folders.insert({ e.model, e.folder_id });
+    for (const auto &f: std::as_const(folders)) {
+        embeddingSegment(q, f.embedding_model);
+        embeddingIndex(q, f.embedding_model, f.folder_id);
+    }
+
     transaction();
 
-    QSqlQuery q(m_db);
     QHash<EmbeddingFolder, EmbeddingStat> stats;
     if (!sqlAddEmbeddings(q, sqlEmbeddings, stats)) {
         qWarning() << "Database ERROR: failed to add embeddings:" << q.lastError();
@@ -1526,6 +1844,47 @@ void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddi
 
     commit();
 
+    // update the vector indexes, including any that are still being built
+    QWriteLocker locker(&m_vectorLock);
+    bool indexesChanged = false;
+    for (const auto &e: std::as_const(sqlEmbeddings)) {
+        if (!e.added)
+            continue;
+        auto *embedding = reinterpret_cast<const float *>(e.data.constData());
+
+        if (auto it = m_embeddingSegments.find(e.model); it != m_embeddingSegments.end()) {
+            auto &segment = it->second;
+            if (size_t(e.data.size()) != segment->dimensions() * sizeof(float)
+                || !segment->add(e.chunk_id, e.folder_id, embedding)
+            ) {
+                qWarning() << "Database ERROR: cannot add embedding to the vector segment of" << e.model;
+                dropEmbeddingSegment(e.model);
+                scheduleEmbeddingSegmentBuild(e.model);
+            }
+            indexesChanged = true; // its generation is stamped again when the indexes are saved
+        }
+
+        auto *index = m_embeddingIndexes->find(e.model, e.folder_id);
+        if (!index)
+            continue;
+        if (size_t(e.data.size()) != index->dimensions() * sizeof(float)) {
+            qWarning() << "Database ERROR: embedding size does not match the vector index of folder" << e.folder_id;
+            m_embeddingIndexes->remove(e.model, e.folder_id);
+            scheduleEmbeddingIndexBuild(e.model, e.folder_id);
+            continue;
+        }
+        if (!index->add(e.chunk_id, embedding)) {
+            m_embeddingIndexes->remove(e.model, e.folder_id);
+            scheduleEmbeddingIndexBuild(e.model, e.folder_id);
+            continue;
+        }
+        indexesChanged = true;
+    }
+    if (indexesChanged)
+        m_indexSaveTimer->start();
+    locker.unlock();
+    m_searchGeneration++; // the vector search sees the new embeddings only now
+
     // FIXME(jared): embedding counts are per-collectionitem, not per-folder
     for (const auto &[key, stat]: std::as_const(stats).asKeyValueRange()) {
         if (!m_collectionMap.contains(key.folder_id)) continue;
@@ -1577,20 +1936,24 @@ void Database::handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const
 
 size_t Database::countOfDocuments(int folder_id) const
 {
+    size_t count = ranges::count_if(m_docsInFlight, [folder_id](auto &e) { return e.second.info.folder == folder_id; });
     if (auto it = m_docsToScan.find(folder_id); it != m_docsToScan.end())
-        return it->second.size();
-    return 0;
+        count += it->second.size();
+    return count;
 }
 
 size_t Database::countOfBytes(int folder_id) const
 {
+    size_t totalBytes = 0;
+    for (const auto &[job_id, state]: m_docsInFlight) {
+        if (state.info.folder == folder_id)
+            totalBytes += state.info.file.size();
+    }
     if (auto it = m_docsToScan.find(folder_id); it != m_docsToScan.end()) {
-        size_t totalBytes = 0;
         for (const DocumentInfo &f : it->second)
             totalBytes += f.file.size();
-        return totalBytes;
     }
-    return 0;
+    return totalBytes;
 }
 
 DocumentInfo Database::dequeueDocument()
@@ -1608,20 +1971,48 @@ DocumentInfo Database::dequeueDocument()
 
 void Database::removeFolderFromDocumentQueue(int folder_id)
 {
-    if (auto queueIt = m_docsToScan.find(folder_id); queueIt != m_docsToScan.end()) {
-        if (auto key = m_chunkStreamer.currentDocKey()) {
-            if (ranges::any_of(queueIt->second, [&key](auto &d) { return d.key() == key; }))
-                m_chunkStreamer.reset(); // done with this document
-        }
-        // remove folder from queue
-        m_docsToScan.erase(queueIt);
-    }
+    // remove folder from queue
+    m_docsToScan.erase(folder_id);
+
+    // stop the workers on documents of this folder, their output is dropped when it arrives
+    std::erase_if(m_docsInFlight, [folder_id](auto &entry) {
+        auto &[job_id, state] = entry;
+        if (state.info.folder != folder_id)
+            return false;
+        *state.cancelled = true;
+        return true;
+    });
 }
 
-void Database::enqueueDocumentInternal(DocumentInfo &&info, bool prepend)
+/* Stops the workers on the document, whose batches are dropped when they arrive, and returns the folder of the job
+ * if there was one. A document has at most one job, as a new one is only submitted after this. */
+std::optional<int> Database::cancelIngestJob(int document_id)
 {
-    auto &queue = m_docsToScan[info.folder];
-    queue.insert(prepend ? queue.begin() : queue.end(), std::move(info));
+    auto it = ranges::find_if(m_docsInFlight, [document_id](auto &entry) {
+        return entry.second.document_id == document_id;
+    });
+    if (it == m_docsInFlight.end())
+        return std::nullopt;
+
+    const IngestState &state = it->second;
+    const int folder_id = state.info.folder;
+    *state.cancelled = true;
+    subtractBytesToIndex(folder_id, state.info.file.size());
+    m_docsInFlight.erase(it);
+    return folder_id;
+}
+
+void Database::subtractBytesToIndex(int folder_id, qint64 bytes)
+{
+    auto item = guiCollectionItem(folder_id);
+    Q_ASSERT(item.currentBytesToIndex >= bytes);
+    if (item.currentBytesToIndex < bytes) {
+        qWarning() << "Database ERROR: underflow in current bytes to index statistics";
+        item.currentBytesToIndex = 0;
+    } else {
+        item.currentBytesToIndex -= bytes;
+    }
+    updateGuiForCollectionItem(item);
 }
 
 void Database::enqueueDocuments(int folder_id, std::list<DocumentInfo> &&infos)
@@ -1631,8 +2022,8 @@ void Database::enqueueDocuments(int folder_id, std::list<DocumentInfo> &&infos)
     queue.splice(queue.end(), std::move(infos));
 
     CollectionItem item = guiCollectionItem(folder_id);
-    item.currentDocsToIndex = queue.size();
-    item.totalDocsToIndex = queue.size();
+    item.currentDocsToIndex = countOfDocuments(folder_id);
+    item.totalDocsToIndex = item.currentDocsToIndex;
     const size_t bytes = countOfBytes(folder_id);
     item.currentBytesToIndex = bytes;
     item.totalBytesToIndex = bytes;
@@ -1645,29 +2036,59 @@ bool Database::scanQueueInterrupted() const
     return m_scanDurationTimer.elapsed() >= 100;
 }
 
+/* Documents are read and chunked by the ingestion workers. This thread remains the only writer: it prepares each
+ * document in the database, hands it to the workers, and writes the chunks they produce in one transaction per
+ * batch interval before passing them on to the embedder. */
 void Database::scanQueueBatch()
 {
     transaction();
 
     m_scanDurationTimer.start();
 
-    // scan for up to the maximum scan duration or until we run out of documents
-    while (!m_docsToScan.empty()) {
+    // keep the workers busy without reading far ahead of what has been written
+    const size_t maxInFlight = m_ingestPool->threadCount() * s_ingestJobsPerThread;
+    while (!m_docsToScan.empty() && m_docsInFlight.size() < maxInFlight) {
         scanQueue();
         if (scanQueueInterrupted())
             break;
     }
 
+    // write chunks for up to the maximum scan duration or until the workers have nothing ready
+    ChunkWriter writer(m_db);
+    bool wroteAny = false;
+    IngestBatch batch;
+    while (!m_docsInFlight.empty() && !scanQueueInterrupted()) {
+        // only wait for the workers when there is no other work to do, this thread also serves searches
+        if (!m_ingestPool->take(batch, wroteAny ? 0 : s_ingestWaitTime))
+            break;
+        writeIngestBatch(writer, batch);
+        wroteAny = true;
+    }
+
+    // index the new chunks for full-text search all at once
+    flushChunks(writer);
+
+    const bool done = m_docsToScan.empty() && m_docsInFlight.empty();
+    if (done && m_ftsRowsSinceOptimize >= s_ftsOptimizeRows) {
+        // after a large import, merge the many small segments of the full-text index
+        QSqlQuery q(m_db);
+        if (!q.exec(FTS_OPTIMIZE_SQL))
+            qWarning() << "Database ERROR: failed to optimize the full-text index:" << q.lastError();
+        m_ftsRowsSinceOptimize = 0;
+    }
+
     commit();
 
-    if (m_docsToScan.empty())
+    if (done) {
         m_scanIntervalTimer->stop();
+        scheduleChunkCompression();
+    }
 }
 
 void Database::scanQueue()
 {
     DocumentInfo info = dequeueDocument();
-    const size_t countForFolder = countOfDocuments(info.folder);
+    size_t countForFolder = countOfDocuments(info.folder);
     const int folder_id = info.folder;
 
     // Update info
@@ -1680,54 +2101,55 @@ void Database::scanQueue()
 
     const qint64 document_time = info.file.fileTime(QFile::FileModificationTime).toMSecsSinceEpoch();
     const QString document_path = info.file.canonicalFilePath();
-    const bool currentlyProcessing = info.currentlyProcessing;
 
     // Check and see if we already have this document
     QSqlQuery q(m_db);
     int existing_id = -1;
     qint64 existing_time = -1;
-    if (!selectDocument(q, document_path, &existing_id, &existing_time)) {
+    QByteArray existing_hash;
+    if (!selectDocument(q, document_path, &existing_id, &existing_time, &existing_hash)) {
         handleDocumentError("ERROR: Cannot select document",
             existing_id, document_path, q.lastError());
         return updateFolderToIndex(folder_id, countForFolder);
     }
 
     // If we have the document, we need to compare the last modification time and if it is newer
-    // we must rescan the document, otherwise return
-    if (existing_id != -1 && !currentlyProcessing) {
+    // we must rescan the document, otherwise return. Its chunks are kept until the workers have read the new
+    // version, so that unchanged content keeps its embeddings.
+    if (existing_id != -1) {
         Q_ASSERT(existing_time != -1);
         if (document_time == existing_time) {
             // No need to rescan, but we do have to schedule next
             return updateFolderToIndex(folder_id, countForFolder);
         }
-        if (!removeChunksByDocumentId(q, existing_id)) {
-            handleDocumentError("ERROR: Cannot remove chunks of document",
-                existing_id, document_path, q.lastError());
-            return updateFolderToIndex(folder_id, countForFolder);
+
+        /* The document changed again while the workers were reading it. That job would go on writing chunks that
+         * are not among the previous chunks of the new job, so it is stopped, and the new job replaces everything it
+         * wrote. Those chunks no longer match the stored content hash. */
+        if (cancelIngestJob(existing_id)) {
+            countForFolder--;
+            existing_hash.clear();
         }
-        updateCollectionStatistics();
     }
 
     // Update the document_time for an existing document, or add it for the first time now
     int document_id = existing_id;
-    if (!currentlyProcessing) {
-        if (document_id != -1) {
-            if (!updateDocument(q, document_id, document_time)) {
-                handleDocumentError("ERROR: Could not update document_time",
-                    document_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
-        } else {
-            if (!addDocument(q, folder_id, document_time, document_path, &document_id)) {
-                handleDocumentError("ERROR: Could not add document",
-                    document_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
-
-            CollectionItem item = guiCollectionItem(folder_id);
-            item.totalDocs += 1;
-            updateGuiForCollectionItem(item);
+    if (document_id != -1) {
+        if (!updateDocument(q, document_id, document_time)) {
+            handleDocumentError("ERROR: Could not update document_time",
+                document_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countForFolder);
         }
+    } else {
+        if (!addDocument(q, folder_id, document_time, document_path, &document_id)) {
+            handleDocumentError("ERROR: Could not add document",
+                document_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countForFolder);
+        }
+
+        CollectionItem item = guiCollectionItem(folder_id);
+        item.totalDocs += 1;
+        updateGuiForCollectionItem(item);
     }
 
     // Get the embedding model for this folder
@@ -1741,49 +2163,192 @@ void Database::scanQueue()
 
     Q_ASSERT(document_id != -1);
 
-    {
-        try {
-            m_chunkStreamer.setDocument(info, document_id, embedding_model);
-        } catch (const std::runtime_error &e) {
-            qWarning() << "LocalDocs ERROR:" << e.what();
-            goto dequeue;
+    IngestState state { info, document_id, embedding_model, std::make_shared<std::atomic<bool>>(false) };
+
+    // remember the chunks we already have, the ones that are still in the document will be reused
+    if (m_documentIdCache.contains(document_id)) {
+        if (!q.prepare(SELECT_PREVIOUS_CHUNKS_SQL)) {
+            handleDocumentError("ERROR: Cannot prepare select of chunks", document_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countForFolder);
+        }
+        q.addBindValue(document_id);
+        if (!q.exec()) {
+            handleDocumentError("ERROR: Cannot select chunks", document_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countForFolder);
+        }
+        while (q.next()) {
+            PreviousChunk chunk {
+                .chunk_id = q.value(0).toInt(),
+                .file     = q.value(2).toString(),
+                .metadata = {
+                    .title    = q.value(3).toString(),
+                    .author   = q.value(4).toString(),
+                    .subject  = q.value(5).toString(),
+                    .keywords = q.value(6).toString(),
+                },
+            };
+            state.previousChunks.insert(q.value(1).toByteArray(), std::move(chunk));
         }
     }
 
-    switch (m_chunkStreamer.step()) {
-    case ChunkStreamer::Status::INTERRUPTED:
-        info.currentlyProcessing = true;
-        enqueueDocumentInternal(std::move(info), /*prepend*/ true);
-        return updateFolderToIndex(folder_id, countForFolder + 1);
+    // hand the document to the ingestion workers, it stays counted for its folder until its last batch is written
+    const quint64 job_id = m_nextIngestJobId++;
+    auto cancelled = state.cancelled;
+    m_docsInFlight.emplace(job_id, std::move(state));
+    m_ingestPool->submit({ job_id, std::move(info), m_chunkSize, m_chunkTokens, existing_hash, std::move(cancelled) });
+}
+
+void Database::writeIngestBatch(ChunkWriter &writer, const IngestBatch &batch)
+{
+    auto it = m_docsInFlight.find(batch.jobId);
+    if (it == m_docsInFlight.end())
+        return; // folder was removed while the document was being read
+    IngestState &state = it->second;
+    const int folder_id = state.info.folder;
+    const QString file = state.info.file.fileName(); // basename
+
+    // chunks that are unchanged since the document was last indexed keep their row and embedding
+    QList<ParsedChunk> newChunks;
+    QSqlQuery q(m_db);
+    for (const ParsedChunk &chunk: batch.chunks) {
+        auto previous = state.previousChunks.find(chunk.hash);
+        while (previous != state.previousChunks.end() && previous.key() == chunk.hash
+               && (previous->file != file || previous->metadata != batch.metadata)) {
+            ++previous; // the full-text entry of the chunk would be outdated
+        }
+        if (previous == state.previousChunks.end() || previous.key() != chunk.hash) {
+            newChunks << chunk;
+            continue;
+        }
+
+        if (!q.prepare(UPDATE_CHUNK_POSITION_SQL)) {
+            qWarning() << "ERROR: Could not prepare chunk update" << q.lastError();
+            newChunks << chunk;
+            continue;
+        }
+        q.addBindValue(chunk.page);
+        q.addBindValue(chunk.words);
+        q.addBindValue(chunk.tokens);
+        q.addBindValue(previous->chunk_id);
+        if (!q.exec()) {
+            qWarning() << "ERROR: Could not update chunk" << q.lastError();
+            newChunks << chunk;
+            continue;
+        }
+        state.previousChunks.erase(previous);
+    }
+
+    QList<int> chunk_ids;
+    if (!writer.add(state.document_id, file, batch.metadata, newChunks, chunk_ids))
+        qWarning() << "ERROR: Could not insert chunks into db" << writer.lastError();
+    if (!chunk_ids.isEmpty())
+        m_documentIdCache << state.document_id;
+
+    int nAddedWords = 0;
+    for (qsizetype i = 0; i < chunk_ids.size(); i++) {
+        const ParsedChunk &chunk = newChunks[i];
+        nAddedWords += chunk.words;
+
+        EmbeddingChunk toEmbed;
+        toEmbed.model = state.embedding_model;
+        toEmbed.folder_id = folder_id;
+        toEmbed.chunk_id = chunk_ids[i];
+        toEmbed.chunk = chunk.text;
+        appendChunk(toEmbed);
+    }
+
+    if (!chunk_ids.isEmpty()) {
+        CollectionItem item = guiCollectionItem(folder_id);
+
+        // Set the start update if we haven't done so already
+        if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
+            setStartUpdateTime(item);
+
+        item.currentEmbeddingsToIndex += chunk_ids.size();
+        item.totalEmbeddingsToIndex += chunk_ids.size();
+        item.totalWords += nAddedWords;
+        updateGuiForCollectionItem(item);
+    }
+
+    if (batch.status)
+        finishIngestJob(writer, batch);
+}
+
+void Database::flushChunks(ChunkWriter &writer)
+{
+    int nIndexed = writer.flush();
+    if (nIndexed < 0)
+        qWarning() << "Database ERROR: failed to add chunks to the full-text index:" << writer.lastError();
+    else
+        m_ftsRowsSinceOptimize += nIndexed;
+}
+
+void Database::finishIngestJob(ChunkWriter &writer, const IngestBatch &batch)
+{
+    auto node = m_docsInFlight.extract(batch.jobId);
+    Q_ASSERT(node);
+    const IngestState &state = node.mapped();
+    const int folder_id = state.info.folder;
+    const QString document_path = state.info.file.canonicalFilePath();
+    const ChunkStreamer::Status status = *batch.status;
+
+    /* The chunks written since the last flush include those of this document, which must be in the full-text index
+     * before chunks of the document are removed. */
+    if (status == ChunkStreamer::Status::BINARY_SEEN || (!batch.unchanged && !state.previousChunks.isEmpty()))
+        flushChunks(writer);
+
+    if (batch.unchanged) {
+        // only the modification time changed, which scanQueue() has already updated
+#if defined(DEBUG)
+        qDebug() << "content of" << document_path << "is unchanged";
+#endif
+    } else {
+        QSqlQuery q(m_db);
+
+        // drop the chunks of the previous version that are no longer in the document
+        if (status != ChunkStreamer::Status::BINARY_SEEN && !state.previousChunks.isEmpty()) {
+            QList<std::pair<int, int>> stale;
+            for (const PreviousChunk &chunk: state.previousChunks)
+                stale.append({ folder_id, chunk.chunk_id });
+            if (!removeChunks(q, stale))
+                handleDocumentError("ERROR: Cannot remove chunks of document", state.document_id, document_path,
+                                    q.lastError());
+            updateCollectionStatistics();
+        }
+
+        // a document that could not be read is read again when it changes
+        if (status != ChunkStreamer::Status::ERROR && !updateDocumentHash(q, state.document_id, batch.contentHash))
+            handleDocumentError("ERROR: Could not update content hash", state.document_id, document_path,
+                                q.lastError());
+    }
+
+    switch (status) {
     case ChunkStreamer::Status::BINARY_SEEN:
-        /* When we see a binary file, we treat it like an empty file so we know not to
-         * scan it again. All existing chunks are removed, and in-progress embeddings
-         * are ignored when they complete. */
-        qInfo() << "LocalDocs: Ignoring file with binary data:" << document_path;
-
-        // this will also ensure in-flight embeddings are ignored
-        if (!removeChunksByDocumentId(q, existing_id))
-            handleDocumentError("ERROR: Cannot remove chunks of document", existing_id, document_path, q.lastError());
-        updateCollectionStatistics();
-        break;
+        {
+            /* When we see a binary file, we treat it like an empty file so we know not to
+             * scan it again. All existing chunks are removed, and in-progress embeddings
+             * are ignored when they complete. */
+            qInfo() << "LocalDocs: Ignoring file with binary data:" << document_path;
+
+            // this will also ensure in-flight embeddings are ignored
+            QSqlQuery q(m_db);
+            if (!removeChunksByDocumentId(q, state.document_id))
+                handleDocumentError("ERROR: Cannot remove chunks of document", state.document_id, document_path,
+                                    q.lastError());
+            updateCollectionStatistics();
+            break;
+        }
     case ChunkStreamer::Status::ERROR:
         qWarning() << "error reading" << document_path;
         break;
+    case ChunkStreamer::Status::INTERRUPTED:
+        Q_UNREACHABLE();
     case ChunkStreamer::Status::DOC_COMPLETE:
         ;
     }
 
-dequeue:
-    auto item = guiCollectionItem(folder_id);
-    Q_ASSERT(item.currentBytesToIndex >= info.file.size());
-    if (item.currentBytesToIndex < info.file.size()) {
-        qWarning() << "Database ERROR: underflow in current bytes to index statistics";
-        item.currentBytesToIndex = 0;
-    } else {
-        item.currentBytesToIndex -= info.file.size();
-    }
-    updateGuiForCollectionItem(item);
-    return updateFolderToIndex(folder_id, countForFolder);
+    subtractBytesToIndex(folder_id, state.info.file.size());
+    updateFolderToIndex(folder_id, countOfDocuments(folder_id));
 }
 
 void Database::scanDocuments(int folder_id, const QString &folder_path)
@@ -1792,41 +2357,192 @@ void Database::scanDocuments(int folder_id, const QString &folder_path)
     qDebug() << "scanning folder for documents" << folder_path;
 #endif
 
-    QDirIterator it(folder_path, QDir::Readable | QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot,
-                    QDirIterator::Subdirectories);
+    // the folder, or a directory in it that changed
+    const QString root = QFileInfo(folder_path).canonicalFilePath();
+    if (root.isEmpty()) {
+        updateFolderToIndex(folder_id, countOfDocuments(folder_id), false);
+        return;
+    }
+
+    // what the last scan saw: the directories, and the documents with their modification times
+    struct KnownDocument { int id; qint64 time; };
+    QHash<QString, ScanJournalEntry> journal;
+    QHash<QString, QStringList> knownSubdirs, knownFiles; // by parent directory
+    QHash<QString, KnownDocument> documents;
+    {
+        QSqlQuery q(m_db);
+        if (!q.prepare(SELECT_SCAN_JOURNAL_SQL))
+            qWarning() << "ERROR: Cannot prepare scan journal query" << q.lastError();
+        q.bindValue(u":folder"_s, folder_id);
+        q.bindValue(u":dir"_s, root);
+        q.bindValue(u":prefix"_s, root + u'/');
+        if (!q.exec())
+            qWarning() << "ERROR: Cannot select scan journal" << q.lastError();
+        while (q.next()) {
+            const QString dir = q.value(0).toString();
+            journal.insert(dir, { q.value(1).toLongLong(), q.value(2).toInt() });
+            knownSubdirs[dir.left(dir.lastIndexOf(u'/'))] << dir;
+        }
+
+        if (!q.prepare(SELECT_DOCUMENT_TIMES_SQL))
+            qWarning() << "ERROR: Cannot prepare document times query" << q.lastError();
+        q.bindValue(u":folder"_s, folder_id);
+        q.bindValue(u":prefix"_s, root + u'/');
+        if (!q.exec())
+            qWarning() << "ERROR: Cannot select document times" << q.lastError();
+        while (q.next()) {
+            const QString path = q.value(1).toString();
+            if (!m_scannedFileExtensions.contains(QFileInfo(path).suffix(), Qt::CaseInsensitive))
+                continue;
+            documents.insert(path, { q.value(0).toInt(), q.value(2).toLongLong() });
+            knownFiles[path.left(path.lastIndexOf(u'/'))] << path;
+        }
+    }
+
     std::list<DocumentInfo> infos;
-    while (it.hasNext()) {
-        it.next();
-        QFileInfo fileInfo = it.fileInfo();
-        if (fileInfo.isDir()) {
-            addFolderToWatch(fileInfo.canonicalFilePath());
+    auto addDocument = [&](const QFileInfo &fileInfo) {
+        // scanQueue() would find it unchanged, without asking the database for each file
+        auto document = documents.constFind(fileInfo.canonicalFilePath());
+        if (document == documents.cend() || document->time != fileInfo.lastModified().toMSecsSinceEpoch())
+            infos.push_back({ folder_id, fileInfo });
+    };
+    QList<int> deletedDocuments;
+
+    QStringList dirsToScan { root };
+    QSet<QString> seenDirs;
+    QList<std::pair<QString, ScanJournalEntry>> journalUpdates;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    while (!dirsToScan.isEmpty()) {
+        const QString dir = dirsToScan.takeLast();
+        if (dir.isEmpty() || seenDirs.contains(dir) || !QFileInfo(dir).isDir())
+            continue; // a directory that is gone is forgotten below
+        seenDirs << dir;
+        auto entry = journal.constFind(dir);
+        if (entry != journal.cend() && entry->isLink()) {
+            addFolderToWatch(folder_id, QFileInfo(dir).canonicalFilePath());
+            continue;
+        }
+        addFolderToWatch(folder_id, dir);
+
+        // an unchanged directory has the entries of the last scan, only its documents need to be checked
+        const qint64 dirTime = QFileInfo(dir).lastModified().toMSecsSinceEpoch();
+        const QStringList subdirs = knownSubdirs.value(dir), files = knownFiles.value(dir);
+        if (entry != journal.cend() && entry->isUnchanged(dirTime, subdirs.size() + files.size())) {
+            for (const QString &file: files) {
+                QFileInfo fileInfo(file);
+                if (fileInfo.exists()) {
+                    addDocument(fileInfo);
+                } else {
+                    deletedDocuments << documents.value(file).id;
+                }
+            }
+            dirsToScan << subdirs;
             continue;
         }
 
-        if (!m_scannedFileExtensions.contains(fileInfo.suffix(), Qt::CaseInsensitive))
+        int entryCount = 0;
+        QSet<QString> listedFiles;
+        QDirIterator it(dir, QDir::Readable | QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+        while (it.hasNext()) {
+            it.next();
+            QFileInfo fileInfo = it.fileInfo();
+            if (fileInfo.isDir()) {
+                if (fileInfo.isSymLink()) {
+                    // like QDirIterator::Subdirectories, links are not followed
+                    addFolderToWatch(folder_id, fileInfo.canonicalFilePath());
+                    seenDirs << fileInfo.absoluteFilePath();
+                    journalUpdates.append({ fileInfo.absoluteFilePath(), ScanJournalEntry::link() });
+                } else {
+                    dirsToScan << fileInfo.canonicalFilePath();
+                }
+                entryCount++;
+                continue;
+            }
+
+            if (!m_scannedFileExtensions.contains(fileInfo.suffix(), Qt::CaseInsensitive))
+                continue;
+
+            addDocument(fileInfo);
+            listedFiles << fileInfo.canonicalFilePath();
+            entryCount++;
+        }
+        for (const QString &file: files) {
+            if (!listedFiles.contains(file))
+                deletedDocuments << documents.value(file).id;
+        }
+        journalUpdates.append({ dir, ScanJournalEntry::listed(dirTime, entryCount, now) });
+    }
+
+    // the documents of directories that are gone
+    for (auto it = knownFiles.cbegin(); it != knownFiles.cend(); ++it) {
+        if (seenDirs.contains(it.key()))
             continue;
+        for (const QString &file: it.value())
+            deletedDocuments << documents.value(file).id;
+    }
 
-        infos.push_back({ folder_id, fileInfo });
+    // record what was listed, and forget the directories that are gone
+    QSqlQuery q(m_db);
+    transaction();
+    bool ok = q.prepare(UPDATE_SCAN_JOURNAL_SQL);
+    for (qsizetype i = 0; ok && i < journalUpdates.size(); i++) {
+        const auto &[dir, entry] = journalUpdates[i];
+        q.addBindValue(dir);
+        q.addBindValue(folder_id);
+        q.addBindValue(entry.dirTime);
+        q.addBindValue(entry.entryCount);
+        ok = q.exec();
+    }
+    ok = ok && q.prepare(DELETE_SCAN_JOURNAL_DIR_SQL);
+    for (auto it = journal.keyBegin(); ok && it != journal.keyEnd(); ++it) {
+        if (!seenDirs.contains(*it)) {
+            unwatchDirectory(*it);
+            q.addBindValue(*it);
+            ok = q.exec();
+        }
+    }
+    if (ok) {
+        commit();
+    } else {
+        qWarning() << "ERROR: Cannot update scan journal" << q.lastError();
+        rollback();
     }
 
+    if (!deletedDocuments.isEmpty())
+        removeDeletedDocuments(deletedDocuments);
+
     if (!infos.empty()) {
         CollectionItem item = guiCollectionItem(folder_id);
         item.indexing = true;
         updateGuiForCollectionItem(item);
         enqueueDocuments(folder_id, std::move(infos));
     } else {
-        updateFolderToIndex(folder_id, 0, false);
+        // nothing changed, but an earlier scan of this folder may still be in progress
+        updateFolderToIndex(folder_id, countOfDocuments(folder_id), false);
     }
 }
 
 void Database::start()
 {
-    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &Database::directoryChanged);
+    connect(m_watcher, &FolderWatcher::changesDetected, this, &Database::handleFolderChanges);
+    connect(m_watcher, &FolderWatcher::watchLost, this, &Database::handleWatchLost);
+    m_unwatchedScanTimer->setInterval(s_unwatchedScanInterval);
+    m_unwatchedScanTimer->callOnTimeout(this, &Database::scanUnwatchedFolders);
     connect(m_embLLM, &EmbeddingLLM::embeddingsGenerated, this, &Database::handleEmbeddingsGenerated);
     connect(m_embLLM, &EmbeddingLLM::errorGenerated, this, &Database::handleErrorGenerated);
     m_scanIntervalTimer->callOnTimeout(this, &Database::scanQueueBatch);
+    // vector indexes are written back lazily, they can always be rebuilt from the database
+    m_indexSaveTimer->setSingleShot(true);
+    m_indexSaveTimer->setInterval(s_indexSaveDelay);
+    m_indexSaveTimer->callOnTimeout(this, &Database::saveEmbeddingIndexes);
 
     const QString modelPath = MySettings::globalInstance()->modelPath();
+    m_vectorQuantization = quantizationFromSetting(MySettings::globalInstance()->localDocsVectorQuantization());
+    m_compressChunks = MySettings::globalInstance()->localDocsCompressChunks() && ChunkCompressor::isAvailable();
+    {
+        QWriteLocker locker(&m_vectorLock);
+        m_embeddingIndexes->setDirectory(u"%1/localdocs_v%2_index"_s.arg(modelPath).arg(LOCALDOCS_VERSION));
+    }
     QList<CollectionItem> oldCollections;
 
     if (!openLatestDb(modelPath, oldCollections)) {
@@ -1834,13 +2550,21 @@ void Database::start()
     } else if (!initDb(modelPath, oldCollections)) {
         m_databaseValid = false;
     } else {
+        QSqlQuery q(m_db);
+        if (!sqlAddMissingSchema(q))
+            qWarning() << "ERROR: failed to add new tables and columns" << q.lastError();
+        if (!loadChunkDictionaries(q))
+            qWarning() << "ERROR: failed to load chunk dictionaries" << q.lastError();
+        if (!sqlTrimEmbeddingCache(q))
+            qWarning() << "ERROR: failed to trim the embedding cache" << q.lastError();
         cleanDB();
         ftsIntegrityCheck();
-        QSqlQuery q(m_db);
         if (!refreshDocumentIdCache(q)) {
             m_databaseValid = false;
         } else {
+            m_readerPool->setDatabasePath(m_db.databaseName());
             addCurrentFolders();
+            scheduleChunkCompression();
         }
     }
 
@@ -1866,10 +2590,8 @@ void Database::addCurrentFolders()
     scheduleUncompletedEmbeddings();
 
     for (const auto &i : collections) {
-        if (!i.forceIndexing) {
-            addFolderToWatch(i.folder_path);
+        if (!i.forceIndexing)
             scanDocuments(i.folder_id, i.folder_path);
-        }
     }
 
     updateCollectionStatistics();
@@ -1879,7 +2601,7 @@ void Database::scheduleUncompletedEmbeddings()
 {
     QHash<IncompleteChunk, QStringList> chunkList;
     QSqlQuery q(m_db);
-    if (!selectAllUncompletedChunks(q, chunkList)) {
+    if (!selectAllUncompletedChunks(q, m_chunkCompressor, chunkList)) {
         qWarning() << "ERROR: Cannot select uncompleted chunks" << q.lastError();
         return;
     }
@@ -1924,7 +2646,7 @@ void Database::scheduleUncompletedEmbeddings()
         for (; it != end && batch.size() < s_batchSize; ++it)
             batch.append({ /*model*/ it->embedding_model, /*folder_id*/ it->folder_id, /*chunk_id*/ it->chunk_id, /*chunk*/ it->text });
         Q_ASSERT(!batch.isEmpty());
-        m_embLLM->generateDocEmbeddingsAsync(batch);
+        embedChunks(batch);
     }
 }
 
@@ -2002,7 +2724,6 @@ void Database::forceIndexing(const QString &collection, const QString &embedding
         item.embeddingModel = embedding_model;
         item.forceIndexing = false;
         updateGuiForCollectionItem(item);
-        addFolderToWatch(folder.second);
         scanDocuments(folder.first, folder.second);
     }
 }
@@ -2027,6 +2748,7 @@ void Database::forceRebuildFolder(const QString &path)
 
     commit();
 
+    removeFolderIndexes(folder_id);
     updateCollectionStatistics();
 
     // We now have zero embeddings. Document progress will be updated by scanDocuments.
@@ -2077,10 +2799,8 @@ bool Database::addFolder(const QString &collection, const QString &path, const Q
         addGuiCollectionItem(item.value());
 
         // note: this is the existing embedding model if the collection was found
-        if (!item->embeddingModel.isNull()) {
-            addFolderToWatch(path);
+        if (!item->embeddingModel.isNull())
             scanDocuments(folder_id, path);
-        }
     }
     return true;
 }
@@ -2104,20 +2824,19 @@ void Database::removeFolder(const QString &collection, const QString &path)
     Q_ASSERT(folder_id != -1);
     if (folder_id == -1) {
         qWarning() << "ERROR: Collected folder does not exist in db" << path;
-        m_watcher->removePath(path);
         return;
     }
 
     transaction();
 
-    if (removeFolderInternal(collection, folder_id, path)) {
+    if (removeFolderInternal(collection, folder_id)) {
         commit();
     } else {
         rollback();
     }
 }
 
-bool Database::removeFolderInternal(const QString &collection, int folder_id, const QString &path)
+bool Database::removeFolderInternal(const QString &collection, int folder_id)
 {
     // Remove it from the collection
     QSqlQuery q(m_db);
@@ -2143,6 +2862,9 @@ bool Database::removeFolderInternal(const QString &collection, int folder_id, co
     // First remove all upcoming jobs associated with this folder
     removeFolderFromDocumentQueue(folder_id);
 
+    // Drop the vector indexes as a whole rather than chunk by chunk
+    removeFolderIndexes(folder_id);
+
     // Get a list of all documents associated with folder
     QList<int> documentIds;
     if (!selectDocuments(q, folder_id, &documentIds)) {
@@ -2169,46 +2891,548 @@ bool Database::removeFolderInternal(const QString &collection, int folder_id, co
     }
 
     m_collectionMap.remove(folder_id);
-    removeFolderFromWatch(path);
+    removeFolderFromWatch(folder_id);
     return true;
 }
 
-void Database::addFolderToWatch(const QString &path)
+void Database::addFolderToWatch(int folder_id, const QString &path)
+{
+#if defined(DEBUG)
+    qDebug() << "addFolderToWatch" << folder_id << path;
+#endif
+    auto it = m_watchedPaths.find(path);
+    if (it != m_watchedPaths.end()) {
+        it->insert(folder_id);
+    } else if (m_watcher->addPath(path)) {
+        m_watchedPaths.insert(path, { folder_id });
+    } else {
+        // e.g. beyond the watch limit, changes are found by rescanning the folder from time to time
+        m_unwatchedFolders << folder_id;
+        if (!m_unwatchedScanTimer->isActive())
+            m_unwatchedScanTimer->start();
+    }
+}
+
+void Database::removeFolderFromWatch(int folder_id)
+{
+#if defined(DEBUG)
+    qDebug() << "removeFolderFromWatch" << folder_id;
+#endif
+    QStringList unwatched;
+    for (auto it = m_watchedPaths.begin(); it != m_watchedPaths.end();) {
+        if (it->remove(folder_id) && it->isEmpty()) {
+            unwatched << it.key();
+            it = m_watchedPaths.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_watcher->removePaths(unwatched);
+
+    m_unwatchedFolders.remove(folder_id);
+    if (m_unwatchedFolders.isEmpty())
+        m_unwatchedScanTimer->stop();
+}
+
+// stops watching a directory that no longer exists, so it is watched again if it comes back
+void Database::unwatchDirectory(const QString &path)
+{
+    if (m_watchedPaths.remove(path))
+        m_watcher->removePaths({ path });
+}
+
+void Database::handleWatchLost(const QString &path)
+{
+#if defined(DEBUG)
+    qDebug() << "handleWatchLost" << path;
+#endif
+    auto it = m_watchedPaths.find(path);
+    if (it == m_watchedPaths.end())
+        return;
+
+    // the directory may have been created again, and listed, before its old watch was reported lost
+    if (QFileInfo(path).isDir()) {
+        if (m_watcher->addPath(path))
+            return;
+        for (int folder_id: std::as_const(*it))
+            m_unwatchedFolders << folder_id;
+        if (!m_unwatchedScanTimer->isActive())
+            m_unwatchedScanTimer->start();
+    }
+    m_watchedPaths.erase(it);
+}
+
+void Database::removeDeletedDocuments(const QList<int> &documentIds)
 {
+    // a document that is being read would otherwise get chunks under an id that no longer exists
+    QSet<int> cancelledFolders;
+    for (int document_id: documentIds) {
+        if (auto folder_id = cancelIngestJob(document_id))
+            cancelledFolders << *folder_id;
+    }
+    for (int folder_id: std::as_const(cancelledFolders))
+        updateFolderToIndex(folder_id, countOfDocuments(folder_id));
+
+    QSqlQuery q(m_db);
+    transaction();
+    for (int document_id: documentIds) {
 #if defined(DEBUG)
-    qDebug() << "addFolderToWatch" << path;
+        qDebug() << "removing deleted document" << document_id;
 #endif
-    // pre-check because addPath returns false for already watched paths
-    if (!m_watchedPaths.contains(path)) {
-        if (!m_watcher->addPath(path))
-            qWarning() << "Database::addFolderToWatch: failed to watch" << path;
-        // add unconditionally to suppress repeated warnings
-        m_watchedPaths << path;
+        if (!removeChunksByDocumentId(q, document_id)) {
+            qWarning() << "ERROR: Cannot remove chunks of document_id" << document_id << q.lastError();
+            return rollback();
+        }
+        if (!removeDocument(q, document_id)) {
+            qWarning() << "ERROR: Cannot remove document_id" << document_id << q.lastError();
+            return rollback();
+        }
     }
+    commit();
+    updateCollectionStatistics();
 }
 
-void Database::removeFolderFromWatch(const QString &path)
+EmbeddingIndex *Database::embeddingIndex(QSqlQuery &q, const QString &embedding_model, int folder_id)
 {
+    QWriteLocker locker(&m_vectorLock);
+    if (auto *index = m_embeddingIndexes->find(embedding_model, folder_id))
+        return index;
+
+    // an index saved by an earlier session can miss changes made after it was saved, e.g. before a crash
+    if (auto *index = m_embeddingIndexes->load(embedding_model, folder_id)) {
+        int count;
+        const std::optional<quint64> generation = sqlFolderEmbeddingGeneration(q, embedding_model, folder_id);
+        if (generation && index->savedGeneration() == generation
+            && sqlCountFolderEmbeddings(q, embedding_model, folder_id, &count) && size_t(count) == index->size()
+        ) {
+            return index;
+        }
 #if defined(DEBUG)
-    qDebug() << "removeFolderFromWatch" << path;
+        qDebug() << "discarding outdated vector index for folder" << folder_id;
 #endif
-    QDirIterator it(path, QDir::Readable | QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
-    QStringList children { path };
-    while (it.hasNext())
-        children.append(it.next());
+        m_embeddingIndexes->remove(embedding_model, folder_id);
+    }
+
+    scheduleEmbeddingIndexBuild(embedding_model, folder_id);
+    return nullptr;
+}
 
-    m_watcher->removePaths(children);
-    m_watchedPaths -= QSet(children.begin(), children.end());
+void Database::scheduleEmbeddingIndexBuild(const QString &embedding_model, int folder_id)
+{
+    std::pair key { embedding_model, folder_id };
+    if (m_indexesToBuild.contains(key))
+        return;
+    m_indexesToBuild.append(key);
+    if (m_indexesToBuild.size() == 1)
+        QTimer::singleShot(0, this, &Database::buildEmbeddingIndexes);
 }
 
-QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q, int nNeighbors)
+void Database::buildEmbeddingIndexes()
+{
+    if (m_indexesToBuild.isEmpty())
+        return;
+
+    QWriteLocker locker(&m_vectorLock);
+
+    // Builds proceed one batch per event loop iteration so searches and indexing are not blocked. Embeddings
+    // added in the meantime go straight into the partial index, which is not used for search until complete.
+    const auto [embedding_model, folder_id] = m_indexesToBuild.first();
+    EmbeddingIndex *index = m_embeddingIndexes->find(embedding_model, folder_id);
+
+    auto finish = [&](bool ok) {
+        if (!ok)
+            m_embeddingIndexes->remove(embedding_model, folder_id);
+        m_indexesToBuild.removeFirst();
+        m_indexBuildCursor = 0;
+        if (!m_indexesToBuild.isEmpty())
+            QTimer::singleShot(0, this, &Database::buildEmbeddingIndexes);
+    };
+
+    QSqlQuery q(m_db);
+    if (!q.prepare(GET_FOLDER_EMBEDDINGS_BATCH_SQL)) {
+        qWarning() << "Database ERROR: Failed to prepare embeddings query:" << q.lastError();
+        return finish(false);
+    }
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    q.addBindValue(m_indexBuildCursor);
+    q.addBindValue(s_indexBuildBatchSize);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
+        return finish(false);
+    }
+
+    int nRows = 0;
+    while (q.next()) {
+        nRows++;
+        const int chunk_id = q.value(0).toInt();
+        const QByteArray embedding = q.value(1).toByteArray();
+        m_indexBuildCursor = chunk_id;
+
+        if (!index) {
+            index = m_embeddingIndexes->create(embedding_model, folder_id, embedding.size() / sizeof(float));
+            if (!index)
+                return finish(false);
+        }
+        if (size_t(embedding.size()) != index->dimensions() * sizeof(float)) {
+            qWarning() << "Database ERROR: Expected embedding to be" << index->dimensions() * sizeof(float)
+                       << "bytes, got" << embedding.size();
+            return finish(false);
+        }
+        if (!index->contains(chunk_id) && !index->add(chunk_id, reinterpret_cast<const float *>(embedding.constData())))
+            return finish(false);
+    }
+
+    if (nRows == s_indexBuildBatchSize) {
+        QTimer::singleShot(0, this, &Database::buildEmbeddingIndexes); // more to come
+        return;
+    }
+
+    if (index) {
+        index->setComplete();
+        if (auto generation = sqlFolderEmbeddingGeneration(q, embedding_model, folder_id))
+            index->save(*generation);
+    }
+    finish(true);
+}
+
+EmbeddingSegment *Database::embeddingSegment(QSqlQuery &q, const QString &embedding_model)
+{
+    QWriteLocker locker(&m_vectorLock);
+    if (auto it = m_embeddingSegments.find(embedding_model); it != m_embeddingSegments.end())
+        return it->second.get();
+    if (!m_embeddingIndexes->hasDirectory())
+        return nullptr;
+
+    // like the indexes, a segment is only trusted if it still matches the embeddings table
+    const QString basePath = m_embeddingIndexes->basePathFor(embedding_model);
+    if (auto segment = EmbeddingSegment::open(basePath)) {
+        int count;
+        const std::optional<quint64> generation = sqlModelEmbeddingGeneration(q, embedding_model);
+        if (segment->isComplete() && generation && segment->generation() == generation
+            && sqlCountModelEmbeddings(q, embedding_model, &count) && size_t(count) == segment->size()
+        ) {
+            segment->setQuantization(m_vectorQuantization);
+            return m_embeddingSegments.emplace(embedding_model, std::move(segment)).first->second.get();
+        }
+#if defined(DEBUG)
+        qDebug() << "discarding outdated vector segment for" << embedding_model;
+#endif
+    }
+
+    EmbeddingSegment::removeFiles(basePath);
+    scheduleEmbeddingSegmentBuild(embedding_model);
+    return nullptr;
+}
+
+void Database::scheduleEmbeddingSegmentBuild(const QString &embedding_model)
+{
+    if (m_segmentsToBuild.contains(embedding_model))
+        return;
+    m_segmentsToBuild.append(embedding_model);
+    if (m_segmentsToBuild.size() == 1)
+        QTimer::singleShot(0, this, &Database::buildEmbeddingSegments);
+}
+
+void Database::dropEmbeddingSegment(const QString &embedding_model)
+{
+    QWriteLocker locker(&m_vectorLock);
+    m_embeddingSegments.erase(embedding_model);
+    EmbeddingSegment::removeFiles(m_embeddingIndexes->basePathFor(embedding_model));
+}
+
+void Database::buildEmbeddingSegments()
+{
+    if (m_segmentsToBuild.isEmpty())
+        return;
+
+    QWriteLocker locker(&m_vectorLock);
+
+    // same approach as buildEmbeddingIndexes(), one batch per event loop iteration
+    const QString embedding_model = m_segmentsToBuild.first();
+    auto it = m_embeddingSegments.find(embedding_model);
+    EmbeddingSegment *segment = it != m_embeddingSegments.end() ? it->second.get() : nullptr;
+
+    auto finish = [&](bool ok) {
+        if (!ok)
+            dropEmbeddingSegment(embedding_model);
+        m_segmentsToBuild.removeFirst();
+        m_segmentBuildCursor = 0;
+        if (!m_segmentsToBuild.isEmpty())
+            QTimer::singleShot(0, this, &Database::buildEmbeddingSegments);
+    };
+
+    QSqlQuery q(m_db);
+    if (!q.prepare(GET_MODEL_EMBEDDINGS_BATCH_SQL)) {
+        qWarning() << "Database ERROR: Failed to prepare embeddings query:" << q.lastError();
+        return finish(false);
+    }
+    q.addBindValue(embedding_model);
+    q.addBindValue(m_segmentBuildCursor);
+    q.addBindValue(s_indexBuildBatchSize);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
+        return finish(false);
+    }
+
+    int nRows = 0;
+    while (q.next()) {
+        nRows++;
+        const int chunk_id = q.value(0).toInt();
+        const int folder_id = q.value(1).toInt();
+        const QByteArray embedding = q.value(2).toByteArray();
+        m_segmentBuildCursor = chunk_id;
+
+        if (!segment) {
+            auto created = EmbeddingSegment::create(m_embeddingIndexes->basePathFor(embedding_model),
+                                                    embedding.size() / sizeof(float));
+            if (!created)
+                return finish(false);
+            created->setQuantization(m_vectorQuantization);
+            segment = m_embeddingSegments.emplace(embedding_model, std::move(created)).first->second.get();
+        }
+        if (size_t(embedding.size()) != segment->dimensions() * sizeof(float)) {
+            qWarning() << "Database ERROR: Expected embedding to be" << segment->dimensions() * sizeof(float)
+                       << "bytes, got" << embedding.size();
+            return finish(false);
+        }
+        if (!segment->contains(chunk_id)
+            && !segment->add(chunk_id, folder_id, reinterpret_cast<const float *>(embedding.constData()))
+        ) {
+            return finish(false);
+        }
+    }
+
+    if (nRows == s_indexBuildBatchSize) {
+        QTimer::singleShot(0, this, &Database::buildEmbeddingSegments); // more to come
+        return;
+    }
+
+    if (segment) {
+        segment->setComplete();
+        if (auto generation = sqlModelEmbeddingGeneration(q, embedding_model))
+            segment->setGeneration(*generation);
+    }
+    finish(true);
+}
+
+bool Database::loadChunkDictionaries(QSqlQuery &q)
+{
+    if (!q.exec(SELECT_CHUNK_DICTIONARIES_SQL))
+        return false;
+    while (q.next()) {
+        if (!m_chunkCompressor.addDictionary(q.value(1).toByteArray()))
+            qWarning() << "Database ERROR: Cannot load chunk dictionary" << q.value(0).toUInt();
+    }
+
+    if (!q.exec(HAS_COMPRESSED_CHUNKS_SQL) || !q.next())
+        return false;
+    m_hasCompressedChunks = q.value(0).toBool();
+    if (m_hasCompressedChunks && !ChunkCompressor::isAvailable())
+        qWarning() << "Database ERROR: This build cannot read the compressed chunks of the database";
+    return true;
+}
+
+void Database::scheduleChunkCompression()
+{
+    // chunks added to a collection after the pass went past it are compressed by the next pass
+    if (!m_compressChunks || !m_collectionsToCompress.isEmpty())
+        return;
+
+    QSqlQuery q(m_db);
+    if (!q.exec(SELECT_COLLECTION_IDS_SQL)) {
+        qWarning() << "Database ERROR: Cannot select collections:" << q.lastError();
+        return;
+    }
+    while (q.next())
+        m_collectionsToCompress.append(q.value(0).toInt());
+    m_compressCursor = 0;
+    if (!m_collectionsToCompress.isEmpty())
+        QTimer::singleShot(0, this, &Database::compressChunks);
+}
+
+quint32 Database::collectionDictionary(QSqlQuery &q, int collection_id)
+{
+    if (!q.prepare(SELECT_COLLECTION_DICTIONARY_SQL)) {
+        qWarning() << "Database ERROR: Failed to prepare dictionary query:" << q.lastError();
+        return 0;
+    }
+    q.addBindValue(collection_id);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec dictionary query:" << q.lastError();
+        return 0;
+    }
+    if (q.next())
+        return q.value(0).toUInt();
+
+    // a dictionary is trained once, when the collection is large enough to have one
+    if (!q.prepare(SELECT_DICTIONARY_SAMPLES_SQL)) {
+        qWarning() << "Database ERROR: Failed to prepare samples query:" << q.lastError();
+        return 0;
+    }
+    q.addBindValue(collection_id);
+    q.addBindValue(s_dictionarySamples);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec samples query:" << q.lastError();
+        return 0;
+    }
+    QList<QByteArray> samples;
+    while (q.next())
+        samples.append(q.value(0).toString().toUtf8());
+    if (samples.size() < s_dictionaryMinSamples)
+        return 0;
+
+    const QByteArray dictionary = ChunkCompressor::trainDictionary(samples);
+    const quint32 id = ChunkCompressor::dictionaryId(dictionary);
+    // ids are derived from the content of a dictionary, in the unlikely case of a collision the collection is skipped
+    if (!id || m_chunkCompressor.hasDictionary(id))
+        return 0;
+
+    if (!q.prepare(INSERT_CHUNK_DICTIONARY_SQL)) {
+        qWarning() << "Database ERROR: Failed to prepare dictionary insert:" << q.lastError();
+        return 0;
+    }
+    q.addBindValue(id);
+    q.addBindValue(collection_id);
+    q.addBindValue(dictionary);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to insert dictionary:" << q.lastError();
+        return 0;
+    }
+    if (!m_chunkCompressor.addDictionary(dictionary))
+        return 0;
+
+#if defined(DEBUG)
+    qDebug() << "trained chunk dictionary" << id << "of" << dictionary.size() << "bytes for collection"
+             << collection_id << "from" << samples.size() << "chunks";
+#endif
+    return id;
+}
+
+/* Chunks are written as plain text and indexed for full-text search, then compressed here in the background. The
+ * full-text index keeps the words it took from the plain text, and FTS5 only reads the content again to remove an
+ * entry, before which removeChunks() and removeChunksByDocumentId() restore it. */
+void Database::compressChunks()
+{
+    if (m_collectionsToCompress.isEmpty())
+        return;
+    if (!m_compressChunks) {
+        m_collectionsToCompress.clear();
+        return;
+    }
+
+    // same approach as buildEmbeddingIndexes(), one batch per event loop iteration
+    const int collection_id = m_collectionsToCompress.first();
+    auto finish = [&] {
+        m_collectionsToCompress.removeFirst();
+        m_compressCursor = 0;
+        if (!m_collectionsToCompress.isEmpty())
+            QTimer::singleShot(0, this, &Database::compressChunks);
+    };
+
+    QSqlQuery q(m_db);
+    const quint32 dictionary_id = collectionDictionary(q, collection_id);
+    if (!dictionary_id)
+        return finish();
+
+    if (!q.prepare(SELECT_UNCOMPRESSED_CHUNKS_SQL)) {
+        qWarning() << "Database ERROR: Failed to prepare chunks query:" << q.lastError();
+        return finish();
+    }
+    q.addBindValue(collection_id);
+    q.addBindValue(m_compressCursor);
+    q.addBindValue(s_compressBatchSize);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec chunks query:" << q.lastError();
+        return finish();
+    }
+
+    QList<std::pair<int, QByteArray>> frames;
+    while (q.next()) {
+        const int chunk_id = q.value(0).toInt();
+        QByteArray frame = m_chunkCompressor.compress(dictionary_id, q.value(1).toString());
+        if (frame.isEmpty())
+            return finish();
+        frames.append({ chunk_id, std::move(frame) });
+        m_compressCursor = chunk_id;
+    }
+
+    transaction();
+    if (!q.prepare(UPDATE_CHUNK_TEXT_SQL)) {
+        qWarning() << "Database ERROR: Failed to prepare chunk update:" << q.lastError();
+        rollback();
+        return finish();
+    }
+    for (const auto &[chunk_id, frame]: std::as_const(frames)) {
+        q.addBindValue(frame);
+        q.addBindValue(dictionary_id);
+        q.addBindValue(chunk_id);
+        if (!q.exec()) {
+            qWarning() << "Database ERROR: Failed to update chunk" << chunk_id << q.lastError();
+            rollback();
+            return finish();
+        }
+    }
+    commit();
+    if (!frames.isEmpty())
+        m_hasCompressedChunks = true;
+
+    if (frames.size() == s_compressBatchSize) {
+        QTimer::singleShot(0, this, &Database::compressChunks); // more to come
+        return;
+    }
+    finish();
+}
+
+void Database::saveEmbeddingIndexes()
+{
+    QWriteLocker locker(&m_vectorLock);
+    QSqlQuery q(m_db);
+    m_embeddingIndexes->saveAll([&q](const QString &model, int folderId) {
+        return sqlFolderEmbeddingGeneration(q, model, folderId);
+    });
+    for (auto &[model, segment]: m_embeddingSegments) {
+        if (segment->needsCompaction())
+            segment->compact();
+        // the rows match the database again, they are only changed along with it
+        if (segment->isComplete()) {
+            if (auto generation = sqlModelEmbeddingGeneration(q, model))
+                segment->setGeneration(*generation);
+        }
+    }
+}
+
+void Database::removeFolderIndexes(int folder_id)
+{
+    QWriteLocker locker(&m_vectorLock);
+    m_embeddingIndexes->removeFolder(folder_id);
+    for (auto &[model, segment]: m_embeddingSegments)
+        segment->removeFolder(folder_id);
+
+    if (!m_indexesToBuild.isEmpty() && m_indexesToBuild.first().second == folder_id)
+        m_indexBuildCursor = 0;
+    m_indexesToBuild.removeIf([folder_id](const auto &key) { return key.second == folder_id; });
+}
+
+static void keepNearest(QList<EmbeddingMatch> &matches, int k)
+{
+    k = qMin(k, matches.size());
+    std::partial_sort(
+        matches.begin(), matches.begin() + k, matches.end(),
+        [](const EmbeddingMatch &a, const EmbeddingMatch &b) { return a.distance < b.distance; }
+    );
+    matches.resize(k);
+}
+
+QList<EmbeddingMatch> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q,
+    int nNeighbors)
 {
     constexpr int BATCH_SIZE = 2048;
 
     const int n_embd = query.size();
     const us::metric_punned_t metric(n_embd, us::metric_kind_t::ip_k); // inner product
 
-    us::executor_default_t executor(std::thread::hardware_concurrency());
+    // single-threaded, concurrent retrievals already run on their own reader threads
     us::exact_search_t search;
 
     QList<int> batchChunkIds;
@@ -2216,8 +3440,7 @@ QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSq
     batchChunkIds.reserve(BATCH_SIZE);
     batchEmbeddings.reserve(BATCH_SIZE * n_embd);
 
-    struct Result { int chunkId; us::distance_punned_t dist; };
-    QList<Result> results;
+    QList<EmbeddingMatch> results;
 
     // The q parameter is expected to be the result of a QSqlQuery returning (chunk_id, embedding) pairs
     while (q.at() != QSql::AfterLastRow) { // batches
@@ -2262,41 +3485,185 @@ QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSq
     }
 
     // get top-k nearest neighbors of combined results
-    nNeighbors = qMin(nNeighbors, results.size());
-    std::partial_sort(
-        results.begin(), results.begin() + nNeighbors, results.end(),
-        [](const Result &a, const Result &b) { return a.dist < b.dist; }
-    );
+    keepNearest(results, nNeighbors);
+    return results;
+}
 
-    QList<int> chunkIds;
-    chunkIds.reserve(nNeighbors);
-    for (int i = 0; i < nNeighbors; i++)
-        chunkIds << results[i].chunkId;
-    return chunkIds;
+void Database::requestEmbeddingIndexes(const QString &embedding_model, const QList<int> &folder_ids)
+{
+    // readers cannot load or build vector indexes themselves, so this happens later on the database thread
+    QMetaObject::invokeMethod(this, [this, embedding_model, folder_ids] {
+        QSqlQuery q(m_db);
+        embeddingSegment(q, embedding_model);
+        for (int folder_id: folder_ids)
+            embeddingIndex(q, embedding_model, folder_id);
+    }, Qt::QueuedConnection);
 }
 
-QList<int> Database::searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections,
-    int nNeighbors)
+QList<EmbeddingMatch> Database::searchFolderEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+    const QString &embedding_model, const QList<int> &folder_ids, int nNeighbors)
 {
-    QSqlQuery q(m_db);
-    if (!q.exec(GET_COLLECTION_EMBEDDINGS_SQL.arg(collections.join("', '")))) {
+    {
+        QReadLocker locker(&m_vectorLock);
+        auto it = m_embeddingSegments.find(embedding_model);
+        if (it != m_embeddingSegments.end()) {
+            auto &segment = it->second;
+            if (segment->isComplete() && segment->dimensions() == query.size())
+                return segment->search(query.data(), QSet<int>(folder_ids.begin(), folder_ids.end()), nNeighbors);
+        } else {
+            requestEmbeddingIndexes(embedding_model, {});
+        }
+    }
+
+    QSqlQuery q(db);
+
+    // no usable segment yet, read the embeddings from the database
+    QStringList folderStrings;
+    for (int id : folder_ids)
+        folderStrings << QString::number(id);
+    if (!q.prepare(GET_FOLDER_EMBEDDINGS_SQL.arg(folderStrings.join(", ")))) {
+        qWarning() << "Database ERROR: Failed to prepare embeddings query:" << q.lastError();
+        return {};
+    }
+    q.addBindValue(embedding_model);
+    if (!q.exec()) {
         qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
         return {};
     }
     return searchEmbeddingsHelper(query, q, nNeighbors);
 }
 
-QList<int> Database::scoreChunks(const std::vector<float> &query, const QList<int> &chunks)
+void Database::checkIndexRecall(const QSqlDatabase &db, const std::vector<float> &query,
+    const QString &embedding_model, const QList<int> &folder_ids, const QList<EmbeddingMatch> &annMatches,
+    int nNeighbors)
 {
-    QList<QString> chunkStrings;
-    for (int id : chunks)
-        chunkStrings << QString::number(id);
-    QSqlQuery q(m_db);
-    if (!q.exec(GET_CHUNK_EMBEDDINGS_SQL.arg(chunkStrings.join(", ")))) {
-        qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
-        return {};
+    QList<EmbeddingMatch> approx = annMatches;
+    keepNearest(approx, nNeighbors);
+    const QList<EmbeddingMatch> exact = searchFolderEmbeddings(db, query, embedding_model, folder_ids, nNeighbors);
+    if (exact.isEmpty())
+        return;
+
+    QSet<int> approxIds;
+    for (const auto &m: std::as_const(approx))
+        approxIds << m.chunkId;
+    int nFound = ranges::count_if(exact, [&](const EmbeddingMatch &m) { return approxIds.contains(m.chunkId); });
+    double recall = double(nFound) / exact.size();
+#if defined(DEBUG)
+    qDebug() << "vector index recall" << recall << "for folders" << folder_ids;
+#endif
+    if (recall >= s_indexMinRecall)
+        return;
+
+    // trade some speed for accuracy on the indexes that missed, other readers may be searching them right now
+    qWarning() << "Database: vector index recall" << recall << "is below" << s_indexMinRecall
+               << "- widening the search";
+    QMetaObject::invokeMethod(this, [this, embedding_model, folder_ids] {
+        QWriteLocker locker(&m_vectorLock);
+        for (int folder_id: folder_ids) {
+            auto *index = m_embeddingIndexes->find(embedding_model, folder_id);
+            if (index && index->expansion() < s_indexMaxExpansion)
+                index->setExpansion(qMin(index->expansion() * 2, s_indexMaxExpansion));
+        }
+    }, Qt::QueuedConnection);
+}
+
+QList<int> Database::searchEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+    const QList<QString> &collections, int nNeighbors)
+{
+    const QMap<QString, QList<int>> modelFolders = collectionFolders(db, collections);
+
+    // search the folders with a complete vector index through it, and the rest exhaustively
+    struct ModelSearch {
+        QList<int>            indexedFolders, exactFolders, missingFolders;
+        QList<EmbeddingMatch> annMatches;
+    };
+    std::map<QString, ModelSearch> searches;
+    {
+        // only the in-memory indexes are searched under the lock, writers wait for it
+        QReadLocker locker(&m_vectorLock);
+        for (const auto &[embedding_model, folder_ids]: std::as_const(modelFolders).asKeyValueRange()) {
+            ModelSearch &s = searches[embedding_model];
+            for (int folder_id: folder_ids) {
+                auto *index = m_embeddingIndexes->find(embedding_model, folder_id);
+                if (index && index->isComplete() && index->dimensions() == query.size()) {
+                    s.annMatches << index->search(query.data(), nNeighbors);
+                    s.indexedFolders << folder_id;
+                } else {
+                    s.exactFolders << folder_id;
+                    if (!index)
+                        s.missingFolders << folder_id;
+                }
+            }
+        }
+    }
+
+    QList<EmbeddingMatch> matches;
+    for (const auto &[embedding_model, s]: searches) {
+        if (!s.missingFolders.isEmpty())
+            requestEmbeddingIndexes(embedding_model, s.missingFolders);
+        if (!s.exactFolders.isEmpty())
+            matches << searchFolderEmbeddings(db, query, embedding_model, s.exactFolders, nNeighbors);
+        if (!s.indexedFolders.isEmpty() && m_annSearchCount++ % s_indexRecallInterval == 0
+            && !m_recallCheckPending.exchange(true)
+        ) {
+            // the exact search behind the check reads every embedding, so it is not done while the user waits
+            m_readerPool->post([this, query, embedding_model, s, nNeighbors](const QSqlDatabase &db) {
+                checkIndexRecall(db, query, embedding_model, s.indexedFolders, s.annMatches, nNeighbors);
+                m_recallCheckPending = false;
+            });
+        }
+        matches << s.annMatches;
+    }
+
+    keepNearest(matches, nNeighbors);
+    QList<int> chunkIds;
+    chunkIds.reserve(matches.size());
+    for (const auto &m: std::as_const(matches))
+        chunkIds << m.chunkId;
+    return chunkIds;
+}
+
+QMap<QString, QList<int>> Database::collectionFolders(const QSqlDatabase &db, const QList<QString> &collections)
+{
+    const quint64 generation = m_searchGeneration;
+    QMutexLocker locker(&m_folderCollectionsMutex);
+
+    // reload after any change to the database, which is rare while nothing is being indexed
+    auto &fc = m_folderCollections;
+    if (fc.generation != generation) {
+        QSqlQuery q(db);
+        if (!q.exec(SELECT_COLLECTION_FOLDERS_SQL)) {
+            qWarning() << "Database ERROR: Failed to exec collection folders query:" << q.lastError();
+            return {};
+        }
+        fc = { .generation = generation };
+        while (q.next()) {
+            const QString name = q.value(2).toString();
+            qsizetype bit = fc.collectionBits.value(name, -1);
+            if (bit == -1) {
+                bit = fc.collectionBits.size();
+                fc.collectionBits.insert(name, bit);
+            }
+            QBitArray &bits = fc.folders[{ q.value(1).toString(), q.value(0).toInt() }];
+            bits.resize(std::max(bits.size(), bit + 1));
+            bits.setBit(bit);
+        }
+    }
+
+    QBitArray wanted(fc.collectionBits.size());
+    for (const QString &name: collections) {
+        if (auto it = fc.collectionBits.constFind(name); it != fc.collectionBits.cend())
+            wanted.setBit(*it);
+    }
+
+    QMap<QString, QList<int>> modelFolders;
+    for (const auto &[key, bits]: fc.folders.asKeyValueRange()) {
+        QBitArray enabled = bits;
+        enabled.resize(wanted.size());
+        if ((enabled & wanted).count(true))
+            modelFolders[key.first] << key.second;
     }
-    return searchEmbeddingsHelper(query, q, chunks.size());
+    return modelFolders;
 }
 
 QList<Database::BM25Query> Database::queriesForFTS5(const QString &input)
@@ -2343,49 +3710,57 @@ QList<Database::BM25Query> Database::queriesForFTS5(const QString &input)
     return queries;
 }
 
-QList<int> Database::searchBM25(const QString &query, const QList<QString> &collections, BM25Query &bm25q, int k)
+QList<Database::BM25Result> Database::searchBM25(const QSqlDatabase &db, const QString &query,
+    const QList<QString> &collections, BM25Query &bm25q, int k)
 {
-    struct SearchResult { int chunkId; float score; };
-    QList<BM25Query> bm25Queries = queriesForFTS5(query);
-
-    QSqlQuery sqlQuery(m_db);
-    sqlQuery.prepare(SELECT_CHUNKS_FTS_SQL.arg(collections.join("', '"), QString::number(k)));
+    const QList<BM25Query> bm25Queries = queriesForFTS5(query);
+    const BM25Query &exactQuery = bm25Queries[0], &termsQuery = bm25Queries[1];
+    if (!exactQuery.qlength)
+        return {};
 
-    QList<SearchResult> results;
-    for (auto &bm25Query : std::as_const(bm25Queries)) {
-        sqlQuery.addBindValue(bm25Query.query);
+    // the folders of every embedding model, found without joining the collections
+    QSet<int> folderIds;
+    for (const QList<int> &folders: collectionFolders(db, collections))
+        folderIds.unite(QSet<int>(folders.begin(), folders.end()));
+    if (folderIds.isEmpty())
+        return {};
+    QJsonArray folderArray;
+    for (int id: std::as_const(folderIds))
+        folderArray.append(id);
 
-        if (!sqlQuery.exec()) {
-            qWarning() << "Database ERROR: Failed to execute BM25 query:" << sqlQuery.lastError();
-            return {};
-        }
+    QSqlQuery *q = ReaderPool::prepared(SELECT_CHUNKS_FTS_SQL);
+    if (!q)
+        return {};
 
-        if (sqlQuery.next()) {
-            // Save the query that was used to produce results
-            bm25q = bm25Query;
-            break;
-        }
+    // both queries in one pass, a query of only stop words has no terms to match
+    QString match = exactQuery.query;
+    if (termsQuery.ilength > termsQuery.rlength)
+        match += u" OR "_s + termsQuery.query;
+    q->bindValue(u":phrase"_s, exactQuery.query);
+    q->bindValue(u":match"_s, match);
+    q->bindValue(u":folders"_s, QString::fromUtf8(QJsonDocument(folderArray).toJson(QJsonDocument::Compact)));
+    q->bindValue(u":k"_s, k);
+    if (!q->exec()) {
+        qWarning() << "Database ERROR: Failed to execute BM25 query:" << q->lastError();
+        return {};
     }
 
-    if (sqlQuery.at() != QSql::AfterLastRow) {
-        do {
-            const int chunkId = sqlQuery.value(0).toInt();
-            const float score = sqlQuery.value(1).toFloat();
-            results.append({chunkId, score});
-        } while (sqlQuery.next());
+    // like searching for the phrase first: if any chunk has it, the chunks that only have the terms are dropped
+    QList<BM25Result> results;
+    bool isExact = false;
+    while (q->next()) {
+        const bool exact = q->value(2).toBool();
+        if (results.isEmpty())
+            isExact = exact;
+        else if (isExact && !exact)
+            break;
+        results.append({ q->value(0).toInt(), q->value(1).toFloat() });
     }
+    q->finish();
 
-    k = qMin(k, results.size());
-    std::partial_sort(
-        results.begin(), results.begin() + k, results.end(),
-        [](const SearchResult &a, const SearchResult &b) { return a.score < b.score; }
-    );
-
-    QList<int> chunkIds;
-    chunkIds.reserve(k);
-    for (int i = 0; i < k; i++)
-        chunkIds << results[i].chunkId;
-    return chunkIds;
+    // Save the query that was used to produce results
+    bm25q = isExact ? exactQuery : termsQuery;
+    return results;
 }
 
 float Database::computeBM25Weight(const Database::BM25Query &bm25q)
@@ -2422,23 +3797,21 @@ float Database::computeBM25Weight(const Database::BM25Query &bm25q)
     return bmWeight;
 }
 
-QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const QList<int> &embeddingResults,
-    const QList<int> &bm25Results, const BM25Query &bm25q, int k)
+QList<int> Database::reciprocalRankFusion(const QList<int> &embeddingResults, const QList<BM25Result> &bm25Results,
+    const BM25Query &bm25q, int k)
 {
     // We default to the embedding results and augment with bm25 if any
     QList<int> results = embeddingResults;
 
-    QList<int> missingScores;
+    // rank by the raw scores, chunks with equal scores share a rank. Chunks that only BM25 found are ranked
+    // after the embedding results in BM25 order, there is no need to look up their embeddings.
     QHash<int, int> bm25Ranks;
-    for (int i = 0; i < bm25Results.size(); ++i) {
-        if (!results.contains(bm25Results[i]))
-            missingScores.append(bm25Results[i]);
-        bm25Ranks[bm25Results[i]] = i + 1;
-    }
-
-    if (!missingScores.isEmpty()) {
-        QList<int> scored = scoreChunks(query, missingScores);
-        results << scored;
+    for (qsizetype i = 0; i < bm25Results.size(); ++i) {
+        const BM25Result &r = bm25Results[i];
+        const bool tied = i > 0 && r.score == bm25Results[i - 1].score;
+        bm25Ranks[r.chunkId] = tied ? bm25Ranks.value(bm25Results[i - 1].chunkId) : int(i) + 1;
+        if (!results.contains(r.chunkId))
+            results.append(r.chunkId);
     }
 
     QHash<int, int> embeddingRanks;
@@ -2480,18 +3853,51 @@ QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const
     return results;
 }
 
-QList<int> Database::searchDatabase(const QString &query, const QList<QString> &collections, int k)
+QList<int> Database::searchDatabase(const QSqlDatabase &db, const QString &query, const QList<QString> &collections,
+    int k)
 {
-    std::vector<float> queryEmbd = m_embLLM->generateQueryEmbedding(query);
+    // read before searching, a result that raced with a change is then stored as outdated
+    const quint64 generation = m_searchGeneration;
+    QStringList sortedCollections = collections;
+    sortedCollections.sort();
+    const QString cacheKey = u"%1\x1f%2\x1f%3"_s.arg(sortedCollections.join(u'\x1f'), QString::number(k), query);
+    {
+        QMutexLocker locker(&m_searchCacheMutex);
+        if (auto *cached = m_searchResultCache.object(cacheKey); cached && cached->generation == generation)
+            return cached->chunkIds;
+    }
+
+    std::vector<float> queryEmbd = queryEmbedding(query);
     if (queryEmbd.empty()) {
         qDebug() << "ERROR: generating embeddings returned a null result";
         return { };
     }
 
-    const QList<int> embeddingResults = searchEmbeddings(queryEmbd, collections, k);
+    const QList<int> embeddingResults = searchEmbeddings(db, queryEmbd, collections, k);
     BM25Query bm25q;
-    const QList<int> bm25Results = searchBM25(query, collections, bm25q, k);
-    return reciprocalRankFusion(queryEmbd, embeddingResults, bm25Results, bm25q, k);
+    const QList<BM25Result> bm25Results = searchBM25(db, query, collections, bm25q, k);
+    QList<int> results = reciprocalRankFusion(embeddingResults, bm25Results, bm25q, k);
+
+    QMutexLocker locker(&m_searchCacheMutex);
+    m_searchResultCache.insert(cacheKey, new CachedSearch { generation, results });
+    return results;
+}
+
+std::vector<float> Database::queryEmbedding(const QString &query)
+{
+    {
+        QMutexLocker locker(&m_searchCacheMutex);
+        if (auto *cached = m_queryEmbeddingCache.object(query))
+            return *cached;
+    }
+
+    // not locked while embedding, two concurrent searches for a new query may both embed it
+    std::vector<float> embedding = m_embLLM->generateQueryEmbedding(query);
+    if (!embedding.empty()) {
+        QMutexLocker locker(&m_searchCacheMutex);
+        m_queryEmbeddingCache.insert(query, new std::vector<float>(embedding));
+    }
+    return embedding;
 }
 
 void Database::retrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize,
@@ -2501,50 +3907,57 @@ void Database::retrieveFromDB(const QList<QString> &collections, const QString &
     qDebug() << "retrieveFromDB" << collections << text << retrievalSize;
 #endif
 
-    QList<int> searchResults = searchDatabase(text, collections, retrievalSize);
-    if (searchResults.isEmpty())
+    if (!m_databaseValid)
         return;
 
-    QSqlQuery q(m_db);
-    if (!selectChunk(q, searchResults)) {
-        qDebug() << "ERROR: selecting chunks:" << q.lastError();
-        return;
-    }
+    m_readerPool->run([&](const QSqlDatabase &db) {
+        QList<int> searchResults = searchDatabase(db, text, collections, retrievalSize);
+        if (searchResults.isEmpty())
+            return;
 
-    QHash<int, ResultInfo> tempResults;
-    while (q.next()) {
-        const int rowid = q.value(0).toInt();
-        const QString document_path = q.value(2).toString();
-        const QString chunk_text = q.value(3).toString();
-        const QString date = QDateTime::fromMSecsSinceEpoch(q.value(1).toLongLong()).toString("yyyy, MMMM dd");
-        const QString file = q.value(4).toString();
-        const QString title = q.value(5).toString();
-        const QString author = q.value(6).toString();
-        const int page = q.value(7).toInt();
-        const int from = q.value(8).toInt();
-        const int to = q.value(9).toInt();
-        const QString collectionName = q.value(10).toString();
-        ResultInfo info;
-        info.collection = collectionName;
-        info.path = document_path;
-        info.file = file;
-        info.title = title;
-        info.author = author;
-        info.date = date;
-        info.text = chunk_text;
-        info.page = page;
-        info.from = from;
-        info.to = to;
-        tempResults.insert(rowid, info);
+        QSqlQuery q(db);
+        if (!selectChunk(q, searchResults)) {
+            qDebug() << "ERROR: selecting chunks:" << q.lastError();
+            return;
+        }
+
+        QHash<int, ResultInfo> tempResults;
+        while (q.next()) {
+            const int rowid = q.value(0).toInt();
+            const QString document_path = q.value(2).toString();
+            const std::optional<QString> chunk_text = chunkText(m_chunkCompressor, q.value(3));
+            if (!chunk_text)
+                continue;
+            const QString date = QDateTime::fromMSecsSinceEpoch(q.value(1).toLongLong()).toString("yyyy, MMMM dd");
+            const QString file = q.value(4).toString();
+            const QString title = q.value(5).toString();
+            const QString author = q.value(6).toString();
+            const int page = q.value(7).toInt();
+            const int from = q.value(8).toInt();
+            const int to = q.value(9).toInt();
+            const QString collectionName = q.value(10).toString();
+            ResultInfo info;
+            info.collection = collectionName;
+            info.path = document_path;
+            info.file = file;
+            info.title = title;
+            info.author = author;
+            info.date = date;
+            info.text = *chunk_text;
+            info.page = page;
+            info.from = from;
+            info.to = to;
+            tempResults.insert(rowid, info);
 #if defined(DEBUG)
-        qDebug() << "retrieve rowid:" << rowid
-                 << "chunk_text:" << chunk_text;
+            qDebug() << "retrieve rowid:" << rowid
+                     << "chunk_text:" << *chunk_text;
 #endif
-    }
+        }
 
-    for (int id : searchResults)
-        if (tempResults.contains(id))
-            results->append(tempResults.value(id));
+        for (int id : searchResults)
+            if (tempResults.contains(id))
+                results->append(tempResults.value(id));
+    });
 }
 
 bool Database::ftsIntegrityCheck()
@@ -2553,12 +3966,33 @@ bool Database::ftsIntegrityCheck()
 
     // Returns an error executing sql if it the integrity check fails
     // See: https://www.sqlite.org/fts5.html#the_integrity_check_command
-    const bool success = q.exec(FTS_INTEGRITY_SQL);
+    const bool success = q.exec(m_hasCompressedChunks ? FTS_INDEX_INTEGRITY_SQL : FTS_INTEGRITY_SQL);
     if (!success && q.lastError().nativeErrorCode() != "267" /*SQLITE_CORRUPT_VTAB from sqlite header*/) {
         qWarning() << "ERROR: Cannot prepare sql for fts integrity check" << q.lastError();
         return false;
     }
 
+    // the index is rebuilt from the content, so the chunks are plain text until they are compressed again
+    if (!success && m_hasCompressedChunks) {
+        transaction();
+        int nRestored;
+        do {
+            if (!q.prepare(SELECT_COMPRESSED_CHUNKS_SQL)) {
+                qWarning() << "ERROR: Cannot prepare sql for restoring chunk text" << q.lastError();
+                rollback();
+                return false;
+            }
+            q.addBindValue(s_compressBatchSize);
+            if (!q.exec() || !restoreChunkText(q, &nRestored)) {
+                qWarning() << "ERROR: Cannot restore chunk text for fts rebuild" << q.lastError();
+                rollback();
+                return false;
+            }
+        } while (nRestored > 0);
+        commit();
+        m_hasCompressedChunks = false;
+    }
+
     if (!success && !q.exec(FTS_REBUILD_SQL)) {
         qWarning() << "ERROR: Cannot exec sql for fts rebuild" << q.lastError();
         return false;
@@ -2593,7 +4027,7 @@ bool Database::cleanDB()
 #if defined(DEBUG)
             qDebug() << "clean db removing folder" << i.folder_id << i.folder_path;
 #endif
-            if (!removeFolderInternal(i.collection, i.folder_id, i.folder_path)) {
+            if (!removeFolderInternal(i.collection, i.folder_id)) {
                 rollback();
                 return false;
             }
@@ -2639,55 +4073,89 @@ bool Database::cleanDB()
         }
     }
 
+    if (!q.exec(DELETE_UNUSED_DICTIONARIES_SQL))
+        qWarning() << "ERROR: Cannot remove unused chunk dictionaries" << q.lastError();
+
     commit();
     return true;
 }
 
-void Database::changeChunkSize(int chunkSize)
+bool Database::rechunkAllDocuments()
 {
-    if (chunkSize == m_chunkSize)
-        return;
-
-#if defined(DEBUG)
-    qDebug() << "changeChunkSize" << chunkSize;
-#endif
-
     QSqlQuery q(m_db);
     // Scan all documents in db to make sure they still exist
     if (!q.prepare(SELECT_ALL_DOCUMENTS_SQL)) {
         qWarning() << "ERROR: Cannot prepare sql for select all documents" << q.lastError();
-        return;
+        return false;
     }
 
     if (!q.exec()) {
         qWarning() << "ERROR: Cannot exec sql for select all documents" << q.lastError();
-        return;
+        return false;
     }
 
+    // documents that are being read are chunked with the old settings
+    for (auto &[job_id, state]: m_docsInFlight)
+        *state.cancelled = true;
+    m_docsInFlight.clear();
+
     transaction();
 
     while (q.next()) {
         int document_id = q.value(0).toInt();
-        // Remove all chunks and documents to change the chunk size
+        // Remove all chunks and documents so they are chunked again
         QSqlQuery query(m_db);
         if (!removeChunksByDocumentId(query, document_id)) {
             qWarning() << "ERROR: Cannot remove chunks of document_id" << document_id << query.lastError();
-            return rollback();
+            rollback();
+            return false;
         }
 
         if (!removeDocument(query, document_id)) {
             qWarning() << "ERROR: Cannot remove document_id" << document_id << query.lastError();
-            return rollback();
+            rollback();
+            return false;
         }
     }
 
     commit();
+    return true;
+}
+
+void Database::changeChunkSize(int chunkSize)
+{
+    if (chunkSize == m_chunkSize)
+        return;
+
+#if defined(DEBUG)
+    qDebug() << "changeChunkSize" << chunkSize;
+#endif
+
+    if (!rechunkAllDocuments())
+        return;
 
     m_chunkSize = chunkSize;
     addCurrentFolders();
     updateCollectionStatistics();
 }
 
+void Database::changeChunkTokens(int chunkTokens)
+{
+    if (chunkTokens == m_chunkTokens)
+        return;
+
+#if defined(DEBUG)
+    qDebug() << "changeChunkTokens" << chunkTokens;
+#endif
+
+    if (!rechunkAllDocuments())
+        return;
+
+    m_chunkTokens = chunkTokens;
+    addCurrentFolders();
+    updateCollectionStatistics();
+}
+
 void Database::changeFileExtensions(const QStringList &extensions)
 {
 #if defined(DEBUG)
@@ -2696,6 +4164,11 @@ void Database::changeFileExtensions(const QStringList &extensions)
 
     m_scannedFileExtensions = extensions;
 
+    // unchanged directories may hold files with the new extensions
+    QSqlQuery journalQuery(m_db);
+    if (!journalQuery.exec(CLEAR_SCAN_JOURNAL_SQL))
+        qWarning() << "ERROR: Cannot clear scan journal" << journalQuery.lastError();
+
     if (cleanDB())
         updateCollectionStatistics();
 
@@ -2712,39 +4185,312 @@ void Database::changeFileExtensions(const QStringList &extensions)
     }
 }
 
-void Database::directoryChanged(const QString &path)
+void Database::changeChunkCompression(bool enabled)
+{
+    // chunks that are compressed already stay that way, they are read like the others
+    m_compressChunks = enabled && ChunkCompressor::isAvailable();
+    scheduleChunkCompression();
+}
+
+void Database::changeVectorQuantization(const QString &quantization)
+{
+    m_vectorQuantization = quantizationFromSetting(quantization);
+    QWriteLocker locker(&m_vectorLock);
+    for (auto &[model, segment]: m_embeddingSegments)
+        segment->setQuantization(m_vectorQuantization);
+}
+
+void Database::handleFolderChanges(const FolderChanges &changes)
 {
 #if defined(DEBUG)
-    qDebug() << "directoryChanged" << path;
+    qDebug() << "handleFolderChanges" << changes.files.size() << "files" << changes.directories.size()
+             << "directories";
 #endif
 
-    // search for a collection that contains this folder (we watch subdirectories)
-    int folder_id = -1;
-    QDir dir(path);
-    for (;;) {
-        QSqlQuery q(m_db);
-        if (!selectFolder(q, dir.path(), &folder_id)) {
-            qWarning() << "ERROR: Cannot select folder from path" << dir.path() << q.lastError();
-            return;
-        }
-        if (folder_id != -1)
-            break;
+    // the folders a path belongs to, known from the watched directory that reported it
+    auto foldersOf = [this](const QString &path) {
+        if (auto it = m_watchedPaths.constFind(path); it != m_watchedPaths.cend())
+            return *it;
+        return m_watchedPaths.value(path.left(path.lastIndexOf(u'/')));
+    };
 
-        // check next parent
-        if (!dir.cdUp()) {
-            if (!dir.isRoot()) break; // folder removed
-            Q_ASSERT(false);
-            qWarning() << "ERROR: Watched folder does not exist in db" << path;
-            m_watcher->removePath(path);
-            return;
+    // directories to list again, by folder; a directory that is gone is listed from its parent
+    std::map<int, QSet<QString>> dirsOfFolder;
+    bool folderRemoved = false;
+    for (const QString &path: changes.directories) {
+        const QSet<int> folders = foldersOf(path);
+        QString dir = path;
+        while (!dir.isEmpty() && !QFileInfo(dir).isDir())
+            dir = dir.left(dir.lastIndexOf(u'/'));
+        for (int folder_id: folders) {
+            if (!m_collectionMap.contains(folder_id))
+                continue;
+            const QString root = QFileInfo(m_collectionMap.value(folder_id).folder_path).canonicalFilePath();
+            if (root.isEmpty()) {
+                folderRemoved = true; // the whole folder is gone
+            } else if (dir == root || dir.startsWith(root + u'/')) {
+                dirsOfFolder[folder_id] << dir;
+            } else {
+                dirsOfFolder[folder_id] << path; // in a linked directory outside of the folder
+            }
         }
     }
 
-    // Clean the database
-    if (cleanDB())
+    if (folderRemoved && cleanDB())
         updateCollectionStatistics();
 
-    // Rescan the documents associated with the folder
-    if (folder_id != -1)
-        scanDocuments(folder_id, path);
+    for (auto &[folder_id, dirs]: dirsOfFolder) {
+        if (!m_collectionMap.contains(folder_id))
+            continue; // removed above
+        // a directory inside another one is scanned with it
+        QStringList sorted(dirs.cbegin(), dirs.cend());
+        sorted.sort();
+        QString last;
+        for (const QString &dir: std::as_const(sorted)) {
+            if (!last.isNull() && (dir == last || dir.startsWith(last + u'/')))
+                continue;
+            last = dir;
+            scanDocuments(folder_id, dir);
+        }
+    }
+
+    // files that changed in place, the journal is updated when their directory is listed again
+    std::map<int, std::list<DocumentInfo>> docsOfFolder;
+    QList<int> deletedDocuments;
+    for (const QString &path: changes.files) {
+        const QString dir = path.left(path.lastIndexOf(u'/'));
+        if (changes.directories.contains(dir))
+            continue; // listed above
+        QFileInfo fileInfo(path);
+        if (!m_scannedFileExtensions.contains(fileInfo.suffix(), Qt::CaseInsensitive))
+            continue;
+        const QSet<int> folders = foldersOf(path);
+        if (fileInfo.isFile() && fileInfo.isReadable()) {
+            for (int folder_id: folders) {
+                if (m_collectionMap.contains(folder_id))
+                    docsOfFolder[folder_id].push_back({ folder_id, fileInfo });
+            }
+        } else if (!fileInfo.exists()) {
+            QSqlQuery q(m_db);
+            int document_id = -1;
+            qint64 document_time;
+            QByteArray content_hash;
+            if (!selectDocument(q, path, &document_id, &document_time, &content_hash))
+                qWarning() << "ERROR: Cannot select document" << path << q.lastError();
+            else if (document_id != -1)
+                deletedDocuments << document_id;
+        }
+    }
+
+    if (!deletedDocuments.isEmpty())
+        removeDeletedDocuments(deletedDocuments);
+
+    for (auto &[folder_id, infos]: docsOfFolder) {
+        CollectionItem item = guiCollectionItem(folder_id);
+        item.indexing = true;
+        updateGuiForCollectionItem(item);
+        enqueueDocuments(folder_id, std::move(infos));
+    }
+}
+
+void Database::scanUnwatchedFolders()
+{
+    // the scan tries to watch the directories again, and restarts the timer for those that still cannot be
+    const QSet<int> folders = std::exchange(m_unwatchedFolders, {});
+    m_unwatchedScanTimer->stop();
+    for (int folder_id: folders) {
+        if (m_collectionMap.contains(folder_id))
+            scanDocuments(folder_id, m_collectionMap.value(folder_id).folder_path);
+    }
+}
+
+void Database::exportCollection(const QString &collection, const QString &path, bool quantize)
+{
+#if defined(DEBUG)
+    qDebug() << "exportCollection" << collection << path << quantize;
+#endif
+
+    // written next to the destination first, so a failed export leaves no partial snapshot behind
+    const QString tmpPath = path + u".tmp"_s;
+    QFile::remove(tmpPath);
+
+    CollectionSnapshot snapshot(m_db);
+    QString error = snapshot.attach(tmpPath);
+    if (error.isEmpty()) {
+        error = writeSnapshot(snapshot, collection, quantize);
+        snapshot.detach();
+    }
+
+    if (error.isEmpty()) {
+        QFile::remove(path);
+        if (!QFile::rename(tmpPath, path))
+            error = u"Cannot rename %1 to %2"_s.arg(tmpPath, path);
+    }
+
+    if (!error.isEmpty()) {
+        qWarning().noquote() << "Database ERROR: Cannot export collection" << collection << "-" << error;
+        QFile::remove(tmpPath);
+    }
+    emit collectionExported(collection, error);
+}
+
+QString Database::writeSnapshot(CollectionSnapshot &snapshot, const QString &collection, bool quantize)
+{
+    QSqlQuery q(m_db);
+    std::optional<CollectionItem> item;
+    if (!selectCollectionByName(q, collection, item))
+        return u"Cannot select collection: %1"_s.arg(q.lastError().text());
+    if (!item)
+        return u"There is no collection named %1"_s.arg(collection);
+    if (item->embeddingModel.isEmpty())
+        return u"The collection needs to be updated first"_s;
+
+    QList<QPair<int, QString>> folders;
+    if (!selectFoldersFromCollection(q, collection, &folders))
+        return u"Cannot select folders: %1"_s.arg(q.lastError().text());
+
+    QList<CollectionSnapshot::Folder> snapshotFolders;
+    for (const auto &[folder_id, folder_path]: std::as_const(folders)) {
+        QString root = QFileInfo(folder_path).canonicalFilePath();
+        if (root.isEmpty())
+            root = folder_path;
+        if (root.endsWith(u'/'))
+            root.chop(1);
+        snapshotFolders.append({ folder_id, root });
+    }
+
+    if (QString error = snapshot.create(); !error.isEmpty())
+        return error;
+
+    transaction();
+    QString error = snapshot.write(collection, item->embeddingModel, snapshotFolders,
+                                   m_hasCompressedChunks ? &m_chunkCompressor : nullptr, quantize);
+    if (error.isEmpty())
+        commit();
+    else
+        rollback();
+    return error;
+}
+
+void Database::importCollection(const QString &path, const QString &collection, const QString &folder_path,
+                                const QString &embedding_model)
+{
+#if defined(DEBUG)
+    qDebug() << "importCollection" << path << collection << folder_path;
+#endif
+
+    CollectionSnapshot snapshot(m_db);
+    QString error = snapshot.attach(path);
+    if (error.isEmpty()) {
+        error = readSnapshot(snapshot, collection, folder_path, embedding_model);
+        snapshot.detach();
+    }
+
+    if (!error.isEmpty())
+        qWarning().noquote() << "Database ERROR: Cannot import collection" << collection << "-" << error;
+    emit collectionImported(collection, error);
+}
+
+QString Database::readSnapshot(CollectionSnapshot &snapshot, const QString &collection, const QString &folder_path,
+                               const QString &embedding_model)
+{
+    CollectionSnapshot::Info info;
+    if (QString error = snapshot.readInfo(info); !error.isEmpty())
+        return error;
+    if (info.embeddingModel != embedding_model)
+        return u"The snapshot was embedded with %1 instead of %2"_s.arg(info.embeddingModel, embedding_model);
+
+    QSqlQuery q(m_db);
+    std::optional<CollectionItem> existing;
+    if (!selectCollectionByName(q, collection, existing))
+        return u"Cannot select collection: %1"_s.arg(q.lastError().text());
+    if (existing)
+        return u"A collection named %1 already exists"_s.arg(collection);
+
+    // a single folder is mapped to the given one, several to its subfolders of the same names
+    QList<CollectionSnapshot::Folder> folders;
+    if (QString error = snapshot.readFolders(folders); !error.isEmpty())
+        return error;
+    if (folders.isEmpty())
+        return u"The snapshot has no folders"_s;
+    if (folders.size() > 1) {
+        // folders exported from different places may have the same name, but only one can be imported under it
+        QHash<QString, QString> exportedRoots; // by name
+        for (const auto &folder: std::as_const(folders)) {
+            const QString name = QFileInfo(folder.root).fileName();
+            if (auto other = exportedRoots.constFind(name); other != exportedRoots.cend()) {
+                return u"The snapshot has two folders named %1 (%2 and %3), which would both be imported into %4"_s
+                    .arg(name, *other, folder.root, QDir(folder_path).filePath(name));
+            }
+            exportedRoots.insert(name, folder.root);
+        }
+        for (auto &folder: folders)
+            folder.root = QDir(folder_path).filePath(QFileInfo(folder.root).fileName());
+    } else {
+        folders.front().root = folder_path;
+    }
+
+    transaction();
+    auto fail = [&](const QString &what, const QSqlQuery &query) {
+        QString error = u"%1: %2"_s.arg(what, query.lastError().text());
+        rollback();
+        return error;
+    };
+
+    CollectionItem item;
+    if (!addCollection(q, collection, QDateTime(), QDateTime(), embedding_model, item))
+        return fail(u"Cannot add collection"_s, q);
+
+    QHash<int, CollectionSnapshot::Folder> localFolders; // by snapshot folder id
+    QList<CollectionItem> items;
+    for (const auto &[snapshot_folder_id, local_path]: std::as_const(folders)) {
+        QString root = QFileInfo(local_path).canonicalFilePath();
+        if (root.isEmpty()) {
+            rollback();
+            return u"Folder %1 does not exist"_s.arg(local_path);
+        }
+        if (root.endsWith(u'/'))
+            root.chop(1);
+
+        int folder_id = -1;
+        if (!selectFolder(q, local_path, &folder_id))
+            return fail(u"Cannot select folder"_s, q);
+        if (folder_id != -1) {
+            rollback();
+            return u"Folder %1 is already in a collection"_s.arg(local_path);
+        }
+        if (!addFolderToDB(q, local_path, &folder_id))
+            return fail(u"Cannot add folder"_s, q);
+        if (addCollectionItem(q, item.collection_id, folder_id) < 0)
+            return fail(u"Cannot add folder to collection"_s, q);
+        localFolders.insert(snapshot_folder_id, { folder_id, root });
+
+        CollectionItem folderItem = item;
+        folderItem.folder_path = local_path;
+        folderItem.folder_id = folder_id;
+        items << folderItem;
+    }
+
+    int nChunks = 0;
+    if (QString error = snapshot.import(info, localFolders, nChunks); !error.isEmpty()) {
+        rollback();
+        return error;
+    }
+
+    commit();
+    m_ftsRowsSinceOptimize += nChunks;
+
+    // the vector segment of the model is rebuilt with the new embeddings, folder indexes are built when searched
+    dropEmbeddingSegment(embedding_model);
+    scheduleEmbeddingSegmentBuild(embedding_model);
+    m_searchGeneration++;
+
+    /* Scanning reconciles the snapshot with the files on this machine. Their modification times differ from the
+     * ones in the snapshot, but files with the same content hash keep their chunks and embeddings. */
+    for (const CollectionItem &i: std::as_const(items)) {
+        addGuiCollectionItem(i);
+        scanDocuments(i.folder_id, i.folder_path);
+    }
+    updateCollectionStatistics();
+    return {};
 }
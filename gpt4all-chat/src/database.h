@@ -1,9 +1,16 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "chunkcompressor.h"
+#include "chunkstreamer.h"
+#include "embeddingindex.h"
+#include "embeddingsegment.h"
 #include "embllm.h" // IWYU pragma: keep
+#include "folderwatcher.h"
 
+#include <QBitArray>
 #include <QByteArray>
+#include <QCache>
 #include <QChar>
 #include <QDateTime>
 #include <QElapsedTimer>
@@ -11,32 +18,40 @@
 #include <QHash>
 #include <QLatin1String>
 #include <QList>
+#include <QMap>
+#include <QMutex>
 #include <QObject>
+#include <QReadWriteLock>
 #include <QSet>
 #include <QSqlDatabase>
 #include <QString>
 #include <QStringList>
+#include <QStringView>
 #include <QThread>
 #include <QUrl>
 #include <QVector>
+#include <QWaitCondition>
 #include <QtGlobal>
 
 #include <atomic>
 #include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
 #include <list>
 #include <map>
 #include <memory>
 #include <optional>
+#include <thread>
 #include <utility>
 #include <vector>
 
 using namespace Qt::Literals::StringLiterals;
 
+class ChunkWriter;
+class CollectionSnapshot;
 class Database;
-class DocumentReader;
-class QFileSystemWatcher;
 class QSqlQuery;
-class QTextStream;
 class QTimer;
 
 /* Version 0: GPT4All v2.4.3, full-text search
@@ -58,20 +73,6 @@ static const int LOCALDOCS_MIN_VER = 1;
 // current version
 static const int LOCALDOCS_VERSION = 3;
 
-struct DocumentInfo
-{
-    using key_type = std::pair<int, QString>;
-
-    int       folder;
-    QFileInfo file;
-    bool      currentlyProcessing = false;
-
-    key_type key() const { return {folder, file.canonicalFilePath()}; } // for comparison
-
-    bool isPdf () const { return !file.suffix().compare("pdf"_L1,  Qt::CaseInsensitive); }
-    bool isDocx() const { return !file.suffix().compare("docx"_L1, Qt::CaseInsensitive); }
-};
-
 struct ResultInfo {
     Q_GADGET
     Q_PROPERTY(QString collection MEMBER collection)
@@ -164,41 +165,91 @@ struct CollectionItem {
 };
 Q_DECLARE_METATYPE(CollectionItem)
 
-class ChunkStreamer {
+struct IngestJob {
+    quint64                            id;
+    DocumentInfo                       info;
+    int                                chunkSize;
+    int                                chunkTokens;
+    QByteArray                         previousHash; // content hash of the indexed version, if any
+    std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+// The next chunks of a job. The chunks of a job arrive in order and only the last batch has a status.
+struct IngestBatch {
+    quint64                              jobId;
+    DocumentMetadata                     metadata;
+    QList<ParsedChunk>                   chunks;
+    std::optional<ChunkStreamer::Status> status;
+    QByteArray                           contentHash;
+    bool                                 unchanged = false; // content matches previousHash, nothing was read
+};
+
+/* Reads and chunks documents on worker threads, so that parsing overlaps with database writes and embedding. The
+ * workers block while the output queue is full, which bounds memory use when the database thread falls behind. */
+class IngestPool {
 public:
-    enum class Status { DOC_COMPLETE, INTERRUPTED, ERROR, BINARY_SEEN };
+    // embLLM counts tokens for token-based chunking and must outlive the pool
+    IngestPool(int nThreads, EmbeddingLLM *embLLM);
+    ~IngestPool();
 
-    explicit ChunkStreamer(Database *database);
-    ~ChunkStreamer();
+    int threadCount() const { return int(m_threads.size()); }
 
-    void setDocument(const DocumentInfo &doc, int documentId, const QString &embeddingModel);
-    std::optional<DocumentInfo::key_type> currentDocKey() const;
-    void reset();
+    void submit(IngestJob &&job);
+    // waits up to timeoutMs for a batch, returns false if there is none
+    bool take(IngestBatch &batch, int timeoutMs = 0);
 
-    Status step();
+private:
+    void run();
+    void ingest(const IngestJob &job);
+    bool push(IngestBatch &&batch);
+
+    QMutex                   m_mutex;
+    QWaitCondition           m_jobAvailable;
+    QWaitCondition           m_batchAvailable;
+    QWaitCondition           m_spaceAvailable;
+    EmbeddingLLM            *m_embLLM;
+    std::deque<IngestJob>    m_jobs;
+    std::deque<IngestBatch>  m_batches;
+    bool                     m_stopping = false;
+    std::vector<std::thread> m_threads;
+};
+
+/* Read-only connections to the database, each owned by one worker thread. In WAL mode a reader sees the last
+ * committed state of the database and never waits for the indexing transaction. */
+class ReaderPool {
+public:
+    using Task = std::function<void(const QSqlDatabase &db)>;
+
+    explicit ReaderPool(int nThreads);
+    ~ReaderPool();
+
+    // connections are (re)opened on this path before their next task
+    void setDatabasePath(const QString &path);
+    // runs the task on a reader thread and waits for it to finish
+    void run(const Task &task);
+    // runs the task on a reader thread later, it is dropped if the pool stops first
+    void post(const Task &task);
+    // a statement prepared once on the connection of the calling reader thread, nullptr on other threads or error
+    static QSqlQuery *prepared(const QString &sql);
 
 private:
-    Database                              *m_database;
-    std::optional<DocumentInfo::key_type>  m_docKey;
-    std::unique_ptr<DocumentReader>        m_reader; // may be invalid, always compare key first
-    int                                    m_documentId;
-    QString                                m_embeddingModel;
-    QString                                m_title;
-    QString                                m_author;
-    QString                                m_subject;
-    QString                                m_keywords;
-
-    // working state
-    QString                                m_chunk; // has a trailing space for convenience
-    int                                    m_nChunkWords = 0;
-    int                                    m_page = 0;
+    using PackagedTask = std::packaged_task<void(const QSqlDatabase &)>;
+
+    void work(int index);
+
+    QMutex                   m_mutex;
+    QWaitCondition           m_taskAvailable;
+    QString                  m_databasePath;
+    std::deque<PackagedTask> m_tasks;
+    bool                     m_stopping = false;
+    std::vector<std::thread> m_threads;
 };
 
 class Database : public QObject
 {
     Q_OBJECT
 public:
-    Database(int chunkSize, QStringList extensions);
+    Database(int chunkSize, int chunkTokens, QStringList extensions);
     ~Database() override;
 
     bool isValid() const { return m_databaseValid; }
@@ -212,11 +263,24 @@ public Q_SLOTS:
     void forceRebuildFolder(const QString &path);
     bool addFolder(const QString &collection, const QString &path, const QString &embedding_model);
     void removeFolder(const QString &collection, const QString &path);
+    // thread-safe, runs on a reader connection
     void retrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize, QList<ResultInfo> *results);
     void changeChunkSize(int chunkSize);
+    void changeChunkTokens(int chunkTokens);
     void changeFileExtensions(const QStringList &extensions);
+    void changeVectorQuantization(const QString &quantization);
+    void changeChunkCompression(bool enabled);
+    // writes a collection to a snapshot file, from which another installation can add it without indexing it again
+    void exportCollection(const QString &collection, const QString &path, bool quantize);
+    // adds a collection from a snapshot, with its folder mapped to folder_path (or its folders to subfolders of it)
+    void importCollection(const QString &path, const QString &collection, const QString &folder_path,
+                          const QString &embedding_model);
 
 Q_SIGNALS:
+    // the error is empty on success
+    void collectionExported(const QString &collection, const QString &error);
+    void collectionImported(const QString &collection, const QString &error);
+
     // Signals for the gui only
     void requestUpdateGuiForCollectionItem(const CollectionItem &item);
     void requestAddGuiCollectionItem(const CollectionItem &item);
@@ -225,21 +289,27 @@ Q_SIGNALS:
     void databaseValidChanged();
 
 private Q_SLOTS:
-    void directoryChanged(const QString &path);
+    void handleFolderChanges(const FolderChanges &changes);
+    void handleWatchLost(const QString &path);
+    void scanUnwatchedFolders();
     void addCurrentFolders();
     void handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddings);
     void handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const QString &error);
+    void buildEmbeddingIndexes();
+    void buildEmbeddingSegments();
+    void saveEmbeddingIndexes();
+    void compressChunks();
 
 private:
     void transaction();
     void commit();
     void rollback();
 
-    bool addChunk(QSqlQuery &q, int document_id, const QString &chunk_text, const QString &file,
-                  const QString &title, const QString &author, const QString &subject, const QString &keywords,
-                  int page, int from, int to, int words, int *chunk_id);
     bool refreshDocumentIdCache(QSqlQuery &q);
     bool removeChunksByDocumentId(QSqlQuery &q, int document_id);
+    bool removeChunks(QSqlQuery &q, const QList<std::pair<int, int>> &chunks);
+    // restores the compressed chunks selected by q as (id, chunk_text) to plain text
+    bool restoreChunkText(QSqlQuery &q, int *nRestored = nullptr);
     bool sqlRemoveDocsByFolderPath(QSqlQuery &q, const QString &path);
     bool hasContent();
     // not found -> 0, , exists and has content -> 1, error -> -1
@@ -247,27 +317,66 @@ private:
     bool openLatestDb(const QString &modelPath, QList<CollectionItem> &oldCollections);
     bool initDb(const QString &modelPath, const QList<CollectionItem> &oldCollections);
     int checkAndAddFolderToDB(const QString &path);
-    bool removeFolderInternal(const QString &collection, int folder_id, const QString &path);
-    size_t chunkStream(QTextStream &stream, int folder_id, int document_id, const QString &embedding_model,
-        const QString &file, const QString &title, const QString &author, const QString &subject,
-        const QString &keywords, int page, int maxChunks = -1);
+    bool removeFolderInternal(const QString &collection, int folder_id);
     void appendChunk(const EmbeddingChunk &chunk);
     void sendChunkList();
+    void embedChunks(const QVector<EmbeddingChunk> &chunks);
     void updateFolderToIndex(int folder_id, size_t countForFolder, bool sendChunks = true);
     size_t countOfDocuments(int folder_id) const;
     size_t countOfBytes(int folder_id) const;
     DocumentInfo dequeueDocument();
     void removeFolderFromDocumentQueue(int folder_id);
-    void enqueueDocumentInternal(DocumentInfo &&info, bool prepend = false);
+    std::optional<int> cancelIngestJob(int document_id);
+    void subtractBytesToIndex(int folder_id, qint64 bytes);
     void enqueueDocuments(int folder_id, std::list<DocumentInfo> &&infos);
     void scanQueue();
+    // a chunk of the indexed version of a document that is being read again
+    struct PreviousChunk {
+        int chunk_id;
+        QString file;
+        DocumentMetadata metadata;
+    };
+    // a document being read by the ingestion workers
+    struct IngestState {
+        DocumentInfo info;
+        int document_id;
+        QString embedding_model;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        QMultiHash<QByteArray, PreviousChunk> previousChunks; // by chunk hash, reused when a new chunk matches
+    };
+    void writeIngestBatch(ChunkWriter &writer, const IngestBatch &batch);
+    void flushChunks(ChunkWriter &writer);
+    void finishIngestJob(ChunkWriter &writer, const IngestBatch &batch);
     bool ftsIntegrityCheck();
     bool cleanDB();
-    void addFolderToWatch(const QString &path);
-    void removeFolderFromWatch(const QString &path);
-    static QList<int> searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q, int nNeighbors);
-    QList<int> searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections,
+    bool rechunkAllDocuments();
+    // with the snapshot attached, return an error message or an empty string
+    QString writeSnapshot(CollectionSnapshot &snapshot, const QString &collection, bool quantize);
+    QString readSnapshot(CollectionSnapshot &snapshot, const QString &collection, const QString &folder_path,
+                         const QString &embedding_model);
+    void addFolderToWatch(int folder_id, const QString &path);
+    void removeFolderFromWatch(int folder_id);
+    void unwatchDirectory(const QString &path);
+    void removeDeletedDocuments(const QList<int> &documentIds);
+    EmbeddingIndex *embeddingIndex(QSqlQuery &q, const QString &embedding_model, int folder_id);
+    void scheduleEmbeddingIndexBuild(const QString &embedding_model, int folder_id);
+    EmbeddingSegment *embeddingSegment(QSqlQuery &q, const QString &embedding_model);
+    void scheduleEmbeddingSegmentBuild(const QString &embedding_model);
+    void dropEmbeddingSegment(const QString &embedding_model);
+    void removeFolderIndexes(int folder_id);
+    bool loadChunkDictionaries(QSqlQuery &q);
+    void scheduleChunkCompression();
+    // returns 0 if the collection has no dictionary and too few chunks to train one
+    quint32 collectionDictionary(QSqlQuery &q, int collection_id);
+    void requestEmbeddingIndexes(const QString &embedding_model, const QList<int> &folder_ids);
+    void checkIndexRecall(const QSqlDatabase &db, const std::vector<float> &query, const QString &embedding_model,
+        const QList<int> &folder_ids, const QList<EmbeddingMatch> &annMatches, int nNeighbors);
+    static QList<EmbeddingMatch> searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q,
         int nNeighbors);
+    QList<EmbeddingMatch> searchFolderEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+        const QString &embedding_model, const QList<int> &folder_ids, int nNeighbors);
+    QList<int> searchEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+        const QList<QString> &collections, int nNeighbors);
     struct BM25Query {
         QString input;
         QString query;
@@ -277,12 +386,17 @@ private:
         int rlength = 0;
     };
     QList<Database::BM25Query> queriesForFTS5(const QString &input);
-    QList<int> searchBM25(const QString &query, const QList<QString> &collections, BM25Query &bm25q, int k);
-    QList<int> scoreChunks(const std::vector<float> &query, const QList<int> &chunks);
+    struct BM25Result { int chunkId; float score; }; // smaller is better
+    QList<BM25Result> searchBM25(const QSqlDatabase &db, const QString &query, const QList<QString> &collections,
+        BM25Query &bm25q, int k);
+    // folders of the given collections, by embedding model
+    QMap<QString, QList<int>> collectionFolders(const QSqlDatabase &db, const QList<QString> &collections);
     float computeBM25Weight(const BM25Query &bm25q);
-    QList<int> reciprocalRankFusion(const std::vector<float> &query, const QList<int> &embeddingResults,
-        const QList<int> &bm25Results, const BM25Query &bm25q, int k);
-    QList<int> searchDatabase(const QString &query, const QList<QString> &collections, int k);
+    QList<int> reciprocalRankFusion(const QList<int> &embeddingResults, const QList<BM25Result> &bm25Results,
+        const BM25Query &bm25q, int k);
+    QList<int> searchDatabase(const QSqlDatabase &db, const QString &query, const QList<QString> &collections,
+        int k);
+    std::vector<float> queryEmbedding(const QString &query);
 
     void setStartUpdateTime(CollectionItem &item);
     void setLastUpdateTime(CollectionItem &item);
@@ -298,22 +412,60 @@ private:
 private:
     QSqlDatabase m_db;
     int m_chunkSize;
+    int m_chunkTokens;
     QStringList m_scannedFileExtensions;
     QTimer *m_scanIntervalTimer;
     QElapsedTimer m_scanDurationTimer;
     std::map<int, std::list<DocumentInfo>> m_docsToScan;
     QList<ResultInfo> m_retrieve;
     QThread m_dbThread;
-    QFileSystemWatcher *m_watcher;
-    QSet<QString> m_watchedPaths;
+    FolderWatcher *m_watcher;
+    QHash<QString, QSet<int>> m_watchedPaths; // directory -> folders that contain it
+    QSet<int> m_unwatchedFolders; // folders with directories that could not be watched, rescanned periodically
+    QTimer *m_unwatchedScanTimer;
     EmbeddingLLM *m_embLLM;
     QVector<EmbeddingChunk> m_chunkList;
     QHash<int, CollectionItem> m_collectionMap; // used only for tracking indexing/embedding progress
     std::atomic<bool> m_databaseValid;
-    ChunkStreamer m_chunkStreamer;
+    std::unique_ptr<IngestPool> m_ingestPool;
+    std::map<quint64, IngestState> m_docsInFlight; // by job id, documents submitted to the ingestion workers
+    quint64 m_nextIngestJobId = 0;
+    int m_ftsRowsSinceOptimize = 0;
     QSet<int> m_documentIdCache; // cached list of documents with chunks for fast lookup
-
-    friend class ChunkStreamer;
+    std::unique_ptr<ReaderPool> m_readerPool;
+    // guards the vector indexes and segments, which are written by this thread and searched by the readers
+    mutable QReadWriteLock m_vectorLock { QReadWriteLock::Recursive };
+    std::unique_ptr<EmbeddingIndexSet> m_embeddingIndexes;
+    QList<std::pair<QString, int>> m_indexesToBuild; // (embedding model, folder id)
+    int m_indexBuildCursor = 0; // last chunk id added to the index being built
+    std::map<QString, std::unique_ptr<EmbeddingSegment>> m_embeddingSegments; // by embedding model
+    QStringList m_segmentsToBuild;
+    int m_segmentBuildCursor = 0; // last chunk id added to the segment being built
+    EmbeddingSegment::Quantization m_vectorQuantization = EmbeddingSegment::Quantization::None;
+    QTimer *m_indexSaveTimer;
+    std::atomic<int> m_annSearchCount = 0;
+    std::atomic<bool> m_recallCheckPending = false; // one check at a time, on a reader thread
+    ChunkCompressor m_chunkCompressor; // dictionaries of all collections, used by the readers too
+    bool m_compressChunks = false;
+    bool m_hasCompressedChunks = false;
+    QList<int> m_collectionsToCompress;
+    int m_compressCursor = 0; // last chunk id compressed in the collection being compressed
+
+    // recent searches, so that regenerating a response does not embed and search the same query again
+    struct CachedSearch { quint64 generation; QList<int> chunkIds; };
+    QMutex m_searchCacheMutex;
+    QCache<QString, std::vector<float>> m_queryEmbeddingCache; // by query text
+    QCache<QString, CachedSearch> m_searchResultCache; // by collections, k and query text
+    std::atomic<quint64> m_searchGeneration = 0; // changes whenever search results may have changed
+
+    // the collections of each folder as bits, so searches find the folders to visit without a join
+    struct FolderCollections {
+        quint64 generation = ~quint64(0);
+        QHash<QString, qsizetype> collectionBits; // collection name -> bit
+        QMap<std::pair<QString, int>, QBitArray> folders; // (embedding model, folder id) -> collections
+    };
+    QMutex m_folderCollectionsMutex;
+    FolderCollections m_folderCollections;
 };
 
 #endif // DATABASE_H
@@ -0,0 +1,281 @@
+#include "embeddingindex.h"
+
+#include <usearch/index_dense.hpp>
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QtLogging>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+namespace us = unum::usearch;
+
+
+static constexpr size_t s_defaultExpansion = 64;
+
+// the generation of a saved index is kept next to it, usearch has no room for it
+static QString generationPath(const QString &path)
+{
+    return path + u".gen"_s;
+}
+
+struct EmbeddingIndex::Private {
+    us::index_dense_t index;
+    size_t expansion = s_defaultExpansion;
+};
+
+EmbeddingIndex::EmbeddingIndex(QString path, std::unique_ptr<Private> d)
+    : m_path(std::move(path))
+    , d(std::move(d))
+{}
+
+EmbeddingIndex::~EmbeddingIndex() = default;
+
+std::unique_ptr<EmbeddingIndex> EmbeddingIndex::create(const QString &path, size_t dimensions)
+{
+    us::metric_punned_t metric(dimensions, us::metric_kind_t::ip_k, us::scalar_kind_t::f32_k); // inner product
+    us::index_dense_config_t config;
+    config.expansion_search = s_defaultExpansion;
+
+    auto state = us::index_dense_t::make(metric, config);
+    if (!state) {
+        qWarning() << "EmbeddingIndex ERROR: failed to create index:" << state.error.what();
+        return {};
+    }
+
+    auto d = std::make_unique<Private>();
+    d->index = std::move(state.index);
+    return std::unique_ptr<EmbeddingIndex>(new EmbeddingIndex(path, std::move(d)));
+}
+
+std::unique_ptr<EmbeddingIndex> EmbeddingIndex::load(const QString &path)
+{
+    if (!QFileInfo::exists(path))
+        return {};
+
+    auto state = us::index_dense_t::make(QFile::encodeName(path).constData());
+    if (!state) {
+        qWarning() << "EmbeddingIndex ERROR: failed to load" << path << state.error.what();
+        return {};
+    }
+
+    auto d = std::make_unique<Private>();
+    d->index = std::move(state.index);
+    d->index.change_expansion_search(d->expansion);
+    std::unique_ptr<EmbeddingIndex> index(new EmbeddingIndex(path, std::move(d)));
+    index->m_complete = true; // only complete indexes are saved
+
+    QFile genFile(generationPath(path));
+    if (genFile.open(QIODevice::ReadOnly)) {
+        bool ok;
+        quint64 generation = genFile.readAll().trimmed().toULongLong(&ok);
+        if (ok)
+            index->m_savedGeneration = generation;
+    }
+    return index;
+}
+
+void EmbeddingIndex::removeFiles(const QString &path)
+{
+    QFile::remove(generationPath(path));
+    QFile::remove(path);
+}
+
+size_t EmbeddingIndex::dimensions() const
+{
+    return d->index.dimensions();
+}
+
+size_t EmbeddingIndex::size() const
+{
+    return d->index.size();
+}
+
+bool EmbeddingIndex::contains(int chunkId) const
+{
+    return d->index.contains(us::default_key_t(chunkId));
+}
+
+bool EmbeddingIndex::add(int chunkId, const float *embedding)
+{
+    auto &index = d->index;
+    auto key = us::default_key_t(chunkId);
+    if (index.contains(key))
+        index.remove(key); // re-embedded chunk
+
+    // grow geometrically, usearch does not reallocate on its own
+    if (index.size() + 1 > index.capacity()) {
+        size_t capacity = std::max<size_t>(1024, index.capacity() * 2);
+        if (!index.reserve(us::index_limits_t(capacity, std::thread::hardware_concurrency()))) {
+            qWarning() << "EmbeddingIndex ERROR: failed to reserve" << capacity << "vectors";
+            return false;
+        }
+    }
+
+    auto result = index.add(key, embedding);
+    if (!result) {
+        qWarning() << "EmbeddingIndex ERROR: failed to add chunk" << chunkId << result.error.what();
+        return false;
+    }
+    m_dirty = true;
+    return true;
+}
+
+void EmbeddingIndex::remove(int chunkId)
+{
+    auto result = d->index.remove(us::default_key_t(chunkId));
+    if (result.completed)
+        m_dirty = true;
+}
+
+QList<EmbeddingMatch> EmbeddingIndex::search(const float *query, int k) const
+{
+    auto result = d->index.search(query, k);
+    if (!result) {
+        qWarning() << "EmbeddingIndex ERROR: search failed:" << result.error.what();
+        return {};
+    }
+
+    std::vector<us::default_key_t> keys(result.size());
+    std::vector<us::distance_punned_t> distances(result.size());
+    size_t found = result.dump_to(keys.data(), distances.data());
+
+    QList<EmbeddingMatch> matches;
+    matches.reserve(found);
+    for (size_t i = 0; i < found; i++)
+        matches.append({ int(keys[i]), float(distances[i]) });
+    return matches;
+}
+
+size_t EmbeddingIndex::expansion() const
+{
+    return d->expansion;
+}
+
+void EmbeddingIndex::setExpansion(size_t expansion)
+{
+    d->expansion = expansion;
+    d->index.change_expansion_search(expansion);
+}
+
+bool EmbeddingIndex::save(quint64 generation)
+{
+    Q_ASSERT(m_complete);
+
+    // the old generation goes first, an index without one is not trusted
+    QFile::remove(generationPath(m_path));
+
+    // write to a temporary file first so a crash never leaves a truncated index behind
+    QString tmpPath = m_path + u".tmp"_s;
+    auto result = d->index.save(QFile::encodeName(tmpPath).constData());
+    if (!result) {
+        qWarning() << "EmbeddingIndex ERROR: failed to save" << tmpPath << result.error.what();
+        QFile::remove(tmpPath);
+        return false;
+    }
+    QFile::remove(m_path);
+    if (!QFile::rename(tmpPath, m_path)) {
+        qWarning() << "EmbeddingIndex ERROR: failed to rename" << tmpPath << "to" << m_path;
+        return false;
+    }
+
+    QFile genFile(generationPath(m_path));
+    if (!genFile.open(QIODevice::WriteOnly) || genFile.write(QByteArray::number(generation)) == -1) {
+        qWarning() << "EmbeddingIndex ERROR: failed to write" << genFile.fileName() << genFile.errorString();
+        return false;
+    }
+    m_savedGeneration = generation;
+    m_dirty = false;
+    return true;
+}
+
+void EmbeddingIndexSet::setDirectory(const QString &path)
+{
+    m_indexes.clear();
+    m_directory = path;
+    if (!QDir().mkpath(path))
+        qWarning() << "EmbeddingIndexSet ERROR: cannot create" << path;
+}
+
+QString EmbeddingIndexSet::basePathFor(const QString &model) const
+{
+    // model names are not guaranteed to be valid file names
+    auto modelHash = QCryptographicHash::hash(model.toUtf8(), QCryptographicHash::Md5).toHex().left(16);
+    return u"%1/%2"_s.arg(m_directory, QString::fromLatin1(modelHash));
+}
+
+QString EmbeddingIndexSet::pathFor(const QString &model, int folderId) const
+{
+    return u"%1_%2.usearch"_s.arg(basePathFor(model)).arg(folderId);
+}
+
+EmbeddingIndex *EmbeddingIndexSet::find(const QString &model, int folderId) const
+{
+    auto it = m_indexes.find({ model, folderId });
+    return it == m_indexes.end() ? nullptr : it->second.get();
+}
+
+EmbeddingIndex *EmbeddingIndexSet::load(const QString &model, int folderId)
+{
+    if (m_directory.isEmpty())
+        return nullptr;
+
+    auto index = EmbeddingIndex::load(pathFor(model, folderId));
+    if (!index)
+        return nullptr;
+    return m_indexes.insert_or_assign(Key { model, folderId }, std::move(index)).first->second.get();
+}
+
+EmbeddingIndex *EmbeddingIndexSet::create(const QString &model, int folderId, size_t dimensions)
+{
+    if (m_directory.isEmpty())
+        return nullptr;
+
+    remove(model, folderId);
+    auto index = EmbeddingIndex::create(pathFor(model, folderId), dimensions);
+    if (!index)
+        return nullptr;
+    return m_indexes.emplace(Key { model, folderId }, std::move(index)).first->second.get();
+}
+
+void EmbeddingIndexSet::remove(const QString &model, int folderId)
+{
+    m_indexes.erase({ model, folderId });
+    EmbeddingIndex::removeFiles(pathFor(model, folderId));
+}
+
+void EmbeddingIndexSet::removeFolder(int folderId)
+{
+    std::erase_if(m_indexes, [folderId](auto &entry) { return entry.first.second == folderId; });
+
+    // also remove the files of indexes that were never loaded
+    QDir dir(m_directory);
+    for (const QString &file: dir.entryList({ u"*_%1.usearch"_s.arg(folderId) }, QDir::Files))
+        EmbeddingIndex::removeFiles(dir.filePath(file));
+}
+
+void EmbeddingIndexSet::removeChunk(int folderId, int chunkId)
+{
+    for (auto &[key, index]: m_indexes) {
+        if (key.second == folderId)
+            index->remove(chunkId);
+    }
+}
+
+void EmbeddingIndexSet::saveAll(const GenerationFn &generationOf)
+{
+    for (auto &[key, index]: m_indexes) {
+        if (!index->isComplete() || !index->isDirty())
+            continue;
+        if (auto generation = generationOf(key.first, key.second))
+            index->save(*generation);
+    }
+}
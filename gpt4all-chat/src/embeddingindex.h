@@ -0,0 +1,102 @@
+#ifndef EMBEDDINGINDEX_H
+#define EMBEDDINGINDEX_H
+
+#include <QList>
+#include <QString>
+
+#include <QtTypes>
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+
+
+struct EmbeddingMatch {
+    int chunkId;
+    float distance; // smaller is closer
+};
+
+/* Approximate nearest neighbor (HNSW) index over the embeddings of one folder made by one embedding model.
+ * The embeddings table is the source of truth; an index is a cache that can be thrown away and rebuilt at any
+ * time. An index is only used for search once it is complete, i.e. it holds every embedding of its folder.
+ *
+ * A saved index records the generation of its folder's embeddings, a counter the database bumps on every change to
+ * them, so an index that missed a change is recognized when it is loaded. */
+class EmbeddingIndex {
+public:
+    ~EmbeddingIndex();
+
+    // returns nullptr on failure
+    static std::unique_ptr<EmbeddingIndex> create(const QString &path, size_t dimensions);
+    // load a saved index, returns nullptr if there is none or it cannot be read
+    static std::unique_ptr<EmbeddingIndex> load(const QString &path);
+    static void removeFiles(const QString &path);
+
+    size_t dimensions() const;
+    size_t size() const;
+    bool contains(int chunkId) const;
+
+    bool isComplete() const { return m_complete; }
+    void setComplete() { m_complete = true; m_dirty = true; }
+    bool isDirty() const { return m_dirty; }
+
+    bool add(int chunkId, const float *embedding);
+    void remove(int chunkId);
+    QList<EmbeddingMatch> search(const float *query, int k) const;
+
+    // number of candidates visited per search, raised when the recall check fails
+    size_t expansion() const;
+    void setExpansion(size_t expansion);
+
+    // the generation of the embeddings when the index was saved, if known
+    std::optional<quint64> savedGeneration() const { return m_savedGeneration; }
+    bool save(quint64 generation);
+
+private:
+    struct Private;
+
+    EmbeddingIndex(QString path, std::unique_ptr<Private> d);
+
+    QString                  m_path;
+    std::unique_ptr<Private> d;
+    bool                     m_complete = false;
+    bool                     m_dirty = false;
+    std::optional<quint64>   m_savedGeneration;
+};
+
+// The HNSW indexes of the database, keyed by (embedding model, folder id) and stored as files in one directory.
+class EmbeddingIndexSet {
+public:
+    using Key = std::pair<QString, int>;
+    // the current generation of the embeddings of a folder, nullopt if it cannot be read
+    using GenerationFn = std::function<std::optional<quint64>(const QString &model, int folderId)>;
+
+    void setDirectory(const QString &path);
+    bool hasDirectory() const { return !m_directory.isEmpty(); }
+    // path without extension for files that belong to an embedding model
+    QString basePathFor(const QString &model) const;
+
+    // returns the index if it is in memory, or nullptr
+    EmbeddingIndex *find(const QString &model, int folderId) const;
+    // loads a saved index from disk, returns nullptr if there is none
+    EmbeddingIndex *load(const QString &model, int folderId);
+    EmbeddingIndex *create(const QString &model, int folderId, size_t dimensions);
+    void remove(const QString &model, int folderId);
+    void removeFolder(int folderId);
+    void removeChunk(int folderId, int chunkId);
+
+    const std::map<Key, std::unique_ptr<EmbeddingIndex>> &indexes() const { return m_indexes; }
+
+    void saveAll(const GenerationFn &generationOf);
+
+private:
+    QString pathFor(const QString &model, int folderId) const;
+
+    QString                                        m_directory;
+    std::map<Key, std::unique_ptr<EmbeddingIndex>> m_indexes;
+};
+
+#endif // EMBEDDINGINDEX_H
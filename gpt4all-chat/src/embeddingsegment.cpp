@@ -0,0 +1,572 @@
+#include "embeddingsegment.h"
+
+#include <usearch/index_plugins.hpp>
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QThread>
+#include <QThreadPool>
+#include <QtLogging>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <latch>
+#include <queue>
+#include <span>
+#include <utility>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+namespace us = unum::usearch;
+
+
+static constexpr char     s_segmentMagic[8]      = { 'L', 'D', 'V', 'E', 'C', 'S', '0', '1' };
+static constexpr size_t   s_rowAlignment         = 64; // bytes
+static constexpr uint64_t s_minCapacity          = 4096;
+static constexpr size_t   s_parallelSearchRows   = 65536;
+static constexpr uint32_t s_flagComplete         = 1;
+static constexpr uint32_t s_flagGeneration       = 2; // the generation field is valid
+// candidates rescored with the float rows after a quantized scan
+static constexpr int      s_int8Candidates       = 256;
+static constexpr int      s_binaryCandidates     = 512;
+
+static QString quantizedSuffix(EmbeddingSegment::Quantization quantization)
+{
+    switch (quantization) {
+        using enum EmbeddingSegment::Quantization;
+        case None:   break;
+        case Int8:   return u".i8"_s;
+        case Binary: return u".b1"_s;
+    }
+    return {};
+}
+
+static size_t quantizedStride(EmbeddingSegment::Quantization quantization, size_t dimensions)
+{
+    switch (quantization) {
+        using enum EmbeddingSegment::Quantization;
+        case None:   break;
+        case Int8:   return (sizeof(float) + dimensions + s_rowAlignment - 1) / s_rowAlignment * s_rowAlignment;
+        case Binary: return (dimensions + 63) / 64 * sizeof(uint64_t);
+    }
+    return 0;
+}
+
+static float ipDistance(const us::metric_punned_t &metric, const float *a, const float *b)
+{
+    return float(metric(reinterpret_cast<const us::byte_t *>(a), reinterpret_cast<const us::byte_t *>(b)));
+}
+
+struct EmbeddingSegment::Header {
+    char     magic[8];
+    uint32_t dimensions;
+    uint32_t flags;
+    uint64_t rows;     // rows in use, including deleted ones
+    uint64_t capacity; // rows allocated in every file
+    uint64_t generation;
+    uint8_t  reserved[24];
+};
+
+EmbeddingSegment::EmbeddingSegment(const QString &basePath)
+    : m_basePath(basePath)
+    , m_vectorsFile(basePath + u".vectors"_s)
+    , m_rowsFile(basePath + u".rows"_s)
+{}
+
+EmbeddingSegment::~EmbeddingSegment()
+{
+    unmap();
+}
+
+std::unique_ptr<EmbeddingSegment> EmbeddingSegment::create(const QString &basePath, size_t dimensions)
+{
+    static_assert(sizeof(Header) == s_rowAlignment); // keeps the first row aligned
+
+    std::unique_ptr<EmbeddingSegment> segment(new EmbeddingSegment(basePath));
+    auto &vf = segment->m_vectorsFile, &rf = segment->m_rowsFile;
+    if (!vf.open(QIODevice::ReadWrite | QIODevice::Truncate) || !rf.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        qWarning() << "EmbeddingSegment ERROR: cannot create" << basePath << vf.errorString() << rf.errorString();
+        return {};
+    }
+
+    Header header {};
+    memcpy(header.magic, s_segmentMagic, sizeof header.magic);
+    header.dimensions = dimensions;
+    if (vf.write(reinterpret_cast<const char *>(&header), sizeof header) != sizeof header) {
+        qWarning() << "EmbeddingSegment ERROR: cannot write" << vf.fileName() << vf.errorString();
+        return {};
+    }
+
+    segment->m_dimensions = dimensions;
+    segment->m_rowStride = (dimensions * sizeof(float) + s_rowAlignment - 1) / s_rowAlignment * s_rowAlignment
+                           / sizeof(float);
+    if (!segment->map() || !segment->reserve(s_minCapacity))
+        return {};
+    return segment;
+}
+
+std::unique_ptr<EmbeddingSegment> EmbeddingSegment::open(const QString &basePath)
+{
+    std::unique_ptr<EmbeddingSegment> segment(new EmbeddingSegment(basePath));
+    auto &vf = segment->m_vectorsFile, &rf = segment->m_rowsFile;
+    if (!vf.exists() || !rf.exists())
+        return {};
+    if (!vf.open(QIODevice::ReadWrite) || !rf.open(QIODevice::ReadWrite)) {
+        qWarning() << "EmbeddingSegment ERROR: cannot open" << basePath << vf.errorString() << rf.errorString();
+        return {};
+    }
+
+    Header header;
+    if (vf.read(reinterpret_cast<char *>(&header), sizeof header) != sizeof header
+        || memcmp(header.magic, s_segmentMagic, sizeof header.magic) || !header.dimensions
+    ) {
+        qWarning() << "EmbeddingSegment ERROR: invalid header in" << vf.fileName();
+        return {};
+    }
+
+    segment->m_dimensions = header.dimensions;
+    segment->m_rowStride = (header.dimensions * sizeof(float) + s_rowAlignment - 1) / s_rowAlignment
+                           * s_rowAlignment / sizeof(float);
+    const auto vectorBytes = sizeof header + header.capacity * segment->m_rowStride * sizeof(float);
+    if (header.rows > header.capacity || uint64_t(vf.size()) < vectorBytes
+        || uint64_t(rf.size()) < header.capacity * sizeof(Row)
+    ) {
+        qWarning() << "EmbeddingSegment ERROR: truncated segment" << basePath;
+        return {};
+    }
+    if (!segment->map())
+        return {};
+
+    // pick up the quantized rows if they were written for the same capacity
+    for (auto quantization: { Quantization::Int8, Quantization::Binary }) {
+        QFile &qf = segment->m_quantizedFile;
+        qf.setFileName(basePath + quantizedSuffix(quantization));
+        if (!qf.exists())
+            continue;
+        const size_t stride = quantizedStride(quantization, header.dimensions);
+        if (uint64_t(qf.size()) == header.capacity * stride && qf.open(QIODevice::ReadWrite)) {
+            segment->m_quantization = quantization;
+            segment->m_quantizedStride = stride;
+            if (segment->mapQuantized())
+                break;
+            segment->m_quantization = Quantization::None;
+        }
+        qf.close();
+        qf.remove();
+    }
+
+    const Row *rows = segment->rows();
+    segment->m_rowOfChunk.reserve(header.rows);
+    for (uint64_t i = 0; i < header.rows; i++) {
+        if (rows[i].chunkId != -1) {
+            segment->m_rowOfChunk.insert(rows[i].chunkId, i);
+            segment->m_rowsOfFolder[rows[i].folderId].push_back(i);
+        }
+    }
+    return segment;
+}
+
+void EmbeddingSegment::removeFiles(const QString &basePath)
+{
+    QFile::remove(basePath + u".vectors"_s);
+    QFile::remove(basePath + u".rows"_s);
+    for (auto quantization: { Quantization::Int8, Quantization::Binary })
+        QFile::remove(basePath + quantizedSuffix(quantization));
+}
+
+bool EmbeddingSegment::map()
+{
+    m_vectorsMap = m_vectorsFile.map(0, m_vectorsFile.size());
+    m_rowsMap = m_rowsFile.size() ? m_rowsFile.map(0, m_rowsFile.size()) : nullptr;
+    if (!m_vectorsMap || (m_rowsFile.size() && !m_rowsMap)) {
+        qWarning() << "EmbeddingSegment ERROR: cannot map" << m_vectorsFile.fileName() << m_vectorsFile.errorString()
+                   << m_rowsFile.errorString();
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+bool EmbeddingSegment::mapQuantized()
+{
+    if (m_quantization == Quantization::None || !m_quantizedFile.size())
+        return true;
+    m_quantizedMap = m_quantizedFile.map(0, m_quantizedFile.size());
+    if (!m_quantizedMap) {
+        qWarning() << "EmbeddingSegment ERROR: cannot map" << m_quantizedFile.fileName()
+                   << m_quantizedFile.errorString();
+        return false;
+    }
+    return true;
+}
+
+void EmbeddingSegment::unmap()
+{
+    if (m_vectorsMap)
+        m_vectorsFile.unmap(std::exchange(m_vectorsMap, nullptr));
+    if (m_rowsMap)
+        m_rowsFile.unmap(std::exchange(m_rowsMap, nullptr));
+    if (m_quantizedMap)
+        m_quantizedFile.unmap(std::exchange(m_quantizedMap, nullptr));
+}
+
+bool EmbeddingSegment::reserve(size_t capacity)
+{
+    if (header()->capacity >= capacity)
+        return true;
+
+    // the files must be remapped to grow, so grow geometrically
+    capacity = std::max<size_t>(capacity, header()->capacity * 2);
+    Header saved = *header();
+    unmap();
+    if (!m_vectorsFile.resize(sizeof(Header) + capacity * m_rowStride * sizeof(float))
+        || !m_rowsFile.resize(capacity * sizeof(Row))
+        || (m_quantization != Quantization::None && !m_quantizedFile.resize(capacity * m_quantizedStride))
+    ) {
+        qWarning() << "EmbeddingSegment ERROR: cannot grow" << m_vectorsFile.fileName() << m_vectorsFile.errorString()
+                   << m_rowsFile.errorString();
+        map();
+        mapQuantized();
+        return false;
+    }
+    if (!map() || !mapQuantized())
+        return false;
+    *header() = saved;
+    header()->capacity = capacity;
+    return true;
+}
+
+float *EmbeddingSegment::vector(size_t row) const
+{
+    return reinterpret_cast<float *>(m_vectorsMap + sizeof(Header)) + row * m_rowStride;
+}
+
+bool EmbeddingSegment::isComplete() const
+{
+    return header()->flags & s_flagComplete;
+}
+
+void EmbeddingSegment::setComplete()
+{
+    header()->flags |= s_flagComplete;
+}
+
+std::optional<uint64_t> EmbeddingSegment::generation() const
+{
+    if (!(header()->flags & s_flagGeneration))
+        return std::nullopt;
+    return header()->generation;
+}
+
+void EmbeddingSegment::setGeneration(uint64_t generation)
+{
+    header()->generation = generation;
+    header()->flags |= s_flagGeneration;
+}
+
+void EmbeddingSegment::clearGeneration()
+{
+    header()->flags &= ~s_flagGeneration;
+}
+
+bool EmbeddingSegment::setQuantization(Quantization quantization)
+{
+    if (quantization == m_quantization)
+        return true;
+
+    if (m_quantizedMap)
+        m_quantizedFile.unmap(std::exchange(m_quantizedMap, nullptr));
+    m_quantizedFile.close();
+    m_quantizedFile.remove();
+    m_quantization = Quantization::None;
+    m_quantizedStride = 0;
+    if (quantization == Quantization::None)
+        return true;
+
+    const size_t stride = quantizedStride(quantization, m_dimensions);
+    m_quantizedFile.setFileName(m_basePath + quantizedSuffix(quantization));
+    if (!m_quantizedFile.open(QIODevice::ReadWrite | QIODevice::Truncate)
+        || !m_quantizedFile.resize(header()->capacity * stride)
+    ) {
+        qWarning() << "EmbeddingSegment ERROR: cannot create" << m_quantizedFile.fileName()
+                   << m_quantizedFile.errorString();
+        m_quantizedFile.close();
+        m_quantizedFile.remove();
+        return false;
+    }
+    m_quantization = quantization;
+    m_quantizedStride = stride;
+    if (!mapQuantized()) {
+        setQuantization(Quantization::None);
+        return false;
+    }
+
+    for (uint64_t i = 0; i < header()->rows; i++)
+        quantize(vector(i), quantizedRow(i));
+    return true;
+}
+
+void EmbeddingSegment::quantize(const float *embedding, uchar *dst) const
+{
+    switch (m_quantization) {
+        using enum Quantization;
+        case None:
+            break;
+        case Int8: {
+            // symmetric, with one scale per row
+            float maxAbs = 0;
+            for (size_t i = 0; i < m_dimensions; i++)
+                maxAbs = std::max(maxAbs, std::abs(embedding[i]));
+            const float scale = maxAbs > 0 ? maxAbs / 127 : 1;
+            memcpy(dst, &scale, sizeof scale);
+            auto *values = reinterpret_cast<int8_t *>(dst + sizeof scale);
+            for (size_t i = 0; i < m_dimensions; i++)
+                values[i] = int8_t(std::lround(embedding[i] / scale));
+            break;
+        }
+        case Binary: {
+            auto *words = reinterpret_cast<uint64_t *>(dst);
+            std::fill_n(words, m_quantizedStride / sizeof(uint64_t), 0);
+            for (size_t i = 0; i < m_dimensions; i++) {
+                if (embedding[i] > 0)
+                    words[i / 64] |= uint64_t(1) << (i % 64);
+            }
+            break;
+        }
+    }
+}
+
+float EmbeddingSegment::quantizedDistance(const uchar *row, const uchar *query) const
+{
+    if (m_quantization == Quantization::Int8) {
+        // written as plain loops over contiguous bytes so the compiler vectorizes them
+        float rowScale, queryScale;
+        memcpy(&rowScale, row, sizeof rowScale);
+        memcpy(&queryScale, query, sizeof queryScale);
+        auto *a = reinterpret_cast<const int8_t *>(row + sizeof rowScale);
+        auto *b = reinterpret_cast<const int8_t *>(query + sizeof queryScale);
+        int32_t dot = 0;
+        for (size_t i = 0; i < m_dimensions; i++)
+            dot += int32_t(a[i]) * int32_t(b[i]);
+        return 1.0f - rowScale * queryScale * float(dot);
+    }
+
+    // Hamming distance between the sign bits
+    auto *a = reinterpret_cast<const uint64_t *>(row);
+    auto *b = reinterpret_cast<const uint64_t *>(query);
+    int bits = 0;
+    for (size_t i = 0; i < m_quantizedStride / sizeof(uint64_t); i++)
+        bits += std::popcount(a[i] ^ b[i]);
+    return float(bits);
+}
+
+bool EmbeddingSegment::add(int chunkId, int folderId, const float *embedding)
+{
+    // a re-embedded chunk gets a new row
+    remove(chunkId);
+    clearGeneration();
+
+    const uint64_t row = header()->rows;
+    if (!reserve(row + 1))
+        return false;
+
+    float *dst = vector(row);
+    memcpy(dst, embedding, m_dimensions * sizeof(float));
+    std::fill(dst + m_dimensions, dst + m_rowStride, 0.0f);
+    if (m_quantization != Quantization::None)
+        quantize(embedding, quantizedRow(row));
+    rows()[row] = { chunkId, folderId };
+    header()->rows = row + 1;
+    m_rowOfChunk.insert(chunkId, row);
+    m_rowsOfFolder[folderId].push_back(row);
+    return true;
+}
+
+void EmbeddingSegment::remove(int chunkId)
+{
+    auto it = m_rowOfChunk.constFind(chunkId);
+    if (it == m_rowOfChunk.cend())
+        return;
+    clearGeneration();
+    rows()[*it].chunkId = -1;
+    m_rowOfChunk.erase(it);
+}
+
+void EmbeddingSegment::removeFolder(int folderId)
+{
+    auto it = m_rowsOfFolder.find(folderId);
+    if (it == m_rowsOfFolder.end())
+        return;
+
+    clearGeneration();
+    Row *rs = rows();
+    for (uint64_t i: *it) {
+        if (rs[i].chunkId != -1) {
+            m_rowOfChunk.remove(rs[i].chunkId);
+            rs[i].chunkId = -1;
+        }
+    }
+    m_rowsOfFolder.erase(it);
+}
+
+bool EmbeddingSegment::needsCompaction() const
+{
+    // reclaim space once a quarter of the rows are deleted
+    uint64_t deleted = header()->rows - m_rowOfChunk.size();
+    return deleted >= s_minCapacity && deleted * 4 >= header()->rows;
+}
+
+void EmbeddingSegment::compact()
+{
+    Row *rs = rows();
+    uint64_t dst = 0;
+    m_rowsOfFolder.clear();
+    for (uint64_t src = 0; src < header()->rows; src++) {
+        if (rs[src].chunkId == -1)
+            continue;
+        if (src != dst) {
+            memcpy(vector(dst), vector(src), m_rowStride * sizeof(float));
+            if (m_quantization != Quantization::None)
+                memcpy(quantizedRow(dst), quantizedRow(src), m_quantizedStride);
+            rs[dst] = rs[src];
+            m_rowOfChunk[rs[dst].chunkId] = dst;
+        }
+        m_rowsOfFolder[rs[dst].folderId].push_back(dst);
+        dst++;
+    }
+    header()->rows = dst;
+}
+
+// shared by every search, so that concurrent readers split the cores between them instead of each starting a thread
+// per core
+static QThreadPool &searchPool()
+{
+    static QThreadPool *pool = [] {
+        auto *pool = new QThreadPool;
+        pool->setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1)); // the caller scans a range too
+        pool->setObjectName(u"segment search"_s);
+        return pool;
+    }();
+    return *pool;
+}
+
+template <typename DistanceFn>
+QList<EmbeddingMatch> EmbeddingSegment::nearestRows(const QSet<int> &folderIds, int k, DistanceFn distance) const
+{
+    if (k <= 0)
+        return {}; // the heaps below need room for at least one row
+
+    // only the rows of the requested folders are visited, numbered across folders as [0, nRows)
+    std::vector<std::span<const uint64_t>> partitions;
+    uint64_t nRows = 0;
+    for (int folderId: folderIds) {
+        auto it = m_rowsOfFolder.constFind(folderId);
+        if (it != m_rowsOfFolder.cend() && !it->empty()) {
+            partitions.emplace_back(*it);
+            nRows += it->size();
+        }
+    }
+    const Row *rs = rows();
+
+    auto cmp = [](const EmbeddingMatch &a, const EmbeddingMatch &b) { return a.distance < b.distance; };
+    using Heap = std::priority_queue<EmbeddingMatch, std::vector<EmbeddingMatch>, decltype(cmp)>;
+
+    // each range keeps its own max-heap of the k nearest rows
+    auto scan = [&](uint64_t begin, uint64_t end, Heap &heap) {
+        auto part = partitions.begin();
+        uint64_t partBegin = 0; // number of the first row of *part
+        for (; part != partitions.end() && partBegin + part->size() <= begin; ++part)
+            partBegin += part->size();
+        for (uint64_t n = begin; n < end; n++) {
+            if (n - partBegin == part->size())
+                partBegin += (part++)->size();
+            const uint64_t i = (*part)[n - partBegin];
+            if (rs[i].chunkId == -1)
+                continue;
+            float d = distance(i);
+            if (heap.size() < size_t(k)) {
+                heap.push({ rs[i].chunkId, d });
+            } else if (d < heap.top().distance) {
+                heap.pop();
+                heap.push({ rs[i].chunkId, d });
+            }
+        }
+    };
+
+    const size_t nRanges = nRows < s_parallelSearchRows ? 1 : size_t(searchPool().maxThreadCount()) + 1;
+    std::vector<Heap> heaps(nRanges, Heap(cmp));
+    const uint64_t perRange = (nRows + nRanges - 1) / nRanges;
+    auto scanRange = [&](size_t r) {
+        uint64_t begin = std::min(nRows, r * perRange), end = std::min(nRows, begin + perRange);
+        scan(begin, end, heaps[r]);
+    };
+    if (nRanges > 1) {
+        // ranges wait in the pool while other searches use it, the first is scanned here meanwhile
+        std::latch done(ptrdiff_t(nRanges - 1));
+        for (size_t r = 1; r < nRanges; r++) {
+            searchPool().start([&scanRange, &done, r] {
+                scanRange(r);
+                done.count_down();
+            });
+        }
+        scanRange(0);
+        done.wait();
+    } else {
+        scanRange(0);
+    }
+
+    QList<EmbeddingMatch> matches;
+    for (auto &heap: heaps) {
+        for (; !heap.empty(); heap.pop())
+            matches.append(heap.top());
+    }
+    k = qMin(k, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + k, matches.end(), cmp);
+    matches.resize(k);
+    return matches;
+}
+
+QList<EmbeddingMatch> EmbeddingSegment::search(const float *query, const QSet<int> &folderIds, int k) const
+{
+    if (k <= 0)
+        return {};
+
+    const us::metric_punned_t metric(m_dimensions, us::metric_kind_t::ip_k, us::scalar_kind_t::f32_k);
+    if (m_quantization == Quantization::None)
+        return nearestRows(folderIds, k, [&](uint64_t row) { return ipDistance(metric, vector(row), query); });
+
+    // scan the compact rows for candidates, then rescore only those with the float rows
+    std::vector<uchar> quantizedQuery(m_quantizedStride);
+    quantize(query, quantizedQuery.data());
+    const int nCandidates = std::max(k, m_quantization == Quantization::Int8 ? s_int8Candidates : s_binaryCandidates);
+
+    QList<EmbeddingMatch> candidates = nearestRows(folderIds, nCandidates,
+        [&](uint64_t row) { return quantizedDistance(quantizedRow(row), quantizedQuery.data()); });
+    for (auto &c: candidates)
+        c.distance = ipDistance(metric, vector(m_rowOfChunk.value(c.chunkId)), query);
+
+    k = qMin(k, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(),
+                      [](const EmbeddingMatch &a, const EmbeddingMatch &b) { return a.distance < b.distance; });
+    candidates.resize(k);
+    return candidates;
+}
+
+QList<EmbeddingMatch> EmbeddingSegment::score(const float *query, const QList<int> &chunkIds) const
+{
+    const us::metric_punned_t metric(m_dimensions, us::metric_kind_t::ip_k, us::scalar_kind_t::f32_k);
+
+    QList<EmbeddingMatch> matches;
+    matches.reserve(chunkIds.size());
+    for (int chunkId: chunkIds) {
+        auto it = m_rowOfChunk.constFind(chunkId);
+        if (it != m_rowOfChunk.cend())
+            matches.append({ chunkId, ipDistance(metric, vector(*it), query) });
+    }
+    std::sort(matches.begin(), matches.end(),
+              [](const EmbeddingMatch &a, const EmbeddingMatch &b) { return a.distance < b.distance; });
+    return matches;
+}
@@ -0,0 +1,106 @@
+#ifndef EMBEDDINGSEGMENT_H
+#define EMBEDDINGSEGMENT_H
+
+#include "embeddingindex.h"
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QString>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+
+/* All embeddings made by one embedding model, kept in memory-mapped files so exact search is a single pass over
+ * contiguous memory instead of a blob read per row:
+ *
+ *  <name>.vectors  a header followed by one 64-byte aligned row of floats per embedding
+ *  <name>.rows     a parallel array of (chunk id, folder id), where chunk id -1 marks a deleted row
+ *
+ * The rows of each folder are listed in memory, so a search only visits the rows of the folders it asks for.
+ * Deleted rows are reclaimed by compact(). Like EmbeddingIndex this is a cache of the embeddings table, which
+ * remains the source of truth. */
+class EmbeddingSegment {
+public:
+    /* Optional compact copy of the rows used to find candidates before rescoring them with the float rows,
+     * stored as <name>.i8 (one byte per dimension and a scale per row) or <name>.b1 (one sign bit per dimension). */
+    enum class Quantization { None, Int8, Binary };
+
+    ~EmbeddingSegment();
+
+    // returns nullptr on failure
+    static std::unique_ptr<EmbeddingSegment> create(const QString &basePath, size_t dimensions);
+    // opens a saved segment, returns nullptr if there is none or it cannot be read
+    static std::unique_ptr<EmbeddingSegment> open(const QString &basePath);
+    static void removeFiles(const QString &basePath);
+
+    size_t dimensions() const { return m_dimensions; }
+    size_t size() const { return m_rowOfChunk.size(); } // live rows
+    bool contains(int chunkId) const { return m_rowOfChunk.contains(chunkId); }
+
+    bool isComplete() const;
+    void setComplete();
+
+    /* The generation of the embeddings the rows match, which the database stamps when the segment is known to be in
+     * sync with it. Any change to the rows clears it, so a segment that was changed and not stamped again, e.g.
+     * because of a crash, is not trusted when it is opened. */
+    std::optional<uint64_t> generation() const;
+    void setGeneration(uint64_t generation);
+
+    Quantization quantization() const { return m_quantization; }
+    bool setQuantization(Quantization quantization);
+
+    bool add(int chunkId, int folderId, const float *embedding);
+    void remove(int chunkId);
+    void removeFolder(int folderId);
+
+    bool needsCompaction() const;
+    void compact();
+
+    // nearest neighbors among the rows of the given folders
+    QList<EmbeddingMatch> search(const float *query, const QSet<int> &folderIds, int k) const;
+    // distances of the given chunks, missing chunks are skipped
+    QList<EmbeddingMatch> score(const float *query, const QList<int> &chunkIds) const;
+
+private:
+    struct Header;
+    struct Row { int32_t chunkId; int32_t folderId; };
+
+    EmbeddingSegment(const QString &basePath);
+
+    void clearGeneration();
+    bool map();
+    void unmap();
+    bool mapQuantized();
+    bool reserve(size_t capacity);
+    Header *header() const { return reinterpret_cast<Header *>(m_vectorsMap); }
+    float *vector(size_t row) const;
+    Row *rows() const { return reinterpret_cast<Row *>(m_rowsMap); }
+    uchar *quantizedRow(size_t row) const { return m_quantizedMap + row * m_quantizedStride; }
+
+    void quantize(const float *embedding, uchar *dst) const;
+    float quantizedDistance(const uchar *row, const uchar *query) const;
+    template <typename DistanceFn>
+    QList<EmbeddingMatch> nearestRows(const QSet<int> &folderIds, int k, DistanceFn distance) const;
+
+    QString              m_basePath;
+    QFile                m_vectorsFile;
+    QFile                m_rowsFile;
+    QFile                m_quantizedFile;
+    uchar               *m_vectorsMap      = nullptr;
+    uchar               *m_rowsMap         = nullptr;
+    uchar               *m_quantizedMap    = nullptr;
+    size_t               m_dimensions      = 0;
+    size_t               m_rowStride       = 0; // floats per row, including padding
+    size_t               m_quantizedStride = 0; // bytes per quantized row
+    Quantization         m_quantization    = Quantization::None;
+    QHash<int, uint64_t> m_rowOfChunk;
+    QHash<int, std::vector<uint64_t>> m_rowsOfFolder; // ascending, may include deleted rows until compact()
+};
+
+#endif // EMBEDDINGSEGMENT_H
@@ -5,6 +5,7 @@
 
 #include <gpt4all-backend/llmodel.h>
 
+#include <QByteArray>
 #include <QCoreApplication>
 #include <QDebug>
 #include <QFile>
@@ -24,7 +25,9 @@
 #include <QtGlobal>
 #include <QtLogging>
 
+#include <algorithm>
 #include <exception>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -33,8 +36,12 @@ using namespace Qt::Literals::StringLiterals;
 static const QString EMBEDDING_MODEL_NAME = u"nomic-embed-text-v1.5"_s;
 static const QString LOCAL_EMBEDDING_MODEL = u"nomic-embed-text-v1.5.f16.gguf"_s;
 
-EmbeddingLLMWorker::EmbeddingLLMWorker()
+static constexpr int s_maxEmbeddingWorkers = 16;
+static constexpr auto RequestIdAttribute = QNetworkRequest::Attribute(QNetworkRequest::User + 1);
+
+EmbeddingLLMWorker::EmbeddingLLMWorker(int nWorkers)
     : QObject(nullptr)
+    , m_nWorkers(nWorkers)
     , m_networkManager(new QNetworkAccessManager(this))
     , m_stopGenerating(false)
 {
@@ -51,6 +58,7 @@ EmbeddingLLMWorker::~EmbeddingLLMWorker()
     m_workerThread.quit();
     m_workerThread.wait();
 
+    m_tokenizer = nullptr;
     if (m_model) {
         delete m_model;
         m_model = nullptr;
@@ -170,18 +178,57 @@ bool EmbeddingLLMWorker::loadModel()
     }
 
     // FIXME(jared): the user may want this to take effect without having to restart
-    int n_threads = MySettings::globalInstance()->threadCount();
+    int n_threads = std::max(1, MySettings::globalInstance()->threadCount() / m_nWorkers);
     m_model->setThreadCount(n_threads);
 
+    /* LLModel::embed() splits documents that do not fit in one sequence of min(n_ctx_train, n_ctx) tokens, which also
+     * holds the task prefix it uses for documents and the special tokens. */
+    const int n_ctx_train = LLModel::Implementation::maxContextLength(filePath.toStdString());
+    m_specialTokens = m_model->countPromptTokens("");
+    m_maxInputTokens = std::min(n_ctx, n_ctx_train > 0 ? n_ctx_train : n_ctx)
+                     - m_model->countPromptTokens("search_document:");
+    m_tokenizer = m_model;
+
     return true;
 }
 
+bool EmbeddingLLMWorker::shareModel(const EmbeddingLLMWorker &primary)
+{
+    QMutexLocker locker(&m_mutex);
+    m_model = primary.m_model ? primary.m_model->createContext() : nullptr;
+    if (!m_model) {
+        qWarning() << "embllm WARNING: Could not create an embedding context, loading another copy of the model";
+        return loadModel();
+    }
+
+    // the context has the thread count of the primary, which is already divided among the workers
+    m_specialTokens = primary.m_specialTokens;
+    m_maxInputTokens = primary.m_maxInputTokens;
+    m_tokenizer = m_model;
+    return true;
+}
+
+int EmbeddingLLMWorker::countTokens(QStringView text)
+{
+    LLModel *model = m_tokenizer.load();
+    if (!model)
+        return -1;
+
+    QByteArray utf8 = text.toUtf8();
+    return model->countPromptTokens({ utf8.constData(), size_t(utf8.size()) }) - m_specialTokens;
+}
+
+int EmbeddingLLMWorker::maxInputTokens()
+{
+    return m_tokenizer.load() ? m_maxInputTokens : 0;
+}
+
 std::vector<float> EmbeddingLLMWorker::generateQueryEmbedding(const QString &text)
 {
     {
         QMutexLocker locker(&m_mutex);
 
-        if (!hasModel() && !loadModel()) {
+        if (!hasModel()) {
             qWarning() << "WARNING: Could not load model for embeddings";
             return {};
         }
@@ -206,7 +253,8 @@ std::vector<float> EmbeddingLLMWorker::generateQueryEmbedding(const QString &tex
     return worker.lastResponse();
 }
 
-void EmbeddingLLMWorker::sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData)
+void EmbeddingLLMWorker::sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData,
+                                          quint64 requestId)
 {
     QJsonObject root;
     root.insert("model", "nomic-embed-text-v1");
@@ -221,6 +269,7 @@ void EmbeddingLLMWorker::sendAtlasRequest(const QStringList &texts, const QStrin
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     request.setRawHeader("Authorization", authorization.toUtf8());
     request.setAttribute(QNetworkRequest::User, userData);
+    request.setAttribute(RequestIdAttribute, requestId);
     QNetworkReply *reply = m_networkManager->post(request, doc.toJson(QJsonDocument::Compact));
     connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::finished, this, &EmbeddingLLMWorker::handleFinished);
@@ -246,7 +295,7 @@ void EmbeddingLLMWorker::atlasQueryEmbeddingRequested(const QString &text)
     sendAtlasRequest({text}, "search_query");
 }
 
-void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &chunks)
+void EmbeddingLLMWorker::docEmbeddingsRequested(quint64 requestId, const QVector<EmbeddingChunk> &chunks)
 {
     if (m_stopGenerating)
         return;
@@ -254,8 +303,9 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
     bool isNomic;
     {
         QMutexLocker locker(&m_mutex);
-        if (!hasModel() && !loadModel()) {
+        if (!hasModel()) {
             qWarning() << "WARNING: Could not load model for embeddings";
+            emit embeddingsGenerated(requestId, {});
             return;
         }
 
@@ -287,20 +337,21 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
                 m_model->embed(batchTexts, result.data() + j * m_model->embeddingSize(), /*isRetrieval*/ false);
             } catch (const std::exception &e) {
                 qWarning() << "WARNING: LLModel::embed failed:" << e.what();
+                emit embeddingsGenerated(requestId, {});
                 return;
             }
         }
         for (int i = 0; i < chunks.size(); i++)
             memcpy(results[i].embedding.data(), &result[i * m_model->embeddingSize()], m_model->embeddingSize() * sizeof(float));
 
-        emit embeddingsGenerated(results);
+        emit embeddingsGenerated(requestId, results);
         return;
     };
 
     QStringList texts;
     for (auto &c: chunks)
         texts.append(c.chunk);
-    sendAtlasRequest(texts, "search_document", QVariant::fromValue(chunks));
+    sendAtlasRequest(texts, "search_document", QVariant::fromValue(chunks), requestId);
 }
 
 std::vector<float> jsonArrayToVector(const QJsonArray &jsonArray)
@@ -358,6 +409,7 @@ void EmbeddingLLMWorker::handleFinished()
     QVector<EmbeddingChunk> chunks;
     if (retrievedData.isValid() && retrievedData.canConvert<QVector<EmbeddingChunk>>())
         chunks = retrievedData.value<QVector<EmbeddingChunk>>();
+    quint64 requestId = reply->request().attribute(RequestIdAttribute).toULongLong();
 
     QVariant response = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
     Q_ASSERT(response.isValid());
@@ -373,7 +425,8 @@ void EmbeddingLLMWorker::handleFinished()
         if (!replyContent.isEmpty())
             errorDetails += u". Response Content: \"%1\""_s.arg(QString::fromUtf8(replyContent));
         qWarning() << errorDetails;
-        emit errorGenerated(chunks, errorDetails);
+        if (!chunks.isEmpty())
+            emit errorGenerated(requestId, chunks, errorDetails);
         return;
     }
 
@@ -383,6 +436,8 @@ void EmbeddingLLMWorker::handleFinished()
     QJsonDocument document = QJsonDocument::fromJson(jsonData, &err);
     if (err.error != QJsonParseError::NoError) {
         qWarning() << "ERROR: Couldn't parse Nomic Atlas response:" << jsonData << err.errorString();
+        if (!chunks.isEmpty())
+            emit embeddingsGenerated(requestId, {});
         return;
     }
 
@@ -390,7 +445,7 @@ void EmbeddingLLMWorker::handleFinished()
     const QJsonArray embeddings = root.value("embeddings").toArray();
 
     if (!chunks.isEmpty()) {
-        emit embeddingsGenerated(jsonArrayToEmbeddingResults(chunks, embeddings));
+        emit embeddingsGenerated(requestId, jsonArrayToEmbeddingResults(chunks, embeddings));
     } else {
         m_lastResponse = jsonArrayToVector(embeddings);
         emit finished();
@@ -401,20 +456,31 @@ void EmbeddingLLMWorker::handleFinished()
 
 EmbeddingLLM::EmbeddingLLM()
     : QObject(nullptr)
-    , m_embeddingWorker(new EmbeddingLLMWorker)
 {
-    connect(this, &EmbeddingLLM::requestDocEmbeddings, m_embeddingWorker,
-        &EmbeddingLLMWorker::docEmbeddingsRequested, Qt::QueuedConnection);
-    connect(m_embeddingWorker, &EmbeddingLLMWorker::embeddingsGenerated, this,
-        &EmbeddingLLM::embeddingsGenerated, Qt::QueuedConnection);
-    connect(m_embeddingWorker, &EmbeddingLLMWorker::errorGenerated, this,
-        &EmbeddingLLM::errorGenerated, Qt::QueuedConnection);
+    /* the first local worker loads the model, the others embed on contexts of their own that share its weights; the
+     * remote API is asked by a single worker */
+    int nWorkers = 1;
+    if (!MySettings::globalInstance()->localDocsUseRemoteEmbed())
+        nWorkers = std::clamp(MySettings::globalInstance()->localDocsEmbedWorkers(), 1, s_maxEmbeddingWorkers);
+
+    m_requestsInFlight.resize(nWorkers);
+    for (int i = 0; i < nWorkers; i++) {
+        auto &worker = m_workers.emplace_back(std::make_unique<EmbeddingLLMWorker>(nWorkers));
+        // replies are put in order on the worker threads, the receivers of our signals are queued
+        connect(worker.get(), &EmbeddingLLMWorker::embeddingsGenerated, this,
+            [this](quint64 requestId, const QVector<EmbeddingResult> &embeddings) {
+                handleReply(requestId, { .embeddings = embeddings });
+            }, Qt::DirectConnection);
+        connect(worker.get(), &EmbeddingLLMWorker::errorGenerated, this,
+            [this](quint64 requestId, const QVector<EmbeddingChunk> &chunks, const QString &error) {
+                handleReply(requestId, { .failedChunks = chunks, .error = error });
+            }, Qt::DirectConnection);
+    }
 }
 
 EmbeddingLLM::~EmbeddingLLM()
 {
-    delete m_embeddingWorker;
-    m_embeddingWorker = nullptr;
+    m_workers.clear();
 }
 
 QString EmbeddingLLM::model()
@@ -422,13 +488,110 @@ QString EmbeddingLLM::model()
     return EMBEDDING_MODEL_NAME;
 }
 
+/* Loads the model the first time it is needed, on the thread of the first worker, which owns it. A failure is not
+ * retried: the model file or the settings only change on a restart. */
+bool EmbeddingLLM::loadModel()
+{
+    if (LoadState state = m_loadState; state != LoadState::NotLoaded)
+        return state == LoadState::Loaded;
+
+    QMutexLocker locker(&m_loadMutex);
+    if (m_loadState != LoadState::NotLoaded)
+        return m_loadState == LoadState::Loaded;
+
+    EmbeddingLLMWorker *primary = m_workers.front().get();
+    size_t nReady = 0;
+    auto load = [this, primary, &nReady] {
+        if (!primary->loadModel()) {
+            qWarning() << "WARNING: Could not load model for embeddings";
+            return;
+        }
+        for (nReady = 1; nReady < m_workers.size(); nReady++) {
+            if (!m_workers[nReady]->shareModel(*primary))
+                break;
+        }
+    };
+    if (QThread::currentThread() == primary->thread()) {
+        load();
+    } else {
+        QMetaObject::invokeMethod(primary, load, Qt::BlockingQueuedConnection);
+    }
+
+    if (nReady && nReady < m_workers.size()) {
+        qWarning() << "embllm WARNING: Embedding with" << nReady << "of" << m_workers.size() << "workers";
+        QMutexLocker requestsLocker(&m_mutex); // no request was sent before the model was loaded
+        m_workers.resize(nReady);
+        m_requestsInFlight.resize(nReady);
+    }
+    m_loadState = nReady ? LoadState::Loaded : LoadState::Failed;
+    return nReady > 0;
+}
+
+bool EmbeddingLLM::hasModel() const
+{
+    return m_loadState == LoadState::Loaded;
+}
+
+// the workers share the same model, so the first one serves as the tokenizer
+int EmbeddingLLM::countTokens(QStringView text)
+{
+    return loadModel() ? m_workers.front()->countTokens(text) : -1;
+}
+
+int EmbeddingLLM::maxInputTokens()
+{
+    return loadModel() ? m_workers.front()->maxInputTokens() : 0;
+}
+
 // TODO(jared): embed using all necessary embedding models given collection
 std::vector<float> EmbeddingLLM::generateQueryEmbedding(const QString &text)
 {
-    return m_embeddingWorker->generateQueryEmbedding(text);
+    if (!loadModel())
+        return {};
+    return m_workers.front()->generateQueryEmbedding(text);
 }
 
 void EmbeddingLLM::generateDocEmbeddingsAsync(const QVector<EmbeddingChunk> &chunks)
 {
-    emit requestDocEmbeddings(chunks);
+    if (!loadModel())
+        return; // the chunks are left without embeddings, as when a worker fails to embed them
+
+    QMutexLocker locker(&m_mutex);
+
+    // batches are about the same size, so the worker with the fewest requests is the least busy
+    auto least = std::ranges::min_element(m_requestsInFlight);
+    const int workerIndex = int(least - m_requestsInFlight.begin());
+    ++*least;
+
+    const quint64 requestId = m_nextRequestId++;
+    m_workerOfRequest.emplace(requestId, workerIndex);
+    locker.unlock();
+
+    EmbeddingLLMWorker *worker = m_workers[workerIndex].get();
+    QMetaObject::invokeMethod(worker, [worker, requestId, chunks] {
+        worker->docEmbeddingsRequested(requestId, chunks);
+    }, Qt::QueuedConnection);
+}
+
+void EmbeddingLLM::handleReply(quint64 requestId, Reply &&reply)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (auto it = m_workerOfRequest.find(requestId); it != m_workerOfRequest.end()) {
+        --m_requestsInFlight[it->second];
+        m_workerOfRequest.erase(it);
+    }
+    m_pendingReplies.emplace(requestId, std::move(reply));
+
+    // emitting while locked keeps the queued signals in request order
+    for (auto it = m_pendingReplies.begin(); it != m_pendingReplies.end() && it->first == m_nextReplyId;) {
+        const Reply &r = it->second;
+        if (!r.error.isNull()) {
+            emit errorGenerated(r.failedChunks, r.error);
+        } else if (!r.embeddings.isEmpty()) {
+            emit embeddingsGenerated(r.embeddings);
+        }
+        it = m_pendingReplies.erase(it);
+        m_nextReplyId++;
+    }
 }
@@ -6,11 +6,14 @@
 #include <QObject>
 #include <QString>
 #include <QStringList>
+#include <QStringView>
 #include <QThread>
 #include <QVariant>
 #include <QVector>
 
 #include <atomic>
+#include <map>
+#include <memory>
 #include <vector>
 
 class LLModel;
@@ -35,7 +38,8 @@ struct EmbeddingResult {
 class EmbeddingLLMWorker : public QObject {
     Q_OBJECT
 public:
-    EmbeddingLLMWorker();
+    // nWorkers is the size of the pool this worker belongs to, they share the CPU threads
+    explicit EmbeddingLLMWorker(int nWorkers = 1);
     ~EmbeddingLLMWorker() override;
 
     void wait();
@@ -43,31 +47,44 @@ public:
     std::vector<float> lastResponse() const { return m_lastResponse; }
 
     bool loadModel();
+    // embeds on a context of its own that shares the weights loaded by primary, or loads a copy if there is none
+    bool shareModel(const EmbeddingLLMWorker &primary);
     bool isNomic() const { return !m_nomicAPIKey.isEmpty(); }
     bool hasModel() const { return isNomic() || m_model; }
 
     std::vector<float> generateQueryEmbedding(const QString &text);
 
+    // thread-safe once the model is loaded; return -1 and 0 respectively without a local model
+    int countTokens(QStringView text);
+    int maxInputTokens();
+
 public Q_SLOTS:
     void atlasQueryEmbeddingRequested(const QString &text);
-    void docEmbeddingsRequested(const QVector<EmbeddingChunk> &chunks);
+    void docEmbeddingsRequested(quint64 requestId, const QVector<EmbeddingChunk> &chunks);
 
 Q_SIGNALS:
     void requestAtlasQueryEmbedding(const QString &text);
-    void embeddingsGenerated(const QVector<EmbeddingResult> &embeddings);
-    void errorGenerated(const QVector<EmbeddingChunk> &chunks, const QString &error);
+    // emitted exactly once per request, with no embeddings if they could not be generated
+    void embeddingsGenerated(quint64 requestId, const QVector<EmbeddingResult> &embeddings);
+    void errorGenerated(quint64 requestId, const QVector<EmbeddingChunk> &chunks, const QString &error);
     void finished();
 
 private Q_SLOTS:
     void handleFinished();
 
 private:
-    void sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData = {});
+    void sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData = {},
+                          quint64 requestId = 0);
 
+    const int m_nWorkers;
     QString m_nomicAPIKey;
     QNetworkAccessManager *m_networkManager;
     std::vector<float> m_lastResponse;
     LLModel *m_model = nullptr;
+    // m_model once it is loaded; tokenizing only reads the vocabulary, so it needs no lock
+    std::atomic<LLModel *> m_tokenizer = nullptr;
+    int m_maxInputTokens = 0; // tokens of a document that fit in one sequence
+    int m_specialTokens = 0; // added to every sequence by the tokenizer
     std::atomic<bool> m_stopGenerating;
     QThread m_workerThread;
     QMutex m_mutex; // guards m_model and m_nomicAPIKey
@@ -84,17 +101,43 @@ public:
     bool loadModel();
     bool hasModel() const;
 
+    // thread-safe, tokens of the local embedding model, or -1 if they cannot be counted (e.g. Nomic API)
+    int countTokens(QStringView text);
+    // thread-safe, the most tokens of a document that are embedded as one sequence, or 0 without a local model
+    int maxInputTokens();
+
 public Q_SLOTS:
     std::vector<float> generateQueryEmbedding(const QString &text); // synchronous
     void generateDocEmbeddingsAsync(const QVector<EmbeddingChunk> &chunks);
 
 Q_SIGNALS:
-    void requestDocEmbeddings(const QVector<EmbeddingChunk> &chunks);
+    // in the order the chunks were requested
     void embeddingsGenerated(const QVector<EmbeddingResult> &embeddings);
     void errorGenerated(const QVector<EmbeddingChunk> &chunks, const QString &error);
 
 private:
-    EmbeddingLLMWorker *m_embeddingWorker;
+    struct Reply {
+        QVector<EmbeddingResult> embeddings;
+        QVector<EmbeddingChunk>  failedChunks;
+        QString                  error;
+    };
+
+    enum class LoadState { NotLoaded, Loaded, Failed };
+
+    void handleReply(quint64 requestId, Reply &&reply);
+
+    // the first worker also serves query embeddings
+    std::vector<std::unique_ptr<EmbeddingLLMWorker>> m_workers;
+
+    QMutex                 m_loadMutex; // serializes loadModel()
+    std::atomic<LoadState> m_loadState = LoadState::NotLoaded;
+
+    QMutex                   m_mutex; // guards the members below
+    std::vector<int>         m_requestsInFlight; // per worker
+    std::map<quint64, int>   m_workerOfRequest;
+    std::map<quint64, Reply> m_pendingReplies; // replies that arrived before an earlier request finished
+    quint64                  m_nextRequestId = 0;
+    quint64                  m_nextReplyId = 0;
 };
 
 #endif // EMBLLM_H
@@ -0,0 +1,205 @@
+#include "folderwatcher.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QtGlobal>
+#include <QtLogging>
+
+#include <cstdint>
+#include <utility>
+
+#if defined(Q_OS_LINUX)
+#   include <sys/inotify.h>
+#   include <unistd.h>
+
+#   include <cerrno>
+#endif
+
+
+static constexpr int s_debounceDelay = 500;  // ms without events before the changes are reported
+static constexpr int s_maxReportDelay = 5000; // ms, so that a steady stream of events is still reported
+
+#if defined(Q_OS_LINUX)
+static constexpr uint32_t s_inotifyMask = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM
+                                        | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+
+FolderWatcher::FolderWatcher(QObject *parent)
+    : QObject(parent)
+    , m_flushTimer(new QTimer(this))
+{
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->callOnTimeout(this, &FolderWatcher::flush);
+}
+
+FolderWatcher::~FolderWatcher()
+{
+#if defined(Q_OS_LINUX)
+    if (m_inotifyFd != -1) {
+        delete m_notifier;
+        ::close(m_inotifyFd);
+    }
+#endif
+}
+
+void FolderWatcher::ensureBackend()
+{
+    if (m_backendChecked)
+        return;
+    m_backendChecked = true;
+
+    // created on first use rather than in the constructor, so that it belongs to the thread that uses it
+#if defined(Q_OS_LINUX)
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd != -1) {
+        m_notifier = new QSocketNotifier(m_inotifyFd, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &FolderWatcher::readInotifyEvents);
+        return;
+    }
+    qWarning() << "FolderWatcher: inotify is unavailable, using QFileSystemWatcher:" << qt_error_string(errno);
+#endif
+
+    m_fallback = new QFileSystemWatcher(this);
+    connect(m_fallback, &QFileSystemWatcher::directoryChanged, this, [this](const QString &path) {
+        m_pending.directories << path;
+        if (!QFileInfo(path).isDir()) {
+            m_fallback->removePath(path);
+            m_lostWatches << path;
+        }
+        scheduleFlush();
+    });
+}
+
+bool FolderWatcher::addPath(const QString &path)
+{
+    ensureBackend();
+
+#if defined(Q_OS_LINUX)
+    if (m_inotifyFd != -1) {
+        if (m_watchOfPath.contains(path))
+            return true;
+        int wd = inotify_add_watch(m_inotifyFd, QFile::encodeName(path).constData(), s_inotifyMask);
+        if (wd == -1) {
+            if (errno != ENOSPC) {
+                qWarning() << "FolderWatcher: failed to watch" << path << qt_error_string(errno);
+            } else if (!m_limitWarned) {
+                qWarning() << "FolderWatcher: the inotify watch limit was reached, directories beyond it are "
+                              "rescanned periodically. Raise fs.inotify.max_user_watches to watch them.";
+                m_limitWarned = true;
+            }
+            return false;
+        }
+        // a directory that is reached by two paths has one watch, the last path wins
+        if (auto old = m_pathOfWatch.constFind(wd); old != m_pathOfWatch.cend())
+            m_watchOfPath.remove(*old);
+        m_pathOfWatch.insert(wd, path);
+        m_watchOfPath.insert(path, wd);
+        return true;
+    }
+#endif
+
+    return m_fallback->addPath(path);
+}
+
+void FolderWatcher::removePaths(const QStringList &paths)
+{
+#if defined(Q_OS_LINUX)
+    if (m_inotifyFd != -1) {
+        for (const QString &path: paths) {
+            auto it = m_watchOfPath.constFind(path);
+            if (it == m_watchOfPath.cend())
+                continue;
+            inotify_rm_watch(m_inotifyFd, *it);
+            m_pathOfWatch.remove(*it);
+            m_watchOfPath.erase(it);
+        }
+        return;
+    }
+#endif
+
+    if (m_fallback)
+        m_fallback->removePaths(paths);
+}
+
+void FolderWatcher::readInotifyEvents()
+{
+#if defined(Q_OS_LINUX)
+    alignas(inotify_event) char buf[16 * 1024];
+    for (;;) {
+        ssize_t len = ::read(m_inotifyFd, buf, sizeof buf);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0) {
+            if (len == -1 && errno != EAGAIN)
+                qWarning() << "FolderWatcher: failed to read inotify events:" << qt_error_string(errno);
+            break;
+        }
+
+        for (const char *p = buf; p < buf + len;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were dropped, every directory must be listed again
+                for (auto it = m_watchOfPath.keyBegin(); it != m_watchOfPath.keyEnd(); ++it)
+                    m_pending.directories << *it;
+                continue;
+            }
+
+            const QString dir = m_pathOfWatch.value(event->wd);
+            if (dir.isNull())
+                continue;
+            if (event->mask & IN_IGNORED) {
+                // the directory is gone; a watch removed by removePaths() was forgotten already
+                m_pathOfWatch.remove(event->wd);
+                m_watchOfPath.remove(dir);
+                m_pending.directories << dir;
+                m_lostWatches << dir;
+                continue;
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                m_pending.directories << dir;
+                continue;
+            }
+            if (!event->len)
+                continue;
+
+            const QString path = dir + u'/' + QFile::decodeName(event->name);
+            if (event->mask & IN_ISDIR) {
+                m_pending.directories << path;
+            } else {
+                m_pending.files << path;
+            }
+        }
+    }
+    scheduleFlush();
+#endif
+}
+
+void FolderWatcher::scheduleFlush()
+{
+    if (m_pending.files.isEmpty() && m_pending.directories.isEmpty())
+        return;
+
+    if (!m_flushTimer->isActive()) {
+        m_pendingSince.start();
+    } else if (m_pendingSince.elapsed() >= s_maxReportDelay) {
+        return; // do not postpone the report any further
+    }
+    m_flushTimer->start(s_debounceDelay);
+}
+
+void FolderWatcher::flush()
+{
+    FolderChanges changes = std::exchange(m_pending, {});
+    const QStringList lost = std::exchange(m_lostWatches, {});
+    if (!changes.files.isEmpty() || !changes.directories.isEmpty())
+        emit changesDetected(changes);
+    // after the changes, so that the receiver still knows which folders the lost directories belonged to
+    for (const QString &path: lost)
+        emit watchLost(path);
+}
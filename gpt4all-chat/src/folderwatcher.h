@@ -0,0 +1,61 @@
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+class QTimer;
+
+// what changed in the watched directories since the last report
+struct FolderChanges {
+    QSet<QString> files;       // files that were created, written, touched, moved or deleted
+    QSet<QString> directories; // directories whose entries must be listed again, which may no longer exist
+};
+
+/* Watches directories (not recursively) for changes to their entries. On Linux the events come straight from
+ * inotify, so the files that changed are known; elsewhere, or if inotify is unavailable, QFileSystemWatcher only
+ * reports the directory. Events are coalesced until the directories have been quiet for a moment, so a burst of
+ * writes (a checkout, a build) is reported once. */
+class FolderWatcher : public QObject {
+    Q_OBJECT
+public:
+    explicit FolderWatcher(QObject *parent = nullptr);
+    ~FolderWatcher() override;
+
+    // returns false if the directory cannot be watched, e.g. because the inotify watch limit was reached
+    bool addPath(const QString &path);
+    void removePaths(const QStringList &paths);
+
+Q_SIGNALS:
+    void changesDetected(const FolderChanges &changes);
+    // the directory was deleted or moved away and is no longer watched, emitted after the changes that report it
+    void watchLost(const QString &path);
+
+private Q_SLOTS:
+    void readInotifyEvents();
+    void flush();
+
+private:
+    void ensureBackend();
+    void scheduleFlush();
+
+    int                     m_inotifyFd = -1;
+    bool                    m_backendChecked = false;
+    bool                    m_limitWarned = false;
+    QSocketNotifier        *m_notifier = nullptr;
+    QHash<int, QString>     m_pathOfWatch; // inotify watch descriptor -> directory
+    QHash<QString, int>     m_watchOfPath;
+    QFileSystemWatcher     *m_fallback = nullptr;
+    QTimer                 *m_flushTimer;
+    QElapsedTimer           m_pendingSince;
+    FolderChanges           m_pending;
+    QStringList             m_lostWatches;
+};
+
+#endif // FOLDERWATCHER_H
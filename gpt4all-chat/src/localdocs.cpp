@@ -23,10 +23,14 @@ LocalDocs::LocalDocs()
     , m_database(nullptr)
 {
     connect(MySettings::globalInstance(), &MySettings::localDocsChunkSizeChanged, this, &LocalDocs::handleChunkSizeChanged);
+    connect(MySettings::globalInstance(), &MySettings::localDocsChunkTokensChanged, this, &LocalDocs::handleChunkTokensChanged);
     connect(MySettings::globalInstance(), &MySettings::localDocsFileExtensionsChanged, this, &LocalDocs::handleFileExtensionsChanged);
+    connect(MySettings::globalInstance(), &MySettings::localDocsVectorQuantizationChanged, this, &LocalDocs::handleVectorQuantizationChanged);
+    connect(MySettings::globalInstance(), &MySettings::localDocsCompressChunksChanged, this, &LocalDocs::handleCompressChunksChanged);
 
     // Create the DB with the chunk size from settings
     m_database = new Database(MySettings::globalInstance()->localDocsChunkSize(),
+                              MySettings::globalInstance()->localDocsChunkTokens(),
                               MySettings::globalInstance()->localDocsFileExtensions());
 
     connect(this, &LocalDocs::requestStart, m_database,
@@ -41,10 +45,24 @@ LocalDocs::LocalDocs()
         &Database::removeFolder, Qt::QueuedConnection);
     connect(this, &LocalDocs::requestChunkSizeChange, m_database,
         &Database::changeChunkSize, Qt::QueuedConnection);
+    connect(this, &LocalDocs::requestChunkTokensChange, m_database,
+        &Database::changeChunkTokens, Qt::QueuedConnection);
     connect(this, &LocalDocs::requestFileExtensionsChange, m_database,
         &Database::changeFileExtensions, Qt::QueuedConnection);
+    connect(this, &LocalDocs::requestVectorQuantizationChange, m_database,
+        &Database::changeVectorQuantization, Qt::QueuedConnection);
+    connect(this, &LocalDocs::requestChunkCompressionChange, m_database,
+        &Database::changeChunkCompression, Qt::QueuedConnection);
+    connect(this, &LocalDocs::requestExportCollection, m_database,
+        &Database::exportCollection, Qt::QueuedConnection);
+    connect(this, &LocalDocs::requestImportCollection, m_database,
+        &Database::importCollection, Qt::QueuedConnection);
     connect(m_database, &Database::databaseValidChanged,
         this, &LocalDocs::databaseValidChanged, Qt::QueuedConnection);
+    connect(m_database, &Database::collectionExported,
+        this, &LocalDocs::collectionExported, Qt::QueuedConnection);
+    connect(m_database, &Database::collectionImported,
+        this, &LocalDocs::collectionImported, Qt::QueuedConnection);
 
     // Connections for modifying the model and keeping it updated with the database
     connect(m_database, &Database::requestUpdateGuiForCollectionItem,
@@ -95,12 +113,50 @@ void LocalDocs::forceIndexing(const QString &collection)
     emit requestForceIndexing(collection, embedding_model);
 }
 
+void LocalDocs::exportCollection(const QString &collection, const QString &path, bool quantize)
+{
+    const QUrl url(path);
+    emit requestExportCollection(collection, url.isLocalFile() ? url.toLocalFile() : path, quantize);
+}
+
+void LocalDocs::importCollection(const QString &path, const QString &collection, const QString &folderPath)
+{
+    const QUrl url(path);
+    const QString localPath = url.isLocalFile() ? url.toLocalFile() : path;
+    const QUrl folderUrl(folderPath);
+    const QString localFolderPath = folderUrl.isLocalFile() ? folderUrl.toLocalFile() : folderPath;
+
+    // the embeddings of the snapshot are only usable with the same model
+    const QString embedding_model = EmbeddingLLM::model();
+    if (embedding_model.isEmpty()) {
+        qWarning() << "ERROR: We have no embedding model";
+        return;
+    }
+
+    emit requestImportCollection(localPath, collection, localFolderPath, embedding_model);
+}
+
 void LocalDocs::handleChunkSizeChanged()
 {
     emit requestChunkSizeChange(MySettings::globalInstance()->localDocsChunkSize());
 }
 
+void LocalDocs::handleChunkTokensChanged()
+{
+    emit requestChunkTokensChange(MySettings::globalInstance()->localDocsChunkTokens());
+}
+
 void LocalDocs::handleFileExtensionsChanged()
 {
     emit requestFileExtensionsChange(MySettings::globalInstance()->localDocsFileExtensions());
 }
+
+void LocalDocs::handleVectorQuantizationChanged()
+{
+    emit requestVectorQuantizationChange(MySettings::globalInstance()->localDocsVectorQuantization());
+}
+
+void LocalDocs::handleCompressChunksChanged()
+{
+    emit requestChunkCompressionChange(MySettings::globalInstance()->localDocsCompressChunks());
+}
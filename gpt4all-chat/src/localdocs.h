@@ -13,6 +13,7 @@ class LocalDocs : public QObject
     Q_OBJECT
     Q_PROPERTY(bool databaseValid READ databaseValid NOTIFY databaseValidChanged)
     Q_PROPERTY(LocalDocsModel *localDocsModel READ localDocsModel NOTIFY localDocsModelChanged)
+    Q_PROPERTY(bool chunkCompressionAvailable READ chunkCompressionAvailable CONSTANT)
 
 public:
     static LocalDocs *globalInstance();
@@ -22,14 +23,20 @@ public:
     Q_INVOKABLE void addFolder(const QString &collection, const QString &path);
     Q_INVOKABLE void removeFolder(const QString &collection, const QString &path);
     Q_INVOKABLE void forceIndexing(const QString &collection);
+    Q_INVOKABLE void exportCollection(const QString &collection, const QString &path, bool quantize);
+    Q_INVOKABLE void importCollection(const QString &path, const QString &collection, const QString &folderPath);
 
     Database *database() const { return m_database; }
 
     bool databaseValid() const { return m_database->isValid(); }
+    bool chunkCompressionAvailable() const { return ChunkCompressor::isAvailable(); }
 
 public Q_SLOTS:
     void handleChunkSizeChanged();
+    void handleChunkTokensChanged();
     void handleFileExtensionsChanged();
+    void handleVectorQuantizationChanged();
+    void handleCompressChunksChanged();
     void aboutToQuit();
 
 Q_SIGNALS:
@@ -39,7 +46,16 @@ Q_SIGNALS:
     void requestAddFolder(const QString &collection, const QString &path, const QString &embedding_model);
     void requestRemoveFolder(const QString &collection, const QString &path);
     void requestChunkSizeChange(int chunkSize);
+    void requestChunkTokensChange(int chunkTokens);
     void requestFileExtensionsChange(const QStringList &extensions);
+    void requestVectorQuantizationChange(const QString &quantization);
+    void requestChunkCompressionChange(bool enabled);
+    void requestExportCollection(const QString &collection, const QString &path, bool quantize);
+    void requestImportCollection(const QString &path, const QString &collection, const QString &folderPath,
+                                 const QString &embedding_model);
+    // the error is empty on success
+    void collectionExported(const QString &collection, const QString &error);
+    void collectionImported(const QString &collection, const QString &error);
     void localDocsModelChanged();
     void databaseValidChanged();
 
@@ -61,12 +61,16 @@ static const QVariantMap basicDefaults {
     { "userDefaultModel",         "Application default" },
     { "suggestionMode",           QVariant::fromValue(SuggestionMode::LocalDocsOnly) },
     { "localdocs/chunkSize",      512 },
+    { "localdocs/chunkTokens",    0 }, // 0 to chunk by characters
     { "localdocs/retrievalSize",  3 },
     { "localdocs/showReferences", true },
     { "localdocs/fileExtensions", QStringList { "docx", "pdf", "txt", "md", "rst" } },
     { "localdocs/useRemoteEmbed", false },
     { "localdocs/nomicAPIKey",    "" },
     { "localdocs/embedDevice",    "Auto" },
+    { "localdocs/embedWorkers",   1 },
+    { "localdocs/vectorQuantization", "None" },
+    { "localdocs/compressChunks", false },
     { "network/attribution",      "" },
 };
 
@@ -259,12 +263,16 @@ void MySettings::restoreApplicationDefaults()
 void MySettings::restoreLocalDocsDefaults()
 {
     setLocalDocsChunkSize(basicDefaults.value("localdocs/chunkSize").toInt());
+    setLocalDocsChunkTokens(basicDefaults.value("localdocs/chunkTokens").toInt());
     setLocalDocsRetrievalSize(basicDefaults.value("localdocs/retrievalSize").toInt());
     setLocalDocsShowReferences(basicDefaults.value("localdocs/showReferences").toBool());
     setLocalDocsFileExtensions(basicDefaults.value("localdocs/fileExtensions").toStringList());
     setLocalDocsUseRemoteEmbed(basicDefaults.value("localdocs/useRemoteEmbed").toBool());
     setLocalDocsNomicAPIKey(basicDefaults.value("localdocs/nomicAPIKey").toString());
     setLocalDocsEmbedDevice(basicDefaults.value("localdocs/embedDevice").toString());
+    setLocalDocsEmbedWorkers(basicDefaults.value("localdocs/embedWorkers").toInt());
+    setLocalDocsVectorQuantization(basicDefaults.value("localdocs/vectorQuantization").toString());
+    setLocalDocsCompressChunks(basicDefaults.value("localdocs/compressChunks").toBool());
 }
 
 void MySettings::eraseModel(const ModelInfo &info)
@@ -618,12 +626,16 @@ int         MySettings::networkPort() const             { return getBasicSetting
 QString     MySettings::userDefaultModel() const        { return getBasicSetting("userDefaultModel"        ).toString(); }
 QString     MySettings::lastVersionStarted() const      { return getBasicSetting("lastVersionStarted"      ).toString(); }
 int         MySettings::localDocsChunkSize() const      { return getBasicSetting("localdocs/chunkSize"     ).toInt(); }
+int         MySettings::localDocsChunkTokens() const    { return getBasicSetting("localdocs/chunkTokens"   ).toInt(); }
 int         MySettings::localDocsRetrievalSize() const  { return getBasicSetting("localdocs/retrievalSize" ).toInt(); }
 bool        MySettings::localDocsShowReferences() const { return getBasicSetting("localdocs/showReferences").toBool(); }
 QStringList MySettings::localDocsFileExtensions() const { return getBasicSetting("localdocs/fileExtensions").toStringList(); }
 bool        MySettings::localDocsUseRemoteEmbed() const { return getBasicSetting("localdocs/useRemoteEmbed").toBool(); }
 QString     MySettings::localDocsNomicAPIKey() const    { return getBasicSetting("localdocs/nomicAPIKey"   ).toString(); }
 QString     MySettings::localDocsEmbedDevice() const    { return getBasicSetting("localdocs/embedDevice"   ).toString(); }
+int         MySettings::localDocsEmbedWorkers() const   { return getBasicSetting("localdocs/embedWorkers"  ).toInt(); }
+QString     MySettings::localDocsVectorQuantization() const { return getBasicSetting("localdocs/vectorQuantization").toString(); }
+bool        MySettings::localDocsCompressChunks() const { return getBasicSetting("localdocs/compressChunks").toBool(); }
 QString     MySettings::networkAttribution() const      { return getBasicSetting("network/attribution"     ).toString(); }
 
 ChatTheme      MySettings::chatTheme() const      { return ChatTheme     (getEnumSetting("chatTheme", chatThemeNames)); }
@@ -636,12 +648,16 @@ void MySettings::setNetworkPort(int value)                            { setBasic
 void MySettings::setUserDefaultModel(const QString &value)            { setBasicSetting("userDefaultModel",         value); }
 void MySettings::setLastVersionStarted(const QString &value)          { setBasicSetting("lastVersionStarted",       value); }
 void MySettings::setLocalDocsChunkSize(int value)                     { setBasicSetting("localdocs/chunkSize",      value, "localDocsChunkSize"); }
+void MySettings::setLocalDocsChunkTokens(int value)                   { setBasicSetting("localdocs/chunkTokens",    value, "localDocsChunkTokens"); }
 void MySettings::setLocalDocsRetrievalSize(int value)                 { setBasicSetting("localdocs/retrievalSize",  value, "localDocsRetrievalSize"); }
 void MySettings::setLocalDocsShowReferences(bool value)               { setBasicSetting("localdocs/showReferences", value, "localDocsShowReferences"); }
 void MySettings::setLocalDocsFileExtensions(const QStringList &value) { setBasicSetting("localdocs/fileExtensions", value, "localDocsFileExtensions"); }
 void MySettings::setLocalDocsUseRemoteEmbed(bool value)               { setBasicSetting("localdocs/useRemoteEmbed", value, "localDocsUseRemoteEmbed"); }
 void MySettings::setLocalDocsNomicAPIKey(const QString &value)        { setBasicSetting("localdocs/nomicAPIKey",    value, "localDocsNomicAPIKey"); }
 void MySettings::setLocalDocsEmbedDevice(const QString &value)        { setBasicSetting("localdocs/embedDevice",    value, "localDocsEmbedDevice"); }
+void MySettings::setLocalDocsEmbedWorkers(int value)                  { setBasicSetting("localdocs/embedWorkers",   value, "localDocsEmbedWorkers"); }
+void MySettings::setLocalDocsVectorQuantization(const QString &value) { setBasicSetting("localdocs/vectorQuantization", value, "localDocsVectorQuantization"); }
+void MySettings::setLocalDocsCompressChunks(bool value)               { setBasicSetting("localdocs/compressChunks", value, "localDocsCompressChunks"); }
 void MySettings::setNetworkAttribution(const QString &value)          { setBasicSetting("network/attribution",      value, "networkAttribution"); }
 
 void MySettings::setChatTheme(ChatTheme value)           { setBasicSetting("chatTheme",      chatThemeNames     .value(int(value))); }
@@ -61,12 +61,16 @@ class MySettings : public QObject
     Q_PROPERTY(bool forceMetal READ forceMetal WRITE setForceMetal NOTIFY forceMetalChanged)
     Q_PROPERTY(QString lastVersionStarted READ lastVersionStarted WRITE setLastVersionStarted NOTIFY lastVersionStartedChanged)
     Q_PROPERTY(int localDocsChunkSize READ localDocsChunkSize WRITE setLocalDocsChunkSize NOTIFY localDocsChunkSizeChanged)
+    Q_PROPERTY(int localDocsChunkTokens READ localDocsChunkTokens WRITE setLocalDocsChunkTokens NOTIFY localDocsChunkTokensChanged)
     Q_PROPERTY(int localDocsRetrievalSize READ localDocsRetrievalSize WRITE setLocalDocsRetrievalSize NOTIFY localDocsRetrievalSizeChanged)
     Q_PROPERTY(bool localDocsShowReferences READ localDocsShowReferences WRITE setLocalDocsShowReferences NOTIFY localDocsShowReferencesChanged)
     Q_PROPERTY(QStringList localDocsFileExtensions READ localDocsFileExtensions WRITE setLocalDocsFileExtensions NOTIFY localDocsFileExtensionsChanged)
     Q_PROPERTY(bool localDocsUseRemoteEmbed READ localDocsUseRemoteEmbed WRITE setLocalDocsUseRemoteEmbed NOTIFY localDocsUseRemoteEmbedChanged)
     Q_PROPERTY(QString localDocsNomicAPIKey READ localDocsNomicAPIKey WRITE setLocalDocsNomicAPIKey NOTIFY localDocsNomicAPIKeyChanged)
     Q_PROPERTY(QString localDocsEmbedDevice READ localDocsEmbedDevice WRITE setLocalDocsEmbedDevice NOTIFY localDocsEmbedDeviceChanged)
+    Q_PROPERTY(int localDocsEmbedWorkers READ localDocsEmbedWorkers WRITE setLocalDocsEmbedWorkers NOTIFY localDocsEmbedWorkersChanged)
+    Q_PROPERTY(QString localDocsVectorQuantization READ localDocsVectorQuantization WRITE setLocalDocsVectorQuantization NOTIFY localDocsVectorQuantizationChanged)
+    Q_PROPERTY(bool localDocsCompressChunks READ localDocsCompressChunks WRITE setLocalDocsCompressChunks NOTIFY localDocsCompressChunksChanged)
     Q_PROPERTY(QString networkAttribution READ networkAttribution WRITE setNetworkAttribution NOTIFY networkAttributionChanged)
     Q_PROPERTY(bool networkIsActive READ networkIsActive WRITE setNetworkIsActive NOTIFY networkIsActiveChanged)
     Q_PROPERTY(bool networkUsageStatsActive READ networkUsageStatsActive WRITE setNetworkUsageStatsActive NOTIFY networkUsageStatsActiveChanged)
@@ -189,6 +193,8 @@ public:
     // Localdocs settings
     int localDocsChunkSize() const;
     void setLocalDocsChunkSize(int value);
+    int localDocsChunkTokens() const;
+    void setLocalDocsChunkTokens(int value);
     int localDocsRetrievalSize() const;
     void setLocalDocsRetrievalSize(int value);
     bool localDocsShowReferences() const;
@@ -201,6 +207,12 @@ public:
     void setLocalDocsNomicAPIKey(const QString &value);
     QString localDocsEmbedDevice() const;
     void setLocalDocsEmbedDevice(const QString &value);
+    int localDocsEmbedWorkers() const;
+    void setLocalDocsEmbedWorkers(int value);
+    QString localDocsVectorQuantization() const;
+    void setLocalDocsVectorQuantization(const QString &value);
+    bool localDocsCompressChunks() const;
+    void setLocalDocsCompressChunks(bool value);
 
     // Network settings
     QString networkAttribution() const;
@@ -242,12 +254,16 @@ Q_SIGNALS:
     void forceMetalChanged(bool);
     void lastVersionStartedChanged();
     void localDocsChunkSizeChanged();
+    void localDocsChunkTokensChanged();
     void localDocsRetrievalSizeChanged();
     void localDocsShowReferencesChanged();
     void localDocsFileExtensionsChanged();
     void localDocsUseRemoteEmbedChanged();
     void localDocsNomicAPIKeyChanged();
     void localDocsEmbedDeviceChanged();
+    void localDocsEmbedWorkersChanged();
+    void localDocsVectorQuantizationChanged();
+    void localDocsCompressChunksChanged();
     void networkAttributionChanged();
     void networkIsActiveChanged();
     void networkPortChanged();
@@ -0,0 +1,29 @@
+#ifndef SCANJOURNAL_H
+#define SCANJOURNAL_H
+
+#include <QtGlobal>
+
+
+/* What the last scan of a LocalDocs folder saw in one of its directories. A directory keeps its modification time
+ * while its entries stay the same, so if the time and the number of entries are as recorded, the scan only checks
+ * the documents it already knows instead of listing the directory again. */
+struct ScanJournalEntry {
+    // a directory modified this recently may still change within the same timestamp, it is listed again next time
+    static constexpr qint64 s_racyTime = 2000; // ms
+
+    qint64 dirTime;    // ms since the epoch, -1 if it was too recent to be trusted
+    int    entryCount; // subdirectories and documents, -1 for a link to a directory, which is only watched
+
+    // the entry for a directory with entryCount entries, listed at now
+    static ScanJournalEntry listed(qint64 dirTime, int entryCount, qint64 now)
+    { return { now - dirTime < s_racyTime ? -1 : dirTime, entryCount }; }
+
+    static ScanJournalEntry link() { return { -1, -1 }; }
+    bool isLink() const { return entryCount == -1; }
+
+    // whether the directory, now modified at dirTime, still has the knownEntries of the last scan
+    bool isUnchanged(qint64 dirTime, qsizetype knownEntries) const
+    { return !isLink() && this->dirTime != -1 && this->dirTime == dirTime && entryCount == knownEntries; }
+};
+
+#endif // SCANJOURNAL_H
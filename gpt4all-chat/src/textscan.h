@@ -0,0 +1,86 @@
+#ifndef TEXTSCAN_H
+#define TEXTSCAN_H
+
+#include <QChar>
+#include <QStringView>
+#include <QtGlobal>
+
+#include <cstdint>
+#include <cstring>
+
+
+/* Scanners for plain text documents, which look at a word of bytes or characters at a time. Each has a scalar
+ * counterpart that gives the same answer one byte or character at a time. */
+namespace TextScan {
+
+/* Control characters we should never see in plain text:
+ * 0x00 NUL - 0x06 ACK
+ * 0x0E SO  - 0x1A SUB
+ * 0x1C FS  - 0x1F US */
+inline bool isBinary(unsigned char c)
+{ return c < 0x07 || (c >= 0x0E && c < 0x1B) || (c >= 0x1C && c < 0x20); }
+
+/* The same test on the eight bytes of a word at once, without branches: the high bit of each byte of the result
+ * is set if that byte is binary. */
+inline uint64_t binaryBytes(uint64_t x)
+{
+    constexpr uint64_t L = 0x0101010101010101, H = 0x8080808080808080;
+    // bytes below n, for n <= 0x80: the subtraction cannot borrow across bytes once their high bits are set
+    auto below = [x](uint64_t n) { return ~((x | H) - n * L) & ~x & H; };
+    return below(0x20) & ~(below(0x0E) & ~below(0x07)) & ~(below(0x1C) & ~below(0x1B));
+}
+
+// whether any of the bytes is binary
+inline bool containsBinary(const char *data, qint64 size)
+{
+    // 32 bytes at a time, which compilers turn into vector code
+    qint64 i = 0;
+    for (; i + 32 <= size; i += 32) {
+        uint64_t w[4];
+        std::memcpy(w, data + i, sizeof w);
+        if (binaryBytes(w[0]) | binaryBytes(w[1]) | binaryBytes(w[2]) | binaryBytes(w[3]))
+            return true;
+    }
+    for (; i < size; i++) {
+        if (isBinary(static_cast<unsigned char>(data[i])))
+            return true;
+    }
+    return false;
+}
+
+inline bool isSpace(QChar c)
+{
+    return c.unicode() < 0x80 ? c == u' ' || (c >= u'\t' && c <= u'\r') : c.isSpace();
+}
+
+/* Index of the first space at or after from, or the size of the text. Four characters are looked at at once, and
+ * only those that might be spaces (control characters, the space itself and non-ASCII characters) are checked one
+ * by one. */
+inline qsizetype findSpace(QStringView text, qsizetype from)
+{
+    constexpr uint64_t L = 0x0001000100010001, H = 0x8000800080008000;
+    const qsizetype size = text.size();
+    qsizetype i = from;
+    for (;;) {
+        for (; i + 4 <= size; i += 4) {
+            uint64_t x;
+            std::memcpy(&x, text.data() + i, sizeof x);
+            uint64_t low = ~((x | H) - 0x21 * L) & ~x & H;                // characters below 0x21
+            uint64_t high = ((((x & ~H) + (0x8000 - 0x80) * L) | x) & H); // characters from 0x80
+            if (low | high)
+                break;
+        }
+        // the four characters that might hold a space, or the tail of the text
+        const qsizetype end = i + 4 <= size ? i + 4 : size;
+        for (; i < end; i++) {
+            if (isSpace(text[i]))
+                return i;
+        }
+        if (i >= size)
+            return size;
+    }
+}
+
+} // namespace TextScan
+
+#endif // TEXTSCAN_H
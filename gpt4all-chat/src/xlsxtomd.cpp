@@ -19,10 +19,30 @@
 #include <QtLogging>
 
 #include <memory>
+#include <utility>
 
 using namespace Qt::Literals::StringLiterals;
 
 
+QString XLSXToMD::escapeCellText(QString cellText)
+{
+    // Escape special characters
+    static QRegularExpression special(
+        QStringLiteral(
+            R"(()([\\`*_[\]<>()!|])|)"    // special characters
+            R"(^(\s*)(#+(?:\s|$))|)"      // headings
+            R"(^(\s*[0-9])(\.(?:\s|$))|)" // ordered lists ("1. a")
+            R"(^(\s*)([+-](?:\s|$)))"     // unordered lists ("- a")
+        ),
+        QRegularExpression::MultilineOption
+    );
+    cellText.replace(special, uR"(\1\\2)"_s);
+    cellText.replace(u'&', "&amp;"_L1);
+    cellText.replace(u'<', "&lt;"_L1);
+    cellText.replace(u'>', "&gt;"_L1);
+    return cellText;
+}
+
 static QString formatCellText(const QXlsx::Cell *cell)
 {
     if (!cell) return QString();
@@ -43,20 +63,7 @@ static QString formatCellText(const QXlsx::Cell *cell)
     if (cellText.isEmpty())
         return QString();
 
-    // Escape special characters
-    static QRegularExpression special(
-        QStringLiteral(
-            R"(()([\\`*_[\]<>()!|])|)"    // special characters
-            R"(^(\s*)(#+(?:\s|$))|)"      // headings
-            R"(^(\s*[0-9])(\.(?:\s|$))|)" // ordered lists ("1. a")
-            R"(^(\s*)([+-](?:\s|$)))"     // unordered lists ("- a")
-        ),
-        QRegularExpression::MultilineOption
-    );
-    cellText.replace(special, uR"(\1\\2)"_s);
-    cellText.replace(u'&', "&amp;"_L1);
-    cellText.replace(u'<', "&lt;"_L1);
-    cellText.replace(u'>', "&gt;"_L1);
+    cellText = XLSXToMD::escapeCellText(std::move(cellText));
 
     // Apply Markdown formatting based on font styles
     if (format.fontUnderline())
@@ -1,13 +1,16 @@
 #ifndef XLSXTOMD_H
 #define XLSXTOMD_H
 
+#include <QString>
+
 class QIODevice;
-class QString;
 
 class XLSXToMD
 {
 public:
     static QString toMarkdown(QIODevice *xlsxDevice);
+    // escapes the markdown in the text of a cell
+    static QString escapeCellText(QString cellText);
 };
 
 #endif // XLSXTOMD_H
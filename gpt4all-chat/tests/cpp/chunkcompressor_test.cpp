@@ -0,0 +1,89 @@
+#include "chunkcompressor.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include <optional>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    // zdict needs a few kilobytes of samples that share phrases, like the chunks of one collection
+    QList<QByteArray> trainingSamples()
+    {
+        static const QStringList subjects { u"The index"_s, u"A document"_s, u"The collection"_s, u"Every chunk"_s };
+        static const QStringList verbs { u"is embedded"_s, u"is compressed"_s, u"is searched"_s, u"is restored"_s };
+        QList<QByteArray> samples;
+        for (int i = 0; i < 2000; ++i) {
+            samples << u"%1 %2 after %3 documents were scanned in folder %4."_s
+                           .arg(subjects[i % subjects.size()], verbs[(i / 4) % verbs.size()])
+                           .arg(i * 7 % 113).arg(i % 17)
+                           .toUtf8();
+        }
+        return samples;
+    }
+
+    class ChunkCompressorTest : public testing::Test {
+    protected:
+        void SetUp() override
+        {
+            if (!ChunkCompressor::isAvailable())
+                GTEST_SKIP() << "built without zstd";
+            m_dictionary = ChunkCompressor::trainDictionary(trainingSamples());
+            ASSERT_FALSE(m_dictionary.isEmpty());
+            m_id = ChunkCompressor::dictionaryId(m_dictionary);
+            ASSERT_NE(m_id, 0u);
+            ASSERT_TRUE(m_compressor.addDictionary(m_dictionary));
+        }
+
+        QByteArray      m_dictionary;
+        quint32         m_id = 0;
+        ChunkCompressor m_compressor;
+    };
+} // namespace
+
+TEST_F(ChunkCompressorTest, RoundTrip)
+{
+    EXPECT_TRUE(m_compressor.hasDictionary(m_id));
+    const QStringList texts {
+        u"The collection is searched after 42 documents were scanned in folder 3."_s,
+        u"Zwölf Boxkämpfer jagen Viktor quer über den großen Sylter Deich — 日本語のテキスト 🙂"_s,
+        u""_s,
+        QString(5000, u'x'),
+    };
+    for (const QString &text: texts) {
+        const QByteArray frame = m_compressor.compress(m_id, text);
+        ASSERT_FALSE(frame.isEmpty());
+        const std::optional<QString> decoded = m_compressor.decompress(frame);
+        ASSERT_TRUE(decoded.has_value());
+        EXPECT_EQ(*decoded, text);
+    }
+}
+
+TEST_F(ChunkCompressorTest, MissingDictionary)
+{
+    const QByteArray frame = m_compressor.compress(m_id, u"Every chunk is restored after 5 documents were scanned."_s);
+    ASSERT_FALSE(frame.isEmpty());
+
+    // a frame written with a dictionary this reader does not have cannot be decoded
+    ChunkCompressor reader;
+    EXPECT_FALSE(reader.hasDictionary(m_id));
+    EXPECT_FALSE(reader.decompress(frame).has_value());
+    EXPECT_TRUE(reader.compress(m_id, u"text"_s).isEmpty());
+
+    ASSERT_TRUE(reader.addDictionary(m_dictionary));
+    EXPECT_TRUE(reader.decompress(frame).has_value());
+}
+
+TEST_F(ChunkCompressorTest, CorruptFrame)
+{
+    QByteArray frame = m_compressor.compress(m_id, u"A document is embedded after 9 documents were scanned."_s);
+    ASSERT_GT(frame.size(), 8);
+    EXPECT_FALSE(m_compressor.decompress(frame.first(frame.size() / 2)).has_value());
+    EXPECT_FALSE(m_compressor.decompress(QByteArray("not a zstd frame")).has_value());
+}
@@ -0,0 +1,160 @@
+#include "chunkstreamer.h"
+
+#include <gtest/gtest.h>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+#include <QTemporaryDir>
+
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    // like a WordPiece tokenizer, a word of n characters is (n + 3) / 4 tokens and a text is the sum of its words
+    int countTokens(QStringView text)
+    {
+        int tokens = 0;
+        qsizetype length = 0;
+        for (qsizetype i = 0; i <= text.size(); i++) {
+            if (i < text.size() && !text[i].isSpace()) {
+                length++;
+            } else if (length) {
+                tokens += int(length + 3) / 4;
+                length = 0;
+            }
+        }
+        return tokens;
+    }
+
+    // words of 1 to 23 characters, in an order that does not repeat quickly
+    QStringList testWords(int count)
+    {
+        QStringList words;
+        for (int i = 0; i < count; i++)
+            words << u"%1%2"_s.arg(QChar(u'a' + i % 26)).arg(QString((i * 7) % 23, u'x'));
+        return words;
+    }
+
+    QList<ParsedChunk> chunkDocument(const QString &text, int chunkSize, int chunkTokens, TokenCounter counter)
+    {
+        QTemporaryDir dir;
+        EXPECT_TRUE(dir.isValid());
+        QFile file(dir.filePath(u"document.txt"_s));
+        EXPECT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(text.toUtf8());
+        file.close();
+
+        const DocumentInfo info { 0, QFileInfo(file.fileName()) };
+        ChunkStreamer streamer(chunkSize, chunkTokens, std::move(counter));
+        streamer.setDocument(info);
+
+        // in batches, like the ingestion workers
+        QList<ParsedChunk> chunks;
+        for (;;) {
+            QList<ParsedChunk> batch;
+            auto status = streamer.step(batch, 8);
+            chunks << batch;
+            if (status != ChunkStreamer::Status::INTERRUPTED) {
+                EXPECT_EQ(status, ChunkStreamer::Status::DOC_COMPLETE);
+                return chunks;
+            }
+        }
+    }
+
+    QStringList chunkWords(const QList<ParsedChunk> &chunks)
+    {
+        QStringList words;
+        for (const ParsedChunk &chunk: chunks)
+            words << chunk.text.split(u' ', Qt::SkipEmptyParts);
+        return words;
+    }
+} // namespace
+
+TEST(ChunkStreamerTest, PacksWordsIntoTokenBudget)
+{
+    constexpr int budget = 24;
+    const QStringList words = testWords(500);
+    const QList<ParsedChunk> chunks = chunkDocument(words.join(u' '), 512, budget, countTokens);
+    ASSERT_GT(chunks.size(), 1);
+
+    int nWords = 0;
+    for (qsizetype i = 0; i < chunks.size(); i++) {
+        const ParsedChunk &chunk = chunks[i];
+        EXPECT_EQ(chunk.tokens, countTokens(chunk.text));
+        EXPECT_LE(chunk.tokens, budget);
+        EXPECT_FALSE(chunk.text.startsWith(u' ') || chunk.text.endsWith(u' '));
+        nWords += chunk.words;
+        // the next word did not fit, or it would have been packed into this chunk
+        if (i + 1 < chunks.size()) {
+            QStringView next = QStringView(chunks[i + 1].text).split(u' ').first();
+            EXPECT_GT(chunk.tokens + countTokens(next), budget) << "chunk " << i;
+        }
+    }
+    EXPECT_EQ(chunkWords(chunks), words);
+    EXPECT_EQ(nWords, words.size());
+}
+
+TEST(ChunkStreamerTest, SplitsWordOverTokenBudget)
+{
+    constexpr int budget = 8;
+    const QString longWord = QString(200, u'y'); // 50 tokens
+    const QList<ParsedChunk> chunks = chunkDocument(u"before "_s + longWord + u" after"_s, 512, budget, countTokens);
+    ASSERT_GT(chunks.size(), 2);
+
+    QString text;
+    for (const ParsedChunk &chunk: chunks) {
+        EXPECT_LE(chunk.tokens, budget);
+        EXPECT_GT(chunk.tokens, 0);
+        text += chunk.text;
+    }
+    text.remove(u' ');
+    EXPECT_EQ(text, u"before"_s + longWord + u"after"_s);
+}
+
+TEST(ChunkStreamerTest, FallsBackToCharactersWithoutTokenizer)
+{
+    const QString text = testWords(400).join(u' ');
+    const QList<ParsedChunk> byCharacters = chunkDocument(text, 64, 0, {});
+    const QList<ParsedChunk> chunks = chunkDocument(text, 64, 24, [](QStringView) { return -1; });
+
+    ASSERT_EQ(chunks.size(), byCharacters.size());
+    for (qsizetype i = 0; i < chunks.size(); i++) {
+        EXPECT_EQ(chunks[i].text, byCharacters[i].text);
+        EXPECT_LE(chunks[i].text.size(), 64);
+    }
+}
+
+TEST(ChunkStreamerTest, FallsBackToCharactersWhenTokenizerFails)
+{
+    // the tokenizer stops working partway through the document
+    bool failed = false;
+    auto counter = [&failed](QStringView text) {
+        if (text.contains(u"failure"_s))
+            failed = true;
+        return failed ? -1 : countTokens(text);
+    };
+    QStringList words = testWords(300);
+    words.insert(100, u"failure"_s);
+    words.insert(200, QString(300, u'z')); // an overlong word, cut by characters too
+    const QList<ParsedChunk> chunks = chunkDocument(words.join(u' '), 64, 24, counter);
+
+    int byTokens = 0;
+    for (const ParsedChunk &chunk: chunks) {
+        if (chunk.tokens) {
+            EXPECT_LE(chunk.tokens, 24);
+            byTokens++;
+        } else {
+            EXPECT_LE(chunk.text.size(), 64);
+        }
+    }
+    EXPECT_GT(byTokens, 0);
+    EXPECT_GT(chunks.size() - byTokens, 10);
+    EXPECT_EQ(chunkWords(chunks).join(QString()), words.join(QString()));
+}
@@ -0,0 +1,202 @@
+#include "chunkstreamer.h"
+#include "chunkwriter.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QList>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QString>
+#include <QTemporaryDir>
+#include <QVariant>
+#include <QVariantList>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    // the chunk tables of the LocalDocs database
+    const QString SCHEMA_SQL[] = {
+        uR"(
+            create table chunks(
+                id            integer primary key autoincrement,
+                document_id   integer not null,
+                chunk_text    text not null,
+                file          text not null,
+                title         text,
+                author        text,
+                subject       text,
+                keywords      text,
+                page          integer,
+                line_from     integer,
+                line_to       integer,
+                words         integer default 0 not null,
+                tokens        integer default 0 not null,
+                chunk_hash    blob,
+                dictionary_id integer
+            );
+        )"_s, uR"(
+            create virtual table chunks_fts using fts5(
+                id unindexed, document_id unindexed, chunk_text, file, title, author, subject, keywords,
+                content='chunks', content_rowid='id', tokenize='porter'
+            );
+        )"_s,
+    };
+
+    // how the database removes the chunks of a document, full-text entries first
+    const QString DELETE_CHUNKS_SQL[] = {
+        u"delete from chunks_fts where document_id = ?;"_s,
+        u"delete from chunks where document_id = ?;"_s,
+    };
+
+    constexpr qsizetype s_batchChunks = 64; // like the ingestion workers
+
+    class ChunkWriterTest : public testing::Test {
+    protected:
+        void SetUp() override
+        {
+            ASSERT_TRUE(m_dir.isValid());
+            m_db = QSqlDatabase::addDatabase(u"QSQLITE"_s, u"chunks"_s);
+            m_db.setDatabaseName(m_dir.filePath(u"chunks.db"_s));
+            ASSERT_TRUE(m_db.open()) << m_db.lastError().text().toStdString();
+            for (const QString &sql: SCHEMA_SQL)
+                exec(sql);
+        }
+
+        void TearDown() override
+        {
+            m_db.close();
+            m_db = QSqlDatabase();
+            QSqlDatabase::removeDatabase(u"chunks"_s);
+        }
+
+        void exec(const QString &sql, const QVariantList &values = {})
+        {
+            QSqlQuery q(m_db);
+            ASSERT_TRUE(q.prepare(sql)) << q.lastError().text().toStdString();
+            for (const QVariant &value: values)
+                q.addBindValue(value);
+            ASSERT_TRUE(q.exec()) << q.lastError().text().toStdString();
+        }
+
+        int count(const QString &sql, const QVariantList &values = {})
+        {
+            QSqlQuery q(m_db);
+            EXPECT_TRUE(q.prepare(sql)) << q.lastError().text().toStdString();
+            for (const QVariant &value: values)
+                q.addBindValue(value);
+            EXPECT_TRUE(q.exec() && q.next()) << q.lastError().text().toStdString();
+            return q.value(0).toInt();
+        }
+
+        // compares the full-text index with the text of the chunks
+        bool integrityCheck()
+        {
+            QSqlQuery q(m_db);
+            bool ok = q.exec(u"insert into chunks_fts(chunks_fts, rank) values('integrity-check', 1);"_s);
+            EXPECT_TRUE(ok) << q.lastError().text().toStdString();
+            return ok;
+        }
+
+        int matches(const QString &term)
+        {
+            return count(u"select count(*) from chunks_fts where chunks_fts match ?;"_s, { term });
+        }
+
+        QString writeFile(const QString &name, const QByteArray &content)
+        {
+            QFile file(m_dir.filePath(name));
+            EXPECT_TRUE(file.open(QIODevice::WriteOnly));
+            file.write(content);
+            return file.fileName();
+        }
+
+        void writeChunks(ChunkWriter &writer, int document_id, const QList<ParsedChunk> &chunks)
+        {
+            QList<int> chunk_ids;
+            ASSERT_TRUE(writer.add(document_id, u"document.txt"_s, {}, chunks, chunk_ids))
+                << writer.lastError().text().toStdString();
+            ASSERT_EQ(chunk_ids.size(), chunks.size());
+        }
+
+        QTemporaryDir m_dir;
+        QSqlDatabase  m_db;
+    };
+
+    ParsedChunk chunkOf(const QString &text)
+    {
+        return { text, 1, int(text.count(u' ') + 1), text.toUtf8() };
+    }
+} // namespace
+
+TEST_F(ChunkWriterTest, IndexesChunksOnFlush)
+{
+    ChunkWriter writer(m_db);
+    QList<ParsedChunk> chunks;
+    for (int i = 0; i < 100; i++)
+        chunks << chunkOf(u"aardvark number %1"_s.arg(i));
+    writeChunks(writer, 1, chunks.first(70)); // more than one statement
+    writeChunks(writer, 2, chunks.sliced(70));
+    writeChunks(writer, 2, { chunkOf(u"badger"_s) });
+
+    EXPECT_EQ(count(u"select count(*) from chunks;"_s), 101);
+    EXPECT_EQ(matches(u"aardvark"_s), 0);
+
+    EXPECT_EQ(writer.flush(), 101);
+    EXPECT_EQ(writer.flush(), 0);
+    EXPECT_EQ(matches(u"aardvark"_s), 100);
+    EXPECT_EQ(matches(u"badger"_s), 1);
+    EXPECT_TRUE(integrityCheck());
+}
+
+// a text file that turns out to be binary after some batches of chunks were written is removed like the database does
+TEST_F(ChunkWriterTest, RemovesDocumentThatTurnsBinary)
+{
+    // an indexed document that must keep its entries
+    {
+        ChunkWriter writer(m_db);
+        writeChunks(writer, 1, { chunkOf(u"zebras run in herds"_s) });
+        EXPECT_EQ(writer.flush(), 1);
+    }
+
+    // more text than the reader reads at once, then a NUL byte
+    QByteArray content;
+    for (int i = 0; content.size() < 200 * 1024; i++)
+        content += "aardvark " + QByteArray::number(i) + ' ';
+    content += '\0';
+    content += "badger";
+    const DocumentInfo info { 0, QFileInfo(writeFile(u"binary.txt"_s, content)) };
+
+    ChunkStreamer streamer(200);
+    streamer.setDocument(info);
+    ChunkWriter writer(m_db);
+    int nBatches = 0;
+    for (;;) {
+        QList<ParsedChunk> batch;
+        auto status = streamer.step(batch, s_batchChunks);
+        writeChunks(writer, 2, batch);
+        nBatches++;
+        if (status == ChunkStreamer::Status::INTERRUPTED)
+            continue;
+        ASSERT_EQ(status, ChunkStreamer::Status::BINARY_SEEN);
+        break;
+    }
+    ASSERT_GT(nBatches, 1);
+    ASSERT_GT(count(u"select count(*) from chunks where document_id = 2;"_s), s_batchChunks);
+
+    // the chunks are indexed before they are removed, then the rest of the batch interval is flushed
+    writer.flush();
+    for (const QString &sql: DELETE_CHUNKS_SQL)
+        exec(sql, { 2 });
+    EXPECT_EQ(writer.flush(), 0);
+
+    EXPECT_TRUE(integrityCheck());
+    EXPECT_EQ(count(u"select count(*) from chunks;"_s), 1);
+    EXPECT_EQ(matches(u"aardvark"_s), 0);
+    EXPECT_EQ(matches(u"zebra"_s), 1);
+}
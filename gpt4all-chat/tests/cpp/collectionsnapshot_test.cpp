@@ -0,0 +1,355 @@
+#include "collectionsnapshot.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QVariant>
+#include <QVariantList>
+
+#include <cmath>
+#include <cstring>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    // the tables of the LocalDocs database that a snapshot is written from and read into
+    const QString SCHEMA_SQL[] = {
+        uR"(
+            create table chunks(
+                id            integer primary key autoincrement,
+                document_id   integer not null,
+                chunk_text    text not null,
+                file          text not null,
+                title         text,
+                author        text,
+                subject       text,
+                keywords      text,
+                page          integer,
+                line_from     integer,
+                line_to       integer,
+                words         integer default 0 not null,
+                tokens        integer default 0 not null,
+                chunk_hash    blob,
+                dictionary_id integer
+            );
+        )"_s, uR"(
+            create virtual table chunks_fts using fts5(
+                id unindexed, document_id unindexed, chunk_text, file, title, author, subject, keywords,
+                content='chunks', content_rowid='id', tokenize='porter'
+            );
+        )"_s, uR"(
+            create table documents(
+                id            integer primary key,
+                folder_id     integer not null,
+                document_time integer not null,
+                document_path text unique not null,
+                content_hash  blob
+            );
+        )"_s, uR"(
+            create table embeddings(
+                model         text not null,
+                folder_id     integer not null,
+                chunk_id      integer not null,
+                embedding     blob not null,
+                primary key(model, folder_id, chunk_id),
+                unique(model, chunk_id)
+            );
+        )"_s,
+    };
+
+    constexpr int s_sourceFolderId = 7;
+    constexpr int s_targetFolderId = 3;
+    constexpr int s_dimensions     = 4;
+
+    QByteArray embeddingOf(int seed)
+    {
+        float values[s_dimensions];
+        float norm = 0;
+        for (int i = 0; i < s_dimensions; i++) {
+            values[i] = float((seed * 31 + i * 17) % 23) - 11.f;
+            norm += values[i] * values[i];
+        }
+        for (float &v: values)
+            v /= std::sqrt(norm);
+        return QByteArray(reinterpret_cast<const char *>(values), sizeof values);
+    }
+
+    float cosine(const QByteArray &a, const QByteArray &b)
+    {
+        float dot = 0;
+        for (int i = 0; i < s_dimensions; i++) {
+            float x, y;
+            std::memcpy(&x, a.constData() + i * sizeof(float), sizeof(float));
+            std::memcpy(&y, b.constData() + i * sizeof(float), sizeof(float));
+            dot += x * y;
+        }
+        return dot;
+    }
+
+    class CollectionSnapshotTest : public testing::Test {
+    protected:
+        void SetUp() override
+        {
+            ASSERT_TRUE(m_dir.isValid());
+            ASSERT_TRUE(QDir(m_dir.path()).mkpath(u"source/docs/sub"_s));
+            ASSERT_TRUE(QDir(m_dir.path()).mkpath(u"target/imported"_s));
+            m_sourceRoot = QFileInfo(m_dir.filePath(u"source/docs"_s)).canonicalFilePath();
+            m_targetRoot = QFileInfo(m_dir.filePath(u"target/imported"_s)).canonicalFilePath();
+            m_source = openDatabase(u"source"_s);
+            m_target = openDatabase(u"target"_s);
+            populateSource();
+            populateTarget();
+        }
+
+        void TearDown() override
+        {
+            m_source = m_target = QSqlDatabase();
+            for (const QString &name: { u"source"_s, u"target"_s }) {
+                QSqlDatabase::database(name, false).close();
+                QSqlDatabase::removeDatabase(name);
+            }
+        }
+
+        QSqlDatabase openDatabase(const QString &name)
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase(u"QSQLITE"_s, name);
+            db.setDatabaseName(m_dir.filePath(name + u".db"_s));
+            EXPECT_TRUE(db.open()) << db.lastError().text().toStdString();
+            for (const QString &sql: SCHEMA_SQL)
+                exec(db, sql);
+            return db;
+        }
+
+        static void exec(const QSqlDatabase &db, const QString &sql, const QVariantList &values = {})
+        {
+            QSqlQuery q(db);
+            ASSERT_TRUE(q.prepare(sql)) << q.lastError().text().toStdString();
+            for (const QVariant &value: values)
+                q.addBindValue(value);
+            ASSERT_TRUE(q.exec()) << q.lastError().text().toStdString();
+        }
+
+        static QList<QVariantList> rows(const QSqlDatabase &db, const QString &sql, const QVariantList &values = {})
+        {
+            QSqlQuery q(db);
+            EXPECT_TRUE(q.prepare(sql)) << q.lastError().text().toStdString();
+            for (const QVariant &value: values)
+                q.addBindValue(value);
+            EXPECT_TRUE(q.exec()) << q.lastError().text().toStdString();
+            QList<QVariantList> result;
+            while (q.next()) {
+                QVariantList row;
+                for (int i = 0; i < q.record().count(); i++)
+                    row << q.value(i);
+                result << row;
+            }
+            return result;
+        }
+
+        void addDocument(int id, const QString &path, const QByteArray &contentHash, const QStringList &chunkTexts)
+        {
+            exec(m_source, u"insert into documents(id, folder_id, document_time, document_path, content_hash) "
+                           "values(?, ?, ?, ?, ?);"_s,
+                 { id, s_sourceFolderId, 1000 + id, path, contentHash });
+            for (int i = 0; i < chunkTexts.size(); i++) {
+                const QString &text = chunkTexts[i];
+                exec(m_source, u"insert into chunks(document_id, chunk_text, file, title, author, subject, keywords, "
+                               "page, words, tokens, chunk_hash) values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);"_s,
+                     { id, text, QFileInfo(path).fileName(), u"Title %1"_s.arg(id), u"Author"_s, QVariant(),
+                       u"kw%1"_s.arg(i), i + 1, int(text.count(u' ') + 1), int(text.size() / 4),
+                       QByteArray("chunk hash ") + text.toUtf8() });
+            }
+        }
+
+        // a folder of two documents and one behind a link outside of it, with embeddings of two models
+        void populateSource()
+        {
+            addDocument(1, m_sourceRoot + u"/alpha.txt"_s, "content hash 1",
+                        { u"the aardvark eats ants"_s, u"a second chunk about badgers"_s });
+            addDocument(2, m_sourceRoot + u"/sub/beta.md"_s, "content hash 2", { u"zebras run in herds"_s });
+            addDocument(3, u"/elsewhere/gamma.txt"_s, "content hash 3", { u"outside of the folder"_s });
+            exec(m_source, u"insert into chunks_fts(rowid, document_id, chunk_text, file, title, author, subject, "
+                           "keywords) select id, document_id, chunk_text, file, title, author, subject, keywords "
+                           "from chunks;"_s);
+            for (const QVariantList &row: rows(m_source, u"select id from chunks;"_s)) {
+                const int chunkId = row[0].toInt();
+                exec(m_source, u"insert into embeddings(model, folder_id, chunk_id, embedding) values(?, ?, ?, ?);"_s,
+                     { u"nomic"_s, s_sourceFolderId, chunkId, embeddingOf(chunkId) });
+                exec(m_source, u"insert into embeddings(model, folder_id, chunk_id, embedding) values(?, ?, ?, ?);"_s,
+                     { u"other"_s, s_sourceFolderId, chunkId, embeddingOf(-chunkId) });
+            }
+        }
+
+        // ids already in use, and chunk ids that were used once, which imported rows must not reuse
+        void populateTarget()
+        {
+            exec(m_target, u"insert into documents(id, folder_id, document_time, document_path) "
+                           "values(1, 1, 1, '/existing.txt');"_s);
+            for (int i = 0; i < 6; i++)
+                exec(m_target, u"insert into chunks(document_id, chunk_text, file) values(1, 'existing', 'f');"_s);
+            exec(m_target, u"delete from chunks where id > 2;"_s);
+        }
+
+        void exportSnapshot(bool quantize)
+        {
+            CollectionSnapshot snapshot(m_source);
+            ASSERT_EQ(snapshot.attach(snapshotPath()), QString());
+            ASSERT_EQ(snapshot.create(), QString());
+            ASSERT_TRUE(m_source.transaction());
+            ASSERT_EQ(snapshot.write(u"docs"_s, u"nomic"_s, { { s_sourceFolderId, m_sourceRoot } }, nullptr, quantize),
+                      QString());
+            ASSERT_TRUE(m_source.commit());
+            snapshot.detach();
+        }
+
+        void importSnapshot(bool quantized)
+        {
+            CollectionSnapshot snapshot(m_target);
+            ASSERT_EQ(snapshot.attach(snapshotPath()), QString());
+
+            CollectionSnapshot::Info info;
+            ASSERT_EQ(snapshot.readInfo(info), QString());
+            EXPECT_EQ(info.embeddingModel, u"nomic"_s);
+            EXPECT_EQ(info.dimensions, s_dimensions);
+            EXPECT_EQ(info.quantized, quantized);
+
+            QList<CollectionSnapshot::Folder> folders;
+            ASSERT_EQ(snapshot.readFolders(folders), QString());
+            ASSERT_EQ(folders.size(), 1);
+            EXPECT_EQ(folders[0].id, s_sourceFolderId);
+            EXPECT_EQ(folders[0].root, m_sourceRoot);
+
+            // under another path, as on another machine
+            const QHash<int, CollectionSnapshot::Folder> localFolders {
+                { s_sourceFolderId, { s_targetFolderId, m_targetRoot } },
+            };
+            int nChunks = 0;
+            ASSERT_TRUE(m_target.transaction());
+            ASSERT_EQ(snapshot.import(info, localFolders, nChunks), QString());
+            ASSERT_TRUE(m_target.commit());
+            snapshot.detach();
+            EXPECT_GE(nChunks, 3);
+        }
+
+        void expectRoundTrip(bool quantized)
+        {
+            // documents with their paths remapped and their fingerprints
+            const QString documentsSql = uR"(
+                select substr(document_path, length(?) + 2), document_time, content_hash
+                from documents
+                where folder_id = ? and substr(document_path, 1, length(?) + 1) = ? || '/'
+                order by document_path;
+            )"_s;
+            const auto sourceDocuments = rows(m_source, documentsSql,
+                                              { m_sourceRoot, s_sourceFolderId, m_sourceRoot, m_sourceRoot });
+            const auto targetDocuments = rows(m_target, documentsSql,
+                                              { m_targetRoot, s_targetFolderId, m_targetRoot, m_targetRoot });
+            ASSERT_EQ(sourceDocuments.size(), 2);
+            EXPECT_EQ(targetDocuments, sourceDocuments);
+            // the document outside of the folder is left out
+            EXPECT_EQ(rows(m_target, u"select count(*) from documents where folder_id = ?;"_s, { s_targetFolderId }),
+                      QList<QVariantList> { { qlonglong(2) } });
+
+            // chunks in the same order, with their text, metadata and fingerprints
+            const QString chunksSql = uR"(
+                select c.id, substr(d.document_path, length(?) + 2), c.chunk_text, c.file, c.title, c.author,
+                       c.subject, c.keywords, c.page, c.line_from, c.line_to, c.words, c.tokens, c.chunk_hash
+                from chunks c join documents d on d.id = c.document_id
+                where d.folder_id = ? and substr(d.document_path, 1, length(?) + 1) = ? || '/'
+                order by c.id;
+            )"_s;
+            auto sourceChunks = rows(m_source, chunksSql,
+                                     { m_sourceRoot, s_sourceFolderId, m_sourceRoot, m_sourceRoot });
+            auto targetChunks = rows(m_target, chunksSql,
+                                     { m_targetRoot, s_targetFolderId, m_targetRoot, m_targetRoot });
+            ASSERT_EQ(sourceChunks.size(), 3);
+            ASSERT_EQ(targetChunks.size(), sourceChunks.size());
+            QHash<int, int> targetIdOf; // by source chunk id
+            for (qsizetype i = 0; i < targetChunks.size(); i++) {
+                const int sourceId = sourceChunks[i].takeFirst().toInt();
+                const int targetId = targetChunks[i].takeFirst().toInt();
+                EXPECT_GT(targetId, 6) << "chunk ids that were used before are not reused";
+                targetIdOf.insert(sourceId, targetId);
+                EXPECT_EQ(targetChunks[i], sourceChunks[i]);
+            }
+
+            // the full-text index is consistent with the chunks and finds them by their new ids
+            exec(m_target, u"insert into chunks_fts(chunks_fts) values('integrity-check');"_s);
+            auto matches = [this](const QString &word) {
+                QList<int> ids;
+                for (const QVariantList &row: rows(m_target, u"select rowid from chunks_fts where chunks_fts match ? "
+                                                              "order by rowid;"_s, { word }))
+                    ids << row[0].toInt();
+                return ids;
+            };
+            EXPECT_EQ(matches(u"aardvark"_s), QList<int> { targetIdOf.value(1) });
+            EXPECT_EQ(matches(u"badger"_s), QList<int> { targetIdOf.value(2) });
+            EXPECT_EQ(matches(u"zebra"_s), QList<int> { targetIdOf.value(3) });
+            EXPECT_TRUE(matches(u"outside"_s).isEmpty());
+
+            // embeddings of the collection's model only, under the new ids and folder
+            const auto embeddings = rows(m_target, u"select model, folder_id, chunk_id, embedding from embeddings "
+                                                    "order by chunk_id;"_s);
+            ASSERT_EQ(embeddings.size(), targetIdOf.size());
+            QHash<int, QByteArray> embeddingOfTarget;
+            for (const QVariantList &row: embeddings) {
+                EXPECT_EQ(row[0].toString(), u"nomic"_s);
+                EXPECT_EQ(row[1].toInt(), s_targetFolderId);
+                embeddingOfTarget.insert(row[2].toInt(), row[3].toByteArray());
+            }
+            for (auto it = targetIdOf.constBegin(); it != targetIdOf.constEnd(); ++it) {
+                const QByteArray expected = embeddingOf(it.key());
+                const QByteArray actual = embeddingOfTarget.value(it.value());
+                ASSERT_EQ(actual.size(), expected.size());
+                if (quantized)
+                    EXPECT_GT(cosine(actual, expected), 0.999f);
+                else
+                    EXPECT_EQ(actual, expected);
+            }
+        }
+
+        QString snapshotPath() const { return m_dir.filePath(u"docs.localdocs"_s); }
+
+        QTemporaryDir m_dir;
+        QString       m_sourceRoot;
+        QString       m_targetRoot;
+        QSqlDatabase  m_source;
+        QSqlDatabase  m_target;
+    };
+} // namespace
+
+TEST_F(CollectionSnapshotTest, RoundTrip)
+{
+    ASSERT_NO_FATAL_FAILURE(exportSnapshot(false));
+    ASSERT_NO_FATAL_FAILURE(importSnapshot(false));
+    expectRoundTrip(false);
+}
+
+TEST_F(CollectionSnapshotTest, QuantizedRoundTrip)
+{
+    ASSERT_NO_FATAL_FAILURE(exportSnapshot(true));
+    ASSERT_NO_FATAL_FAILURE(importSnapshot(true));
+    expectRoundTrip(true);
+}
+
+TEST_F(CollectionSnapshotTest, RejectsOtherFiles)
+{
+    // an empty SQLite file is not a snapshot
+    CollectionSnapshot snapshot(m_target);
+    ASSERT_EQ(snapshot.attach(m_dir.filePath(u"empty.db"_s)), QString());
+    CollectionSnapshot::Info info;
+    EXPECT_EQ(snapshot.readInfo(info), u"Not a LocalDocs snapshot"_s);
+    snapshot.detach();
+}
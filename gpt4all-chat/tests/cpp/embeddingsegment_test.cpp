@@ -0,0 +1,292 @@
+#include "embeddingsegment.h"
+
+#include <gtest/gtest.h>
+
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    using Quantization = EmbeddingSegment::Quantization;
+
+    struct Entry {
+        int                folderId;
+        std::vector<float> embedding;
+    };
+
+    /* Unit vectors around a number of centers, so that the nearest neighbors of a query near a center are clearly
+     * closer than the rest, and a quantized scan finds all of them among its candidates. spread is the length of the
+     * noise added to the center. */
+    class TestEmbeddings {
+    public:
+        TestEmbeddings(size_t dimensions, int nCenters)
+            : m_dimensions(dimensions)
+        {
+            for (int i = 0; i < nCenters; i++)
+                m_centers.push_back(randomVector(1.0f, nullptr));
+        }
+
+        std::vector<float> near(int center, float spread = 0.3f)
+        {
+            return randomVector(spread, &m_centers[center % m_centers.size()]);
+        }
+
+    private:
+        std::vector<float> randomVector(float spread, const std::vector<float> *center)
+        {
+            std::vector<float> v(m_dimensions);
+            const float sigma = spread / std::sqrt(float(m_dimensions));
+            float norm = 0;
+            for (size_t i = 0; i < m_dimensions; i++) {
+                v[i] = (center ? (*center)[i] : 0.0f) + sigma * m_normal(m_rng);
+                norm += v[i] * v[i];
+            }
+            for (float &x: v)
+                x /= std::sqrt(norm);
+            return v;
+        }
+
+        size_t                          m_dimensions;
+        std::vector<std::vector<float>> m_centers;
+        std::mt19937                    m_rng { 42 };
+        std::normal_distribution<float> m_normal;
+    };
+
+    // inner product distance, the way the segment measures it
+    float distance(const std::vector<float> &a, const std::vector<float> &b)
+    {
+        float dot = 0;
+        for (size_t i = 0; i < a.size(); i++)
+            dot += a[i] * b[i];
+        return 1.0f - dot;
+    }
+
+    // the distances of the live rows of the folders, by chunk id
+    std::map<int, float> exactDistances(const std::map<int, Entry> &entries, const std::vector<float> &query,
+                                        const QSet<int> &folderIds)
+    {
+        std::map<int, float> distances;
+        for (const auto &[chunkId, entry]: entries) {
+            if (folderIds.contains(entry.folderId))
+                distances.emplace(chunkId, distance(query, entry.embedding));
+        }
+        return distances;
+    }
+
+    /* The result of a search must be the k nearest of the exact distances. Chunks at nearly the same distance may
+     * come in either order, as the segment sums in another order, so matches are compared by distance. */
+    void expectNearest(const QList<EmbeddingMatch> &actual, const std::map<int, float> &distances, int k)
+    {
+        std::vector<float> expected;
+        for (const auto &[chunkId, d]: distances)
+            expected.push_back(d);
+        std::sort(expected.begin(), expected.end());
+        expected.resize(std::min(size_t(k), expected.size()));
+
+        ASSERT_EQ(size_t(actual.size()), expected.size());
+        for (qsizetype i = 0; i < actual.size(); i++) {
+            auto it = distances.find(actual[i].chunkId);
+            ASSERT_TRUE(it != distances.end()) << "chunk " << actual[i].chunkId << " should not be found";
+            EXPECT_NEAR(actual[i].distance, it->second, 1e-5) << "match " << i;
+            EXPECT_NEAR(actual[i].distance, expected[i], 1e-5) << "match " << i;
+        }
+    }
+
+    class EmbeddingSegmentTest : public testing::TestWithParam<Quantization> {
+    protected:
+        static constexpr size_t s_dimensions = 64;
+
+        void SetUp() override
+        {
+            ASSERT_TRUE(m_dir.isValid());
+            m_basePath = m_dir.filePath(u"model"_s);
+            m_segment = EmbeddingSegment::create(m_basePath, s_dimensions);
+            ASSERT_TRUE(m_segment);
+            ASSERT_TRUE(m_segment->setQuantization(GetParam()));
+        }
+
+        void add(int chunkId, int folderId, std::vector<float> embedding)
+        {
+            ASSERT_TRUE(m_segment->add(chunkId, folderId, embedding.data()));
+            m_entries[chunkId] = { folderId, std::move(embedding) };
+        }
+
+        void remove(int chunkId)
+        {
+            m_segment->remove(chunkId);
+            m_entries.erase(chunkId);
+        }
+
+        void removeFolder(int folderId)
+        {
+            m_segment->removeFolder(folderId);
+            std::erase_if(m_entries, [folderId](auto &e) { return e.second.folderId == folderId; });
+        }
+
+        // queries near every center, against the folders together and one at a time
+        void expectExactResults(int nCenters, const QList<QSet<int>> &folderSets, int k = 10)
+        {
+            ASSERT_EQ(m_segment->size(), m_entries.size());
+            for (int center = 0; center < nCenters; center++) {
+                const std::vector<float> query = m_embeddings.near(center, 0.1f);
+                for (const QSet<int> &folderIds: folderSets) {
+                    SCOPED_TRACE(testing::Message() << "center " << center);
+                    expectNearest(m_segment->search(query.data(), folderIds, k),
+                                  exactDistances(m_entries, query, folderIds), k);
+                }
+            }
+        }
+
+        QTemporaryDir                     m_dir;
+        QString                           m_basePath;
+        std::unique_ptr<EmbeddingSegment> m_segment;
+        TestEmbeddings                    m_embeddings { s_dimensions, 40 };
+        std::map<int, Entry>              m_entries; // by chunk id, what the segment should hold
+    };
+} // namespace
+
+TEST_P(EmbeddingSegmentTest, SearchMatchesExactScan)
+{
+    for (int chunkId = 1; chunkId <= 2000; chunkId++)
+        add(chunkId, 1 + chunkId % 3, m_embeddings.near(chunkId));
+    expectExactResults(40, { { 1 }, { 2 }, { 1, 2, 3 }, { 2, 3, 99 } });
+    EXPECT_TRUE(m_segment->search(m_embeddings.near(0).data(), { 99 }, 10).isEmpty());
+
+    // nothing to find, not even candidates for a quantized scan
+    EXPECT_TRUE(m_segment->search(m_embeddings.near(0).data(), { 1, 2, 3 }, 0).isEmpty());
+    EXPECT_TRUE(m_segment->search(m_embeddings.near(0).data(), { 1, 2, 3 }, -1).isEmpty());
+}
+
+TEST_P(EmbeddingSegmentTest, RemovesRowsAndFolders)
+{
+    for (int chunkId = 1; chunkId <= 2000; chunkId++)
+        add(chunkId, 1 + chunkId % 3, m_embeddings.near(chunkId));
+    for (int chunkId = 1; chunkId <= 2000; chunkId += 7)
+        remove(chunkId);
+    remove(123456); // not in the segment
+    removeFolder(3);
+    EXPECT_FALSE(m_segment->contains(1)); // removed
+    EXPECT_FALSE(m_segment->contains(2)); // in folder 3
+    EXPECT_TRUE(m_segment->contains(3));
+    EXPECT_TRUE(m_segment->contains(4));
+
+    // a chunk that is embedded again replaces its row, also in another folder
+    add(3, 2, m_embeddings.near(17));
+    add(5, 3, m_embeddings.near(18));
+    expectExactResults(40, { { 1 }, { 2 }, { 3 }, { 1, 2, 3 } });
+
+    // missing chunks are skipped
+    const std::vector<float> query = m_embeddings.near(17, 0.1f);
+    const QList<EmbeddingMatch> scores = m_segment->score(query.data(), { 3, 5, 8 });
+    ASSERT_EQ(scores.size(), 2);
+    EXPECT_EQ(scores[0].chunkId, 3);
+    EXPECT_NEAR(scores[0].distance, distance(query, m_entries.at(3).embedding), 1e-5);
+    EXPECT_EQ(scores[1].chunkId, 5);
+    EXPECT_NEAR(scores[1].distance, distance(query, m_entries.at(5).embedding), 1e-5);
+}
+
+TEST_P(EmbeddingSegmentTest, SearchAfterCompactAndReopen)
+{
+    // enough deleted rows to need compaction
+    for (int chunkId = 1; chunkId <= 6000; chunkId++)
+        add(chunkId, 1 + chunkId % 2, m_embeddings.near(chunkId));
+    EXPECT_FALSE(m_segment->needsCompaction());
+    for (int chunkId = 1; chunkId <= 6000; chunkId++) {
+        if (chunkId % 4)
+            remove(chunkId);
+    }
+    ASSERT_TRUE(m_segment->needsCompaction());
+    m_segment->compact();
+    EXPECT_FALSE(m_segment->needsCompaction());
+    expectExactResults(40, { { 1 }, { 2 }, { 1, 2 } });
+
+    // rows added after compaction go after the moved ones
+    for (int chunkId = 6001; chunkId <= 6100; chunkId++)
+        add(chunkId, 2, m_embeddings.near(chunkId));
+    m_segment->setGeneration(7);
+    m_segment->setComplete();
+    m_segment.reset();
+
+    m_segment = EmbeddingSegment::open(m_basePath);
+    ASSERT_TRUE(m_segment);
+    EXPECT_EQ(m_segment->dimensions(), s_dimensions);
+    EXPECT_EQ(m_segment->quantization(), GetParam());
+    EXPECT_EQ(m_segment->generation().value_or(0), 7u);
+    EXPECT_TRUE(m_segment->isComplete());
+    expectExactResults(40, { { 1 }, { 2 }, { 1, 2 } });
+}
+
+TEST_P(EmbeddingSegmentTest, ChangesClearTheGeneration)
+{
+    add(1, 1, m_embeddings.near(1));
+    m_segment->setGeneration(3);
+    EXPECT_EQ(m_segment->generation().value_or(0), 3u);
+
+    // any change to the rows, until the database stamps the segment again
+    add(2, 1, m_embeddings.near(2));
+    EXPECT_FALSE(m_segment->generation());
+    m_segment->setGeneration(4);
+    remove(2);
+    EXPECT_FALSE(m_segment->generation());
+    m_segment->setGeneration(5);
+    removeFolder(1);
+    EXPECT_FALSE(m_segment->generation());
+
+    // a segment that was changed without being stamped is not trusted after a restart
+    add(3, 2, m_embeddings.near(3));
+    m_segment.reset();
+    m_segment = EmbeddingSegment::open(m_basePath);
+    ASSERT_TRUE(m_segment);
+    EXPECT_FALSE(m_segment->generation());
+    EXPECT_EQ(m_segment->size(), 1u);
+    EXPECT_TRUE(m_segment->contains(3));
+}
+
+INSTANTIATE_TEST_SUITE_P(Quantizations, EmbeddingSegmentTest,
+                         testing::Values(Quantization::None, Quantization::Int8, Quantization::Binary),
+                         [](const testing::TestParamInfo<Quantization> &info) -> std::string {
+                             switch (info.param) {
+                                 case Quantization::None:   return "None";
+                                 case Quantization::Int8:   return "Int8";
+                                 case Quantization::Binary: return "Binary";
+                             }
+                             return "";
+                         });
+
+// enough rows for the scan to be split between threads, with ranges that start in the middle of a folder
+TEST(EmbeddingSegmentParallelTest, ParallelScanMatchesExactScan)
+{
+    constexpr size_t dimensions = 16;
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    auto segment = EmbeddingSegment::create(dir.filePath(u"model"_s), dimensions);
+    ASSERT_TRUE(segment);
+
+    TestEmbeddings embeddings(dimensions, 100);
+    std::map<int, Entry> entries;
+    for (int chunkId = 1; chunkId <= 80000; chunkId++) {
+        Entry entry { 1 + chunkId % 5, embeddings.near(chunkId) };
+        ASSERT_TRUE(segment->add(chunkId, entry.folderId, entry.embedding.data()));
+        entries.emplace(chunkId, std::move(entry));
+    }
+
+    for (int center = 0; center < 10; center++) {
+        const std::vector<float> query = embeddings.near(center, 0.1f);
+        for (const QSet<int> &folderIds: { QSet<int> { 1, 2, 3, 4, 5 }, QSet<int> { 2, 4 } })
+            expectNearest(segment->search(query.data(), folderIds, 20), exactDistances(entries, query, folderIds), 20);
+    }
+}
@@ -0,0 +1,178 @@
+#include "folderwatcher.h"
+
+#include <gtest/gtest.h>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtGlobal>
+
+#include <functional>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    class FolderWatcherTest : public testing::Test {
+    protected:
+        // the watcher needs an event loop; the application is kept until the tests exit
+        static void SetUpTestSuite()
+        {
+            if (QCoreApplication::instance())
+                return;
+            static int argc = 1;
+            static char arg0[] = "gpt4all_tests";
+            static char *argv[] = { arg0, nullptr };
+            new QCoreApplication(argc, argv);
+        }
+
+        void SetUp() override
+        {
+            ASSERT_TRUE(m_dir.isValid());
+            m_root = QFileInfo(m_dir.path()).canonicalFilePath();
+            QObject::connect(&m_watcher, &FolderWatcher::changesDetected, [this](const FolderChanges &changes) {
+                m_reports << changes;
+                m_events << u"changes"_s;
+            });
+            QObject::connect(&m_watcher, &FolderWatcher::watchLost, [this](const QString &path) {
+                m_events << u"lost "_s + path;
+            });
+        }
+
+        QString makeDir(const QString &name)
+        {
+            EXPECT_TRUE(QDir(m_root).mkpath(name));
+            return m_root + u'/' + name;
+        }
+
+        static void writeFile(const QString &path)
+        {
+            QFile file(path);
+            ASSERT_TRUE(file.open(QIODevice::WriteOnly)) << path.toStdString();
+            file.write("text");
+        }
+
+        // runs the event loop until the condition holds or the time is up
+        static bool waitFor(const std::function<bool()> &condition, int ms)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            while (!condition() && timer.elapsed() < ms) {
+                QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+                QThread::msleep(5);
+            }
+            return condition();
+        }
+
+        // more than the debounce delay of the watcher
+        static void waitQuietly() { waitFor([] { return false; }, 1500); }
+
+        QTemporaryDir        m_dir;
+        QString              m_root;
+        FolderWatcher        m_watcher;
+        QList<FolderChanges> m_reports;
+        QStringList          m_events; // in the order of the signals
+    };
+} // namespace
+
+// the receiver learns that the directory changed while it still knows the watch, and then that the watch is gone
+TEST_F(FolderWatcherTest, ReportsLostWatchAfterChanges)
+{
+    const QString parent = makeDir(u"parent"_s), child = makeDir(u"parent/child"_s);
+    ASSERT_TRUE(m_watcher.addPath(parent));
+    ASSERT_TRUE(m_watcher.addPath(child));
+
+    ASSERT_TRUE(QDir(child).removeRecursively());
+    ASSERT_TRUE(waitFor([this] { return !m_events.isEmpty() && m_events.last().startsWith(u"lost"_s); }, 5000));
+    waitQuietly();
+
+    EXPECT_EQ(m_events, QStringList({ u"changes"_s, u"lost "_s + child }));
+    ASSERT_EQ(m_reports.size(), 1);
+    EXPECT_TRUE(m_reports.first().directories.contains(child));
+
+    // the directory can be watched again once it is back
+    makeDir(u"parent/child"_s);
+    EXPECT_TRUE(m_watcher.addPath(child));
+}
+
+#if defined(Q_OS_LINUX)
+// the files that changed are only known with inotify, elsewhere the directory is reported
+TEST_F(FolderWatcherTest, CoalescesBurstOfChanges)
+{
+    const QString dir = makeDir(u"docs"_s);
+    ASSERT_TRUE(m_watcher.addPath(dir));
+
+    QElapsedTimer sinceLastChange;
+    for (int i = 0; i < 20; i++) {
+        writeFile(dir + u"/file%1.txt"_s.arg(i));
+        writeFile(dir + u"/file%1.txt"_s.arg(i)); // written again
+        QCoreApplication::processEvents(); // events may be read while the burst goes on
+    }
+    makeDir(u"docs/sub"_s);
+    QFile::remove(dir + u"/file0.txt"_s);
+    sinceLastChange.start();
+
+    ASSERT_TRUE(waitFor([this] { return !m_reports.isEmpty(); }, 5000));
+    EXPECT_GE(sinceLastChange.elapsed(), 400); // the changes are reported once the directory is quiet
+    waitQuietly();
+
+    ASSERT_EQ(m_reports.size(), 1);
+    const FolderChanges &changes = m_reports.first();
+    EXPECT_EQ(changes.files.size(), 20);
+    for (int i = 0; i < 20; i++)
+        EXPECT_TRUE(changes.files.contains(dir + u"/file%1.txt"_s.arg(i))) << i;
+    EXPECT_EQ(changes.directories, QSet<QString> { dir + u"/sub"_s });
+}
+
+TEST_F(FolderWatcherTest, IgnoresRemovedPaths)
+{
+    const QString watched = makeDir(u"watched"_s), removed = makeDir(u"removed"_s);
+    ASSERT_TRUE(m_watcher.addPath(watched));
+    ASSERT_TRUE(m_watcher.addPath(removed));
+    m_watcher.removePaths({ removed });
+
+    writeFile(removed + u"/ignored.txt"_s);
+    writeFile(watched + u"/seen.txt"_s);
+    ASSERT_TRUE(waitFor([this] { return !m_reports.isEmpty(); }, 5000));
+    waitQuietly();
+
+    ASSERT_EQ(m_reports.size(), 1);
+    EXPECT_EQ(m_reports.first().files, QSet<QString> { watched + u"/seen.txt"_s });
+    EXPECT_TRUE(m_reports.first().directories.isEmpty());
+}
+
+// when the kernel drops events, nothing is known about what changed, so every watched directory is listed again
+TEST_F(FolderWatcherTest, ReportsEveryDirectoryAfterOverflow)
+{
+    QFile limitFile(u"/proc/sys/fs/inotify/max_queued_events"_s);
+    ASSERT_TRUE(limitFile.open(QIODevice::ReadOnly));
+    const int maxQueuedEvents = limitFile.readAll().trimmed().toInt();
+    if (maxQueuedEvents <= 0 || maxQueuedEvents > 100000)
+        GTEST_SKIP() << "the inotify queue holds " << maxQueuedEvents << " events";
+
+    const QString busy = makeDir(u"busy"_s), idle = makeDir(u"idle"_s);
+    ASSERT_TRUE(m_watcher.addPath(busy));
+    ASSERT_TRUE(m_watcher.addPath(idle));
+
+    // at least two events per file, none of them read until the queue has overflowed
+    for (int i = 0; i < maxQueuedEvents / 2 + 100; i++)
+        writeFile(busy + u"/file%1.txt"_s.arg(i));
+
+    ASSERT_TRUE(waitFor([this] { return !m_reports.isEmpty(); }, 10000));
+    waitQuietly();
+
+    ASSERT_EQ(m_reports.size(), 1);
+    EXPECT_TRUE(m_reports.first().directories.contains(busy));
+    EXPECT_TRUE(m_reports.first().directories.contains(idle));
+}
+#endif
@@ -0,0 +1,71 @@
+#include "scanjournal.h"
+
+#include <gtest/gtest.h>
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QString>
+#include <QTemporaryDir>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    constexpr qint64 s_dirTime = 1700000000000; // ms since the epoch
+} // namespace
+
+TEST(ScanJournalTest, SkipsDirectoryWithSameTimeAndEntries)
+{
+    const auto entry = ScanJournalEntry::listed(s_dirTime, 12, s_dirTime + ScanJournalEntry::s_racyTime);
+    EXPECT_EQ(entry.dirTime, s_dirTime);
+    EXPECT_TRUE(entry.isUnchanged(s_dirTime, 12));
+}
+
+TEST(ScanJournalTest, ListsDirectoryThatChanged)
+{
+    const auto entry = ScanJournalEntry::listed(s_dirTime, 12, s_dirTime + 60000);
+    EXPECT_FALSE(entry.isUnchanged(s_dirTime + 1, 12)); // an entry was added, removed or renamed
+    EXPECT_FALSE(entry.isUnchanged(s_dirTime - 1, 12)); // e.g. restored from a backup
+    EXPECT_FALSE(entry.isUnchanged(s_dirTime, 11));     // a document is no longer known, e.g. it failed to index
+    EXPECT_FALSE(entry.isUnchanged(s_dirTime, 13));
+}
+
+// a change in the same millisecond as the listing, or after it but within the resolution of the file system, would
+// keep the time of the directory
+TEST(ScanJournalTest, ListsRacyDirectoryAgain)
+{
+    for (qint64 age: { qint64(0), qint64(1), ScanJournalEntry::s_racyTime - 1 }) {
+        const auto entry = ScanJournalEntry::listed(s_dirTime, 12, s_dirTime + age);
+        EXPECT_EQ(entry.dirTime, -1) << "listed after " << age << " ms";
+        EXPECT_FALSE(entry.isUnchanged(s_dirTime, 12)) << "listed after " << age << " ms";
+        EXPECT_FALSE(entry.isUnchanged(-1, 12)) << "listed after " << age << " ms";
+    }
+
+    // also when the clock is behind the file system, e.g. on a network share
+    EXPECT_FALSE(ScanJournalEntry::listed(s_dirTime, 12, s_dirTime - 5000).isUnchanged(s_dirTime, 12));
+}
+
+TEST(ScanJournalTest, LinksAreNeverListed)
+{
+    const auto entry = ScanJournalEntry::link();
+    EXPECT_TRUE(entry.isLink());
+    EXPECT_FALSE(entry.isUnchanged(s_dirTime, 0));
+    EXPECT_FALSE(entry.isUnchanged(-1, -1));
+    EXPECT_FALSE(ScanJournalEntry::listed(s_dirTime, 0, s_dirTime + 60000).isLink());
+}
+
+// a directory that was just written to is listed again by the next scan, however quickly it comes
+TEST(ScanJournalTest, JustModifiedDirectoryIsNotTrusted)
+{
+    QTemporaryDir dir;
+    ASSERT_TRUE(dir.isValid());
+    QFile file(dir.filePath(u"document.txt"_s));
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.close();
+
+    const qint64 dirTime = QFileInfo(dir.path()).lastModified().toMSecsSinceEpoch();
+    const auto entry = ScanJournalEntry::listed(dirTime, 1, QDateTime::currentMSecsSinceEpoch());
+    EXPECT_FALSE(entry.isUnchanged(QFileInfo(dir.path()).lastModified().toMSecsSinceEpoch(), 1));
+}
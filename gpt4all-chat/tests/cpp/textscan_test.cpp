@@ -0,0 +1,161 @@
+#include "textscan.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QChar>
+#include <QList>
+#include <QString>
+#include <QStringView>
+
+#include <cstdint>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+    // the scalar references, written out by class rather than with the ranges of TextScan::isBinary
+    bool referenceIsBinary(unsigned char c)
+    {
+        if (c >= 0x20)
+            return false; // printable, DEL and everything from 0x80
+        switch (c) {
+        case 0x07: case 0x08: case 0x09: case 0x0A: case 0x0B: case 0x0C: case 0x0D: // BEL BS HT LF VT FF CR
+        case 0x1B: // ESC
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    qsizetype referenceFindSpace(QStringView text, qsizetype from)
+    {
+        for (qsizetype i = from; i < text.size(); i++) {
+            if (text[i].isSpace())
+                return i;
+        }
+        return text.size();
+    }
+
+    uint64_t wordOf(const unsigned char (&bytes)[8])
+    {
+        uint64_t x = 0;
+        for (int lane = 7; lane >= 0; lane--)
+            x = x << 8 | bytes[lane];
+        return x;
+    }
+
+    bool laneIsSet(uint64_t mask, int lane) { return mask >> (8 * lane + 7) & 1; }
+
+    // every control character, both sides of the ASCII and Latin-1 boundaries, and spaces and letters beyond them
+    QList<char16_t> testCharacters()
+    {
+        QList<char16_t> chars;
+        for (char16_t c = 0; c < 0x80; c++)
+            chars << c;
+        chars << 0x80 << 0x85 << 0x9F << 0xA0 << 0xE9 << 0xFF << 0x100 << 0x1680 << 0x2000 << 0x200B << 0x2028
+              << 0x3000 << 0x4E2D << 0x7FFF << 0x8000 << 0x8020 << 0xD83D << 0xFEFF << 0xFFFF;
+        return chars;
+    }
+} // namespace
+
+TEST(TextScanTest, IsBinaryMatchesReference)
+{
+    for (int c = 0; c < 256; c++)
+        EXPECT_EQ(TextScan::isBinary(c), referenceIsBinary(c)) << "byte " << c;
+}
+
+TEST(TextScanTest, BinaryBytesMatchesScalarInEveryLane)
+{
+    // fillers that are binary, text, DEL and non-ASCII, so that neighbouring lanes cannot hide a wrong lane
+    const unsigned char fillers[] { 0x00, 0x06, 0x07, 0x1B, 0x1F, 0x20, 0x41, 0x7F, 0x80, 0xFF };
+    for (unsigned char filler: fillers) {
+        for (int lane = 0; lane < 8; lane++) {
+            for (int c = 0; c < 256; c++) {
+                unsigned char bytes[8];
+                for (auto &b: bytes)
+                    b = filler;
+                bytes[lane] = c;
+                const uint64_t mask = TextScan::binaryBytes(wordOf(bytes));
+                for (int l = 0; l < 8; l++)
+                    ASSERT_EQ(laneIsSet(mask, l), referenceIsBinary(bytes[l])) << "byte " << c << " lane " << l;
+                // nothing but the high bits
+                ASSERT_EQ(mask & ~0x8080808080808080, 0u);
+            }
+        }
+    }
+}
+
+TEST(TextScanTest, BinaryBytesHasNoBorrowBetweenLanes)
+{
+    // every pair of adjacent bytes, as a borrow out of one lane could only flip the next
+    for (int lane = 0; lane < 7; lane++) {
+        for (int lo = 0; lo < 256; lo++) {
+            for (int hi = 0; hi < 256; hi++) {
+                unsigned char bytes[8] { 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
+                bytes[lane] = lo;
+                bytes[lane + 1] = hi;
+                const uint64_t mask = TextScan::binaryBytes(wordOf(bytes));
+                ASSERT_EQ(laneIsSet(mask, lane), referenceIsBinary(lo)) << lo << ' ' << hi;
+                ASSERT_EQ(laneIsSet(mask, lane + 1), referenceIsBinary(hi)) << lo << ' ' << hi;
+            }
+        }
+    }
+}
+
+TEST(TextScanTest, ContainsBinaryAtBlockBoundariesAndTails)
+{
+    // sizes across the 32-byte blocks and their tails, including tails under 8 bytes, at unaligned addresses
+    for (qint64 size = 0; size <= 100; size++) {
+        for (int offset = 0; offset < 8; offset += 3) {
+            QByteArray buffer(offset + size, 'a');
+            char *data = buffer.data() + offset;
+            EXPECT_FALSE(TextScan::containsBinary(data, size)) << "size " << size;
+            for (qint64 pos = 0; pos < size; pos++) {
+                for (int c = 0; c < 256; c++) {
+                    data[pos] = char(c);
+                    ASSERT_EQ(TextScan::containsBinary(data, size), referenceIsBinary(c))
+                        << "byte " << c << " at " << pos << " of " << size;
+                }
+                data[pos] = 'a';
+            }
+        }
+    }
+}
+
+TEST(TextScanTest, IsSpaceMatchesQChar)
+{
+    for (char16_t c: testCharacters())
+        EXPECT_EQ(TextScan::isSpace(QChar(c)), QChar(c).isSpace()) << "character " << int(c);
+}
+
+TEST(TextScanTest, FindSpaceMatchesScalar)
+{
+    // around every character that might be a space, in ASCII and in non-ASCII text, at every position and start
+    const QList<char16_t> chars = testCharacters();
+    for (char16_t filler: { char16_t(u'a'), char16_t(0xE9), char16_t(0x4E2D) }) {
+        for (qsizetype size = 0; size <= 13; size++) {
+            for (qsizetype pos = 0; pos < size; pos++) {
+                for (char16_t c: chars) {
+                    QString text(size, QChar(filler));
+                    text[pos] = QChar(c);
+                    for (qsizetype from = 0; from <= size; from++) {
+                        ASSERT_EQ(TextScan::findSpace(text, from), referenceFindSpace(text, from))
+                            << "character " << int(c) << " at " << pos << " of " << size << " from " << from;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(TextScanTest, FindSpaceAfterNonAsciiWord)
+{
+    // the characters that are not spaces do not end the scan, in any of the positions of a group of four
+    for (qsizetype start = 0; start < 4; start++) {
+        QString text = QString(start, u'a') + QString(37, QChar(0xE9)) + u' ' + u"tail"_s;
+        EXPECT_EQ(TextScan::findSpace(text, 0), start + 37);
+        EXPECT_EQ(TextScan::findSpace(text, start + 38), text.size());
+    }
+    EXPECT_EQ(TextScan::findSpace(QStringView(), 0), 0);
+}